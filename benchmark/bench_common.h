@@ -0,0 +1,130 @@
+// Fixtures shared by the benchmarks: random textures and synthetic putative
+// matches with a known homography.
+#ifndef _BENCH_COMMON_H_
+#define _BENCH_COMMON_H_
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+ * Synthetic putative matches, the i-th query point matched to the i-th
+ * reference point.
+ */
+struct SyntheticMatches {
+	std::vector<cv::Point2d> query_pts; //!< Points in the query image.
+	std::vector<cv::Point2d> refer_pts; //!< Points in the reference image.
+	std::vector<bool> truth;            //!< Whether a match is an inlier.
+};
+
+/**
+ * @brief  Makes a random texture of blurred shapes, so every detector finds
+ *         keypoints.
+ *
+ * @return cv::Mat BGR image.
+ * @param  size [in] Image size.
+ * @param  rng [in,out] Random number generator.
+ */
+inline cv::Mat MakeTexture(const cv::Size& size, cv::RNG& rng) {
+
+	cv::Mat img(size, CV_8UC3);
+	rng.fill(img, cv::RNG::UNIFORM, 0, 256);
+	cv::GaussianBlur(img, img, cv::Size(0, 0), 3.0);
+	const int num_shapes = size.area() / 2000;
+	for (int i = 0; i < num_shapes; ++i) {
+		cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+		cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+		int radius = rng.uniform(3, 40);
+		if (i % 2) {
+			cv::circle(img, center, radius, color, -1);
+		}
+		else {
+			cv::rectangle(img, center, center + cv::Point(radius, radius / 2), color, -1);
+		}
+	}
+	return img;
+}
+
+/**
+ * @brief  Makes a similarity transform about the center of an image.
+ *
+ * @return cv::Matx33d Transform.
+ * @param  size [in] Image size.
+ * @param  scale [in] Scale.
+ * @param  angle [in] Rotation, in radians.
+ * @param  shift [in] Translation after the rotation.
+ */
+inline cv::Matx33d MakeSimilarity(const cv::Size& size, const double scale,
+	const double angle, const cv::Point2d& shift = cv::Point2d()) {
+
+	const double c = scale * std::cos(angle), s = scale * std::sin(angle);
+	const double cx = size.width * 0.5, cy = size.height * 0.5;
+	return cv::Matx33d(c, -s, cx - c * cx + s * cy + shift.x,
+		s, c, cy - s * cx - c * cy + shift.y, 0, 0, 1);
+}
+
+/**
+ * @brief  Makes synthetic putative matches between two images of the same
+ *         size. An inlier maps a random query point with the homography and
+ *         adds Gaussian noise, and lands inside the reference image. An
+ *         outlier connects two random points. Inliers and outliers are mixed
+ *         in random order.
+ *
+ * @return SyntheticMatches Matches.
+ * @param  num_inliers [in] Number of inliers.
+ * @param  num_outliers [in] Number of outliers.
+ * @param  H [in] Homography from the query to the reference image.
+ * @param  size [in] Image size.
+ * @param  noise [in] Standard deviation of the noise of the inliers.
+ * @param  rng [in,out] Random number generator.
+ */
+inline SyntheticMatches MakeSyntheticMatches(const int num_inliers,
+	const int num_outliers, const cv::Matx33d& H, const cv::Size& size,
+	const double noise, cv::RNG& rng) {
+
+	SyntheticMatches matches;
+	int inliers_left = num_inliers, outliers_left = num_outliers;
+	while (inliers_left + outliers_left > 0) {
+		const bool inlier = rng.uniform(0, inliers_left + outliers_left) < inliers_left;
+		cv::Point2d p(rng.uniform(0., (double)size.width),
+			rng.uniform(0., (double)size.height));
+		cv::Point2d q(rng.uniform(0., (double)size.width),
+			rng.uniform(0., (double)size.height));
+		if (inlier) {
+			const cv::Vec3d x = H * cv::Vec3d(p.x, p.y, 1);
+			q.x = x[0] / x[2] + rng.gaussian(noise);
+			q.y = x[1] / x[2] + rng.gaussian(noise);
+			if (q.x < 0 || q.y < 0 || q.x >= size.width || q.y >= size.height) continue;
+			--inliers_left;
+		}
+		else {
+			--outliers_left;
+		}
+		matches.query_pts.push_back(p);
+		matches.refer_pts.push_back(q);
+		matches.truth.push_back(inlier);
+	}
+	return matches;
+}
+
+/**
+ * @brief  Converts synthetic matches to keypoints and one-to-one matches.
+ *
+ * @return void
+ * @param  matches [in] Synthetic matches.
+ * @param  kpts0 [out] Query keypoints.
+ * @param  kpts1 [out] Reference keypoints.
+ * @param  dmatches [out] Matches of the i-th keypoints.
+ */
+inline void ToKeyPoints(const SyntheticMatches& matches,
+	std::vector<cv::KeyPoint>& kpts0, std::vector<cv::KeyPoint>& kpts1,
+	std::vector<cv::DMatch>& dmatches) {
+
+	kpts0.clear();
+	kpts1.clear();
+	dmatches.clear();
+	for (size_t i = 0; i < matches.query_pts.size(); ++i) {
+		kpts0.push_back(cv::KeyPoint(cv::Point2f(matches.query_pts[i]), 1.f));
+		kpts1.push_back(cv::KeyPoint(cv::Point2f(matches.refer_pts[i]), 1.f));
+		dmatches.push_back(cv::DMatch((int)i, (int)i, 0.f));
+	}
+}
+#endif
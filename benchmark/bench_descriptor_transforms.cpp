@@ -0,0 +1,67 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/descriptor_transforms.h"
+
+// Row-wise ROOTSIFT transform kept for comparison.
+static void LegacyRootSift(cv::Mat& descriptors) {
+	cv::Mat temp;
+	for (int i = 0; i < descriptors.rows; ++i) {
+		cv::normalize(descriptors.row(i), temp, 1, cv::NORM_L1);
+		cv::sqrt(temp, temp);
+		temp.row(0).copyTo(descriptors.row(i));
+	}
+}
+
+// Column-pair HALFSIFT transform kept for comparison.
+static void LegacyHalfSift(cv::Mat& descriptors) {
+	cv::Mat temp;
+	for (int i = 0; i < descriptors.rows; ++i) {
+		for (int jhist = 0; jhist < 16; ++jhist) {
+			for (int jori = 0; jori < 4; ++jori) {
+				temp = (descriptors.row(i).col(jhist * 8 + jori) +
+					descriptors.row(i).col(jhist * 8 + jori + 4));
+				temp.copyTo(descriptors.row(i).col(jhist * 8 + jori));
+				temp.copyTo(descriptors.row(i).col(jhist * 8 + jori + 4));
+			}
+		}
+	}
+}
+
+static void Compare(const char* name, const cv::Mat& descriptors,
+	void(*legacy)(cv::Mat&), void(*vectorized)(cv::Mat&), int repeats) {
+
+	cv::Mat des0, des1;
+	cv::TickMeter tm0, tm1;
+	for (int r = 0; r < repeats; ++r) {
+		descriptors.copyTo(des0);
+		tm0.start();
+		legacy(des0);
+		tm0.stop();
+
+		descriptors.copyTo(des1);
+		tm1.start();
+		vectorized(des1);
+		tm1.stop();
+	}
+
+	double t0 = tm0.getTimeMilli() / repeats;
+	double t1 = tm1.getTimeMilli() / repeats;
+	std::cout << name << ": legacy " << t0 << " ms, vectorized " << t1
+		<< " ms, speedup " << t0 / t1 << "x, max abs diff "
+		<< cv::norm(des0, des1, cv::NORM_INF) << std::endl;
+}
+
+int main() {
+
+	const int num_descriptors = 20000;
+	const int repeats = 5;
+
+	// SIFT-like descriptors.
+	cv::Mat descriptors(num_descriptors, 128, CV_32F);
+	cv::randu(descriptors, cv::Scalar(0), cv::Scalar(255));
+
+	Compare("ROOTSIFT", descriptors, LegacyRootSift, RootSiftTransform, repeats);
+	Compare("HALFSIFT", descriptors, LegacyHalfSift, HalfSiftTransform, repeats);
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/feature_extractor.h"
+#include "../src/batch_matcher.h"
+#include "../src/gallery_index.h"
+#include "bench_common.h"
+
+// Matches data/biscuit1.jpg against galleries of growing size that hide
+// data/biscuit2.jpg among synthetic distractors, once with BatchMatcher,
+// which matches every reference with its own FLANN index, once more with
+// the cascaded GMS, which rejects most distractors after one hypothesis, and
+// once with one persistent GalleryIndex.
+
+// Reference with the most inliers.
+static int BestRefer(const std::vector<PairResult>& results) {
+
+	int best = -1, best_inliers = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (results[i].num_inliers > best_inliers) {
+			best_inliers = results[i].num_inliers;
+			best = results[i].refer_index;
+		}
+	}
+	return best;
+}
+
+int main() {
+
+	const std::string source_dir = SOURCE_DIR;
+	cv::Mat query_img = cv::imread(source_dir + "/data/biscuit1.jpg");
+	cv::Mat target_img = cv::imread(source_dir + "/data/biscuit2.jpg");
+	if (query_img.empty() || target_img.empty()) {
+		std::cerr << "Failed to read the images under " << source_dir << "/data" << std::endl;
+		return 1;
+	}
+
+	const int repeats = 3;
+	const int gallery_sizes[] = { 8, 32, 128 };
+	const int max_refers = 4;
+
+	FeatureExtractor extractor(FEATURE_ORB, KeypointBudget(1000));
+	FeatureSet query_features;
+	extractor.Extract(query_img, query_features);
+
+	cv::RNG rng(0x2019);
+	std::vector<FeatureSet> gallery;
+	const int target = 3;
+	for (int g = 0; g < 3; ++g) {
+		while ((int)gallery.size() < gallery_sizes[g]) {
+			FeatureSet refer_features;
+			if ((int)gallery.size() == target) {
+				extractor.Extract(target_img, refer_features);
+			}
+			else {
+				extractor.Extract(MakeTexture(target_img.size(), rng), refer_features);
+			}
+			gallery.push_back(refer_features);
+		}
+
+		BatchMatcher batch_matcher(MATCHER_FLANN_LSH, PRUNER_GMS, 2);
+		BatchMatcher cascade_matcher(MATCHER_FLANN_LSH, PRUNER_GMS_CASCADE, 2);
+		std::vector<PairResult> batch_results, cascade_results, index_results;
+		cv::TickMeter tm_batch, tm_cascade, tm_build, tm_index;
+		GalleryIndex index(MATCHER_FLANN_LSH);
+		tm_build.start();
+		index.Build(gallery);
+		tm_build.stop();
+		for (int r = 0; r < repeats; ++r) {
+			tm_batch.start();
+			batch_matcher.Match(query_features, gallery, batch_results);
+			tm_batch.stop();
+
+			tm_cascade.start();
+			cascade_matcher.Match(query_features, gallery, cascade_results);
+			tm_cascade.stop();
+
+			tm_index.start();
+			index.Match(query_features, PRUNER_GMS, index_results, 2, max_refers);
+			tm_index.stop();
+		}
+
+		std::cout << "gallery " << gallery.size() << ": batch "
+			<< tm_batch.getTimeMilli() / repeats << " ms (best " << BestRefer(batch_results)
+			<< "), cascade " << tm_cascade.getTimeMilli() / repeats << " ms (best "
+			<< BestRefer(cascade_results) << "), index build " << tm_build.getTimeMilli()
+			<< " ms, query " << tm_index.getTimeMilli() / repeats << " ms (best "
+			<< BestRefer(index_results) << "), target " << target << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/geometric_verifier.h"
+#include "bench_common.h"
+
+// Synthetic putative matches related by a homography at a low inlier ratio.
+// The distance ratio of an inlier is lower on average, as for real matches,
+// but the two overlap.
+
+int main() {
+
+	const int repeats = 5;
+	const int num_matches = 2000;
+	const double inlier_ratios[] = { 0.5, 0.2, 0.1 };
+	const cv::Matx33d H(1.1, 0.05, 20, -0.03, 0.95, -10, 1e-4, 2e-5, 1);
+	const cv::Size size(1280, 960);
+	bool ok = true;
+
+	for (int k = 0; k < 3; ++k) {
+		const int num_inliers = (int)(num_matches * inlier_ratios[k]);
+		cv::RNG rng(0x2019);
+		const SyntheticMatches matches = MakeSyntheticMatches(num_inliers,
+			num_matches - num_inliers, H, size, 0.7, rng);
+		const std::vector<cv::Point2f> query_pts(matches.query_pts.begin(),
+			matches.query_pts.end());
+		const std::vector<cv::Point2f> refer_pts(matches.refer_pts.begin(),
+			matches.refer_pts.end());
+		const std::vector<bool>& truth = matches.truth;
+		std::vector<double> ratios;
+		for (size_t i = 0; i < truth.size(); ++i) {
+			ratios.push_back(truth[i] ? rng.uniform(0.3, 0.9) : rng.uniform(0.6, 1.0));
+		}
+		int num_true = 0;
+		for (size_t i = 0; i < truth.size(); ++i) num_true += truth[i];
+
+		std::cout << "inlier ratio " << inlier_ratios[k] << ":";
+		for (int s = SAMPLING_UNIFORM; s <= SAMPLING_PROSAC; ++s) {
+			GeometricVerifier verifier((SamplingType)s, 3.0, 0.999, 100000);
+			cv::TickMeter tm;
+			for (int r = 0; r < repeats; ++r) {
+				tm.start();
+				verifier.Verify(query_pts, refer_pts, ratios);
+				tm.stop();
+			}
+
+			int num_found = 0;
+			for (size_t i = 0; i < truth.size(); ++i) {
+				num_found += truth[i] && verifier.GetInlierMask()[i];
+			}
+			// The model must keep nearly all inliers.
+			const bool found = num_found >= 0.9 * num_true;
+			ok = ok && found;
+			std::cout << (s == SAMPLING_PROSAC ? " prosac " : " uniform ")
+				<< tm.getTimeMilli() / repeats << " ms, " << verifier.GetIterations()
+				<< " hypotheses, " << num_found << "/" << num_true << " inliers"
+				<< (found ? "" : " (MODEL MISSED)") << ",";
+		}
+
+		cv::TickMeter tm_cv;
+		for (int r = 0; r < repeats; ++r) {
+			tm_cv.start();
+			cv::findHomography(query_pts, refer_pts, cv::RANSAC, 3.0, cv::noArray(),
+				100000, 0.999);
+			tm_cv.stop();
+		}
+		std::cout << " cv::findHomography " << tm_cv.getTimeMilli() / repeats << " ms"
+			<< std::endl;
+	}
+
+	return ok ? 0 : 1;
+}
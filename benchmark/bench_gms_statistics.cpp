@@ -0,0 +1,86 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/libGMS/gms_matcher.h"
+#include "bench_common.h"
+
+// Synthetic matches between two 4K images related by a similarity transform.
+
+int main() {
+
+	const cv::Size size(3840, 2160);
+	const int repeats = 5;
+	const int grids[] = { 15, 20, 40 };
+
+	cv::RNG rng(0x2019);
+	std::vector<cv::KeyPoint> kpts0, kpts1;
+	std::vector<cv::DMatch> matches;
+	ToKeyPoints(MakeSyntheticMatches(3000, 1000, MakeSimilarity(size, 1.2, CV_PI / 6),
+		size, 2.0, rng), kpts0, kpts1, matches);
+
+	for (int g = 0; g < 3; ++g) {
+		const cv::Size grid_size(grids[g], grids[g]);
+		std::vector<bool> mask0, mask1, mask2;
+		int num0 = 0, num1 = 0, num2 = 0;
+		bool fixed = false;
+		cv::TickMeter tm0, tm1, tm2;
+		for (int r = 0; r < repeats; ++r) {
+			tm0.start();
+			GMS_Matcher dense(kpts0, size, kpts1, size, matches, grid_size, 6,
+				GMS_STATISTICS_DENSE);
+			dense.UseFixedGridKernel(false);
+			num0 = dense.GetInlierMask(mask0, true, true);
+			tm0.stop();
+
+			tm1.start();
+			GMS_Matcher compact(kpts0, size, kpts1, size, matches, grid_size, 6,
+				GMS_STATISTICS_COMPACT);
+			num1 = compact.GetInlierMask(mask1, true, true);
+			tm1.stop();
+
+			// The specialized kernel of the grid size, if there is one.
+			tm2.start();
+			GMS_Matcher kernel(kpts0, size, kpts1, size, matches, grid_size, 6,
+				GMS_STATISTICS_DENSE);
+			fixed = kernel.UseFixedGridKernel(true);
+			num2 = kernel.GetInlierMask(mask2, true, true);
+			tm2.stop();
+		}
+
+		double t0 = tm0.getTimeMilli() / repeats;
+		double t1 = tm1.getTimeMilli() / repeats;
+		double t2 = tm2.getTimeMilli() / repeats;
+		std::cout << "grid " << grids[g] << "x" << grids[g] << ": dense " << t0
+			<< " ms, compact " << t1 << " ms, speedup " << t0 / t1 << "x, inliers "
+			<< num0 << "/" << num1 << (mask0 == mask1 ? ", same mask" : ", MASK DIFFERS")
+			<< std::endl;
+		if (fixed) {
+			std::cout << "grid " << grids[g] << "x" << grids[g] << ": fixed grid kernel "
+				<< t2 << " ms, speedup " << t0 / t2 << "x over dense, inliers " << num2
+				<< (mask0 == mask2 ? ", same mask" : ", MASK DIFFERS") << std::endl;
+		}
+	}
+
+	// Per frame matchers against one persistent context, as for video.
+	const cv::Size grid_size(20, 20);
+	GMS_Matcher context(grid_size, 6);
+	std::vector<bool> mask0, mask1;
+	bool same_mask = true;
+	cv::TickMeter tm0, tm1;
+	for (int r = 0; r < repeats; ++r) {
+		tm0.start();
+		GMS_Matcher fresh(kpts0, size, kpts1, size, matches, grid_size, 6);
+		fresh.GetInlierMask(mask0, true, true);
+		tm0.stop();
+
+		tm1.start();
+		context.SetMatches(kpts0, size, kpts1, size, matches);
+		context.GetInlierMask(mask1, true, true);
+		tm1.stop();
+		same_mask = same_mask && mask0 == mask1;
+	}
+	std::cout << "grid 20x20 per frame: fresh " << tm0.getTimeMilli() / repeats
+		<< " ms, persistent " << tm1.getTimeMilli() / repeats << " ms"
+		<< (same_mask ? ", same mask" : ", MASK DIFFERS") << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/feature_extractor.h"
+#include "../src/knn_matcher.h"
+
+// Matches the SIFT descriptors of data/biscuit1.jpg against those of
+// data/biscuit2.jpg with cv::BFMatcher and with TiledKnnMatcher, compares
+// the two results row by row and prints the times. Returns 1 if any train
+// index or distance differs.
+
+static int CountMismatches(const std::vector<std::vector<cv::DMatch> >& bf_matches,
+	const MatchTable& tiled_matches) {
+
+	int num_mismatches = 0;
+	for (int i = 0; i < (int)bf_matches.size(); ++i) {
+		const std::vector<cv::DMatch>& row = bf_matches[i];
+		bool same = i < tiled_matches.rows() && (int)row.size() == tiled_matches.ValidCount(i);
+		for (size_t k = 0; same && k < row.size(); ++k) {
+			same = row[k].trainIdx == tiled_matches.TrainIdx(i)[k] &&
+				row[k].distance == tiled_matches.Distances(i)[k];
+		}
+		if (!same) ++num_mismatches;
+	}
+	return num_mismatches;
+}
+
+int main() {
+
+	const std::string source_dir = SOURCE_DIR;
+	cv::Mat img0 = cv::imread(source_dir + "/data/biscuit1.jpg");
+	cv::Mat img1 = cv::imread(source_dir + "/data/biscuit2.jpg");
+	if (img0.empty() || img1.empty()) {
+		std::cerr << "Failed to read the images under " << source_dir << "/data" << std::endl;
+		return 1;
+	}
+
+	const int repeats = 5;
+	const FeatureType features[] = { FEATURE_SIFT, FEATURE_ROOTSIFT };
+	const char* names[] = { "SIFT", "ROOTSIFT" };
+	const int knns[] = { 1, 2, 5 };
+	int num_failures = 0;
+	for (int f = 0; f < 2; ++f) {
+		FeatureExtractor extractor(features[f]);
+		FeatureSet query_features, refer_features;
+		extractor.Extract(img0, img1, query_features, refer_features);
+		cv::Mat query_des, refer_des;
+		query_features.descriptors.convertTo(query_des, CV_32F);
+		refer_features.descriptors.convertTo(refer_des, CV_32F);
+
+		for (int k = 0; k < 3; ++k) {
+			std::vector<std::vector<cv::DMatch> > bf_matches;
+			MatchTable tiled_matches;
+			cv::BFMatcher bf_matcher(cv::NORM_L2);
+			TiledKnnMatcher tiled_matcher;
+			cv::TickMeter tm_bf, tm_tiled;
+			for (int r = 0; r < repeats; ++r) {
+				tm_bf.start();
+				bf_matcher.knnMatch(query_des, refer_des, bf_matches, knns[k]);
+				tm_bf.stop();
+
+				tm_tiled.start();
+				tiled_matcher.KnnMatch(query_des, refer_des, tiled_matches, knns[k]);
+				tm_tiled.stop();
+			}
+
+			const int num_mismatches = CountMismatches(bf_matches, tiled_matches);
+			if (num_mismatches > 0) ++num_failures;
+			std::cout << names[f] << " " << query_des.rows << "x" << refer_des.rows
+				<< ", k = " << knns[k] << ": BFMatcher " << tm_bf.getTimeMilli() / repeats
+				<< " ms, tiled " << tm_tiled.getTimeMilli() / repeats << " ms, "
+				<< num_mismatches << " rows differ" << std::endl;
+		}
+	}
+
+	return num_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <cstring>
+#include "../src/libLPM/lpm_matcher.h"
+#include "bench_common.h"
+
+// Runs LPM on synthetic putative matches related by a similarity transform.
+// Compares the serial and the parallel K-NN queries and costs, which must be
+// bit-identical, and the double and the single precision consistency test,
+// which may only flip a few labels at the threshold tau.
+
+// Two iterations as in MatchPruner.
+static void RunLPM(const std::vector<cv::Point2d>& query_pts,
+	const std::vector<cv::Point2d>& refer_pts, const int num_threads,
+	cv::Mat& cost, std::vector<bool>& labels) {
+
+	LPM_Matcher lpm0(query_pts, refer_pts, 8, 0.8, 0.2, std::vector<bool>(),
+		num_threads);
+	cv::Mat cost0;
+	std::vector<bool> labels0;
+	lpm0.Match(cost0, labels0);
+
+	LPM_Matcher lpm1(query_pts, refer_pts, lpm0.GetQueryTree(),
+		lpm0.GetReferTree(), 8, 0.5, 0.2, labels0, num_threads);
+	lpm1.Match(cost, labels);
+}
+
+// Serial against parallel, returns whether the results are bit-identical.
+static bool CompareThreads(const std::vector<cv::Point2d>& query_pts,
+	const std::vector<cv::Point2d>& refer_pts, const int repeats) {
+
+	cv::Mat cost0, cost1;
+	std::vector<bool> labels0, labels1;
+	cv::TickMeter tm0, tm1;
+	bool identical = true;
+	for (int r = 0; r < repeats; ++r) {
+		tm0.start();
+		RunLPM(query_pts, refer_pts, 1, cost0, labels0);
+		tm0.stop();
+
+		tm1.start();
+		RunLPM(query_pts, refer_pts, 0, cost1, labels1);
+		tm1.stop();
+
+		identical = identical && labels0 == labels1 &&
+			cost0.total() == cost1.total() &&
+			memcmp(cost0.data, cost1.data, cost0.total() * sizeof(double)) == 0;
+	}
+
+	double t0 = tm0.getTimeMilli() / repeats;
+	double t1 = tm1.getTimeMilli() / repeats;
+	std::cout << "LPM " << query_pts.size() << " matches: serial " << t0
+		<< " ms, " << cv::getNumThreads() << " threads " << t1 << " ms, speedup "
+		<< t0 / t1 << "x, " << (identical ? "bit-identical" : "RESULTS DIFFER")
+		<< std::endl;
+	return identical;
+}
+
+// Double against single precision, returns whether the flipped labels are
+// within the tolerance.
+static bool ComparePrecisions(const std::vector<cv::Point2d>& query_pts,
+	const std::vector<cv::Point2d>& refer_pts, const int repeats,
+	const double tolerance) {
+
+	LPM_Matcher lpm(query_pts, refer_pts, 8, 0.8, 0.2);
+	cv::Mat cost0, cost1;
+	std::vector<bool> labels0, labels1;
+	cv::TickMeter tm0, tm1;
+	for (int r = 0; r < repeats; ++r) {
+		tm0.start();
+		lpm.Match(cost0, labels0, LPM_PRECISION_DOUBLE);
+		tm0.stop();
+
+		tm1.start();
+		lpm.Match(cost1, labels1, LPM_PRECISION_FLOAT);
+		tm1.stop();
+	}
+
+	int num_flips = 0;
+	for (size_t i = 0; i < labels0.size(); ++i) {
+		if (labels0[i] != labels1[i]) num_flips++;
+	}
+	double flip_rate = labels0.empty() ? 0 : (double)num_flips / labels0.size();
+
+	double t0 = tm0.getTimeMilli() / repeats;
+	double t1 = tm1.getTimeMilli() / repeats;
+	std::cout << "LPM cost " << query_pts.size() << " matches: double " << t0
+		<< " ms, float " << t1 << " ms, speedup " << t0 / t1 << "x, max cost diff "
+		<< cv::norm(cost0, cost1, cv::NORM_INF) << ", flipped labels " << num_flips
+		<< (flip_rate <= tolerance ? " (within tolerance)" : " (OUT OF TOLERANCE)")
+		<< std::endl;
+	return flip_rate <= tolerance;
+}
+
+int main() {
+
+	const int repeats = 5;
+	// At most 0.1% of the labels may flip at the threshold tau.
+	const double tolerance = 1e-3;
+
+	const cv::Size size(8000, 6000);
+	cv::RNG rng(0x2019);
+	SyntheticMatches matches = MakeSyntheticMatches(30000, 20000,
+		MakeSimilarity(size, 0.9, CV_PI / 8, cv::Point2d(500, 100)), size, 1.0, rng);
+	// Zero displacement vectors take the NaN path of the test.
+	for (int i = 0; i < 100; ++i) {
+		matches.refer_pts[i] = matches.query_pts[i];
+	}
+
+	bool ok = CompareThreads(matches.query_pts, matches.refer_pts, repeats);
+	ok = ComparePrecisions(matches.query_pts, matches.refer_pts, repeats, tolerance) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+#include "../src/feature_extractor.h"
+#include "../src/image_matcher.h"
+#include "../src/match_pruner.h"
+#include "bench_common.h"
+
+// Sweeps every feature, matcher and pruner over image pairs with a known
+// homography and prints one CSV row per configuration.
+//
+//   bench_pipeline [--quick] [--repeats=N] [--baseline=file.csv] [--tolerance=x]
+//
+// With a baseline, which is an earlier output of this program, every stage
+// slower than tolerance times the baseline and every precision or recall
+// more than 0.05 below it is reported, and the exit code is 1. The memory
+// column is the growth of the current resident set over one configuration,
+// sampled after every stage while its buffers are alive, so the rows don't
+// depend on the ones before them.
+
+static const char* kFeatureNames[] = { "SIFT", "SURF", "ORB", "AKAZE",
+	"ROOTSIFT", "HALFSIFT" };
+static const char* kMatcherNames[] = { "BF", "FLANN", "BF_HAMMING",
+	"FLANN_LSH", "BF_TILED" };
+static const char* kPrunerNames[] = { "RATIO", "GMS", "LPM", "GMS_CASCADE",
+	"LPM_CASCADE" };
+
+// A correspondence is correct if it is closer to the homography than that.
+static const double kInlierThreshold = 3.0;
+
+/**
+ * An image pair with its ground truth.
+ */
+struct PairCase {
+	std::string name;  // Name of the pair.
+	cv::Mat img0;      // Query image.
+	cv::Mat img1;      // Reference image.
+	cv::Matx33d H;     // Homography from the query to the reference image.
+	bool has_truth;    // Whether H is known.
+};
+
+/**
+ * Measurements of one configuration.
+ */
+struct BenchResult {
+	double extract_ms;
+	double match_ms;
+	double prune_ms;
+	int query_kpts;
+	int refer_kpts;
+	int putative;
+	int kept;
+	double precision;
+	double recall;
+	double rss_delta_mb;
+};
+
+// Current resident set size of the process, in MB. 0 where /proc is
+// missing, e.g. on macOS.
+static double CurrentRssMB() {
+
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+	return pmc.WorkingSetSize / (1024.0 * 1024.0);
+#else
+	// The second field of statm is the resident set in pages.
+	std::ifstream ifs("/proc/self/statm");
+	long size = 0, resident = 0;
+	if (!(ifs >> size >> resident)) return 0;
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+#endif
+}
+
+// Rotation, scale and a mild perspective about the image center.
+static cv::Matx33d MakeHomography(const cv::Size& size) {
+
+	const double angle = 10.0 * CV_PI / 180, scale = 0.9;
+	const double cx = size.width * 0.5, cy = size.height * 0.5;
+	cv::Matx33d to_center(1, 0, -cx, 0, 1, -cy, 0, 0, 1);
+	cv::Matx33d from_center(1, 0, cx, 0, 1, cy, 0, 0, 1);
+	cv::Matx33d similarity(scale * std::cos(angle), -scale * std::sin(angle), 0,
+		scale * std::sin(angle), scale * std::cos(angle), 0,
+		0.05 / size.width, 0.02 / size.height, 1);
+	return from_center * similarity * to_center;
+}
+
+static PairCase MakeWarpedPair(const std::string& name, const cv::Mat& img0) {
+
+	PairCase pair;
+	pair.name = name;
+	pair.img0 = img0;
+	pair.H = MakeHomography(img0.size());
+	cv::warpPerspective(img0, pair.img1, cv::Mat(pair.H), img0.size());
+	pair.has_truth = true;
+	return pair;
+}
+
+static bool IsCorrect(const cv::Matx33d& H, const cv::Point2f& p,
+	const cv::Point2f& q) {
+
+	cv::Vec3d x = H * cv::Vec3d(p.x, p.y, 1.0);
+	double dx = x[0] / x[2] - q.x, dy = x[1] / x[2] - q.y;
+	return dx * dx + dy * dy < kInlierThreshold * kInlierThreshold;
+}
+
+static bool IsBinary(const FeatureType feature) {
+	return feature == FEATURE_ORB || feature == FEATURE_AKAZE;
+}
+
+static bool IsHamming(const MatcherType matcher) {
+	return matcher == MATCHER_BF_HAMMING || matcher == MATCHER_FLANN_LSH;
+}
+
+static BenchResult RunPipeline(const PairCase& pair, const FeatureType feature,
+	const MatcherType matcher, const PrunerType pruner,
+	const int max_keypoints, const int repeats) {
+
+	BenchResult result = BenchResult();
+	const double rss_before_mb = CurrentRssMB();
+	double rss_max_mb = rss_before_mb;
+	FeatureExtractor extractor(feature, KeypointBudget(max_keypoints));
+	cv::TickMeter tm_extract, tm_match, tm_prune;
+
+	for (int r = 0; r < repeats; ++r) {
+		FeatureSet query, refer;
+		tm_extract.start();
+		extractor.Extract(pair.img0, pair.img1, query, refer);
+		tm_extract.stop();
+		rss_max_mb = std::max(rss_max_mb, CurrentRssMB());
+		result.query_kpts = (int)query.keypoints.size();
+		result.refer_kpts = (int)refer.keypoints.size();
+
+		tm_match.start();
+		ImageMatcher image_matcher(std::move(query), std::move(refer), matcher, 2);
+		tm_match.stop();
+		rss_max_mb = std::max(rss_max_mb, CurrentRssMB());
+
+		tm_prune.start();
+		MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+			image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(), pruner);
+		tm_prune.stop();
+		rss_max_mb = std::max(rss_max_mb, CurrentRssMB());
+
+		if (r > 0) continue;
+
+		// Precision and recall against the nearest neighbor matches.
+		const std::vector<cv::KeyPoint>& kpts0 = image_matcher.GetQueryFeatures().keypoints;
+		const std::vector<cv::KeyPoint>& kpts1 = image_matcher.GetReferFeatures().keypoints;
+		const MatchTable& table = image_matcher.GetMatchTable();
+		int num_correct_putative = 0;
+		for (int i = 0; i < table.rows(); ++i) {
+			if (table.ValidCount(i) == 0) continue;
+			++result.putative;
+			cv::DMatch m = table.GetMatch(i, 0);
+			if (pair.has_truth && IsCorrect(pair.H, kpts0[m.queryIdx].pt, kpts1[m.trainIdx].pt)) {
+				++num_correct_putative;
+			}
+		}
+		const std::vector<cv::DMatch>& kept = match_pruner.GetMatches();
+		int num_correct_kept = 0;
+		for (size_t i = 0; i < kept.size(); ++i) {
+			if (pair.has_truth && IsCorrect(pair.H, kpts0[kept[i].queryIdx].pt,
+				kpts1[kept[i].trainIdx].pt)) {
+				++num_correct_kept;
+			}
+		}
+		result.kept = (int)kept.size();
+		result.precision = kept.empty() ? 0 : (double)num_correct_kept / kept.size();
+		result.recall = num_correct_putative == 0 ? 0 :
+			(double)num_correct_kept / num_correct_putative;
+	}
+
+	result.extract_ms = tm_extract.getTimeMilli() / repeats;
+	result.match_ms = tm_match.getTimeMilli() / repeats;
+	result.prune_ms = tm_prune.getTimeMilli() / repeats;
+	result.rss_delta_mb = rss_max_mb - rss_before_mb;
+	return result;
+}
+
+// Regression check against one row of the baseline.
+static bool CheckBaseline(const std::string& key, const BenchResult& result,
+	const std::vector<double>& base, const double tolerance) {
+
+	const char* stages[] = { "extract", "match", "prune" };
+	const double times[] = { result.extract_ms, result.match_ms, result.prune_ms };
+	bool ok = true;
+	for (int s = 0; s < 3; ++s) {
+		// Stages under a millisecond are all noise.
+		if (times[s] > 1.0 && times[s] > tolerance * base[s]) {
+			std::cerr << "REGRESSION " << key << " " << stages[s] << ": " << times[s]
+				<< " ms, baseline " << base[s] << " ms" << std::endl;
+			ok = false;
+		}
+	}
+	if (result.precision < base[7] - 0.05 || result.recall < base[8] - 0.05) {
+		std::cerr << "REGRESSION " << key << " precision/recall: " << result.precision
+			<< "/" << result.recall << ", baseline " << base[7] << "/" << base[8]
+			<< std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+// Reads the rows of an earlier run, keyed by the first six columns.
+static std::map<std::string, std::vector<double> > ReadBaseline(
+	const std::string& path) {
+
+	std::map<std::string, std::vector<double> > rows;
+	std::ifstream ifs(path.c_str());
+	std::string line;
+	std::getline(ifs, line); // header
+	while (std::getline(ifs, line)) {
+		std::stringstream ss(line);
+		std::string field, key;
+		for (int i = 0; i < 6 && std::getline(ss, field, ','); ++i) {
+			key += (i ? "," : "") + field;
+		}
+		std::vector<double> values;
+		while (std::getline(ss, field, ',')) values.push_back(std::atof(field.c_str()));
+		if (values.size() >= 9) rows[key] = values;
+	}
+	return rows;
+}
+
+int main(int argc, char** argv) {
+
+	bool quick = false;
+	int repeats = 3;
+	double tolerance = 1.25;
+	std::string baseline_path;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--quick") quick = true;
+		else if (arg.compare(0, 10, "--repeats=") == 0) repeats = std::max(1, std::atoi(arg.c_str() + 10));
+		else if (arg.compare(0, 11, "--baseline=") == 0) baseline_path = arg.substr(11);
+		else if (arg.compare(0, 12, "--tolerance=") == 0) tolerance = std::atof(arg.c_str() + 12);
+		else {
+			std::cerr << "usage: " << argv[0] << " [--quick] [--repeats=N]"
+				" [--baseline=file.csv] [--tolerance=x]" << std::endl;
+			return 2;
+		}
+	}
+
+	// Synthetic pairs at several resolutions and a real image warped by a
+	// known homography. The real pair has no ground truth.
+	std::vector<PairCase> pairs;
+	cv::RNG rng(0x2019);
+	std::vector<cv::Size> sizes;
+	sizes.push_back(cv::Size(640, 480));
+	if (!quick) {
+		sizes.push_back(cv::Size(1920, 1080));
+		sizes.push_back(cv::Size(3840, 2160));
+	}
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		pairs.push_back(MakeWarpedPair("synthetic", MakeTexture(sizes[i], rng)));
+	}
+	cv::Mat biscuit1 = cv::imread(std::string(SOURCE_DIR) + "/data/biscuit1.jpg");
+	cv::Mat biscuit2 = cv::imread(std::string(SOURCE_DIR) + "/data/biscuit2.jpg");
+	if (!biscuit1.empty()) {
+		pairs.push_back(MakeWarpedPair("biscuit_warped", biscuit1));
+	}
+	if (!biscuit1.empty() && !biscuit2.empty()) {
+		PairCase real;
+		real.name = "biscuit";
+		real.img0 = biscuit1;
+		real.img1 = biscuit2;
+		real.has_truth = false;
+		pairs.push_back(real);
+	}
+
+	std::vector<int> budgets;
+	budgets.push_back(0);
+	budgets.push_back(2000);
+	if (!quick) budgets.push_back(8000);
+
+	std::map<std::string, std::vector<double> > baseline;
+	if (!baseline_path.empty()) baseline = ReadBaseline(baseline_path);
+
+	std::cout << "pair,resolution,feature,matcher,pruner,budget,extract_ms,match_ms,"
+		"prune_ms,query_kpts,refer_kpts,putative,kept,precision,recall,rss_delta_mb"
+		<< std::endl;
+	std::cout.setf(std::ios::fixed);
+	std::cout.precision(3);
+
+	bool ok = true;
+	for (size_t p = 0; p < pairs.size(); ++p) {
+		for (int f = FEATURE_SIFT; f <= FEATURE_HALFSIFT; ++f) {
+			for (int m = MATCHER_BF; m <= MATCHER_BF_TILED; ++m) {
+				// Hamming distances need binary descriptors.
+				if (IsHamming((MatcherType)m) && !IsBinary((FeatureType)f)) continue;
+				for (int r = PRUNER_RATIO; r <= PRUNER_LPM_CASCADE; ++r) {
+					for (size_t b = 0; b < budgets.size(); ++b) {
+						BenchResult result = RunPipeline(pairs[p], (FeatureType)f,
+							(MatcherType)m, (PrunerType)r, budgets[b], repeats);
+
+						std::ostringstream key;
+						key << pairs[p].name << "," << pairs[p].img0.cols << "x"
+							<< pairs[p].img0.rows << "," << kFeatureNames[f] << ","
+							<< kMatcherNames[m] << "," << kPrunerNames[r] << "," << budgets[b];
+						std::cout << key.str() << "," << result.extract_ms << ","
+							<< result.match_ms << "," << result.prune_ms << ","
+							<< result.query_kpts << "," << result.refer_kpts << ","
+							<< result.putative << "," << result.kept << ","
+							<< result.precision << "," << result.recall << ","
+							<< result.rss_delta_mb << std::endl;
+
+						std::map<std::string, std::vector<double> >::const_iterator it =
+							baseline.find(key.str());
+						if (it != baseline.end()) {
+							ok = CheckBaseline(key.str(), result, it->second, tolerance) && ok;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/feature_extractor.h"
+#include "../src/image_matcher.h"
+#include "../src/match_pruner.h"
+#include "../src/geometric_verifier.h"
+#include "../src/pipeline_executor.h"
+
+// Matches data/biscuit1.jpg against data/biscuit2.jpg as a stream of
+// requests, once one pair at a time as in demo_im and once through
+// PipelineExecutor with growing numbers of extraction threads, and prints
+// the throughput.
+
+int main() {
+
+	const std::string source_dir = SOURCE_DIR;
+	const std::string query_path = source_dir + "/data/biscuit1.jpg";
+	const std::string refer_path = source_dir + "/data/biscuit2.jpg";
+	if (cv::imread(query_path).empty() || cv::imread(refer_path).empty()) {
+		std::cerr << "Failed to read the images under " << source_dir << "/data" << std::endl;
+		return 1;
+	}
+
+	const int num_requests = 32;
+	const KeypointBudget budget(2000);
+
+	// One pair at a time.
+	int sequential_inliers = 0;
+	cv::TickMeter tm_sequential;
+	tm_sequential.start();
+	{
+		FeatureExtractor extractor(FEATURE_ORB, budget);
+		GeometricVerifier verifier;
+		for (int r = 0; r < num_requests; ++r) {
+			cv::Mat img0 = cv::imread(query_path);
+			cv::Mat img1 = cv::imread(refer_path);
+			ImageMatcher image_matcher(img0, img1, extractor, MATCHER_BF_HAMMING, 2);
+			MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+				image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(),
+				PRUNER_GMS);
+			verifier.Verify(match_pruner);
+			sequential_inliers = verifier.GetInlierCount();
+		}
+	}
+	tm_sequential.stop();
+	std::cout << "sequential: " << num_requests * 1000.0 / tm_sequential.getTimeMilli()
+		<< " pairs/s (" << sequential_inliers << " inliers)" << std::endl;
+
+	const int extract_threads[] = { 1, 2, 4 };
+	for (int t = 0; t < 3; ++t) {
+		PipelineOptions options(FEATURE_ORB, MATCHER_BF_HAMMING, PRUNER_GMS, 2);
+		options.budget = budget;
+		options.num_threads[STAGE_DECODE] = 2;
+		options.num_threads[STAGE_EXTRACT] = extract_threads[t];
+
+		int pipeline_inliers = 0;
+		cv::TickMeter tm_pipeline;
+		tm_pipeline.start();
+		{
+			PipelineExecutor executor(options);
+			std::vector<std::future<PipelineResult> > futures;
+			for (int r = 0; r < num_requests; ++r) {
+				futures.push_back(executor.Submit(query_path, refer_path));
+			}
+			for (size_t r = 0; r < futures.size(); ++r) {
+				pipeline_inliers = futures[r].get().num_inliers;
+			}
+		}
+		tm_pipeline.stop();
+		std::cout << "pipeline, " << extract_threads[t] << " extraction threads: "
+			<< num_requests * 1000.0 / tm_pipeline.getTimeMilli() << " pairs/s ("
+			<< pipeline_inliers << " inliers)" << std::endl;
+	}
+
+	return 0;
+}
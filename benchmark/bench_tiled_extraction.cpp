@@ -0,0 +1,54 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include "../src/feature_extractor.h"
+
+// Extracts the features of data/biscuit1.jpg upscaled 4 times, once on the
+// whole image, once on 1024x1024 tiles and once inside a region of interest.
+
+int main() {
+
+	const std::string source_dir = SOURCE_DIR;
+	cv::Mat img = cv::imread(source_dir + "/data/biscuit1.jpg");
+	if (img.empty()) {
+		std::cerr << "Failed to read the image under " << source_dir << "/data" << std::endl;
+		return 1;
+	}
+	cv::resize(img, img, cv::Size(), 4.0, 4.0, cv::INTER_CUBIC);
+
+	const int repeats = 3;
+	const FeatureType types[] = { FEATURE_SIFT, FEATURE_ORB };
+	const char* names[] = { "SIFT", "ORB" };
+	const cv::Rect roi(img.cols / 4, img.rows / 4, img.cols / 2, img.rows / 2);
+	const cv::Mat roi_mask = MakeRoiMask(img.size(), roi);
+
+	for (int t = 0; t < 2; ++t) {
+		FeatureExtractor whole(types[t], KeypointBudget(8000));
+		FeatureExtractor tiled(types[t], KeypointBudget(8000));
+		tiled.SetTileLayout(TileLayout(cv::Size(1024, 1024)));
+
+		FeatureSet whole_features, tiled_features, roi_features;
+		cv::TickMeter tm_whole, tm_tiled, tm_roi;
+		for (int r = 0; r < repeats; ++r) {
+			tm_whole.start();
+			whole.Extract(img, whole_features);
+			tm_whole.stop();
+
+			tm_tiled.start();
+			tiled.Extract(img, tiled_features);
+			tm_tiled.stop();
+
+			tm_roi.start();
+			tiled.Extract(img, roi_features, roi_mask);
+			tm_roi.stop();
+		}
+
+		std::cout << names[t] << " " << img.cols << "x" << img.rows << ": whole "
+			<< tm_whole.getTimeMilli() / repeats << " ms (" << whole_features.keypoints.size()
+			<< " keypoints), tiled " << tm_tiled.getTimeMilli() / repeats << " ms ("
+			<< tiled_features.keypoints.size() << " keypoints), tiled roi "
+			<< tm_roi.getTimeMilli() / repeats << " ms (" << roi_features.keypoints.size()
+			<< " keypoints)" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include "../src/feature_extractor.h"
+#include "../src/image_matcher.h"
+#include "../src/match_pruner.h"
+#include "../src/workspace.h"
+
+// Matches and prunes the features of data/biscuit1.jpg and data/biscuit2.jpg
+// pair after pair, once with a new matcher and pruner per pair and once with
+// one Workspace, and counts the allocations per pair. With glibc the malloc
+// family is wrapped, which also counts the matrices of OpenCV and the pool
+// of nanoflann, elsewhere only the calls of operator new are counted.
+
+static std::atomic<long> g_num_allocations(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+	++g_num_allocations;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+	++g_num_allocations;
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	++g_num_allocations;
+	return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+	++g_num_allocations;
+	return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	++g_num_allocations;
+	return __libc_memalign(alignment, size);
+}
+
+// cv::fastMalloc() allocates with it.
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+	if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+	++g_num_allocations;
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr || !size ? 0 : ENOMEM;
+}
+}
+#else
+void* operator new(size_t size) {
+	++g_num_allocations;
+	void* ptr = std::malloc(size ? size : 1);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+#endif
+
+int main() {
+
+	const std::string source_dir = SOURCE_DIR;
+	cv::Mat img0 = cv::imread(source_dir + "/data/biscuit1.jpg");
+	cv::Mat img1 = cv::imread(source_dir + "/data/biscuit2.jpg");
+	if (img0.empty() || img1.empty()) {
+		std::cerr << "Failed to read the images under " << source_dir << "/data" << std::endl;
+		return 1;
+	}
+
+	FeatureExtractor extractor(FEATURE_ORB, KeypointBudget(2000));
+	FeatureSet query_features, refer_features;
+	extractor.Extract(img0, img1, query_features, refer_features);
+
+	const int repeats = 20;
+	const PrunerType pruners[] = { PRUNER_RATIO, PRUNER_GMS, PRUNER_LPM };
+	const char* names[] = { "ratio", "GMS", "LPM" };
+	for (int p = 0; p < 3; ++p) {
+		long allocations_new = 0, allocations_workspace = 0;
+		size_t num_new = 0, num_workspace = 0;
+		cv::TickMeter tm_new, tm_workspace;
+		Workspace workspace;
+		for (int r = 0; r < repeats; ++r) {
+			long before = g_num_allocations;
+			tm_new.start();
+			{
+				ImageMatcher image_matcher(query_features, refer_features,
+					MATCHER_BF_HAMMING, 2);
+				MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+					image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(),
+					pruners[p]);
+				num_new = match_pruner.GetMatches().size();
+			}
+			tm_new.stop();
+			allocations_new += g_num_allocations - before;
+
+			before = g_num_allocations;
+			tm_workspace.start();
+			{
+				ImageMatcher image_matcher(query_features, refer_features, workspace,
+					MATCHER_BF_HAMMING, 2);
+				MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+					image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(),
+					pruners[p], workspace);
+				num_workspace = match_pruner.GetMatches().size();
+			}
+			tm_workspace.stop();
+			// The first pair grows the buffers.
+			if (r > 0) allocations_workspace += g_num_allocations - before;
+		}
+
+		std::cout << names[p] << ": new per pair " << tm_new.getTimeMilli() / repeats
+			<< " ms, " << allocations_new / repeats << " allocations (" << num_new
+			<< " matches), workspace " << tm_workspace.getTimeMilli() / repeats << " ms, "
+			<< allocations_workspace / (repeats - 1) << " allocations (" << num_workspace
+			<< " matches)" << std::endl;
+	}
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <iostream>
 #include "./src/image_matcher.h"
 #include "./src/match_pruner.h"
+#include "./src/profiler.h"
 
 int main() {
 	
@@ -10,26 +11,31 @@ int main() {
 	cv::Mat img0 = cv::imread(img0_path);
 	cv::Mat img1 = cv::imread(img1_path);
 
+#if defined(IM_ENABLE_PROFILING)
+	Profiler::Instance().SetRecordCapacity(100000);
+#endif
+
 	cv::TickMeter tm;
 	tm.start();
 
 	//=========================== Image matching ===========================//
-	std::vector<cv::KeyPoint> keypts0, keypts1;
-	std::vector<std::vector<cv::DMatch> > putative_matches;
-
 	ImageMatcher image_matcher(img0, img1, FEATURE_SIFT, MATCHER_BF, 2);
-	image_matcher.GetKeyPoints(keypts0, keypts1);
-	image_matcher.GetMatches(putative_matches);
 
 	//=========================== Matches pruning ===========================//
-	MatchPruner match_pruner(img0, img1, keypts0, keypts1, putative_matches, PRUNER_GMS);
+	MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+		image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(), PRUNER_GMS);
 
-	std::vector<cv::Point2f> src_points, dst_points;
-	match_pruner.GetMatchedPoints(src_points, dst_points);
+	const std::vector<cv::Point2f>& src_points = match_pruner.GetQueryPoints();
+	const std::vector<cv::Point2f>& dst_points = match_pruner.GetReferPoints();
 
 	tm.stop();
 	std::cout << "cost time: " << tm.getTimeMilli() << " ms" << std::endl;
 
+#if defined(IM_ENABLE_PROFILING)
+	std::cout << Profiler::Instance().ToJson() << std::endl;
+	Profiler::Instance().WriteChromeTrace("demo_im_trace.json");
+#endif
+
 	//=========================== Draw results ===========================//
 	cv::Mat concat_img;
 	cv::hconcat(img0, img1, concat_img);
@@ -0,0 +1,139 @@
+#include "batch_matcher.h"
+#include "workspace.h"
+
+/**
+ * Parallel body where every stripe is one worker processing its range of 
+ * the references one after another.
+ */
+class BatchWorkerBody : public cv::ParallelLoopBody {
+public:
+	BatchWorkerBody(const int num_refers, const int num_workers,
+		const std::function<void(int, int)>& worker)
+		:num_refers_(num_refers), num_workers_(num_workers), worker_(worker) {}
+
+	void operator()(const cv::Range& range) const {
+
+		for (int w = range.start; w < range.end; ++w) {
+			worker_(w * num_refers_ / num_workers_,
+				(w + 1) * num_refers_ / num_workers_);
+		}
+	}
+
+private:
+	const int num_refers_;
+	const int num_workers_;
+	const std::function<void(int, int)>& worker_;
+};
+
+BatchMatcher::BatchMatcher(MatcherType matcher, PrunerType pruner,
+	const int knn, const int num_workers)
+	:matcher_method_(matcher), pruner_method_(pruner), knn_(knn),
+	num_workers_(num_workers > 0 ? num_workers : cv::getNumThreads()) {}
+
+BatchMatcher::~BatchMatcher() {}
+
+void BatchMatcher::MatchPair(const FeatureSet& query_features,
+	const FeatureSet& refer_features, PairResult& result) const {
+
+	Workspace workspace;
+	MatchPair(query_features, refer_features, result, workspace);
+}
+
+void BatchMatcher::MatchPair(const FeatureSet& query_features,
+	const FeatureSet& refer_features, PairResult& result,
+	Workspace& workspace) const {
+
+	result.matches.clear();
+	result.scores.clear();
+	result.num_inliers = 0;
+	if (query_features.empty() || refer_features.empty()) return;
+
+	{
+		// The feature sets share their descriptors, only the keypoints are copied.
+		ImageMatcher image_matcher(query_features, refer_features, workspace,
+			matcher_method_, knn_);
+		MatchPruner match_pruner(image_matcher.GetQueryFeatures(),
+			image_matcher.GetReferFeatures(), image_matcher.GetMatchTable(),
+			pruner_method_, workspace);
+
+		match_pruner.TakeMatches(result.matches);
+		result.scores = match_pruner.GetMatchingScores();
+		result.num_inliers = static_cast<int>(result.matches.size());
+	}
+	// The buffers came back with the destructors. Clearing them drops the
+	// descriptors of the pair, which the workspace must not keep alive.
+	workspace.Reset();
+}
+
+void BatchMatcher::RunWorkers(const int num_refers,
+	const std::function<void(int, int)>& worker) const {
+
+	if (num_refers <= 0) return;
+
+	const int num_workers = std::min(num_workers_, num_refers);
+	BatchWorkerBody body(num_refers, num_workers, worker);
+	cv::parallel_for_(cv::Range(0, num_workers), body, num_workers);
+}
+
+void BatchMatcher::Match(const FeatureSet& query_features,
+	const std::vector<FeatureSet>& refer_features,
+	const ResultCallback& callback) const {
+
+	cv::Mutex mutex;
+	RunWorkers(static_cast<int>(refer_features.size()), [&](int first, int last) {
+		Workspace workspace;
+		PairResult result;
+		for (int i = first; i < last; ++i) {
+			MatchPair(query_features, refer_features[i], result, workspace);
+			result.refer_index = i;
+
+			cv::AutoLock lock(mutex);
+			callback(result);
+		}
+	});
+}
+
+void BatchMatcher::Match(const FeatureSet& query_features,
+	const std::vector<std::string>& refer_paths, FeatureType feature_type,
+	const FeatureCache& cache, const ResultCallback& callback) const {
+
+	cv::Mutex mutex;
+	RunWorkers(static_cast<int>(refer_paths.size()), [&](int first, int last) {
+		// Every worker extracts its references with an extractor of its own.
+		FeatureExtractor extractor(feature_type);
+		Workspace workspace;
+		FeatureSet refer_features;
+		PairResult result;
+		for (int i = first; i < last; ++i) {
+			cv::Mat img = cv::imread(refer_paths[i]);
+			if (img.empty()) {
+				refer_features = FeatureSet();
+			}
+			else {
+				cache.Extract(img, extractor, refer_features);
+			}
+			img.release();
+
+			MatchPair(query_features, refer_features, result, workspace);
+			result.refer_index = i;
+
+			cv::AutoLock lock(mutex);
+			callback(result);
+		}
+	});
+}
+
+void BatchMatcher::Match(const FeatureSet& query_features,
+	const std::vector<FeatureSet>& refer_features,
+	std::vector<PairResult>& results) const {
+
+	results.clear();
+	results.resize(refer_features.size());
+	Match(query_features, refer_features, [&results](PairResult& result) {
+		PairResult& dst = results[result.refer_index];
+		dst.refer_index = result.refer_index;
+		dst.matches.swap(result.matches);
+		dst.scores.swap(result.scores);
+		dst.num_inliers = result.num_inliers;
+	});
+}
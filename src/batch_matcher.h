@@ -0,0 +1,158 @@
+/****************************************************************************//**
+ * @file batch_matcher.h
+ * @brief A c++ implementation of one-to-many image matching.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-08
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _BATCH_MATCHER_H_
+#define _BATCH_MATCHER_H_
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include "feature_extractor.h"
+#include "feature_cache.h"
+#include "image_matcher.h"
+#include "match_pruner.h"
+
+/**
+ * Result of matching the query against one reference.
+ */
+struct PairResult {
+	int refer_index;                 //!< Index of the reference in the batch.
+	std::vector<cv::DMatch> matches; //!< Matches after pruning.
+	std::vector<double> scores;      //!< Matching scores of the matches.
+	int num_inliers;                 //!< Number of matches after pruning.
+
+	PairResult() :refer_index(-1), num_inliers(0) {}
+};
+
+/**
+ * Class for matching one query against a batch of references.
+ *
+ * The pairs are matched and pruned by a pool of workers. Every finished pair
+ * is handed to a callback and released afterwards, so at most one result per
+ * worker is held at any time, whatever the size of the batch.
+ */
+class BatchMatcher {
+public:
+	/**
+	 * Callback receiving the result of one pair. The calls are serialized, 
+	 * but come from the worker threads in the order of completion. The 
+	 * result may be moved out.
+	 */
+	typedef std::function<void(PairResult&)> ResultCallback;
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  matcher [in] Matching method.
+	 * @param  pruner [in] Matches pruning algorithm.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  num_workers [in] Number of pairs processed at once, 0 for 
+	 *                          cv::getNumThreads().
+	 */
+	explicit BatchMatcher(MatcherType matcher = MATCHER_BF,
+		PrunerType pruner = PRUNER_GMS, const int knn = 2,
+		const int num_workers = 0);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~BatchMatcher();
+
+	/**
+	 * @brief  Matches the query against every reference and streams the 
+	 *         results.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference images.
+	 * @param  callback [in] Receives the result of every pair.
+	 */
+	void Match(const FeatureSet& query_features,
+		const std::vector<FeatureSet>& refer_features,
+		const ResultCallback& callback) const;
+
+	/**
+	 * @brief  Matches the query against every reference and collects the 
+	 *         results.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference images.
+	 * @param  results [out] Results in the order of the references.
+	 */
+	void Match(const FeatureSet& query_features,
+		const std::vector<FeatureSet>& refer_features,
+		std::vector<PairResult>& results) const;
+
+	/**
+	 * @brief  Matches the query against the images of a gallery and streams
+	 *         the results. The features of the references are loaded from 
+	 *         the cache, and only extracted and saved if they are missing.
+	 *
+	 * Every worker reads, extracts and matches one reference at a time with
+	 * an extractor of its own.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_paths [in] Paths of the reference images.
+	 * @param  feature_type [in] Feature type of the references.
+	 * @param  cache [in] Feature cache.
+	 * @param  callback [in] Receives the result of every pair. An image that
+	 *                       can't be read gives an empty result.
+	 */
+	void Match(const FeatureSet& query_features,
+		const std::vector<std::string>& refer_paths, FeatureType feature_type,
+		const FeatureCache& cache, const ResultCallback& callback) const;
+
+	/**
+	 * @brief  Matches and prunes one pair.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  result [out] Result of the pair.
+	 */
+	void MatchPair(const FeatureSet& query_features,
+		const FeatureSet& refer_features, PairResult& result) const;
+
+	/**
+	 * @brief  Matches and prunes one pair with the workspace of the worker,
+	 *         which every worker of Match() keeps for all of its pairs. The
+	 *         workspace is reset after the pair.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  result [out] Result of the pair.
+	 * @param  workspace [in] Workspace of the worker.
+	 */
+	void MatchPair(const FeatureSet& query_features,
+		const FeatureSet& refer_features, PairResult& result,
+		Workspace& workspace) const;
+
+private:
+	/**
+	 * @brief  Splits the references into one contiguous range per worker 
+	 *         and runs the workers in parallel.
+	 *
+	 * @return void
+	 * @param  num_refers [in] Number of references.
+	 * @param  worker [in] Processes the references [first, last).
+	 */
+	void RunWorkers(const int num_refers,
+		const std::function<void(int, int)>& worker) const;
+
+private:
+	MatcherType matcher_method_; //!< Matching method.
+	PrunerType pruner_method_;   //!< Matches pruning algorithm.
+	const int knn_;              //!< Count of best matches per query descriptor.
+	const int num_workers_;      //!< Number of pairs processed at once.
+};
+#endif
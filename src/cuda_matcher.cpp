@@ -0,0 +1,147 @@
+#include "cuda_matcher.h"
+
+#if defined(IM_WITH_CUDA)
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudafeatures2d.hpp>
+#if defined(IM_WITH_CUDA_SURF)
+#include <opencv2/xfeatures2d/cuda.hpp>
+#endif
+
+/**
+ * Device buffers and algorithms.
+ */
+struct CudaMatcher::Impl {
+	cv::Ptr<cv::cuda::ORB> orb;            //!< ORB detector.
+#if defined(IM_WITH_CUDA_SURF)
+	cv::cuda::SURF_CUDA surf;              //!< SURF detector.
+#endif
+	cv::Ptr<cv::cuda::DescriptorMatcher> matcher; //!< Brute force matcher.
+
+	cv::cuda::GpuMat image;                //!< Uploaded gray image.
+	cv::cuda::GpuMat keypoints;            //!< Keypoints on the device.
+	cv::cuda::GpuMat query_descriptors;    //!< Query descriptors on the device.
+	cv::cuda::GpuMat refer_descriptors;    //!< Reference descriptors on the device.
+	cv::Mat gray;                          //!< Gray image on the host.
+
+	/**
+	 * @brief  Extracts the features of one image on the device.
+	 *
+	 * @return void
+	 * @param  feature [in] Feature type.
+	 * @param  img [in] Image.
+	 * @param  features [out] Features, the descriptors are left empty.
+	 * @param  descriptors [out] Descriptors on the device.
+	 */
+	void Extract(FeatureType feature, const cv::Mat& img, FeatureSet& features,
+		cv::cuda::GpuMat& descriptors) {
+
+		// The CUDA detectors only take gray images.
+		if (img.channels() == 3) {
+			cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+		}
+		else if (img.channels() == 4) {
+			cv::cvtColor(img, gray, cv::COLOR_BGRA2GRAY);
+		}
+		else {
+			gray = img;
+		}
+		image.upload(gray);
+
+		if (feature == FEATURE_ORB) {
+			orb->detectAndComputeAsync(image, cv::noArray(), keypoints, descriptors);
+			orb->convert(keypoints, features.keypoints);
+		}
+#if defined(IM_WITH_CUDA_SURF)
+		else {
+			surf(image, cv::cuda::GpuMat(), keypoints, descriptors);
+			surf.downloadKeypoints(keypoints, features.keypoints);
+		}
+#endif
+		features.descriptors.release();
+		features.image_size = img.size();
+	}
+};
+
+
+#else
+struct CudaMatcher::Impl {};
+#endif
+
+bool CudaMatcher::IsAvailable() {
+#if defined(IM_WITH_CUDA)
+	return cv::cuda::getCudaEnabledDeviceCount() > 0;
+#else
+	return false;
+#endif
+}
+
+bool CudaMatcher::Supports(FeatureType feature, MatcherType matcher) {
+
+	switch (feature)
+	{
+	case FEATURE_ORB:
+		return matcher == MATCHER_BF_HAMMING;
+	case FEATURE_SURF:
+#if defined(IM_WITH_CUDA) && !defined(IM_WITH_CUDA_SURF)
+		return false;
+#else
+		return matcher == MATCHER_BF || matcher == MATCHER_BF_TILED;
+#endif
+	default:
+		return false;
+	}
+}
+
+CudaMatcher::CudaMatcher(FeatureType feature, MatcherType matcher)
+	:impl_(new Impl), feature_method_(feature), matcher_method_(matcher) {
+
+	CV_Assert(Supports(feature, matcher));
+#if defined(IM_WITH_CUDA)
+	if (feature_method_ == FEATURE_ORB) {
+		impl_->orb = cv::cuda::ORB::create();
+		impl_->matcher = cv::cuda::DescriptorMatcher::createBFMatcher(cv::NORM_HAMMING);
+	}
+	else {
+		impl_->matcher = cv::cuda::DescriptorMatcher::createBFMatcher(cv::NORM_L2);
+	}
+#endif
+}
+
+CudaMatcher::~CudaMatcher() {
+	delete impl_;
+}
+
+void CudaMatcher::ExtractAndMatch(const cv::Mat& img0, const cv::Mat& img1,
+	FeatureSet& query_features, FeatureSet& refer_features,
+	MatchTable& matches, const int knn) {
+
+#if defined(IM_WITH_CUDA)
+	impl_->Extract(feature_method_, img0, query_features, impl_->query_descriptors);
+	impl_->Extract(feature_method_, img1, refer_features, impl_->refer_descriptors);
+
+	if (impl_->query_descriptors.empty() || impl_->refer_descriptors.empty()) {
+		matches.Create(static_cast<int>(query_features.keypoints.size()), knn);
+		return;
+	}
+
+	// Only the matches leave the device.
+	std::vector<std::vector<cv::DMatch> > knn_matches;
+	impl_->matcher->knnMatch(impl_->query_descriptors, impl_->refer_descriptors,
+		knn_matches, knn);
+	matches = MatchTable(knn_matches);
+#else
+	CV_Error(cv::Error::StsNotImplemented, "The CUDA backend is not built.");
+#endif
+}
+
+void CudaMatcher::DownloadDescriptors(FeatureSet& query_features,
+	FeatureSet& refer_features) const {
+
+#if defined(IM_WITH_CUDA)
+	// Empty device descriptors download as empty matrices.
+	impl_->query_descriptors.download(query_features.descriptors);
+	impl_->refer_descriptors.download(refer_features.descriptors);
+#else
+	CV_Error(cv::Error::StsNotImplemented, "The CUDA backend is not built.");
+#endif
+}
@@ -0,0 +1,106 @@
+/****************************************************************************//**
+ * @file cuda_matcher.h
+ * @brief A CUDA implementation of feature extraction and matching.
+ *
+ * The backend is compiled with the CMake option WITH_CUDA, which defines 
+ * IM_WITH_CUDA when OpenCV has the cudafeatures2d module, and is selected 
+ * at runtime when a CUDA device is present. Without it, IsAvailable() 
+ * returns false. SURF also needs the xfeatures2d module, which defines
+ * IM_WITH_CUDA_SURF; without it only ORB runs on the device.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-14
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _CUDA_MATCHER_H_
+#define _CUDA_MATCHER_H_
+#include <opencv2/opencv.hpp>
+#include "feature_extractor.h"
+#include "image_matcher.h"
+#include "match_table.h"
+
+/**
+ * Class for the extraction and matching on a CUDA device.
+ *
+ * The descriptors stay on the device between the extraction and the 
+ * \f$k\f$ nearest neighbor matching, only the keypoints and the matches are
+ * downloaded, and the descriptors on demand. Supported combinations are 
+ * FEATURE_ORB with MATCHER_BF_HAMMING, and FEATURE_SURF with MATCHER_BF or
+ * MATCHER_BF_TILED.
+ */
+class CudaMatcher {
+public:
+	/**
+	 * @brief  Checks whether OpenCV was built with CUDA and a device exists.
+	 *
+	 * @return bool True if the backend can be used.
+	 */
+	static bool IsAvailable();
+
+	/**
+	 * @brief  Checks whether a combination of methods has a CUDA version.
+	 *
+	 * @return bool True if supported.
+	 * @param  feature [in] Feature type.
+	 * @param  matcher [in] Matcher type.
+	 */
+	static bool Supports(FeatureType feature, MatcherType matcher);
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  feature [in] Feature type.
+	 * @param  matcher [in] Matcher type.
+	 */
+	CudaMatcher(FeatureType feature, MatcherType matcher);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~CudaMatcher();
+
+	/**
+	 * @brief  Extracts the features of both images and matches them.
+	 *
+	 * @return void
+	 * @param  img0 [in] Query image.
+	 * @param  img1 [in] Reference image.
+	 * @param  query_features [out] Features of the query image, the 
+	 *                              descriptors are left empty, see 
+	 *                              DownloadDescriptors().
+	 * @param  refer_features [out] Features of the reference image, the 
+	 *                              descriptors are left empty.
+	 * @param  matches [out] Matches, \f$N\times k\f$.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	void ExtractAndMatch(const cv::Mat& img0, const cv::Mat& img1,
+		FeatureSet& query_features, FeatureSet& refer_features,
+		MatchTable& matches, const int knn);
+
+	/**
+	 * @brief  Downloads the descriptors of the last ExtractAndMatch() call.
+	 *
+	 * @return void
+	 * @param  query_features [in,out] Features of the query image, which get 
+	 *                                 the descriptors.
+	 * @param  refer_features [in,out] Features of the reference image, which 
+	 *                                 get the descriptors.
+	 */
+	void DownloadDescriptors(FeatureSet& query_features,
+		FeatureSet& refer_features) const;
+
+private:
+	CudaMatcher(const CudaMatcher&) = delete;
+	CudaMatcher& operator=(const CudaMatcher&) = delete;
+
+	struct Impl;
+	Impl* impl_; //!< Device buffers and algorithms, hidden from the CPU builds.
+
+	const FeatureType feature_method_; //!< Feature type.
+	const MatcherType matcher_method_; //!< Matcher type.
+};
+#endif
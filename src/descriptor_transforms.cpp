@@ -0,0 +1,53 @@
+#include "descriptor_transforms.h"
+#include "descriptor_transforms_kernels.h"
+
+// With the runtime CPU dispatch, a baseline build that lacks AVX also gets
+// the AVX kernels of descriptor_transforms_avx.cpp.
+#if defined(IM_WITH_CPU_DISPATCH) && !defined(IM_USE_AVX) && defined(IM_USE_SSE2)
+#define IM_DISPATCH_AVX 1
+void RootSiftRowsAVX(float* data, const int rows, const int cols,
+	const size_t step);
+#endif
+
+void RootSiftTransform(cv::Mat& descriptors) {
+
+	if (descriptors.empty()) return;
+	CV_Assert(descriptors.type() == CV_32F);
+
+	float* data = descriptors.ptr<float>(0);
+	const size_t step = descriptors.step1();
+#if defined(IM_DISPATCH_AVX)
+	// The AVX kernels are built separately and only run on a capable host.
+	if (cv::checkHardwareSupport(CV_CPU_AVX)) {
+		RootSiftRowsAVX(data, descriptors.rows, descriptors.cols, step);
+		return;
+	}
+#endif
+	RootSiftRows(data, descriptors.rows, descriptors.cols, step);
+}
+
+void HalfSiftTransform(cv::Mat& descriptors) {
+
+	if (descriptors.empty()) return;
+	CV_Assert(descriptors.type() == CV_32F && descriptors.cols == 128);
+
+	for (int i = 0; i < descriptors.rows; ++i) {
+		float* p = descriptors.ptr<float>(i);
+		// 16 histograms of 8 orientation bins, bin j and bin j+4 are opposite.
+		for (int jhist = 0; jhist < 16; ++jhist, p += 8) {
+#if defined(IM_USE_AVX) || defined(IM_USE_SSE2)
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4));
+			_mm_storeu_ps(p, sum);
+			_mm_storeu_ps(p + 4, sum);
+#elif defined(IM_USE_NEON)
+			float32x4_t sum = vaddq_f32(vld1q_f32(p), vld1q_f32(p + 4));
+			vst1q_f32(p, sum);
+			vst1q_f32(p + 4, sum);
+#else
+			for (int jori = 0; jori < 4; ++jori) {
+				p[jori] = p[jori + 4] = p[jori] + p[jori + 4];
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,42 @@
+/****************************************************************************//**
+ * @file descriptor_transforms.h
+ * @brief In-place descriptor transforms of ROOTSIFT and HALFSIFT.
+ *
+ * Both transforms work on the whole descriptor matrix at once. Every row is
+ * processed in registers with SSE2, AVX or NEON when the compiler targets
+ * them, and with a scalar loop otherwise. No temporary matrix is allocated.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-09-20
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _DESCRIPTOR_TRANSFORMS_H_
+#define _DESCRIPTOR_TRANSFORMS_H_
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief  Converts SIFT descriptors into ROOTSIFT descriptors in place.
+ *
+ * Each row is L1-normalized and then square-rooted element-wise, which is
+ * the same as cv::normalize(row, row, 1, cv::NORM_L1) followed by cv::sqrt.
+ *
+ * @return void
+ * @param  descriptors [in,out] SIFT descriptors, \f$N\times128\f$, CV_32F.
+ */
+void RootSiftTransform(cv::Mat& descriptors);
+
+/**
+ * @brief  Converts SIFT descriptors into HALFSIFT descriptors in place.
+ *
+ * Opposite orientation bins of every 8-bin histogram are summed, so that bin
+ * \f$j\f$ and bin \f$j+4\f$ both hold the sum for \f$j<4\f$.
+ *
+ * @return void
+ * @param  descriptors [in,out] SIFT descriptors, \f$N\times128\f$, CV_32F.
+ */
+void HalfSiftTransform(cv::Mat& descriptors);
+
+#endif
@@ -0,0 +1,12 @@
+// The AVX build of the descriptor transform kernels for the runtime CPU 
+// dispatch. CMake compiles this file with AVX enabled, the kernels are only
+// called after cv::checkHardwareSupport(CV_CPU_AVX).
+#if defined(IM_WITH_CPU_DISPATCH) && defined(__AVX__)
+#include "descriptor_transforms_kernels.h"
+
+void RootSiftRowsAVX(float* data, const int rows, const int cols,
+	const size_t step) {
+
+	RootSiftRows(data, rows, cols, step);
+}
+#endif
@@ -0,0 +1,131 @@
+/****************************************************************************//**
+ * @file descriptor_transforms_kernels.h
+ * @brief Row kernels of the descriptor transforms, for one instruction set.
+ *
+ * The instruction set is picked from the flags of the including translation
+ * unit, so the same kernels are compiled once with the baseline flags in
+ * descriptor_transforms.cpp and once more with AVX enabled in
+ * descriptor_transforms_avx.cpp for the runtime CPU dispatch. Every function
+ * has internal linkage and works on raw pointers, so no inline function of
+ * OpenCV is compiled with AVX.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-22
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _DESCRIPTOR_TRANSFORMS_KERNELS_H_
+#define _DESCRIPTOR_TRANSFORMS_KERNELS_H_
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define IM_USE_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IM_USE_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define IM_USE_NEON 1
+#endif
+
+/**
+ * @brief  Computes the L1 norm of a row.
+ *
+ * @return double L1 norm.
+ * @param  p [in] Row data.
+ * @param  n [in] Number of elements.
+ */
+static double RowNormL1(const float* p, const int n) {
+
+	int j = 0;
+	double norm = 0;
+#if defined(IM_USE_AVX)
+	const __m256 sign_mask = _mm256_set1_ps(-0.f);
+	__m256 acc = _mm256_setzero_ps();
+	for (; j <= n - 8; j += 8) {
+		acc = _mm256_add_ps(acc, _mm256_andnot_ps(sign_mask, _mm256_loadu_ps(p + j)));
+	}
+	float buf[8];
+	_mm256_storeu_ps(buf, acc);
+	for (int k = 0; k < 8; ++k) norm += buf[k];
+#elif defined(IM_USE_SSE2)
+	const __m128 sign_mask = _mm_set1_ps(-0.f);
+	__m128 acc = _mm_setzero_ps();
+	for (; j <= n - 4; j += 4) {
+		acc = _mm_add_ps(acc, _mm_andnot_ps(sign_mask, _mm_loadu_ps(p + j)));
+	}
+	float buf[4];
+	_mm_storeu_ps(buf, acc);
+	for (int k = 0; k < 4; ++k) norm += buf[k];
+#elif defined(IM_USE_NEON)
+	float32x4_t acc = vdupq_n_f32(0.f);
+	for (; j <= n - 4; j += 4) {
+		acc = vaddq_f32(acc, vabsq_f32(vld1q_f32(p + j)));
+	}
+	norm += vaddvq_f32(acc);
+#endif
+	for (; j < n; ++j) {
+		norm += std::abs(p[j]);
+	}
+	return norm;
+}
+
+/**
+ * @brief  Scales a row and takes the square root of every element.
+ *
+ * @return void
+ * @param  p [in,out] Row data.
+ * @param  n [in] Number of elements.
+ * @param  scale [in] Scale factor.
+ */
+static void ScaleSqrtRow(float* p, const int n, const float scale) {
+
+	int j = 0;
+#if defined(IM_USE_AVX)
+	const __m256 vscale = _mm256_set1_ps(scale);
+	for (; j <= n - 8; j += 8) {
+		_mm256_storeu_ps(p + j, _mm256_sqrt_ps(_mm256_mul_ps(_mm256_loadu_ps(p + j), vscale)));
+	}
+#elif defined(IM_USE_SSE2)
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; j <= n - 4; j += 4) {
+		_mm_storeu_ps(p + j, _mm_sqrt_ps(_mm_mul_ps(_mm_loadu_ps(p + j), vscale)));
+	}
+#elif defined(IM_USE_NEON)
+	const float32x4_t vscale = vdupq_n_f32(scale);
+	for (; j <= n - 4; j += 4) {
+		vst1q_f32(p + j, vsqrtq_f32(vmulq_f32(vld1q_f32(p + j), vscale)));
+	}
+#endif
+	for (; j < n; ++j) {
+		p[j] = std::sqrt(p[j] * scale);
+	}
+}
+
+/**
+ * @brief  Converts the rows of SIFT descriptors into ROOTSIFT descriptors.
+ *
+ * @return void
+ * @param  data [in,out] First row.
+ * @param  rows [in] Number of rows.
+ * @param  cols [in] Number of elements per row.
+ * @param  step [in] Distance between the rows in elements.
+ */
+static void RootSiftRows(float* data, const int rows, const int cols,
+	const size_t step) {
+
+	for (int i = 0; i < rows; ++i) {
+		float* p = data + i * step;
+		// Same degenerate case handling as cv::normalize.
+		double norm = RowNormL1(p, cols);
+		float scale = norm > DBL_EPSILON ? static_cast<float>(1.0 / norm) : 0.f;
+		ScaleSqrtRow(p, cols, scale);
+	}
+}
+
+#endif
@@ -0,0 +1,343 @@
+#include "feature_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <sstream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Magic number and version of the cache files.
+static const char kMagic[8] = { 'I', 'M', 'F', 'E', 'A', 'T', 0, 0 };
+static const uint32_t kVersion = 1;
+// Alignment of the descriptor block.
+static const uint64_t kDescriptorAlignment = 64;
+
+/**
+ * Header of a cache file.
+ */
+struct FeatureFileHeader {
+	char magic[8];          //!< kMagic.
+	uint32_t version;       //!< kVersion.
+	uint32_t header_size;   //!< sizeof(FeatureFileHeader).
+	int32_t image_width;    //!< Width of the source image.
+	int32_t image_height;   //!< Height of the source image.
+	int32_t num_keypoints;  //!< Number of keypoints.
+	int32_t desc_rows;      //!< Rows of the descriptors.
+	int32_t desc_cols;      //!< Columns of the descriptors.
+	int32_t desc_type;      //!< OpenCV type of the descriptors.
+	uint64_t desc_offset;   //!< Offset of the descriptor block in the file.
+	uint64_t desc_step;     //!< Bytes per descriptor row.
+	uint64_t reserved;      //!< Zero.
+};
+static_assert(sizeof(FeatureFileHeader) == 64, "The header must be 64 bytes.");
+
+/**
+ * Keypoint of a cache file.
+ */
+struct KeyPointRecord {
+	float x, y, size, angle, response;
+	int32_t octave, class_id;
+};
+static_assert(sizeof(KeyPointRecord) == 28, "The keypoint record must be 28 bytes.");
+
+/**
+ * Read-only mapping of a whole file, copy on write.
+ */
+class MappedFile {
+public:
+	MappedFile() :data_(NULL), size_(0) {}
+
+	~MappedFile() {
+#if defined(_WIN32)
+		if (data_) UnmapViewOfFile(data_);
+#else
+		if (data_) munmap(data_, size_);
+#endif
+	}
+
+	bool Open(const std::string& path) {
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mapping) return false;
+		data_ = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+		size_ = static_cast<size_t>(file_size.QuadPart);
+		return data_ != NULL;
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		void* data = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) return false;
+		data_ = data;
+		return true;
+#endif
+	}
+
+	const unsigned char* data() const { return (const unsigned char*)data_; }
+	size_t size() const { return size_; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	void* data_;
+	size_t size_;
+};
+
+FeatureCache::FeatureCache(const std::string& directory) :directory_(directory) {}
+
+FeatureCache::~FeatureCache() {}
+
+uint64_t FeatureCache::HashImage(const cv::Mat& img) {
+
+	uint64_t hash = 14695981039346656037ULL;
+	auto update = [&hash](const unsigned char* p, size_t n) {
+		for (size_t i = 0; i < n; ++i) {
+			hash ^= p[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+
+	int32_t meta[3] = { img.rows, img.cols, img.type() };
+	update((const unsigned char*)meta, sizeof(meta));
+
+	const size_t row_bytes = img.cols * img.elemSize();
+	for (int i = 0; i < img.rows; ++i) {
+		update(img.ptr(i), row_bytes);
+	}
+	return hash;
+}
+
+std::string FeatureCache::MakeKey(const cv::Mat& img, FeatureType type,
+	const std::string& params) {
+
+	uint64_t hash = HashImage(img);
+	std::ostringstream description;
+	description << static_cast<int>(type) << ':' << params;
+	const std::string text = description.str();
+	for (size_t i = 0; i < text.size(); ++i) {
+		hash ^= static_cast<unsigned char>(text[i]);
+		hash *= 1099511628211ULL;
+	}
+
+	char key[17];
+	snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+	return std::string(key);
+}
+
+std::string FeatureCache::GetPath(const std::string& key) const {
+	return directory_ + "/" + key + ".feat";
+}
+
+bool FeatureCache::Load(const std::string& key, FeatureSet& features) const {
+	return Read(GetPath(key), features);
+}
+
+bool FeatureCache::Save(const std::string& key, const FeatureSet& features) const {
+
+	// Write to a unique temporary file, so that readers never see a 
+	// partial entry.
+	static std::atomic<unsigned> counter(0);
+	std::ostringstream tmp_path;
+	tmp_path << GetPath(key) << ".tmp" << counter++ << '_'
+		<< std::hash<std::thread::id>()(std::this_thread::get_id());
+
+	if (!Write(tmp_path.str(), features)) {
+		std::remove(tmp_path.str().c_str());
+		return false;
+	}
+	if (std::rename(tmp_path.str().c_str(), GetPath(key).c_str()) != 0) {
+		// Another thread may have saved the same entry first.
+		std::remove(tmp_path.str().c_str());
+	}
+	return true;
+}
+
+/**
+ * @brief  Describes the settings of an extractor that change its output.
+ *
+ * The default settings add nothing, so the keys of the entries saved
+ * without them stay valid.
+ *
+ * @return std::string Description, followed by the caller's parameters.
+ * @param  extractor [in] Feature extractor.
+ * @param  params [in] Description of further parameters.
+ */
+static std::string DescribeSettings(const FeatureExtractor& extractor,
+	const std::string& params) {
+
+	std::ostringstream description;
+	const KeypointBudget& budget = extractor.GetKeypointBudget();
+	if (budget.max_keypoints > 0) {
+		description << "budget=" << budget.max_keypoints << ','
+			<< static_cast<int>(budget.selection);
+		if (budget.selection == SELECTION_GRID) {
+			description << ',' << budget.grid_size.width << 'x' << budget.grid_size.height;
+		}
+		description << ';';
+	}
+	// Per tile caps and borders change the keypoints near the seams.
+	const TileLayout& tiles = extractor.GetTileLayout();
+	if (tiles.enabled()) {
+		description << "tiles=" << tiles.tile_size.width << 'x'
+			<< tiles.tile_size.height << ',' << tiles.overlap << ';';
+	}
+	description << params;
+	return description.str();
+}
+
+bool FeatureCache::Extract(const cv::Mat& img, FeatureExtractor& extractor,
+	FeatureSet& features, const std::string& params) const {
+
+	const std::string key = MakeKey(img, extractor.GetFeatureType(),
+		DescribeSettings(extractor, params));
+	if (Load(key, features)) return true;
+
+	// Don't extract into the mapping of a previous entry.
+	features = FeatureSet();
+	extractor.Extract(img, features);
+	Save(key, features);
+	return false;
+}
+
+bool FeatureCache::Write(const std::string& path, const FeatureSet& features) {
+
+	const cv::Mat& des = features.descriptors;
+	const int num_keypoints = static_cast<int>(features.keypoints.size());
+
+	FeatureFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.header_size = sizeof(FeatureFileHeader);
+	header.image_width = features.image_size.width;
+	header.image_height = features.image_size.height;
+	header.num_keypoints = num_keypoints;
+	header.desc_rows = des.rows;
+	header.desc_cols = des.cols;
+	header.desc_type = des.type();
+	header.desc_step = des.cols * des.elemSize();
+	uint64_t end_keypoints = sizeof(FeatureFileHeader) +
+		(uint64_t)num_keypoints * sizeof(KeyPointRecord);
+	header.desc_offset = (end_keypoints + kDescriptorAlignment - 1) /
+		kDescriptorAlignment * kDescriptorAlignment;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file) return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	std::vector<KeyPointRecord> records(num_keypoints);
+	for (int i = 0; i < num_keypoints; ++i) {
+		const cv::KeyPoint& kp = features.keypoints[i];
+		KeyPointRecord& r = records[i];
+		r.x = kp.pt.x;
+		r.y = kp.pt.y;
+		r.size = kp.size;
+		r.angle = kp.angle;
+		r.response = kp.response;
+		r.octave = kp.octave;
+		r.class_id = kp.class_id;
+	}
+	if (ok && num_keypoints > 0) {
+		ok = fwrite(records.data(), sizeof(KeyPointRecord), num_keypoints, 
+			file) == (size_t)num_keypoints;
+	}
+
+	static const char padding[kDescriptorAlignment] = { 0 };
+	const size_t num_padding = static_cast<size_t>(header.desc_offset - end_keypoints);
+	if (ok && num_padding > 0) {
+		ok = fwrite(padding, 1, num_padding, file) == num_padding;
+	}
+
+	for (int i = 0; ok && i < des.rows; ++i) {
+		ok = fwrite(des.ptr(i), 1, header.desc_step, file) == header.desc_step;
+	}
+
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
+
+bool FeatureCache::Read(const std::string& path, FeatureSet& features) {
+
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+	if (!mapping->Open(path)) return false;
+
+	const unsigned char* data = mapping->data();
+	const size_t size = mapping->size();
+	if (size < sizeof(FeatureFileHeader)) return false;
+
+	FeatureFileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+		header.version != kVersion ||
+		header.header_size != sizeof(FeatureFileHeader) ||
+		header.num_keypoints < 0 || header.desc_rows < 0 || header.desc_cols < 0) {
+		return false;
+	}
+	// Every keypoint has one row of a single channel 8-bit or float
+	// descriptor, which the matchers and pruners rely on.
+	if (header.desc_rows != header.num_keypoints ||
+		(header.desc_rows > 0 && header.desc_cols == 0) ||
+		(header.desc_type != CV_8UC1 && header.desc_type != CV_32FC1)) {
+		return false;
+	}
+
+	const uint64_t end_keypoints = sizeof(FeatureFileHeader) +
+		(uint64_t)header.num_keypoints * sizeof(KeyPointRecord);
+	const uint64_t desc_bytes = (uint64_t)header.desc_rows * header.desc_step;
+	if (end_keypoints > header.desc_offset || header.desc_offset + desc_bytes > size ||
+		header.desc_step != (uint64_t)header.desc_cols * CV_ELEM_SIZE(header.desc_type)) {
+		return false;
+	}
+
+	features.keypoints.resize(header.num_keypoints);
+	const KeyPointRecord* records = 
+		(const KeyPointRecord*)(data + sizeof(FeatureFileHeader));
+	for (int i = 0; i < header.num_keypoints; ++i) {
+		KeyPointRecord r;
+		memcpy(&r, records + i, sizeof(r));
+		features.keypoints[i] = cv::KeyPoint(cv::Point2f(r.x, r.y), r.size,
+			r.angle, r.response, r.octave, r.class_id);
+	}
+
+	features.image_size = cv::Size(header.image_width, header.image_height);
+	if (header.desc_rows > 0) {
+		// The descriptors stay in the mapping, which lives as long as the holder.
+		features.descriptors = cv::Mat(header.desc_rows, header.desc_cols,
+			header.desc_type, (void*)(data + header.desc_offset), 
+			(size_t)header.desc_step);
+		features.holder = mapping;
+	}
+	else {
+		features.descriptors.release();
+		features.holder.reset();
+	}
+	return true;
+}
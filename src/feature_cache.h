@@ -0,0 +1,139 @@
+/****************************************************************************//**
+ * @file feature_cache.h
+ * @brief An on-disk cache of the extracted features.
+ *
+ * Every entry is one binary file, in the byte order of the host:
+ * - a header of 64 bytes, see FeatureCache::Write(),
+ * - the keypoints, 28 bytes each,
+ * - the descriptors, row by row, starting at a 64-byte aligned offset.
+ *
+ * The descriptor block is memory mapped on loading, and the descriptors of 
+ * the loaded FeatureSet are a cv::Mat header on the mapping without any 
+ * parsing or copying.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-10
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _FEATURE_CACHE_H_
+#define _FEATURE_CACHE_H_
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <cstdint>
+#include "feature_extractor.h"
+
+/**
+ * Class for the feature cache in one directory.
+ *
+ * The entries are keyed by the hash of the image, the feature type and the
+ * parameters of the extractor. The methods may be called from several 
+ * threads at once, the files are written to a temporary name and renamed.
+ */
+class FeatureCache {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  directory [in] Existing directory of the cache files.
+	 */
+	explicit FeatureCache(const std::string& directory);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~FeatureCache();
+
+	/**
+	 * @brief  Computes the 64-bit FNV-1a hash of the image size, type and 
+	 *         pixels.
+	 *
+	 * @return uint64_t Hash.
+	 * @param  img [in] Image.
+	 */
+	static uint64_t HashImage(const cv::Mat& img);
+
+	/**
+	 * @brief  Makes the key of an entry.
+	 *
+	 * @return std::string Key, 16 hexadecimal digits.
+	 * @param  img [in] Image.
+	 * @param  type [in] Feature type.
+	 * @param  params [in] Description of the extractor parameters, which
+	 *                     distinguishes the entries of one image and type.
+	 */
+	static std::string MakeKey(const cv::Mat& img, FeatureType type,
+		const std::string& params = std::string());
+
+	/**
+	 * @brief  Loads an entry.
+	 *
+	 * @return bool True if the entry exists and is valid.
+	 * @param  key [in] Key of the entry.
+	 * @param  features [out] Features, the descriptors are mapped.
+	 */
+	bool Load(const std::string& key, FeatureSet& features) const;
+
+	/**
+	 * @brief  Saves an entry.
+	 *
+	 * @return bool True on success.
+	 * @param  key [in] Key of the entry.
+	 * @param  features [in] Features.
+	 */
+	bool Save(const std::string& key, const FeatureSet& features) const;
+
+	/**
+	 * @brief  Loads the features of an image, or extracts and saves them if
+	 *         they are not cached yet.
+	 *
+	 * The key holds the feature type, the keypoint budget and the tile 
+	 * layout of the extractor, so extractors that differ in them never share
+	 * an entry.
+	 *
+	 * @return bool True if the features were loaded from the cache.
+	 * @param  img [in] Image.
+	 * @param  extractor [in] Feature extractor.
+	 * @param  features [out] Features.
+	 * @param  params [in] Description of further extractor parameters, only
+	 *                     needed for settings the extractor doesn't expose.
+	 */
+	bool Extract(const cv::Mat& img, FeatureExtractor& extractor,
+		FeatureSet& features, const std::string& params = std::string()) const;
+
+	/**
+	 * @brief  Writes features into a file.
+	 *
+	 * @return bool True on success.
+	 * @param  path [in] Path of the file.
+	 * @param  features [in] Features.
+	 */
+	static bool Write(const std::string& path, const FeatureSet& features);
+
+	/**
+	 * @brief  Reads features from a file. The descriptors are memory mapped,
+	 *         and the mapping is kept alive by FeatureSet::holder.
+	 *
+	 * @return bool True if the file exists and is valid, with one CV_8U or
+	 *         CV_32F descriptor row per keypoint.
+	 * @param  path [in] Path of the file.
+	 * @param  features [out] Features.
+	 */
+	static bool Read(const std::string& path, FeatureSet& features);
+
+private:
+	/**
+	 * @brief  Gets the path of an entry.
+	 *
+	 * @return std::string Path.
+	 * @param  key [in] Key of the entry.
+	 */
+	std::string GetPath(const std::string& key) const;
+
+private:
+	std::string directory_; //!< Directory of the cache files.
+};
+#endif
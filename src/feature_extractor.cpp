@@ -0,0 +1,314 @@
+#include "feature_extractor.h"
+#include "descriptor_transforms.h"
+#include "profiler.h"
+#include <opencv2/xfeatures2d.hpp>
+#include <future>
+
+/**
+ * Grid of the tiles of an image.
+ */
+struct TileGrid {
+	int cols;       //!< Number of tiles along the columns.
+	int rows;       //!< Number of tiles along the rows.
+	cv::Size core;  //!< Size of the core of a tile, smaller for the last ones.
+	cv::Size image; //!< Size of the image.
+
+	TileGrid(const cv::Size& image_size, const cv::Size& tile_size)
+		:image(image_size) {
+		// Balanced cores, so the last tiles are not slivers.
+		cols = (image.width + tile_size.width - 1) / tile_size.width;
+		rows = (image.height + tile_size.height - 1) / tile_size.height;
+		core.width = (image.width + cols - 1) / cols;
+		core.height = (image.height + rows - 1) / rows;
+	}
+
+	int size() const { return cols * rows; } //!< Number of tiles.
+
+	//! Core of a tile.
+	cv::Rect Core(const int i) const {
+		return cv::Rect((i % cols) * core.width, (i / cols) * core.height,
+			core.width, core.height) & cv::Rect(cv::Point(), image);
+	}
+
+	//! Core grown by the overlap, clipped to the image.
+	cv::Rect Tile(const int i, const int overlap) const {
+		cv::Rect core_rect = Core(i);
+		return cv::Rect(core_rect.x - overlap, core_rect.y - overlap,
+			core_rect.width + 2 * overlap, core_rect.height + 2 * overlap) &
+			cv::Rect(cv::Point(), image);
+	}
+
+	//! Tile whose core holds a point of the image.
+	int Owner(const cv::Point2f& pt) const {
+		const int col = std::min(std::max((int)(pt.x / core.width), 0), cols - 1);
+		const int row = std::min(std::max((int)(pt.y / core.height), 0), rows - 1);
+		return row * cols + col;
+	}
+};
+
+/**
+ * Parallel body that detects the keypoints of every tile and keeps the ones
+ * in its core, in image coordinates.
+ */
+class TileDetectBody : public cv::ParallelLoopBody {
+public:
+	TileDetectBody(const std::vector<cv::Ptr<cv::Feature2D> >& features,
+		const cv::Mat& img, const cv::Mat& mask, const TileGrid& grid,
+		const int overlap, std::vector<std::vector<cv::KeyPoint> >& keypoints)
+		:features_(features), img_(img), mask_(mask), grid_(grid),
+		overlap_(overlap), keypoints_(keypoints) {}
+
+	void operator()(const cv::Range& range) const {
+
+		for (int i = range.start; i < range.end; ++i) {
+			keypoints_[i].clear();
+			if (features_[i].empty()) continue;
+
+			const cv::Rect tile = grid_.Tile(i, overlap_);
+			std::vector<cv::KeyPoint> tile_keypoints;
+			features_[i]->detect(img_(tile), tile_keypoints,
+				mask_.empty() ? cv::Mat() : mask_(tile));
+			for (size_t k = 0; k < tile_keypoints.size(); ++k) {
+				cv::KeyPoint kp = tile_keypoints[k];
+				kp.pt.x += tile.x;
+				kp.pt.y += tile.y;
+				if (grid_.Owner(kp.pt) == i) keypoints_[i].push_back(kp);
+			}
+		}
+	}
+
+private:
+	const std::vector<cv::Ptr<cv::Feature2D> >& features_;
+	const cv::Mat& img_;
+	const cv::Mat& mask_;
+	const TileGrid& grid_;
+	const int overlap_;
+	std::vector<std::vector<cv::KeyPoint> >& keypoints_;
+};
+
+cv::Mat MakeRoiMask(const cv::Size& image_size, const cv::Rect& roi) {
+
+	cv::Mat mask = cv::Mat::zeros(image_size, CV_8U);
+	mask(roi & cv::Rect(cv::Point(), image_size)).setTo(255);
+	return mask;
+}
+
+FeatureExtractor::FeatureExtractor() :feature_method_(FEATURE_SIFT) {
+
+	feature_ = CreateFeature2D();
+}
+
+FeatureExtractor::~FeatureExtractor() {}
+
+FeatureExtractor::FeatureExtractor(FeatureType method) :feature_method_(method) {
+
+	feature_ = CreateFeature2D();
+}
+
+FeatureExtractor::FeatureExtractor(FeatureType method,
+	const KeypointBudget& budget) :feature_method_(method), budget_(budget) {
+
+	feature_ = CreateFeature2D();
+}
+
+FeatureType FeatureExtractor::GetFeatureType() const {
+	return feature_method_;
+}
+
+void FeatureExtractor::SetKeypointBudget(const KeypointBudget& budget) {
+
+	budget_ = budget;
+	// The candidate pool of ORB depends on the budget.
+	if (feature_method_ == FEATURE_ORB) {
+		feature_ = CreateFeature2D();
+		concurrent_feature_.release();
+	}
+}
+
+const KeypointBudget& FeatureExtractor::GetKeypointBudget() const {
+	return budget_;
+}
+
+void FeatureExtractor::SetTileLayout(const TileLayout& tiles) {
+
+	CV_Assert(tiles.overlap >= 0);
+	tiles_ = tiles;
+}
+
+const TileLayout& FeatureExtractor::GetTileLayout() const {
+	return tiles_;
+}
+
+int FeatureExtractor::GetTileOverlap() const {
+
+	int overlap = tiles_.overlap;
+	// ORB skips edgeThreshold pixels of every pyramid level, which is the
+	// widest at the coarsest level.
+	cv::Ptr<cv::ORB> orb = feature_.dynamicCast<cv::ORB>();
+	if (orb) {
+		const double border = orb->getEdgeThreshold() *
+			std::pow(orb->getScaleFactor(), orb->getNLevels() - 1);
+		overlap = std::max(overlap, (int)std::ceil(border));
+	}
+	return overlap;
+}
+
+cv::Ptr<cv::Feature2D> FeatureExtractor::CreateFeature2D() const {
+
+	cv::Ptr<cv::Feature2D> feature;
+	switch (feature_method_)
+	{
+	case FEATURE_SIFT:
+	case FEATURE_ROOTSIFT:
+	case FEATURE_HALFSIFT:
+		feature = cv::xfeatures2d::SIFT::create();
+		break;
+	case FEATURE_SURF:
+		feature = cv::xfeatures2d::SURF::create();
+		break;
+	case FEATURE_ORB:
+		// ORB caps its own count, so the pool has to exceed the budget.
+		feature = budget_.enabled() ?
+			cv::ORB::create(std::max(500, 4 * budget_.max_keypoints)) :
+			cv::ORB::create();
+		break;
+	case FEATURE_AKAZE:
+		feature = cv::AKAZE::create();
+		break;
+	default:
+		break;
+	}
+	return feature;
+}
+
+void FeatureExtractor::Extract(const cv::Mat& img, FeatureSet& features,
+	const cv::Mat& mask) {
+
+	DetectAndCompute(feature_, img, mask, features);
+}
+
+void FeatureExtractor::Extract(const cv::Mat& img0, const cv::Mat& img1,
+	FeatureSet& features0, FeatureSet& features1, const bool concurrent,
+	const cv::Mat& mask0, const cv::Mat& mask1) {
+
+	if (!concurrent) {
+		DetectAndCompute(feature_, img0, mask0, features0);
+		DetectAndCompute(feature_, img1, mask1, features1);
+		return;
+	}
+
+	// The reference image gets a detector of its own.
+	if (concurrent_feature_.empty()) {
+		concurrent_feature_ = CreateFeature2D();
+	}
+
+	std::future<void> refer_task = std::async(std::launch::async,
+		[this, &img1, &mask1, &features1]() {
+		DetectAndCompute(concurrent_feature_, img1, mask1, features1);
+	});
+	DetectAndCompute(feature_, img0, mask0, features0);
+	refer_task.get();
+}
+
+void FeatureExtractor::DetectAndCompute(const cv::Ptr<cv::Feature2D>& feature,
+	const cv::Mat& img, const cv::Mat& mask, FeatureSet& features) const {
+
+	CV_Assert(!feature.empty());
+	CV_Assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == img.size()));
+	if (tiles_.enabled() && (img.cols > tiles_.tile_size.width ||
+		img.rows > tiles_.tile_size.height)) {
+		DetectAndComputeTiled(img, mask, features);
+	}
+	else if (budget_.enabled()) {
+		{
+			IM_PROFILE_SCOPE("extract.detect");
+			feature->detect(img, features.keypoints, mask);
+		}
+		IM_PROFILE_COUNTER("extract.detected_keypoints", features.keypoints.size());
+		{
+			IM_PROFILE_SCOPE("extract.select");
+			SelectKeypoints(features.keypoints, img.size(), budget_);
+		}
+		IM_PROFILE_SCOPE("extract.compute");
+		feature->compute(img, features.keypoints, features.descriptors);
+	}
+	else {
+		IM_PROFILE_SCOPE("extract.detect_and_compute");
+		feature->detectAndCompute(img, mask, features.keypoints,
+			features.descriptors);
+	}
+	features.image_size = img.size();
+	IM_PROFILE_COUNTER("extract.keypoints", features.keypoints.size());
+	IM_PROFILE_COUNTER("extract.descriptor_bytes",
+		features.descriptors.total() * features.descriptors.elemSize());
+
+	// The descriptors keep their native type, e.g. CV_8U for ORB and AKAZE,
+	// and are converted by the matcher if needed.
+	TransformDescriptors(features.descriptors);
+}
+
+void FeatureExtractor::DetectAndComputeTiled(const cv::Mat& img,
+	const cv::Mat& mask, FeatureSet& features) const {
+
+	const TileGrid grid(img.size(), tiles_.tile_size);
+	const int num_tiles = grid.size();
+	IM_PROFILE_COUNTER("extract.tiles", num_tiles);
+
+	// Every tile gets a detector of its own. Creating one only sets its
+	// parameters.
+	// Tiles whose core is masked out are skipped.
+	std::vector<cv::Ptr<cv::Feature2D> > tile_features(num_tiles);
+	for (int i = 0; i < num_tiles; ++i) {
+		if (!mask.empty() && cv::countNonZero(mask(grid.Core(i))) == 0) continue;
+		tile_features[i] = CreateFeature2D();
+	}
+
+	std::vector<std::vector<cv::KeyPoint> > tile_keypoints(num_tiles);
+	{
+		IM_PROFILE_SCOPE("extract.detect");
+		TileDetectBody body(tile_features, img, mask, grid, GetTileOverlap(),
+			tile_keypoints);
+		cv::parallel_for_(cv::Range(0, num_tiles), body);
+	}
+
+	std::vector<cv::KeyPoint>& keypoints = features.keypoints;
+	keypoints.clear();
+	for (int i = 0; i < num_tiles; ++i) {
+		keypoints.insert(keypoints.end(), tile_keypoints[i].begin(),
+			tile_keypoints[i].end());
+	}
+	if (budget_.enabled()) {
+		IM_PROFILE_COUNTER("extract.detected_keypoints", keypoints.size());
+		IM_PROFILE_SCOPE("extract.select");
+		SelectKeypoints(keypoints, img.size(), budget_);
+	}
+
+	// The sampling windows of the coarse scales, e.g. of the upper SIFT
+	// octaves, are far larger than any overlap, so the descriptors are
+	// computed on the whole image, in one pass over all tiles.
+	IM_PROFILE_SCOPE("extract.compute");
+	if (keypoints.empty()) {
+		features.descriptors.release();
+		return;
+	}
+	CreateFeature2D()->compute(img, keypoints, features.descriptors);
+}
+
+void FeatureExtractor::TransformDescriptors(cv::Mat& descriptors) const {
+
+	switch (feature_method_)
+	{
+	case FEATURE_ROOTSIFT: {
+		IM_PROFILE_SCOPE("extract.transform");
+		RootSiftTransform(descriptors);
+		break;
+	}
+	case FEATURE_HALFSIFT: {
+		IM_PROFILE_SCOPE("extract.transform");
+		HalfSiftTransform(descriptors);
+		break;
+	}
+	default:
+		break;
+	}
+}
@@ -0,0 +1,269 @@
+/****************************************************************************//**
+ * @file feature_extractor.h
+ * @brief A c++ implementation of reusable feature extraction.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-09-20
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _FEATURE_EXTRACTOR_H_
+#define _FEATURE_EXTRACTOR_H_
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include "keypoint_selector.h"
+
+//! Types of a feature detector and a descriptor extractor.
+enum FeatureType{
+	FEATURE_UNKNOWN = -1,     //!< Features handed in without their extractor
+	FEATURE_SIFT = 0,         //!< SIFT
+	FEATURE_SURF = 1,         //!< SURF
+	FEATURE_ORB = 2,          //!< ORB
+	FEATURE_AKAZE = 3,        //!< AKAZE
+	FEATURE_ROOTSIFT = 4,     //!< ROOTSIFT
+	FEATURE_HALFSIFT = 5      //!< HALFSIFT
+};
+
+/**
+ * Keypoints and descriptors extracted from one image.
+ */
+struct FeatureSet {
+	std::vector<cv::KeyPoint> keypoints; //!< Keypoints detected in the image.
+	cv::Mat descriptors;                 //!< Descriptors, one row per keypoint, in the native type of the extractor.
+	cv::Size image_size;                 //!< Size of the source image.
+	std::shared_ptr<const void> holder;  //!< Keeps external memory of the descriptors alive, e.g. a file mapping.
+
+	/**
+	 * @brief  Checks whether the feature set contains any keypoint.
+	 *
+	 * @return bool True if there is no keypoint.
+	 */
+	bool empty() const { return keypoints.empty(); }
+};
+
+/**
+ * Layout of the tiles of the tiled extraction.
+ *
+ * The image is split into a grid of cores of at most tile_size pixels. Every
+ * tile is its core grown by overlap pixels on each side, and the keypoints
+ * are detected on the tiles. A keypoint is kept only by the tile whose core
+ * holds it, so no keypoint is found twice. The overlap is raised to the
+ * border ORB skips at its coarsest level, so the seams don't lose ORB
+ * keypoints to it, and the descriptors are computed on the whole image.
+ *
+ * The keypoints still differ from those of the whole image near the seams:
+ * every tile builds its own scale space, whose blur sees the edge of the
+ * tile, and a tile has fewer octaves than the whole image, so SIFT finds no
+ * keypoints of the coarsest octaves.
+ */
+struct TileLayout {
+	cv::Size tile_size; //!< Maximum size of the core of a tile, empty for no tiling.
+	int overlap;        //!< Margin around the core of a tile, in pixels.
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  tile_size [in] Maximum size of the core of a tile, empty for no
+	 *                        tiling.
+	 * @param  overlap [in] Margin around the core of a tile, in pixels.
+	 */
+	explicit TileLayout(const cv::Size& tile_size = cv::Size(),
+		const int overlap = 64)
+		:tile_size(tile_size), overlap(overlap) {}
+
+	//! Whether the extraction is tiled.
+	bool enabled() const { return tile_size.width > 0 && tile_size.height > 0; }
+};
+
+/**
+ * @brief  Makes the detection mask of a region of interest.
+ *
+ * @return cv::Mat Mask of the image, CV_8U, nonzero inside the region.
+ * @param  image_size [in] Size of the image.
+ * @param  roi [in] Region of interest, clipped to the image.
+ */
+cv::Mat MakeRoiMask(const cv::Size& image_size, const cv::Rect& roi);
+
+/**
+ * Class for feature extraction.
+ *
+ * The detector and the descriptor extractor are created once and reused for
+ * every image passed to Extract(), so one instance can serve any number of
+ * images. Feature2D instances are not guaranteed to be reentrant, so an
+ * extractor serves one thread at a time, and its own parallel work uses
+ * detectors of its own.
+ *
+ * With a keypoint budget the keypoints are detected first, thinned out by
+ * SelectKeypoints(), and the descriptors are only computed for the kept ones.
+ *
+ * With a tile layout large images are split into overlapping tiles that are
+ * detected in parallel, each with a detector of its own, see TileLayout. The
+ * caps of the detector, e.g. the number of ORB features, apply per tile, the
+ * budget to the whole image.
+ */
+class FeatureExtractor {
+public:
+	/**
+	 * @brief  Default constructor.
+	 *
+	 */
+	FeatureExtractor();
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~FeatureExtractor();
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  method [in] Feature detector type.
+	 */
+	explicit FeatureExtractor(FeatureType method);
+
+	/**
+	 * @brief  Constructor with a keypoint budget.
+	 *
+	 * ORB detects four times the budget, at least the default 500 keypoints,
+	 * so that the selection has candidates all over the image.
+	 *
+	 * @param  method [in] Feature detector type.
+	 * @param  budget [in] Budget of the keypoints kept per image.
+	 */
+	FeatureExtractor(FeatureType method, const KeypointBudget& budget);
+
+	/**
+	 * @brief  Detects keypoints in the image and computes the descriptors for
+	 *         the corresponding keypoints.
+	 *
+	 * @return void
+	 * @param  img [in] Image.
+	 * @param  features [out] Keypoints and descriptors of the image.
+	 * @param  mask [in] Detection mask, CV_8U of the size of the image,
+	 *                   keypoints are only detected where it is nonzero.
+	 *                   Empty for the whole image.
+	 */
+	void Extract(const cv::Mat& img, FeatureSet& features,
+		const cv::Mat& mask = cv::Mat());
+
+	/**
+	 * @brief  Extracts the features of an image pair.
+	 *
+	 * In the concurrent mode both images are processed at the same time on 
+	 * separate threads, each with its own detector. The output is the same as
+	 * the sequential mode.
+	 *
+	 * @return void
+	 * @param  img0 [in] Query image.
+	 * @param  img1 [in] Reference image.
+	 * @param  features0 [out] Keypoints and descriptors of the query image.
+	 * @param  features1 [out] Keypoints and descriptors of the reference image.
+	 * @param  concurrent [in] Whether to extract both images concurrently.
+	 * @param  mask0 [in] Detection mask of the query image, empty for the
+	 *                    whole image.
+	 * @param  mask1 [in] Detection mask of the reference image, empty for the
+	 *                    whole image.
+	 */
+	void Extract(const cv::Mat& img0, const cv::Mat& img1,
+		FeatureSet& features0, FeatureSet& features1,
+		const bool concurrent = false, const cv::Mat& mask0 = cv::Mat(),
+		const cv::Mat& mask1 = cv::Mat());
+
+	/**
+	 * @brief  Gets the feature detector type.
+	 *
+	 * @return FeatureType Feature detector type.
+	 */
+	FeatureType GetFeatureType() const;
+
+	/**
+	 * @brief  Sets the budget of the keypoints kept per image.
+	 *
+	 * @return void
+	 * @param  budget [in] Budget of the keypoints, KeypointBudget() for no limit.
+	 */
+	void SetKeypointBudget(const KeypointBudget& budget);
+
+	/**
+	 * @brief  Gets the budget of the keypoints kept per image.
+	 *
+	 * @return const KeypointBudget& Budget of the keypoints.
+	 */
+	const KeypointBudget& GetKeypointBudget() const;
+
+	/**
+	 * @brief  Sets the tile layout of the extraction.
+	 *
+	 * @return void
+	 * @param  tiles [in] Tile layout, TileLayout() for no tiling.
+	 */
+	void SetTileLayout(const TileLayout& tiles);
+
+	/**
+	 * @brief  Gets the tile layout of the extraction.
+	 *
+	 * @return const TileLayout& Tile layout.
+	 */
+	const TileLayout& GetTileLayout() const;
+
+private:
+	/**
+	 * @brief  Creates the feature detector and descriptor extractor.
+	 *
+	 * @return cv::Ptr<cv::Feature2D> Feature detector and descriptor extractor.
+	 */
+	cv::Ptr<cv::Feature2D> CreateFeature2D() const;
+
+	/**
+	 * @brief  Extracts the features of an image with the given detector.
+	 *
+	 * @return void
+	 * @param  feature [in] Feature detector and descriptor extractor.
+	 * @param  img [in] Image.
+	 * @param  mask [in] Detection mask, empty for the whole image.
+	 * @param  features [out] Keypoints and descriptors of the image.
+	 */
+	void DetectAndCompute(const cv::Ptr<cv::Feature2D>& feature,
+		const cv::Mat& img, const cv::Mat& mask, FeatureSet& features) const;
+
+	/**
+	 * @brief  Detects the keypoints of an image tile by tile in parallel and
+	 *         computes their descriptors on the whole image.
+	 *
+	 * The keypoints are in the order of the tiles, row by row.
+	 *
+	 * @return void
+	 * @param  img [in] Image.
+	 * @param  mask [in] Detection mask, empty for the whole image.
+	 * @param  features [out] Keypoints and descriptors of the image.
+	 */
+	void DetectAndComputeTiled(const cv::Mat& img, const cv::Mat& mask,
+		FeatureSet& features) const;
+
+	/**
+	 * @brief  Gets the overlap of the tiles, the one of the layout raised to
+	 *         the border the detector skips.
+	 *
+	 * @return int Overlap in pixels.
+	 */
+	int GetTileOverlap() const;
+
+	/**
+	 * @brief  Applies the descriptor transform of ROOTSIFT or HALFSIFT.
+	 *
+	 * @return void
+	 * @param  descriptors [in,out] Descriptors, one row per keypoint.
+	 */
+	void TransformDescriptors(cv::Mat& descriptors) const;
+
+private:
+	FeatureType feature_method_;     //!< Local Features.
+	KeypointBudget budget_;          //!< Budget of the keypoints per image.
+	TileLayout tiles_;               //!< Tile layout of the extraction.
+	cv::Ptr<cv::Feature2D> feature_; //!< Feature detector and descriptor extractor.
+	cv::Ptr<cv::Feature2D> concurrent_feature_; //!< Second detector for the concurrent mode.
+};
+#endif
@@ -0,0 +1,195 @@
+#include "gallery_index.h"
+#include "profiler.h"
+#include "workspace.h"
+
+/**
+ * Parallel body that prunes the candidates of every kept reference.
+ */
+class GalleryPruneBody : public cv::ParallelLoopBody {
+public:
+	GalleryPruneBody(const GalleryIndex& index, const FeatureSet& query_features,
+		const std::vector<GalleryCandidates>& candidates, const PrunerType pruner,
+		std::vector<PairResult>& results)
+		:index_(index), query_features_(query_features), candidates_(candidates),
+		pruner_(pruner), results_(results) {}
+
+	void operator()(const cv::Range& range) const {
+
+		// The references of a stripe are pruned with one workspace.
+		Workspace workspace;
+		for (int i = range.start; i < range.end; ++i) {
+			const GalleryCandidates& candidate = candidates_[i];
+			{
+				MatchPruner match_pruner(query_features_,
+					index_.GetReferFeatures(candidate.refer_index), candidate.matches,
+					pruner_, workspace);
+
+				PairResult& result = results_[i];
+				result.refer_index = candidate.refer_index;
+				match_pruner.TakeMatches(result.matches);
+				result.scores = match_pruner.GetMatchingScores();
+				result.num_inliers = static_cast<int>(result.matches.size());
+			}
+			workspace.Reset();
+		}
+	}
+
+private:
+	const GalleryIndex& index_;
+	const FeatureSet& query_features_;
+	const std::vector<GalleryCandidates>& candidates_;
+	const PrunerType pruner_;
+	std::vector<PairResult>& results_;
+};
+
+GalleryIndex::GalleryIndex(MatcherType method, const int checks)
+	:method_(method), checks_(checks) {
+
+	CV_Assert(method_ == MATCHER_FLANN || method_ == MATCHER_FLANN_LSH);
+}
+
+GalleryIndex::~GalleryIndex() {}
+
+void GalleryIndex::Build(const std::vector<FeatureSet>& gallery) {
+
+	IM_PROFILE_SCOPE("gallery.build");
+	gallery_ = gallery;
+	image_ids_.clear();
+	first_rows_.assign(gallery_.size() + 1, 0);
+	index_.release();
+
+	std::vector<cv::Mat> blocks;
+	for (size_t i = 0; i < gallery_.size(); ++i) {
+		const cv::Mat& des = gallery_[i].descriptors;
+		first_rows_[i + 1] = first_rows_[i] + des.rows;
+		if (des.empty()) continue;
+		blocks.push_back(des);
+		image_ids_.insert(image_ids_.end(), des.rows, static_cast<int>(i));
+	}
+	if (blocks.empty()) {
+		descriptors_.release();
+		return;
+	}
+	cv::vconcat(blocks.data(), blocks.size(), descriptors_);
+	IM_PROFILE_COUNTER("gallery.descriptors", descriptors_.rows);
+
+	if (method_ == MATCHER_FLANN_LSH) {
+		CV_Assert(descriptors_.depth() == CV_8U);
+		index_ = cv::makePtr<cv::flann::Index>(descriptors_,
+			cv::flann::LshIndexParams(12, 20, 2), cvflann::FLANN_DIST_HAMMING);
+	}
+	else {
+		// Make sure the types of the descriptors support the kd-trees.
+		descriptors_.convertTo(descriptors_, CV_32F);
+		index_ = cv::makePtr<cv::flann::Index>(descriptors_,
+			cv::flann::KDTreeIndexParams(4), cvflann::FLANN_DIST_L2);
+	}
+}
+
+void GalleryIndex::Search(const FeatureSet& query_features,
+	std::vector<GalleryCandidates>& candidates, const int knn,
+	const int num_neighbors, const int max_refers) const {
+
+	IM_PROFILE_SCOPE("gallery.search");
+	candidates.clear();
+	if (index_.empty() || query_features.empty() || knn <= 0) return;
+
+	cv::Mat query_des = query_features.descriptors;
+	if (method_ == MATCHER_FLANN_LSH) {
+		CV_Assert(query_des.depth() == CV_8U);
+	}
+	else {
+		query_des.convertTo(query_des, CV_32F);
+	}
+	CV_Assert(query_des.cols == descriptors_.cols);
+
+	const int num_search = std::min(num_neighbors > 0 ? num_neighbors : 4 * knn,
+		descriptors_.rows);
+	cv::Mat indices, dists;
+	index_->knnSearch(query_des, indices, dists, num_search,
+		cv::flann::SearchParams(checks_));
+
+	// Every query descriptor votes once for every reference among its
+	// neighbors.
+	const int num_queries = query_des.rows;
+	const int num_refers = size();
+	std::vector<int> votes(num_refers, 0), last_query(num_refers, -1);
+	for (int i = 0; i < num_queries; ++i) {
+		const int* pidx = indices.ptr<int>(i);
+		for (int j = 0; j < num_search; ++j) {
+			if (pidx[j] < 0) continue;
+			const int ref = image_ids_[pidx[j]];
+			if (last_query[ref] != i) {
+				last_query[ref] = i;
+				++votes[ref];
+			}
+		}
+	}
+
+	std::vector<int> order;
+	for (int r = 0; r < num_refers; ++r) {
+		if (votes[r] > 0) order.push_back(r);
+	}
+	std::stable_sort(order.begin(), order.end(), [&votes](int a, int b) {
+		return votes[a] > votes[b];
+	});
+	if (max_refers > 0 && (int)order.size() > max_refers) {
+		order.resize(max_refers);
+	}
+
+	std::vector<int> slot_of(num_refers, -1);
+	candidates.resize(order.size());
+	for (size_t s = 0; s < order.size(); ++s) {
+		slot_of[order[s]] = static_cast<int>(s);
+		candidates[s].refer_index = order[s];
+		candidates[s].num_votes = votes[order[s]];
+		candidates[s].matches.Create(votes[order[s]], knn);
+	}
+
+	// The neighbors come sorted by distance, so the first knn of every
+	// reference are its best candidates.
+	const bool binary = dists.depth() == CV_32S;
+	std::vector<int> next_row(order.size(), 0), row_of(order.size(), -1);
+	std::vector<int> row_size(order.size(), 0);
+	for (int i = 0; i < num_queries; ++i) {
+		const int* pidx = indices.ptr<int>(i);
+		for (int j = 0; j < num_search; ++j) {
+			if (pidx[j] < 0) continue;
+			const int ref = image_ids_[pidx[j]];
+			const int s = slot_of[ref];
+			if (s < 0) continue;
+
+			MatchTable& table = candidates[s].matches;
+			if (row_of[s] != i) {
+				row_of[s] = i;
+				row_size[s] = 0;
+				table.QueryIdxData()[next_row[s]++] = i;
+			}
+			if (row_size[s] == knn) continue;
+
+			const size_t k = (size_t)(next_row[s] - 1) * knn + row_size[s]++;
+			table.TrainIdxData()[k] = pidx[j] - first_rows_[ref];
+			// FLANN gives squared L2 distances, like FlannBasedMatcher take the root.
+			table.DistancesData()[k] = binary ? (float)dists.ptr<int>(i)[j] :
+				std::sqrt(dists.ptr<float>(i)[j]);
+		}
+	}
+	IM_PROFILE_COUNTER("gallery.candidate_refers", candidates.size());
+}
+
+void GalleryIndex::Match(const FeatureSet& query_features, PrunerType pruner,
+	std::vector<PairResult>& results, const int knn, const int max_refers) const {
+
+	std::vector<GalleryCandidates> candidates;
+	Search(query_features, candidates, knn, 0, max_refers);
+
+	IM_PROFILE_SCOPE("gallery.prune");
+	results.clear();
+	results.resize(candidates.size());
+	GalleryPruneBody body(*this, query_features, candidates, pruner, results);
+	cv::parallel_for_(cv::Range(0, static_cast<int>(candidates.size())), body);
+}
+
+const FeatureSet& GalleryIndex::GetReferFeatures(const int refer_index) const {
+	return gallery_[refer_index];
+}
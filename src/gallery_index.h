@@ -0,0 +1,127 @@
+/****************************************************************************//**
+ * @file gallery_index.h
+ * @brief A persistent approximate nearest neighbor index over a gallery of
+ *        reference images.
+ *
+ * BatchMatcher matches the query against every reference, so its cost grows
+ * linearly with the size of the gallery. GalleryIndex builds one FLANN index
+ * over the descriptors of all references once, each row tagged with the
+ * index of its image. Every query descriptor is then searched once. Its
+ * neighbors are grouped by reference into one MatchTable per image, and only
+ * the references with the most votes are pruned.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-23
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _GALLERY_INDEX_H_
+#define _GALLERY_INDEX_H_
+#include <opencv2/opencv.hpp>
+#include "feature_extractor.h"
+#include "image_matcher.h"
+#include "match_pruner.h"
+#include "batch_matcher.h"
+
+/**
+ * Candidate matches of the query against one reference of the gallery.
+ */
+struct GalleryCandidates {
+	int refer_index;    //!< Index of the reference in the gallery.
+	int num_votes;      //!< Number of query descriptors with a neighbor in the reference.
+	MatchTable matches; //!< One row per voting query descriptor, train indices of the reference.
+
+	GalleryCandidates() :refer_index(-1), num_votes(0) {}
+};
+
+/**
+ * Class for the nearest neighbor index of a gallery.
+ */
+class GalleryIndex {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  method [in] MATCHER_FLANN for a randomized kd-tree forest on
+	 *                     float descriptors, MATCHER_FLANN_LSH for an LSH
+	 *                     index on binary descriptors.
+	 * @param  checks [in] Number of leaves visited per query descriptor,
+	 *                     more is slower and more accurate. Ignored by LSH.
+	 */
+	explicit GalleryIndex(MatcherType method = MATCHER_FLANN, const int checks = 32);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~GalleryIndex();
+
+	/**
+	 * @brief  Builds the index. The feature sets are kept for the pruning,
+	 *         sharing the descriptors with the caller.
+	 *
+	 * @return void
+	 * @param  gallery [in] Features of the reference images, all of the same
+	 *                      descriptor type.
+	 */
+	void Build(const std::vector<FeatureSet>& gallery);
+
+	/**
+	 * @brief  Searches the neighbors of every query descriptor and groups
+	 *         them by reference.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  candidates [out] Candidates of the references, by decreasing
+	 *                          number of votes.
+	 * @param  knn [in] Count of best matches kept per query descriptor and
+	 *                  reference.
+	 * @param  num_neighbors [in] Count of neighbors searched in the whole
+	 *                            gallery per query descriptor, 0 for 4 * knn.
+	 * @param  max_refers [in] Number of references kept, 0 for all with a vote.
+	 */
+	void Search(const FeatureSet& query_features,
+		std::vector<GalleryCandidates>& candidates, const int knn = 2,
+		const int num_neighbors = 0, const int max_refers = 0) const;
+
+	/**
+	 * @brief  Searches the candidates and prunes them per reference in
+	 *         parallel.
+	 *
+	 * @return void
+	 * @param  query_features [in] Features of the query image.
+	 * @param  pruner [in] Matches pruning algorithm.
+	 * @param  results [out] Results of the kept references, by decreasing
+	 *                       number of votes.
+	 * @param  knn [in] Count of best matches kept per query descriptor and
+	 *                  reference.
+	 * @param  max_refers [in] Number of references pruned, 0 for all with a vote.
+	 */
+	void Match(const FeatureSet& query_features, PrunerType pruner,
+		std::vector<PairResult>& results, const int knn = 2,
+		const int max_refers = 0) const;
+
+	/**
+	 * @brief  Gets the features of a reference.
+	 *
+	 * @return const FeatureSet& Features of the reference.
+	 * @param  refer_index [in] Index of the reference in the gallery.
+	 */
+	const FeatureSet& GetReferFeatures(const int refer_index) const;
+
+	int size() const { return static_cast<int>(gallery_.size()); } //!< Number of references.
+	bool empty() const { return index_.empty(); } //!< Whether no descriptor is indexed.
+
+private:
+	MatcherType method_; //!< Index type.
+	const int checks_;   //!< Number of leaves visited per query descriptor.
+
+	std::vector<FeatureSet> gallery_; //!< Features of the references.
+	cv::Mat descriptors_;             //!< Descriptors of all references, in the order of the gallery.
+	std::vector<int> image_ids_;      //!< Reference of every row of descriptors_.
+	std::vector<int> first_rows_;     //!< First row of every reference in descriptors_.
+	cv::Ptr<cv::flann::Index> index_; //!< Index over descriptors_.
+};
+#endif
@@ -0,0 +1,404 @@
+#include "geometric_verifier.h"
+#include "profiler.h"
+
+// Number of samples after which PROSAC draws like RANSAC, T_N of the paper.
+static const double kProsacSamples = 200000;
+
+// Size of a minimal sample of the homography.
+static const int kSampleSize = 4;
+
+// Smallest set of the best matches PROSAC stops on. Any model fits a few
+// points, too few of them say nothing of the rest.
+static const int kProsacMinSet = 50;
+
+// Probability that a wrong model supports a match, beta of PROSAC.
+static const double kProsacBeta = 0.05;
+
+// Standard deviations that the support of a wrong model rarely exceeds,
+// about 5% of the wrong models.
+static const double kProsacNonRandom = 1.645;
+
+/**
+ * @brief  Gets the z component of the cross product of the edges ab and ac.
+ *
+ * @return double Twice the signed area of the triangle abc.
+ */
+static inline double Cross(const double ax, const double ay, const double bx,
+	const double by, const double cx, const double cy) {
+	return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+/**
+ * @brief  Solves a linear system with Gaussian elimination and partial
+ *         pivoting in place.
+ *
+ * @return bool False if the system is singular.
+ * @param  A [in,out] Augmented matrix, 8x9.
+ * @param  x [out] Solution, 8 elements.
+ */
+static bool Solve8x8(double A[8][9], double* x) {
+
+	for (int c = 0; c < 8; ++c) {
+		int pivot = c;
+		for (int r = c + 1; r < 8; ++r) {
+			if (std::abs(A[r][c]) > std::abs(A[pivot][c])) pivot = r;
+		}
+		if (std::abs(A[pivot][c]) < 1e-12) return false;
+		if (pivot != c) {
+			for (int k = c; k < 9; ++k) std::swap(A[c][k], A[pivot][k]);
+		}
+		for (int r = c + 1; r < 8; ++r) {
+			const double f = A[r][c] / A[c][c];
+			for (int k = c; k < 9; ++k) A[r][k] -= f * A[c][k];
+		}
+	}
+	for (int r = 7; r >= 0; --r) {
+		double s = A[r][8];
+		for (int k = r + 1; k < 8; ++k) s -= A[r][k] * x[k];
+		x[r] = s / A[r][r];
+	}
+	return true;
+}
+
+/**
+ * @brief  Counts the points within the threshold of a homography in one
+ *         branch-free pass over the arrays, so the loop vectorizes. A point
+ *         mapped to infinity gives inf or NaN, which fail the comparison.
+ *
+ * @return int Number of inliers.
+ * @param  H [in] Homography, 9 elements, row-major.
+ * @param  mask [out] Inliers/outliers if Mark, 1 for an inlier.
+ */
+template <bool Mark>
+static int InlierKernel(const double* H, const std::vector<float>& query_x,
+	const std::vector<float>& query_y, const std::vector<float>& refer_x,
+	const std::vector<float>& refer_y, const float thresh2, uchar* mask) {
+
+	const float h0 = (float)H[0], h1 = (float)H[1], h2 = (float)H[2];
+	const float h3 = (float)H[3], h4 = (float)H[4], h5 = (float)H[5];
+	const float h6 = (float)H[6], h7 = (float)H[7], h8 = (float)H[8];
+
+	const int num_points = static_cast<int>(query_x.size());
+	const float* qx = query_x.data();
+	const float* qy = query_y.data();
+	const float* rx = refer_x.data();
+	const float* ry = refer_y.data();
+	int num_inliers = 0;
+	for (int i = 0; i < num_points; ++i) {
+		const float iw = 1.f / (h6 * qx[i] + h7 * qy[i] + h8);
+		const float du = (h0 * qx[i] + h1 * qy[i] + h2) * iw - rx[i];
+		const float dv = (h3 * qx[i] + h4 * qy[i] + h5) * iw - ry[i];
+		const int inlier = (du * du + dv * dv < thresh2) ? 1 : 0;
+		if (Mark) mask[i] = (uchar)inlier;
+		num_inliers += inlier;
+	}
+	return num_inliers;
+}
+
+GeometricVerifier::GeometricVerifier(SamplingType sampling,
+	const double threshold, const double confidence, const int max_iterations)
+	:sampling_(sampling), threshold_(threshold), confidence_(confidence),
+	max_iterations_(max_iterations), rng_(0x2019), prosac_n_(0), prosac_tn_(0),
+	prosac_tn_prime_(0), homography_(cv::Matx33d::zeros()), num_inliers_(0),
+	num_iterations_(0) {}
+
+GeometricVerifier::~GeometricVerifier() {}
+
+bool GeometricVerifier::Verify(const MatchPruner& pruner) {
+
+	ComputeQuality(pruner, quality_);
+	return Verify(pruner.GetQueryPoints(), pruner.GetReferPoints(), quality_);
+}
+
+void GeometricVerifier::ComputeQuality(const MatchPruner& pruner,
+	std::vector<double>& quality) {
+
+	// The ratio of the two nearest neighbors is the quality PROSAC orders
+	// by. Without a second neighbor the score of the pruner is used, which
+	// is the ratio for the ratio test and the cost for LPM. GMS scores all
+	// matches the same, they keep their order.
+	const cv::Mat& knn_distances = pruner.GetKnnDistances();
+	const std::vector<double>& scores = pruner.GetMatchingScores();
+	const int num_matches = static_cast<int>(pruner.GetQueryPoints().size());
+	quality.resize(num_matches);
+	for (int i = 0; i < num_matches; ++i) {
+		quality[i] = i < (int)scores.size() ? scores[i] : 0.0;
+		if (knn_distances.cols >= 2) {
+			const double* pdist = knn_distances.ptr<double>(i);
+			if (pdist[1] > 0) quality[i] = pdist[0] / pdist[1];
+		}
+	}
+}
+
+bool GeometricVerifier::Verify(const std::vector<cv::Point2f>& query_pts,
+	const std::vector<cv::Point2f>& refer_pts, const std::vector<double>& quality) {
+
+	IM_PROFILE_SCOPE("verify.homography");
+	CV_Assert(query_pts.size() == refer_pts.size());
+	CV_Assert(quality.empty() || quality.size() == query_pts.size());
+
+	const int num_points = static_cast<int>(query_pts.size());
+	homography_ = cv::Matx33d::zeros();
+	inlier_mask_.assign(num_points, false);
+	num_inliers_ = 0;
+	num_iterations_ = 0;
+	if (num_points < kSampleSize) return false;
+
+	order_.resize(num_points);
+	for (int i = 0; i < num_points; ++i) order_[i] = i;
+	if (!quality.empty()) {
+		std::stable_sort(order_.begin(), order_.end(), [&quality](int a, int b) {
+			return quality[a] < quality[b];
+		});
+	}
+	query_x_.resize(num_points);
+	query_y_.resize(num_points);
+	refer_x_.resize(num_points);
+	refer_y_.resize(num_points);
+	for (int i = 0; i < num_points; ++i) {
+		query_x_[i] = query_pts[order_[i]].x;
+		query_y_[i] = query_pts[order_[i]].y;
+		refer_x_[i] = refer_pts[order_[i]].x;
+		refer_y_[i] = refer_pts[order_[i]].y;
+	}
+
+	// T_n of the initial set of kSampleSize matches.
+	prosac_n_ = kSampleSize;
+	prosac_tn_ = kProsacSamples;
+	for (int i = 0; i < kSampleSize; ++i) {
+		prosac_tn_ *= (double)(kSampleSize - i) / (num_points - i);
+	}
+	prosac_tn_prime_ = 1;
+
+	double best_H[9];
+	int best_inliers = 0;
+	double max_iterations = max_iterations_;
+	int sample[kSampleSize];
+	double H[9];
+	int t = 0;
+	while (t < max_iterations) {
+		++t;
+		DrawSample(t, sample);
+		if (!SolveMinimal(sample, H)) continue;
+
+		const int num_inliers = CountInliers(H);
+		if (num_inliers > best_inliers) {
+			best_inliers = num_inliers;
+			std::copy(H, H + 9, best_H);
+			max_iterations = std::min<double>(max_iterations, MaxIterations(H, num_inliers));
+			max_iterations = std::max<double>(max_iterations, t);
+		}
+	}
+	num_iterations_ = t;
+	IM_PROFILE_COUNTER("verify.hypotheses", t);
+	if (best_inliers < kSampleSize) return false;
+
+	// Refit on all inliers, and keep the refit only if it doesn't lose any.
+	MarkInliers(best_H);
+	inlier_query_.clear();
+	inlier_refer_.clear();
+	for (int i = 0; i < num_points; ++i) {
+		if (!mask_[i]) continue;
+		inlier_query_.push_back(cv::Point2f(query_x_[i], query_y_[i]));
+		inlier_refer_.push_back(cv::Point2f(refer_x_[i], refer_y_[i]));
+	}
+	cv::Mat refit = cv::findHomography(inlier_query_, inlier_refer_, 0);
+	if (!refit.empty()) {
+		double H_refit[9];
+		for (int k = 0; k < 9; ++k) H_refit[k] = refit.at<double>(k / 3, k % 3);
+		if (CountInliers(H_refit) >= best_inliers) {
+			std::copy(H_refit, H_refit + 9, best_H);
+		}
+	}
+
+	homography_ = cv::Matx33d(best_H);
+	num_inliers_ = MarkInliers(best_H);
+	for (int i = 0; i < num_points; ++i) {
+		inlier_mask_[order_[i]] = mask_[i] != 0;
+	}
+	IM_PROFILE_COUNTER("verify.inliers", num_inliers_);
+	return num_inliers_ >= kSampleSize;
+}
+
+double GeometricVerifier::MaxIterations(const double* H, const int num_inliers) {
+
+	const int num_points = static_cast<int>(query_x_.size());
+	const double log_fail = std::log(1 - confidence_);
+	double bound = max_iterations_;
+
+	// Iterations to draw an all-inlier sample of a set with the confidence.
+	const double w = (double)num_inliers / num_points;
+	const double p_good = std::pow(w, kSampleSize);
+	if (p_good >= 1) return 0;
+	if (p_good > 0) bound = std::min(bound, log_fail / std::log(1 - p_good));
+	if (sampling_ != SAMPLING_PROSAC) return bound;
+
+	// PROSAC may stop earlier on a set of the best matches whose inliers
+	// can't be explained by a wrong model. A wrong model supports any other
+	// match with the probability kProsacBeta, so the support of n matches
+	// is binomial, approximated by a normal distribution here. Only the sets
+	// holding the current sampling set count, all samples so far came from
+	// them.
+	MarkInliers(H);
+	int prefix_inliers = 0;
+	for (int n = 0; n < num_points; ++n) {
+		prefix_inliers += mask_[n];
+		const int size = n + 1;
+		if (size < prosac_n_ || size < kProsacMinSet) continue;
+
+		const double mean = (size - kSampleSize) * kProsacBeta;
+		const double sigma = std::sqrt(mean * (1 - kProsacBeta));
+		if (prefix_inliers < kSampleSize + mean + kProsacNonRandom * sigma) continue;
+
+		const double p = std::pow((double)prefix_inliers / size, kSampleSize);
+		bound = std::min(bound, p >= 1 ? 0 : log_fail / std::log(1 - p));
+	}
+	return bound;
+}
+
+void GeometricVerifier::DrawSample(const int t, int* sample) {
+
+	const int num_points = static_cast<int>(query_x_.size());
+	int n = num_points;
+	bool with_last = false;
+
+	if (sampling_ == SAMPLING_PROSAC) {
+		// Grow the sampling set once T'_n samples were drawn from it.
+		while (prosac_n_ < num_points && prosac_tn_prime_ < t) {
+			const double tn_next = prosac_tn_ * (prosac_n_ + 1) /
+				(prosac_n_ + 1 - kSampleSize);
+			prosac_tn_prime_ += (int)std::ceil(tn_next - prosac_tn_);
+			prosac_tn_ = tn_next;
+			++prosac_n_;
+		}
+		n = prosac_n_;
+		// Until then every sample holds the newest match of the set.
+		with_last = prosac_tn_prime_ >= t;
+	}
+
+	int num_drawn = 0;
+	if (with_last) {
+		sample[num_drawn++] = n - 1;
+		--n;
+	}
+	while (num_drawn < kSampleSize) {
+		const int idx = rng_.uniform(0, n);
+		bool duplicate = false;
+		for (int k = 0; k < num_drawn; ++k) {
+			duplicate = duplicate || sample[k] == idx;
+		}
+		if (!duplicate) sample[num_drawn++] = idx;
+	}
+}
+
+int GeometricVerifier::CountInliers(const double* H) const {
+	return InlierKernel<false>(H, query_x_, query_y_, refer_x_, refer_y_,
+		(float)(threshold_ * threshold_), 0);
+}
+
+int GeometricVerifier::MarkInliers(const double* H) {
+	mask_.resize(query_x_.size());
+	return InlierKernel<true>(H, query_x_, query_y_, refer_x_, refer_y_,
+		(float)(threshold_ * threshold_), mask_.data());
+}
+
+bool GeometricVerifier::SolveMinimal(const int* sample, double* H) const {
+
+	double q[kSampleSize][2], r[kSampleSize][2];
+	for (int k = 0; k < kSampleSize; ++k) {
+		q[k][0] = query_x_[sample[k]];
+		q[k][1] = query_y_[sample[k]];
+		r[k][0] = refer_x_[sample[k]];
+		r[k][1] = refer_y_[sample[k]];
+	}
+
+	// No three points on a line, and the same orientation of every triangle
+	// in both images, otherwise no homography maps the sample.
+	static const int kTriangles[4][3] = { { 0, 1, 2 }, { 0, 1, 3 }, { 0, 2, 3 },
+		{ 1, 2, 3 } };
+	for (int k = 0; k < 4; ++k) {
+		const int a = kTriangles[k][0], b = kTriangles[k][1], c = kTriangles[k][2];
+		const double cq = Cross(q[a][0], q[a][1], q[b][0], q[b][1], q[c][0], q[c][1]);
+		const double cr = Cross(r[a][0], r[a][1], r[b][0], r[b][1], r[c][0], r[c][1]);
+		if (std::abs(cq) < 1e-3 || std::abs(cr) < 1e-3 || (cq > 0) != (cr > 0)) {
+			return false;
+		}
+	}
+
+	// Normalize both samples to the centroid and a mean distance of sqrt(2).
+	double tq[3], tr[3];
+	for (int s = 0; s < 2; ++s) {
+		double (*p)[2] = s == 0 ? q : r;
+		double* T = s == 0 ? tq : tr;
+		double cx = 0, cy = 0, d = 0;
+		for (int k = 0; k < kSampleSize; ++k) {
+			cx += p[k][0];
+			cy += p[k][1];
+		}
+		cx /= kSampleSize;
+		cy /= kSampleSize;
+		for (int k = 0; k < kSampleSize; ++k) {
+			d += std::sqrt((p[k][0] - cx) * (p[k][0] - cx) + (p[k][1] - cy) * (p[k][1] - cy));
+		}
+		const double scale = std::sqrt(2.0) * kSampleSize / d;
+		for (int k = 0; k < kSampleSize; ++k) {
+			p[k][0] = (p[k][0] - cx) * scale;
+			p[k][1] = (p[k][1] - cy) * scale;
+		}
+		T[0] = scale;
+		T[1] = cx;
+		T[2] = cy;
+	}
+
+	// h33 = 1, two equations per correspondence.
+	double A[8][9];
+	for (int k = 0; k < kSampleSize; ++k) {
+		const double x = q[k][0], y = q[k][1], u = r[k][0], v = r[k][1];
+		double* a0 = A[2 * k];
+		double* a1 = A[2 * k + 1];
+		a0[0] = x; a0[1] = y; a0[2] = 1; a0[3] = 0; a0[4] = 0; a0[5] = 0;
+		a0[6] = -u * x; a0[7] = -u * y; a0[8] = u;
+		a1[0] = 0; a1[1] = 0; a1[2] = 0; a1[3] = x; a1[4] = y; a1[5] = 1;
+		a1[6] = -v * x; a1[7] = -v * y; a1[8] = v;
+	}
+	double h[9];
+	if (!Solve8x8(A, h)) return false;
+	h[8] = 1;
+
+	// H = Tr^-1 * Hn * Tq
+	const double sq = tq[0], qcx = tq[1], qcy = tq[2];
+	const double sr = tr[0], rcx = tr[1], rcy = tr[2];
+	double M[9];
+	for (int row = 0; row < 3; ++row) {
+		// Hn * Tq with Tq = [sq 0 -sq*qcx; 0 sq -sq*qcy; 0 0 1]
+		const double* hr = h + 3 * row;
+		M[3 * row + 0] = hr[0] * sq;
+		M[3 * row + 1] = hr[1] * sq;
+		M[3 * row + 2] = hr[2] - hr[0] * sq * qcx - hr[1] * sq * qcy;
+	}
+	// Tr^-1 = [1/sr 0 rcx; 0 1/sr rcy; 0 0 1]
+	for (int col = 0; col < 3; ++col) {
+		H[col] = M[col] / sr + rcx * M[6 + col];
+		H[3 + col] = M[3 + col] / sr + rcy * M[6 + col];
+		H[6 + col] = M[6 + col];
+	}
+	return true;
+}
+
+const cv::Matx33d& GeometricVerifier::GetHomography() const {
+	return homography_;
+}
+
+const std::vector<bool>& GeometricVerifier::GetInlierMask() const {
+	return inlier_mask_;
+}
+
+void GeometricVerifier::GetInlierMatches(const std::vector<cv::DMatch>& matches,
+	std::vector<cv::DMatch>& inliers) const {
+
+	CV_Assert(matches.size() == inlier_mask_.size());
+	inliers.clear();
+	for (size_t i = 0; i < matches.size(); ++i) {
+		if (inlier_mask_[i]) inliers.push_back(matches[i]);
+	}
+}
@@ -0,0 +1,197 @@
+/****************************************************************************//**
+ * @file geometric_verifier.h
+ * @brief Robust homography verification of the pruned matches with guided
+ *        sampling.
+ *
+ * The matches are sorted by the quality the pruner left behind, the ratio of
+ * the two nearest neighbor distances when there are two, its score
+ * otherwise. PROSAC ("Matching with PROSAC - Progressive Sample Consensus" by
+ * Ondrej Chum and Jiri Matas) draws the minimal samples from a growing set of
+ * the best matches, so it hits an all-inlier sample long before uniform
+ * sampling does when the inlier ratio is low, and falls back to RANSAC after
+ * enough samples.
+ *
+ * The points are kept as a struct of arrays in the order of the quality, and
+ * every hypothesis is scored with one branch-free pass over them, which the
+ * compiler vectorizes. The minimal solver works on the stack. The buffers,
+ * including the inliers handed to the refit, are kept for the next call, so
+ * the verifier itself stops allocating once they have grown. The refit with
+ * cv::findHomography still allocates its temporaries.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-24
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _GEOMETRIC_VERIFIER_H_
+#define _GEOMETRIC_VERIFIER_H_
+#include <opencv2/opencv.hpp>
+#include "match_pruner.h"
+
+//! Sampling strategies of the verifier.
+enum SamplingType {
+	SAMPLING_UNIFORM = 0, //!< RANSAC, uniform samples of all matches
+	SAMPLING_PROSAC = 1   //!< PROSAC, samples of the best matches first
+};
+
+/**
+ * Class for the homography verification of putative matches.
+ */
+class GeometricVerifier {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  sampling [in] Sampling strategy.
+	 * @param  threshold [in] Maximum reprojection error of an inlier in pixels.
+	 * @param  confidence [in] Probability that an all-inlier sample was drawn
+	 *                         when the search stops.
+	 * @param  max_iterations [in] Maximum number of hypotheses.
+	 */
+	explicit GeometricVerifier(SamplingType sampling = SAMPLING_PROSAC,
+		const double threshold = 3.0, const double confidence = 0.999,
+		const int max_iterations = 10000);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~GeometricVerifier();
+
+	/**
+	 * @brief  Verifies the matches kept by a pruner, ordered by their knn
+	 *         distance ratios or scores.
+	 *
+	 * @return bool False if no homography with at least 4 inliers is found.
+	 * @param  pruner [in] Pruner with the matched points.
+	 */
+	bool Verify(const MatchPruner& pruner);
+
+	/**
+	 * @brief  Verifies point correspondences.
+	 *
+	 * @return bool False if no homography with at least 4 inliers is found.
+	 * @param  query_pts [in] Points in the query image.
+	 * @param  refer_pts [in] Corresponding points in the reference image.
+	 * @param  quality [in] Quality of every correspondence, lower is better.
+	 *                      Empty to take the correspondences in their order.
+	 */
+	bool Verify(const std::vector<cv::Point2f>& query_pts,
+		const std::vector<cv::Point2f>& refer_pts,
+		const std::vector<double>& quality = std::vector<double>());
+
+	/**
+	 * @brief  Gets the homography from the query to the reference image.
+	 *
+	 * @return const cv::Matx33d& Homography, zero if the verification failed.
+	 */
+	const cv::Matx33d& GetHomography() const;
+
+	/**
+	 * @brief  Gets the mask of inliers/outliers in the order of the input.
+	 *
+	 * @return const std::vector<bool>& Mask of inliers/outliers.
+	 */
+	const std::vector<bool>& GetInlierMask() const;
+
+	/**
+	 * @brief  Gets the inliers of matches in the order of the input.
+	 *
+	 * @return void
+	 * @param  matches [in] Matches that were verified.
+	 * @param  inliers [out] Inlier matches.
+	 */
+	void GetInlierMatches(const std::vector<cv::DMatch>& matches,
+		std::vector<cv::DMatch>& inliers) const;
+
+	/**
+	 * @brief  Computes the quality of the matches kept by a pruner, the ratio
+	 *         of the two nearest neighbor distances when there are two, its 
+	 *         score otherwise.
+	 *
+	 * @return void
+	 * @param  pruner [in] Pruner with the matched points.
+	 * @param  quality [out] Quality of every match, lower is better.
+	 */
+	static void ComputeQuality(const MatchPruner& pruner,
+		std::vector<double>& quality);
+
+	int GetInlierCount() const { return num_inliers_; } //!< Number of inliers.
+	int GetIterations() const { return num_iterations_; } //!< Number of hypotheses of the last call.
+
+private:
+	/**
+	 * @brief  Draws the next minimal sample.
+	 *
+	 * @return void
+	 * @param  t [in] Index of the sample, from 1.
+	 * @param  sample [out] Indices of the sample, 4 elements.
+	 */
+	void DrawSample(const int t, int* sample);
+
+	/**
+	 * @brief  Counts the correspondences within the threshold of a homography.
+	 *
+	 * @return int Number of inliers.
+	 * @param  H [in] Homography, 9 elements, row-major.
+	 */
+	int CountInliers(const double* H) const;
+
+	/**
+	 * @brief  Marks the correspondences within the threshold of a homography
+	 *         in mask_.
+	 *
+	 * @return int Number of inliers.
+	 * @param  H [in] Homography, 9 elements, row-major.
+	 */
+	int MarkInliers(const double* H);
+
+	/**
+	 * @brief  Gets the number of hypotheses after which the search stops,
+	 *         given the best one so far.
+	 *
+	 * @return double Maximum number of hypotheses.
+	 * @param  H [in] Best homography, 9 elements, row-major.
+	 * @param  num_inliers [in] Number of inliers of H.
+	 */
+	double MaxIterations(const double* H, const int num_inliers);
+
+	/**
+	 * @brief  Solves the homography of a minimal sample.
+	 *
+	 * @return bool False if the sample is degenerate.
+	 * @param  sample [in] Indices of the sample, 4 elements.
+	 * @param  H [out] Homography, 9 elements, row-major.
+	 */
+	bool SolveMinimal(const int* sample, double* H) const;
+
+private:
+	SamplingType sampling_;    //!< Sampling strategy.
+	const double threshold_;   //!< Maximum reprojection error of an inlier.
+	const double confidence_;  //!< Confidence of the stopping criterion.
+	const int max_iterations_; //!< Maximum number of hypotheses.
+	cv::RNG rng_;              //!< Random numbers of the samples.
+
+	std::vector<int> order_;     //!< Input indices of the correspondences by quality.
+	std::vector<float> query_x_; //!< Query x coordinates by quality.
+	std::vector<float> query_y_; //!< Query y coordinates by quality.
+	std::vector<float> refer_x_; //!< Reference x coordinates by quality.
+	std::vector<float> refer_y_; //!< Reference y coordinates by quality.
+	std::vector<uchar> mask_;    //!< Inliers/outliers by quality.
+	std::vector<double> quality_; //!< Quality of the matches of Verify(const MatchPruner&).
+	std::vector<cv::Point2f> inlier_query_; //!< Query inliers of the refit.
+	std::vector<cv::Point2f> inlier_refer_; //!< Reference inliers of the refit.
+
+	// PROSAC state
+	int prosac_n_;        //!< Size of the current sampling set.
+	double prosac_tn_;    //!< \f$T_n\f$, expected number of samples from the first n.
+	int prosac_tn_prime_; //!< \f$T'_n\f$, number of samples drawn before the set grows.
+
+	cv::Matx33d homography_;       //!< Best homography.
+	std::vector<bool> inlier_mask_; //!< Inliers in the order of the input.
+	int num_inliers_;              //!< Number of inliers.
+	int num_iterations_;           //!< Number of hypotheses of the last call.
+};
+#endif
@@ -0,0 +1,261 @@
+#include "guided_matcher.h"
+
+MotionField::MotionField()
+	:grid_cols_(0), grid_rows_(0), scale_x_(0), scale_y_(0) {}
+
+MotionField::~MotionField() {}
+
+MotionField::MotionField(const std::vector<cv::Point2f>& query_pts,
+	const std::vector<cv::Point2f>& refer_pts, const cv::Size& image_size,
+	const cv::Size& grid_size)
+	:grid_cols_(std::max(grid_size.width, 1)),
+	grid_rows_(std::max(grid_size.height, 1)),
+	scale_x_((double)grid_cols_ / std::max(image_size.width, 1)),
+	scale_y_((double)grid_rows_ / std::max(image_size.height, 1)) {
+
+	CV_Assert(query_pts.size() == refer_pts.size());
+	if (query_pts.empty()) return;
+
+	const int num_cells = grid_cols_ * grid_rows_;
+	std::vector<std::vector<float> > dx(num_cells), dy(num_cells);
+	for (size_t i = 0; i < query_pts.size(); ++i) {
+		int x = static_cast<int>(query_pts[i].x * scale_x_);
+		int y = static_cast<int>(query_pts[i].y * scale_y_);
+		x = std::min(std::max(x, 0), grid_cols_ - 1);
+		y = std::min(std::max(y, 0), grid_rows_ - 1);
+		dx[y * grid_cols_ + x].push_back(refer_pts[i].x - query_pts[i].x);
+		dy[y * grid_cols_ + x].push_back(refer_pts[i].y - query_pts[i].y);
+	}
+
+	// The median is robust to the outliers left by the pruner.
+	displacements_.resize(num_cells);
+	std::vector<int> filled;
+	for (int c = 0; c < num_cells; ++c) {
+		if (dx[c].empty()) continue;
+		const size_t mid = dx[c].size() / 2;
+		std::nth_element(dx[c].begin(), dx[c].begin() + mid, dx[c].end());
+		std::nth_element(dy[c].begin(), dy[c].begin() + mid, dy[c].end());
+		displacements_[c] = cv::Point2f(dx[c][mid], dy[c][mid]);
+		filled.push_back(c);
+	}
+
+	// Empty cells copy the nearest filled cell.
+	for (int c = 0; c < num_cells; ++c) {
+		if (!dx[c].empty()) continue;
+		const int cx = c % grid_cols_, cy = c / grid_cols_;
+		int best_dist = INT_MAX;
+		for (size_t k = 0; k < filled.size(); ++k) {
+			const int fx = filled[k] % grid_cols_, fy = filled[k] / grid_cols_;
+			const int dist = (fx - cx) * (fx - cx) + (fy - cy) * (fy - cy);
+			if (dist < best_dist) {
+				best_dist = dist;
+				displacements_[c] = displacements_[filled[k]];
+			}
+		}
+	}
+}
+
+cv::Point2f MotionField::Predict(const cv::Point2f& pt) const {
+
+	if (displacements_.empty()) return pt;
+
+	int x = static_cast<int>(pt.x * scale_x_);
+	int y = static_cast<int>(pt.y * scale_y_);
+	x = std::min(std::max(x, 0), grid_cols_ - 1);
+	y = std::min(std::max(y, 0), grid_rows_ - 1);
+	return pt + displacements_[y * grid_cols_ + x];
+}
+
+/**
+ * @brief  Inserts a candidate into an ascending fixed-size list.
+ *
+ * @return void
+ * @param  dist [in,out] Distances of the list.
+ * @param  idx [in,out] Train indices of the list.
+ * @param  size [in] Capacity of the list.
+ * @param  d [in] Distance of the candidate.
+ * @param  j [in] Train index of the candidate.
+ */
+static inline void InsertCandidate(float* dist, int* idx, const int size,
+	const float d, const int j) {
+
+	if (!(d < dist[size - 1])) return;
+	int k = size - 1;
+	while (k > 0 && d < dist[k - 1]) {
+		dist[k] = dist[k - 1];
+		idx[k] = idx[k - 1];
+		--k;
+	}
+	dist[k] = d;
+	idx[k] = j;
+}
+
+/**
+ * Reference keypoints bucketed into square cells of the window size.
+ */
+struct KeypointBuckets {
+	float cell;                  //!< Side of a cell in pixels.
+	int cols;                    //!< Number of cells along the columns.
+	int rows;                    //!< Number of cells along the rows.
+	std::vector<int> cell_start; //!< Offset of every cell in indices, plus the end.
+	std::vector<int> indices;    //!< Keypoint indices sorted by cell, ascending within a cell.
+
+	/**
+	 * @brief  Gets the cell of a coordinate, clamped to the grid.
+	 *
+	 * @return int Cell index along one axis.
+	 * @param  v [in] Coordinate in pixels.
+	 * @param  n [in] Number of cells along the axis.
+	 */
+	int CellOf(const float v, const int n) const {
+		return std::min(std::max(static_cast<int>(std::floor(v / cell)), 0), n - 1);
+	}
+};
+
+/**
+ * @brief  Buckets the keypoints with a counting sort.
+ *
+ * @return void
+ * @param  kpts [in] Keypoints.
+ * @param  cell [in] Side of a cell in pixels.
+ * @param  buckets [out] Bucketed keypoints.
+ */
+static void BucketKeypoints(const std::vector<cv::KeyPoint>& kpts,
+	const float cell, KeypointBuckets& buckets) {
+
+	float max_x = 0.f, max_y = 0.f;
+	for (size_t i = 0; i < kpts.size(); ++i) {
+		max_x = std::max(max_x, kpts[i].pt.x);
+		max_y = std::max(max_y, kpts[i].pt.y);
+	}
+	buckets.cell = cell;
+	buckets.cols = static_cast<int>(max_x / cell) + 1;
+	buckets.rows = static_cast<int>(max_y / cell) + 1;
+
+	const int num_cells = buckets.cols * buckets.rows;
+	std::vector<int> cell_of(kpts.size());
+	buckets.cell_start.assign(num_cells + 1, 0);
+	for (size_t i = 0; i < kpts.size(); ++i) {
+		cell_of[i] = buckets.CellOf(kpts[i].pt.y, buckets.rows) * buckets.cols +
+			buckets.CellOf(kpts[i].pt.x, buckets.cols);
+		++buckets.cell_start[cell_of[i] + 1];
+	}
+	for (int c = 0; c < num_cells; ++c) {
+		buckets.cell_start[c + 1] += buckets.cell_start[c];
+	}
+	std::vector<int> offset(buckets.cell_start.begin(), buckets.cell_start.end() - 1);
+	buckets.indices.resize(kpts.size());
+	for (size_t i = 0; i < kpts.size(); ++i) {
+		buckets.indices[offset[cell_of[i]]++] = static_cast<int>(i);
+	}
+}
+
+/**
+ * Parallel body that searches the nearest neighbors inside the windows.
+ */
+class GuidedSearchBody : public cv::ParallelLoopBody {
+public:
+	GuidedSearchBody(const std::vector<cv::KeyPoint>& query_kpts,
+		const cv::Mat& query_des, const std::vector<cv::KeyPoint>& refer_kpts,
+		const cv::Mat& refer_des, const MotionField& field,
+		const KeypointBuckets& buckets, const float radius, const int knn,
+		MatchTable& matches)
+		:query_kpts_(query_kpts), query_des_(query_des), refer_kpts_(refer_kpts),
+		refer_des_(refer_des), field_(field), buckets_(buckets), radius_(radius),
+		knn_(knn), matches_(matches) {}
+
+	void operator()(const cv::Range& range) const {
+
+		const bool binary = query_des_.depth() == CV_8U;
+		const int dims = query_des_.cols;
+		int* ptrain = matches_.TrainIdxData();
+		float* pdist = matches_.DistancesData();
+
+		for (int i = range.start; i < range.end; ++i) {
+			const cv::Point2f center = field_.Predict(query_kpts_[i].pt);
+			int* pidx = ptrain + (size_t)i * knn_;
+			float* pd = pdist + (size_t)i * knn_;
+
+			const int c0 = buckets_.CellOf(center.x - radius_, buckets_.cols);
+			const int c1 = buckets_.CellOf(center.x + radius_, buckets_.cols);
+			const int r0 = buckets_.CellOf(center.y - radius_, buckets_.rows);
+			const int r1 = buckets_.CellOf(center.y + radius_, buckets_.rows);
+			for (int r = r0; r <= r1; ++r) {
+				for (int c = c0; c <= c1; ++c) {
+					const int cell = r * buckets_.cols + c;
+					for (int k = buckets_.cell_start[cell];
+						k < buckets_.cell_start[cell + 1]; ++k) {
+						const int j = buckets_.indices[k];
+						const cv::Point2f& pt = refer_kpts_[j].pt;
+						if (std::abs(pt.x - center.x) > radius_ ||
+							std::abs(pt.y - center.y) > radius_) {
+							continue;
+						}
+
+						float d;
+						if (binary) {
+							d = (float)cv::normHamming(query_des_.ptr<uchar>(i),
+								refer_des_.ptr<uchar>(j), dims);
+						}
+						else {
+							const float* a = query_des_.ptr<float>(i);
+							const float* b = refer_des_.ptr<float>(j);
+							d = 0.f;
+							for (int m = 0; m < dims; ++m) {
+								float diff = a[m] - b[m];
+								d += diff * diff;
+							}
+						}
+						InsertCandidate(pd, pidx, knn_, d, j);
+					}
+				}
+			}
+
+			if (!binary) {
+				for (int k = 0; k < knn_ && pidx[k] >= 0; ++k) {
+					pd[k] = std::sqrt(pd[k]);
+				}
+			}
+		}
+	}
+
+private:
+	const std::vector<cv::KeyPoint>& query_kpts_;
+	const cv::Mat& query_des_;
+	const std::vector<cv::KeyPoint>& refer_kpts_;
+	const cv::Mat& refer_des_;
+	const MotionField& field_;
+	const KeypointBuckets& buckets_;
+	const float radius_;
+	const int knn_;
+	MatchTable& matches_;
+};
+
+GuidedMatcher::GuidedMatcher(const double window_radius)
+	:window_radius_(std::max(window_radius, 1.0)) {}
+
+GuidedMatcher::~GuidedMatcher() {}
+
+void GuidedMatcher::KnnMatch(const std::vector<cv::KeyPoint>& query_kpts,
+	const cv::Mat& query_des, const std::vector<cv::KeyPoint>& refer_kpts,
+	const cv::Mat& refer_des, const MotionField& field, MatchTable& matches,
+	const int knn) const {
+
+	matches.Create(static_cast<int>(query_kpts.size()), std::max(knn, 0));
+	if (knn <= 0 || query_kpts.empty() || refer_kpts.empty()) return;
+
+	CV_Assert(query_des.type() == refer_des.type() &&
+		query_des.cols == refer_des.cols &&
+		(query_des.type() == CV_8U || query_des.type() == CV_32F) &&
+		query_des.rows == static_cast<int>(query_kpts.size()) &&
+		refer_des.rows == static_cast<int>(refer_kpts.size()));
+
+	// With cells of the window size, a window overlaps at most 2x2 cells.
+	const float radius = static_cast<float>(window_radius_);
+	KeypointBuckets buckets;
+	BucketKeypoints(refer_kpts, 2.f * radius, buckets);
+
+	GuidedSearchBody body(query_kpts, query_des, refer_kpts, refer_des, field,
+		buckets, radius, knn, matches);
+	cv::parallel_for_(cv::Range(0, static_cast<int>(query_kpts.size())), body);
+}
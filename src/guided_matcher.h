@@ -0,0 +1,123 @@
+/****************************************************************************//**
+ * @file guided_matcher.h
+ * @brief Descriptor matching restricted to windows predicted by a motion field.
+ *
+ * A MotionField is interpolated from a sparse set of inlier correspondences,
+ * e.g. the matches of a downscaled image pair kept by GMS or LPM. The
+ * GuidedMatcher then compares each query descriptor only against the
+ * reference keypoints inside a square window around its predicted location,
+ * instead of against all reference descriptors.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-18
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _GUIDED_MATCHER_H_
+#define _GUIDED_MATCHER_H_
+#include <opencv2/opencv.hpp>
+#include "match_table.h"
+
+/**
+ * Class for a piecewise constant motion field of the query image.
+ *
+ * The query image is divided into a grid. Each cell holds the median
+ * displacement of the correspondences starting in it, and the cells without
+ * any correspondence take the displacement of the nearest cell that has one.
+ */
+class MotionField {
+public:
+	/**
+	 * @brief  Default constructor, an empty field.
+	 *
+	 */
+	MotionField();
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~MotionField();
+
+	/**
+	 * @brief  Constructor with the correspondences.
+	 *
+	 * @param  query_pts [in] Points in the query image.
+	 * @param  refer_pts [in] Corresponding points in the reference image.
+	 * @param  image_size [in] Size of the query image.
+	 * @param  grid_size [in] Number of cells along the columns and the rows.
+	 */
+	MotionField(const std::vector<cv::Point2f>& query_pts,
+		const std::vector<cv::Point2f>& refer_pts, const cv::Size& image_size,
+		const cv::Size& grid_size = cv::Size(20, 20));
+
+	/**
+	 * @brief  Predicts the location of a query point in the reference image.
+	 *
+	 * @return cv::Point2f Predicted location.
+	 * @param  pt [in] Point in the query image.
+	 */
+	cv::Point2f Predict(const cv::Point2f& pt) const;
+
+	/**
+	 * @brief  Checks whether the field was built from any correspondence.
+	 *
+	 * @return bool True if there is no correspondence.
+	 */
+	bool empty() const { return displacements_.empty(); }
+
+private:
+	int grid_cols_;      //!< Number of cells along the columns.
+	int grid_rows_;      //!< Number of cells along the rows.
+	double scale_x_;     //!< Cells per pixel along the columns.
+	double scale_y_;     //!< Cells per pixel along the rows.
+
+	std::vector<cv::Point2f> displacements_; //!< Displacement of every cell, row-major.
+};
+
+/**
+ * Class for the window-restricted \f$k\f$ nearest neighbor matcher.
+ */
+class GuidedMatcher {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  window_radius [in] Half size of the search window in pixels.
+	 */
+	explicit GuidedMatcher(const double window_radius = 48.0);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~GuidedMatcher();
+
+	/**
+	 * @brief  Finds the k best matches for each query descriptor among the
+	 *         reference keypoints inside its predicted window.
+	 *
+	 * CV_8U descriptors are compared with the Hamming distance, CV_32F with
+	 * the L2 distance. The query rows are processed in parallel with
+	 * cv::parallel_for_.
+	 *
+	 * @return void
+	 * @param  query_kpts [in] Keypoints of the query image.
+	 * @param  query_des [in] Query descriptors, one row per keypoint.
+	 * @param  refer_kpts [in] Keypoints of the reference image.
+	 * @param  refer_des [in] Reference descriptors, one row per keypoint.
+	 * @param  field [in] Motion field from the query to the reference image.
+	 * @param  matches [out] Matches, \f$N\times k\f$, -1 if missing.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	void KnnMatch(const std::vector<cv::KeyPoint>& query_kpts,
+		const cv::Mat& query_des, const std::vector<cv::KeyPoint>& refer_kpts,
+		const cv::Mat& refer_des, const MotionField& field, MatchTable& matches,
+		const int knn) const;
+
+private:
+	const double window_radius_; //!< Half size of the search window in pixels.
+};
+#endif
@@ -1,124 +1,362 @@
 #include "image_matcher.h"
-#include <opencv2/xfeatures2d.hpp>
+#include "knn_matcher.h"
+#include "cuda_matcher.h"
+#include "guided_matcher.h"
+#include "profiler.h"
+#include "workspace.h"
 
-ImageMatcher::ImageMatcher() {}
+ImageMatcher::ImageMatcher() :workspace_(NULL) {}
 
-ImageMatcher::~ImageMatcher() {}
+ImageMatcher::~ImageMatcher() {
+
+	if (workspace_) {
+		// The descriptors may reference the memory of the caller.
+		query_features_.descriptors.release();
+		query_features_.holder.reset();
+		refer_features_.descriptors.release();
+		refer_features_.holder.reset();
+		SwapBuffers(*workspace_);
+	}
+}
 
 ImageMatcher::ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
-	FeatureType method1, MatcherType method2, int knn)
+	FeatureType method1, MatcherType method2, int knn, bool concurrent)
 	:query_image_(img0), refer_image_(img1), feature_method_(method1),
-	matcher_method_(method2) {
+	matcher_method_(method2), workspace_(NULL) {
 
-	ExtractFeatures();
+	// The descriptors stay on the device, only the matches are downloaded.
+	if (CudaMatcher::IsAvailable() &&
+		CudaMatcher::Supports(feature_method_, matcher_method_)) {
+		cuda_matcher_ = cv::makePtr<CudaMatcher>(feature_method_, matcher_method_);
+		cuda_matcher_->ExtractAndMatch(query_image_, refer_image_, query_features_,
+			refer_features_, matches_, knn);
+		return;
+	}
+
+	FeatureExtractor extractor(feature_method_);
+	ExtractFeatures(extractor, concurrent);
 	MatchFeatures(knn);
 }
 
-void ImageMatcher::ExtractFeatures() {
+ImageMatcher::ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+	FeatureExtractor& extractor, MatcherType method, int knn, bool concurrent,
+	const cv::Mat& mask0, const cv::Mat& mask1)
+	:query_image_(img0), refer_image_(img1),
+	feature_method_(extractor.GetFeatureType()), matcher_method_(method),
+	workspace_(NULL) {
 
-	cv::Ptr<cv::Feature2D> feature;
+	ExtractFeatures(extractor, concurrent, mask0, mask1);
+	MatchFeatures(knn);
+}
 
-	int i = 0;
-	int jhist = 0, jori = 0;
-	cv::Mat temp;
-	switch (feature_method_)
-	{
-	case FEATURE_SIFT:
-		feature = cv::xfeatures2d::SIFT::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-		break;
-	case FEATURE_SURF:
-		feature = cv::xfeatures2d::SURF::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-		break;
-	case FEATURE_ORB:
-		feature = cv::ORB::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-		break;
-	case FEATURE_AKAZE:
-		feature = cv::AKAZE::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-		break;
-	case FEATURE_ROOTSIFT:
-		feature = cv::xfeatures2d::SIFT::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-
-		for (i = 0; i < query_des_.rows; ++i) {
-			cv::normalize(query_des_.row(i), temp, 1, cv::NORM_L1);
-			cv::sqrt(temp, temp);
-			temp.row(0).copyTo(query_des_.row(i));
-		}
+ImageMatcher::ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+	FeatureExtractor& extractor, Workspace& workspace, MatcherType method,
+	int knn, bool concurrent, const cv::Mat& mask0, const cv::Mat& mask1)
+	:query_image_(img0), refer_image_(img1),
+	feature_method_(extractor.GetFeatureType()), matcher_method_(method),
+	workspace_(&workspace) {
 
-		for (i = 0; i < refer_des_.rows; ++i) {
-			cv::normalize(refer_des_.row(i), temp, 1, cv::NORM_L1);
-			cv::sqrt(temp, temp);
-			temp.row(0).copyTo(refer_des_.row(i));
-		}
+	SwapBuffers(workspace);
+	ExtractFeatures(extractor, concurrent, mask0, mask1);
+	MatchFeatures(knn);
+}
 
-		break;
-	case FEATURE_HALFSIFT:
-		feature = cv::xfeatures2d::SIFT::create();
-		feature->detectAndCompute(query_image_, cv::Mat(), query_kpts_, query_des_);
-		feature->detectAndCompute(refer_image_, cv::Mat(), refer_kpts_, refer_des_);
-
-		for (i = 0; i < query_des_.rows; ++i) {
-			for (jhist = 0; jhist < 16; ++jhist) {
-				for (jori = 0; jori < 4; ++jori) {
-					temp = (query_des_.row(i).col(jhist * 8 + jori) +
-						query_des_.row(i).col(jhist * 8 + jori + 4));
-					temp.copyTo(query_des_.row(i).col(jhist * 8 + jori));
-					temp.copyTo(query_des_.row(i).col(jhist * 8 + jori + 4));
-				}
-			}
-		}
+ImageMatcher::ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+	FeatureExtractor& extractor, const PyramidOptions& pyramid,
+	MatcherType method, int knn, bool concurrent)
+	:query_image_(img0), refer_image_(img1),
+	feature_method_(extractor.GetFeatureType()), matcher_method_(method),
+	workspace_(NULL) {
+
+	MatchFeaturesCoarseToFine(extractor, pyramid, knn, concurrent);
+}
+
+ImageMatcher::ImageMatcher(FeatureSet query_features,
+	FeatureSet refer_features, MatcherType method, int knn)
+	:feature_method_(FEATURE_UNKNOWN), matcher_method_(method),
+	query_features_(std::move(query_features)),
+	refer_features_(std::move(refer_features)), workspace_(NULL) {
+
+	MatchFeatures(knn);
+}
 
-		for (i = 0; i < refer_des_.rows; ++i) {
-			for (jhist = 0; jhist < 16; ++jhist) {
-				for (jori = 0; jori < 4; ++jori) {
-					temp = (refer_des_.row(i).col(jhist * 8 + jori) +
-						refer_des_.row(i).col(jhist * 8 + jori + 4));
-					temp.copyTo(refer_des_.row(i).col(jhist * 8 + jori));
-					temp.copyTo(refer_des_.row(i).col(jhist * 8 + jori + 4));
-				}
-			}
+ImageMatcher::ImageMatcher(const FeatureSet& query_features,
+	const FeatureSet& refer_features, Workspace& workspace, MatcherType method,
+	int knn)
+	:feature_method_(FEATURE_UNKNOWN), matcher_method_(method),
+	workspace_(&workspace) {
+
+	// The assignments reuse the capacity of the keypoints of the workspace.
+	SwapBuffers(workspace);
+	query_features_ = query_features;
+	refer_features_ = refer_features;
+	MatchFeatures(knn);
+}
+
+ImageMatcher::ImageMatcher(FeatureSet query_features,
+	FeatureSet refer_features, const double ratio, MatcherType method)
+	:feature_method_(FEATURE_UNKNOWN), matcher_method_(method),
+	query_features_(std::move(query_features)),
+	refer_features_(std::move(refer_features)), workspace_(NULL) {
+
+	MatchFeaturesWithRatioTest(ratio);
+}
+
+void ImageMatcher::SwapBuffers(Workspace& workspace) {
+
+	MatcherBuffers& buffers = workspace.GetMatcherBuffers();
+	std::swap(query_features_, buffers.query_features);
+	std::swap(refer_features_, buffers.refer_features);
+	std::swap(matches_, buffers.matches);
+}
+
+/**
+ * @brief  Converts descriptors to CV_32F unless they already are.
+ *
+ * @return void
+ * @param  src [in] Descriptors.
+ * @param  buffer [in,out] Memory of the conversion.
+ * @param  dst [out] Descriptors in CV_32F.
+ */
+static void ConvertToFloat(const cv::Mat& src, cv::Mat& buffer, cv::Mat& dst) {
+
+	if (src.depth() == CV_32F) {
+		dst = src;
+		return;
+	}
+	src.convertTo(buffer, CV_32F);
+	dst = buffer;
+}
+
+void ImageMatcher::ExtractFeatures(FeatureExtractor& extractor,
+	const bool concurrent, const cv::Mat& mask0, const cv::Mat& mask1) {
+
+	IM_PROFILE_SCOPE("image_matcher.extract");
+	extractor.Extract(query_image_, refer_image_, query_features_,
+		refer_features_, concurrent, mask0, mask1);
+}
+
+cv::Ptr<cv::DescriptorMatcher> ImageMatcher::CreateMatcher(cv::Mat& query_des,
+	cv::Mat& refer_des) const {
+
+	cv::Ptr<cv::DescriptorMatcher> matcher;
+	if (workspace_) {
+		matcher = workspace_->GetMatcherBuffers().descriptor_matchers[matcher_method_];
+	}
+	const bool binary_matcher = matcher_method_ == MATCHER_BF_HAMMING ||
+		matcher_method_ == MATCHER_FLANN_LSH;
+	if (matcher.empty()) {
+		switch (matcher_method_)
+		{
+		case MATCHER_BF:
+			matcher = cv::DescriptorMatcher::create("BruteForce");
+			break;
+		case MATCHER_FLANN:
+			matcher = cv::DescriptorMatcher::create("FlannBased");
+			break;
+		case MATCHER_BF_HAMMING:
+			matcher = cv::DescriptorMatcher::create("BruteForce-Hamming");
+			break;
+		case MATCHER_FLANN_LSH:
+			matcher = cv::makePtr<cv::FlannBasedMatcher>(
+				cv::makePtr<cv::flann::LshIndexParams>(12, 20, 2));
+			break;
+		case MATCHER_BF_TILED:
+			break;
+		}
+		if (workspace_) {
+			workspace_->GetMatcherBuffers().descriptor_matchers[matcher_method_] = matcher;
 		}
-		break;
-	default:
-		break;
 	}
 
-	// Make sure the types of the descriptors support the FlannBasedMatcher.
-	query_des_.convertTo(query_des_, CV_32F);
-	refer_des_.convertTo(refer_des_, CV_32F);
+	if (binary_matcher) {
+		// Hamming distance is only defined for the binary descriptors of ORB
+		// and AKAZE.
+		query_des = query_features_.descriptors;
+		refer_des = refer_features_.descriptors;
+		CV_Assert(query_des.depth() == CV_8U && refer_des.depth() == CV_8U);
+	}
+	else {
+		// Make sure the types of the descriptors support the FlannBasedMatcher.
+		cv::Mat query_buffer, refer_buffer;
+		ConvertToFloat(query_features_.descriptors,
+			workspace_ ? workspace_->GetMatcherBuffers().query_des : query_buffer,
+			query_des);
+		ConvertToFloat(refer_features_.descriptors,
+			workspace_ ? workspace_->GetMatcherBuffers().refer_des : refer_buffer,
+			refer_des);
+	}
+	return matcher;
 }
 
 void ImageMatcher::MatchFeatures(int knn) {
 
-	cv::Ptr<cv::DescriptorMatcher> matcher;
-	switch (matcher_method_)
+	IM_PROFILE_SCOPE("image_matcher.knn_match");
+	IM_PROFILE_COUNTER("image_matcher.query_keypoints", query_features_.keypoints.size());
+	IM_PROFILE_COUNTER("image_matcher.refer_keypoints", refer_features_.keypoints.size());
+
+	cv::Mat query_des, refer_des;
+	cv::Ptr<cv::DescriptorMatcher> matcher = CreateMatcher(query_des, refer_des);
+
+	if (matcher_method_ == MATCHER_BF_TILED) {
+		TiledKnnMatcher().KnnMatch(query_des, refer_des, matches_, knn);
+	}
+	else if (workspace_) {
+		// Training the matcher of the workspace in place spares the clone of
+		// the matcher made by knnMatch() with the train descriptors.
+		MatcherBuffers& buffers = workspace_->GetMatcherBuffers();
+		buffers.train_descriptors.assign(1, refer_des);
+		matcher->clear();
+		matcher->add(buffers.train_descriptors);
+		matcher->knnMatch(query_des, buffers.knn_matches, knn);
+		matcher->clear();
+		buffers.train_descriptors.clear();
+		matches_.Assign(buffers.knn_matches);
+	}
+	else {
+		std::vector<std::vector<cv::DMatch> > knn_matches;
+		matcher->knnMatch(query_des, refer_des, knn_matches, knn);
+		matches_ = MatchTable(knn_matches);
+	}
+
+	IM_PROFILE_COUNTER("image_matcher.putative_matches", matches_.rows());
+	IM_PROFILE_COUNTER("image_matcher.table_bytes", (size_t)matches_.rows() *
+		(sizeof(int) + (size_t)matches_.knn() * (sizeof(int) + sizeof(float))));
+}
+
+void ImageMatcher::MatchFeaturesCoarseToFine(FeatureExtractor& extractor,
+	const PyramidOptions& pyramid, const int knn, const bool concurrent) {
+
+	CV_Assert(pyramid.coarse_scale > 0 && pyramid.coarse_scale < 1);
+	const double scale = pyramid.coarse_scale;
+
+	// Coarse level. The ratio test of the pruners needs two neighbors.
+	std::vector<cv::Point2f> coarse_pts0, coarse_pts1;
 	{
-	case MATCHER_BF:
-		matcher = cv::DescriptorMatcher::create("BruteForce");
-		break;
-	case MATCHER_FLANN:
-		matcher = cv::DescriptorMatcher::create("FlannBased");
-		break;
+		IM_PROFILE_SCOPE("image_matcher.coarse");
+		cv::Mat coarse_image0, coarse_image1;
+		cv::resize(query_image_, coarse_image0, cv::Size(), scale, scale, cv::INTER_AREA);
+		cv::resize(refer_image_, coarse_image1, cv::Size(), scale, scale, cv::INTER_AREA);
+		FeatureSet coarse_query, coarse_refer;
+		extractor.Extract(coarse_image0, coarse_image1, coarse_query, coarse_refer,
+			concurrent);
+		ImageMatcher coarse_matcher(std::move(coarse_query), std::move(coarse_refer),
+			matcher_method_, std::max(knn, 2));
+		MatchPruner coarse_pruner(coarse_matcher.GetQueryFeatures(),
+			coarse_matcher.GetReferFeatures(), coarse_matcher.GetMatchTable(),
+			pyramid.pruner);
+		coarse_pruner.TakeMatchedPoints(coarse_pts0, coarse_pts1);
+	}
+	IM_PROFILE_COUNTER("image_matcher.coarse_inliers", coarse_pts0.size());
+
+	ExtractFeatures(extractor, concurrent);
+
+	if (static_cast<int>(coarse_pts0.size()) < pyramid.min_inliers) {
+		MatchFeatures(knn);
+		return;
+	}
+
+	// Pixel centers of the coarse level back to the full resolution.
+	std::vector<cv::Point2f> pts0(coarse_pts0.size()), pts1(coarse_pts1.size());
+	const float inv_scale = static_cast<float>(1.0 / scale);
+	const cv::Point2f half(0.5f, 0.5f);
+	for (size_t i = 0; i < pts0.size(); ++i) {
+		pts0[i] = (coarse_pts0[i] + half) * inv_scale - half;
+		pts1[i] = (coarse_pts1[i] + half) * inv_scale - half;
+	}
+	MotionField field(pts0, pts1, query_image_.size());
+
+	IM_PROFILE_SCOPE("image_matcher.guided_match");
+	cv::Mat query_des, refer_des;
+	CreateMatcher(query_des, refer_des);
+	GuidedMatcher(pyramid.window_radius).KnnMatch(query_features_.keypoints,
+		query_des, refer_features_.keypoints, refer_des, field, matches_, knn);
+}
+
+void ImageMatcher::MatchFeaturesWithRatioTest(const double ratio) {
+
+	IM_PROFILE_SCOPE("image_matcher.ratio_match");
+
+	cv::Mat query_des, refer_des;
+	cv::Ptr<cv::DescriptorMatcher> matcher = CreateMatcher(query_des, refer_des);
+
+	if (matcher_method_ == MATCHER_BF_TILED) {
+		TiledKnnMatcher().RatioMatch(query_des, refer_des, ratio,
+			ratio_matches_, ratio_scores_);
+		return;
 	}
-	matcher->knnMatch(query_des_, refer_des_, matches_, knn);
 
+	// The other matchers only provide the k nearest neighbor interface.
+	std::vector<std::vector<cv::DMatch> > knn_matches;
+	matcher->knnMatch(query_des, refer_des, knn_matches, 2);
+
+	ratio_matches_.clear();
+	ratio_scores_.clear();
+	double score;
+	for (size_t i = 0; i < knn_matches.size(); ++i) {
+		if (knn_matches[i].size() < 2) continue;
+		score = knn_matches[i][0].distance / knn_matches[i][1].distance;
+		if (score < ratio) {
+			ratio_matches_.push_back(knn_matches[i][0]);
+			ratio_scores_.push_back(score);
+		}
+	}
+}
+
+void ImageMatcher::DownloadDescriptors() const {
+
+	if (cuda_matcher_.empty()) return;
+	cuda_matcher_->DownloadDescriptors(query_features_, refer_features_);
+	cuda_matcher_.release();
 }
 
 void ImageMatcher::GetKeyPoints(std::vector<cv::KeyPoint>& key_points0,
 	std::vector<cv::KeyPoint>& key_points1) const {
-	key_points0 = query_kpts_;
-	key_points1 = refer_kpts_;
+	key_points0 = query_features_.keypoints;
+	key_points1 = refer_features_.keypoints;
+}
+
+void ImageMatcher::GetFeatures(FeatureSet& query_features,
+	FeatureSet& refer_features) const {
+	DownloadDescriptors();
+	query_features = query_features_;
+	refer_features = refer_features_;
+}
+
+const FeatureSet& ImageMatcher::GetQueryFeatures() const {
+	DownloadDescriptors();
+	return query_features_;
+}
+
+const FeatureSet& ImageMatcher::GetReferFeatures() const {
+	DownloadDescriptors();
+	return refer_features_;
+}
+
+void ImageMatcher::TakeFeatures(FeatureSet& query_features,
+	FeatureSet& refer_features) {
+	DownloadDescriptors();
+	query_features = std::move(query_features_);
+	refer_features = std::move(refer_features_);
+	query_features_ = FeatureSet();
+	refer_features_ = FeatureSet();
 }
 
 void ImageMatcher::GetMatches(std::vector<std::vector<cv::DMatch> >& matches) const {
-	matches = matches_;
+	matches_.ToNested(matches);
+}
+
+const MatchTable& ImageMatcher::GetMatchTable() const {
+	return matches_;
+}
+
+void ImageMatcher::TakeMatches(MatchTable& matches) {
+	matches = std::move(matches_);
+	matches_ = MatchTable();
+}
+
+void ImageMatcher::GetRatioMatches(std::vector<cv::DMatch>& matches,
+	std::vector<double>& scores) const {
+	matches = ratio_matches_;
+	scores = ratio_scores_;
 }
\ No newline at end of file
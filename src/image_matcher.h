@@ -12,21 +12,44 @@
 #ifndef _IMAGE_MATCHER_H_
 #define _IMAGE_MATCHER_H_
 #include <opencv2/opencv.hpp>
+#include "feature_extractor.h"
+#include "match_table.h"
+#include "match_pruner.h"
 
-//! Types of a feature detector and a descriptor extractor.
-enum FeatureType{
-	FEATURE_SIFT = 0,         //!< SIFT
-	FEATURE_SURF = 1,         //!< SURF
-	FEATURE_ORB = 2,          //!< ORB
-	FEATURE_AKAZE = 3,        //!< AKAZE
-	FEATURE_ROOTSIFT = 4,     //!< ROOTSIFT
-	FEATURE_HALFSIFT = 5      //!< HALFSIFT
-};
+class Workspace;
+class CudaMatcher;
 
 //! Matcher types.
 enum MatcherType{
-	MATCHER_BF = 0,        //!< BruteForce-L2
-	MATCHER_FLANN = 1      //!< FlannBased
+	MATCHER_BF = 0,          //!< BruteForce-L2
+	MATCHER_FLANN = 1,       //!< FlannBased
+	MATCHER_BF_HAMMING = 2,  //!< BruteForce-Hamming, binary descriptors only
+	MATCHER_FLANN_LSH = 3,   //!< FlannBased with LSH index, binary descriptors only
+	MATCHER_BF_TILED = 4     //!< Multi-threaded tiled BruteForce-L2
+};
+
+/**
+ * Options of the coarse-to-fine matching mode.
+ */
+struct PyramidOptions {
+	double coarse_scale;  //!< Scale of the coarse level, in (0, 1).
+	PrunerType pruner;    //!< Pruner of the coarse matches, which give the motion field.
+	double window_radius; //!< Half size of the search window at full resolution, in pixels.
+	int min_inliers;      //!< Fewer coarse inliers fall back to the all-pairs matching.
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  coarse_scale [in] Scale of the coarse level, in (0, 1).
+	 * @param  pruner [in] Pruner of the coarse matches.
+	 * @param  window_radius [in] Half size of the search window in pixels.
+	 * @param  min_inliers [in] Minimum number of coarse inliers.
+	 */
+	explicit PyramidOptions(const double coarse_scale = 0.25,
+		const PrunerType pruner = PRUNER_GMS, const double window_radius = 48.0,
+		const int min_inliers = 20)
+		:coarse_scale(coarse_scale), pruner(pruner),
+		window_radius(window_radius), min_inliers(min_inliers) {}
 };
 
 /**
@@ -49,15 +72,179 @@ public:
 	/**
 	 * @brief  Constructor with parameters.
 	 *
+	 * The CUDA backend is used instead of the CPU when it is available and
+	 * supports the methods, see CudaMatcher. The descriptors then stay on
+	 * the device until the features are first accessed, which downloads
+	 * them, so the features are the same as on the CPU. The first access
+	 * must not race with another one.
+	 *
 	 * @param  img0 [in] Query image.
 	 * @param  img1 [in] Reference image.
 	 * @param  method1 [in] Feature detector type.
 	 * @param  method2 [in] Descriptor matcher type.
 	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  concurrent [in] Whether to extract the features of both images
+	 *                         concurrently.
 	 */
 	ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
 		FeatureType method1 = FEATURE_SIFT, MatcherType method2 = MATCHER_BF,
-		const int knn = 1);
+		const int knn = 1, const bool concurrent = false);
+
+	/**
+	 * @brief  Constructor with a reusable feature extractor. 
+	 *
+	 * @param  img0 [in] Query image.
+	 * @param  img1 [in] Reference image.
+	 * @param  extractor [in] Feature extractor shared across image pairs.
+	 * @param  method [in] Descriptor matcher type.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  concurrent [in] Whether to extract the features of both images
+	 *                         concurrently.
+	 * @param  mask0 [in] Detection mask of the query image, empty for the
+	 *                    whole image, see MakeRoiMask().
+	 * @param  mask1 [in] Detection mask of the reference image, empty for
+	 *                    the whole image.
+	 */
+	ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+		FeatureExtractor& extractor, MatcherType method = MATCHER_BF,
+		const int knn = 1, const bool concurrent = false,
+		const cv::Mat& mask0 = cv::Mat(), const cv::Mat& mask1 = cv::Mat());
+
+	/**
+	 * @brief  Constructor with a reusable feature extractor and the workspace
+	 *         of the worker.
+	 *
+	 * The features, the match table and the converted descriptors are kept 
+	 * in buffers of the workspace, which the destructor hands back, and the 
+	 * descriptor matcher is created once per workspace.
+	 *
+	 * @param  img0 [in] Query image.
+	 * @param  img1 [in] Reference image.
+	 * @param  extractor [in] Feature extractor shared across image pairs.
+	 * @param  workspace [in] Workspace of the worker, which must outlive the
+	 *                        matcher.
+	 * @param  method [in] Descriptor matcher type.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  concurrent [in] Whether to extract the features of both images
+	 *                         concurrently.
+	 * @param  mask0 [in] Detection mask of the query image, empty for the
+	 *                    whole image.
+	 * @param  mask1 [in] Detection mask of the reference image, empty for
+	 *                    the whole image.
+	 */
+	ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+		FeatureExtractor& extractor, Workspace& workspace,
+		MatcherType method = MATCHER_BF, const int knn = 1,
+		const bool concurrent = false, const cv::Mat& mask0 = cv::Mat(),
+		const cv::Mat& mask1 = cv::Mat());
+
+	/**
+	 * @brief  Constructor of the coarse-to-fine matching mode.
+	 *
+	 * Both images are first matched at the coarse scale, and the inliers
+	 * of the coarse matches give a MotionField. At full resolution every
+	 * query descriptor is then only compared with the reference keypoints 
+	 * inside a window around its predicted location, see GuidedMatcher. 
+	 * If the coarse level has too few inliers, the full resolution features
+	 * are matched all-pairs instead.
+	 *
+	 * The matcher type only selects the distance, Hamming for 
+	 * MATCHER_BF_HAMMING and MATCHER_FLANN_LSH and L2 otherwise.
+	 *
+	 * @param  img0 [in] Query image.
+	 * @param  img1 [in] Reference image.
+	 * @param  extractor [in] Feature extractor shared by both levels.
+	 * @param  pyramid [in] Options of the coarse-to-fine mode.
+	 * @param  method [in] Descriptor matcher type.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  concurrent [in] Whether to extract the features of both images
+	 *                         concurrently.
+	 */
+	ImageMatcher(const cv::Mat& img0, const cv::Mat& img1,
+		FeatureExtractor& extractor, const PyramidOptions& pyramid,
+		MatcherType method = MATCHER_BF, const int knn = 1,
+		const bool concurrent = false);
+
+	/**
+	 * @brief  Constructor with features extracted in advance.
+	 *
+	 * The features are taken by value, pass them with std::move() to hand 
+	 * them over without copying.
+	 *
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  method [in] Descriptor matcher type.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	ImageMatcher(FeatureSet query_features, FeatureSet refer_features,
+		MatcherType method = MATCHER_BF, const int knn = 1);
+
+	/**
+	 * @brief  Constructor with features extracted in advance and the 
+	 *         workspace of the worker.
+	 *
+	 * The keypoints are copied into the buffers of the workspace, which keep
+	 * their capacity, and the descriptors are shared.
+	 *
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  workspace [in] Workspace of the worker, which must outlive the
+	 *                        matcher.
+	 * @param  method [in] Descriptor matcher type.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	ImageMatcher(const FeatureSet& query_features,
+		const FeatureSet& refer_features, Workspace& workspace,
+		MatcherType method = MATCHER_BF, const int knn = 1);
+
+	/**
+	 * @brief  Constructor of the fused matching and ratio test mode.
+	 *
+	 * Only the two best distances are kept per query descriptor and the
+	 * matches passing Lowe's ratio test are stored in a flat vector, see
+	 * GetRatioMatches(). No \f$k\f$ nearest neighbor matches are stored.
+	 *
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  ratio [in] Threshold for ratio test.
+	 * @param  method [in] Descriptor matcher type.
+	 */
+	ImageMatcher(FeatureSet query_features, FeatureSet refer_features,
+		const double ratio, MatcherType method = MATCHER_BF_TILED);
+
+	/**
+	 * @brief  Gets the features from both the query and reference image.
+	 *
+	 * @return void
+	 * @param  query_features [out] Features of the query image.
+	 * @param  refer_features [out] Features of the reference image.
+	 */
+	void GetFeatures(FeatureSet& query_features,
+		FeatureSet& refer_features) const;
+
+	/**
+	 * @brief  Gets the features of the query image without copying.
+	 *
+	 * @return const FeatureSet& Features of the query image.
+	 */
+	const FeatureSet& GetQueryFeatures() const;
+
+	/**
+	 * @brief  Gets the features of the reference image without copying.
+	 *
+	 * @return const FeatureSet& Features of the reference image.
+	 */
+	const FeatureSet& GetReferFeatures() const;
+
+	/**
+	 * @brief  Moves the features out of the matcher. The matcher keeps
+	 *         empty features afterwards.
+	 *
+	 * @return void
+	 * @param  query_features [out] Features of the query image.
+	 * @param  refer_features [out] Features of the reference image.
+	 */
+	void TakeFeatures(FeatureSet& query_features, FeatureSet& refer_features);
 
 	/**
 	 * @brief  Gets the keypoints from both the query and reference image.
@@ -77,14 +264,57 @@ public:
 	 */
 	void GetMatches(std::vector<std::vector<cv::DMatch> >& matches) const;
 
+	/**
+	 * @brief  Gets the matches without copying.
+	 *
+	 * @return const MatchTable& Matches, \f$N\times k\f$.
+	 */
+	const MatchTable& GetMatchTable() const;
+
+	/**
+	 * @brief  Moves the matches out of the matcher. The matcher keeps an
+	 *         empty table afterwards.
+	 *
+	 * @return void
+	 * @param  matches [out] Matches, \f$N\times k\f$.
+	 */
+	void TakeMatches(MatchTable& matches);
+
+	/**
+	 * @brief  Gets the matches of the fused matching and ratio test mode.
+	 *
+	 * @return void
+	 * @param  matches [out] Matches passing the ratio test.
+	 * @param  scores [out] Distance ratios of the matches.
+	 */
+	void GetRatioMatches(std::vector<cv::DMatch>& matches,
+		std::vector<double>& scores) const;
+
 private:
+	ImageMatcher(const ImageMatcher&) = delete;            //!< The buffers may belong to a workspace.
+	ImageMatcher& operator=(const ImageMatcher&) = delete; //!< The buffers may belong to a workspace.
+
+	/**
+	 * @brief  Swaps the features and the match table with the buffers of a
+	 *         workspace.
+	 *
+	 * @return void
+	 * @param  workspace [in] Workspace.
+	 */
+	void SwapBuffers(Workspace& workspace);
+
 	/**
 	 * @brief  Detects keypoints in the query and reference images and computes
 	 *         the descriptors for the corresponding keypoints.
 	 *
 	 * @return void
+	 * @param  extractor [in] Feature extractor.
+	 * @param  concurrent [in] Whether to extract both images concurrently.
+	 * @param  mask0 [in] Detection mask of the query image.
+	 * @param  mask1 [in] Detection mask of the reference image.
 	 */
-	void ExtractFeatures();
+	void ExtractFeatures(FeatureExtractor& extractor, const bool concurrent,
+		const cv::Mat& mask0 = cv::Mat(), const cv::Mat& mask1 = cv::Mat());
 
 	/**
 	 * @brief  Finds the best matches and rejects false matches.
@@ -94,19 +324,65 @@ private:
 	 */
 	void MatchFeatures(int knn);
 
+	/**
+	 * @brief  Matches the coarse level, then searches the full resolution
+	 *         matches in the windows predicted by the coarse inliers.
+	 *
+	 * @return void
+	 * @param  extractor [in] Feature extractor.
+	 * @param  pyramid [in] Options of the coarse-to-fine mode.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  concurrent [in] Whether to extract both images concurrently.
+	 */
+	void MatchFeaturesCoarseToFine(FeatureExtractor& extractor,
+		const PyramidOptions& pyramid, const int knn, const bool concurrent);
+
+	/**
+	 * @brief  Finds the best matches and applies the ratio test at once.
+	 *
+	 * @return void
+	 * @param  ratio [in] Threshold for ratio test.
+	 */
+	void MatchFeaturesWithRatioTest(const double ratio);
+
+	/**
+	 * @brief  Creates the descriptor matcher and prepares the descriptors.
+	 *
+	 * The matcher of a workspace is created on its first use. The 
+	 * descriptors are only converted if the matcher needs another depth.
+	 *
+	 * @return cv::Ptr<cv::DescriptorMatcher> Matcher, empty for MATCHER_BF_TILED.
+	 * @param  query_des [out] Query descriptors in the type of the matcher.
+	 * @param  refer_des [out] Reference descriptors in the type of the matcher.
+	 */
+	cv::Ptr<cv::DescriptorMatcher> CreateMatcher(cv::Mat& query_des,
+		cv::Mat& refer_des) const;
+
+	/**
+	 * @brief  Downloads the descriptors of the CUDA backend into the 
+	 *         features, if they aren't yet.
+	 *
+	 * @return void
+	 */
+	void DownloadDescriptors() const;
+
 private:
 	cv::Mat query_image_;    //!< Query image.
 	cv::Mat refer_image_;    //!< Reference image.
 
-	FeatureType feature_method_;  //!< Local Features.
+	FeatureType feature_method_;  //!< Local Features, FEATURE_UNKNOWN for feature sets handed in.
 	MatcherType matcher_method_;  //!< Matching methods.
 
-	std::vector<cv::KeyPoint> query_kpts_; //!< Key points from the query image.	
-	std::vector<cv::KeyPoint> refer_kpts_; //!< Key points from the reference image.
+	// Mutable for the download of the descriptors of the CUDA backend.
+	mutable FeatureSet query_features_; //!< Key points and descriptors from the query image.
+	mutable FeatureSet refer_features_; //!< Key points and descriptors from the reference image.
+	mutable cv::Ptr<CudaMatcher> cuda_matcher_; //!< CUDA backend holding the descriptors, empty once downloaded.
+
+	MatchTable matches_; //!< Matchers of keypoint descriptors.
 
-	cv::Mat query_des_; //!< Keypoint descriptors from the query image.	
-	cv::Mat refer_des_; //!< Keypoint descriptors from the reference image.
+	std::vector<cv::DMatch> ratio_matches_; //!< Matches passing the fused ratio test.
+	std::vector<double> ratio_scores_;      //!< Distance ratios of the fused ratio test.
 
-	std::vector<std::vector<cv::DMatch> > matches_; //!< Matchers of keypoint descriptors.
+	Workspace* workspace_; //!< Workspace the buffers are handed back to, NULL for none.
 };
 #endif
\ No newline at end of file
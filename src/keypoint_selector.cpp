@@ -0,0 +1,202 @@
+#include "keypoint_selector.h"
+
+/**
+ * @brief  Sorts the keypoint indices by decreasing response. Equal responses
+ *         keep the order of the detector.
+ *
+ * @return void
+ * @param  keypoints [in] Keypoints of the image.
+ * @param  order [out] Indices of the keypoints.
+ */
+static void SortByResponse(const std::vector<cv::KeyPoint>& keypoints,
+	std::vector<int>& order) {
+
+	order.resize(keypoints.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = static_cast<int>(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [&keypoints](int a, int b) {
+		return keypoints[a].response > keypoints[b].response;
+	});
+}
+
+/**
+ * @brief  Keeps the selected keypoints in the order of the detector.
+ *
+ * @return void
+ * @param  keypoints [in,out] Keypoints of the image.
+ * @param  selected [in] Indices of the kept keypoints.
+ */
+static void KeepKeypoints(std::vector<cv::KeyPoint>& keypoints,
+	std::vector<int> selected) {
+
+	std::sort(selected.begin(), selected.end());
+	std::vector<cv::KeyPoint> kept(selected.size());
+	for (size_t i = 0; i < selected.size(); ++i) {
+		kept[i] = keypoints[selected[i]];
+	}
+	keypoints.swap(kept);
+}
+
+void SelectKeypoints(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const KeypointBudget& budget) {
+
+	if (!budget.enabled() ||
+		static_cast<int>(keypoints.size()) <= budget.max_keypoints) {
+		return;
+	}
+
+	switch (budget.selection) {
+	case SELECTION_RESPONSE:
+		// One cell ranks by response only. Unlike
+		// cv::KeyPointsFilter::retainBest(), ties never exceed the budget.
+		SelectKeypointsByGrid(keypoints, image_size, budget.max_keypoints,
+			cv::Size(1, 1));
+		break;
+	case SELECTION_GRID:
+		SelectKeypointsByGrid(keypoints, image_size, budget.max_keypoints,
+			budget.grid_size);
+		break;
+	case SELECTION_ANMS:
+		SelectKeypointsByANMS(keypoints, image_size, budget.max_keypoints);
+		break;
+	}
+}
+
+void SelectKeypointsByGrid(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const int max_keypoints,
+	const cv::Size& grid_size) {
+
+	if (max_keypoints <= 0 ||
+		static_cast<int>(keypoints.size()) <= max_keypoints) {
+		return;
+	}
+
+	const int grid_cols = std::max(grid_size.width, 1);
+	const int grid_rows = std::max(grid_size.height, 1);
+	const double scale_x = (double)grid_cols / std::max(image_size.width, 1);
+	const double scale_y = (double)grid_rows / std::max(image_size.height, 1);
+
+	std::vector<int> order;
+	SortByResponse(keypoints, order);
+
+	// Rank of every keypoint within its cell.
+	std::vector<int> cell_count(grid_cols * grid_rows, 0);
+	std::vector<int> rank(keypoints.size());
+	for (size_t k = 0; k < order.size(); ++k) {
+		const cv::Point2f& pt = keypoints[order[k]].pt;
+		int x = static_cast<int>(std::floor(pt.x * scale_x));
+		int y = static_cast<int>(std::floor(pt.y * scale_y));
+		x = std::min(std::max(x, 0), grid_cols - 1);
+		y = std::min(std::max(y, 0), grid_rows - 1);
+		rank[order[k]] = cell_count[y * grid_cols + x]++;
+	}
+
+	// The stable sort keeps the response order within a rank.
+	std::stable_sort(order.begin(), order.end(), [&rank](int a, int b) {
+		return rank[a] < rank[b];
+	});
+	order.resize(max_keypoints);
+	KeepKeypoints(keypoints, order);
+}
+
+/**
+ * @brief  Covers the image with squares centered at the keypoints, in the
+ *         order of the responses. A keypoint is selected if its cell is not
+ *         covered yet.
+ *
+ * @return void
+ * @param  keypoints [in] Keypoints of the image.
+ * @param  order [in] Indices of the keypoints by decreasing response.
+ * @param  image_size [in] Size of the image.
+ * @param  width [in] Suppression radius in pixels.
+ * @param  max_count [in] The covering stops after that many selections.
+ * @param  selected [out] Indices of the selected keypoints.
+ */
+static void CoverBySquares(const std::vector<cv::KeyPoint>& keypoints,
+	const std::vector<int>& order, const cv::Size& image_size, const int width,
+	const int max_count, std::vector<int>& selected) {
+
+	selected.clear();
+	const double cell = std::max(width / 2.0, 1.0);
+	const int span = static_cast<int>(width / cell);
+	const int cols = static_cast<int>(image_size.width / cell) + 1;
+	const int rows = static_cast<int>(image_size.height / cell) + 1;
+	std::vector<uchar> covered((size_t)cols * rows, 0);
+
+	for (size_t k = 0; k < order.size(); ++k) {
+		const cv::Point2f& pt = keypoints[order[k]].pt;
+		int col = std::min(std::max(static_cast<int>(pt.x / cell), 0), cols - 1);
+		int row = std::min(std::max(static_cast<int>(pt.y / cell), 0), rows - 1);
+		if (covered[(size_t)row * cols + col]) continue;
+
+		selected.push_back(order[k]);
+		if (static_cast<int>(selected.size()) >= max_count) return;
+
+		const int r0 = std::max(row - span, 0), r1 = std::min(row + span, rows - 1);
+		const int c0 = std::max(col - span, 0), c1 = std::min(col + span, cols - 1);
+		for (int r = r0; r <= r1; ++r) {
+			uchar* pcovered = &covered[(size_t)r * cols];
+			for (int c = c0; c <= c1; ++c) {
+				pcovered[c] = 1;
+			}
+		}
+	}
+}
+
+void SelectKeypointsByANMS(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const int max_keypoints,
+	const double tolerance) {
+
+	if (max_keypoints <= 0 ||
+		static_cast<int>(keypoints.size()) <= max_keypoints) {
+		return;
+	}
+
+	std::vector<int> order;
+	SortByResponse(keypoints, order);
+
+	const int min_count = static_cast<int>(max_keypoints * (1.0 - tolerance));
+	const int max_count = static_cast<int>(max_keypoints * (1.0 + tolerance)) + 1;
+
+	// A larger radius selects fewer keypoints. A covering that hits max_count
+	// is cut short and only spans the strongest keypoints, so the best
+	// covering is the largest one that ran to completion.
+	int low = 1;
+	int high = std::max(image_size.width, image_size.height);
+	std::vector<int> selected, best;
+	while (low <= high) {
+		const int width = low + (high - low) / 2;
+		CoverBySquares(keypoints, order, image_size, width, max_count, selected);
+		const int count = static_cast<int>(selected.size());
+		if (count >= max_count) {
+			low = width + 1;
+			continue;
+		}
+		if (count > static_cast<int>(best.size())) {
+			best.swap(selected);
+		}
+		if (count >= min_count) break;
+		high = width - 1;
+	}
+
+	// The selection is in the order of the responses, so the weakest
+	// keypoints are dropped first.
+	if (static_cast<int>(best.size()) > max_keypoints) {
+		best.resize(max_keypoints);
+	}
+
+	// Clustered keypoints may not fill the budget, the strongest of the
+	// suppressed ones make up the difference.
+	if (static_cast<int>(best.size()) < max_keypoints) {
+		std::vector<uchar> taken(keypoints.size(), 0);
+		for (size_t i = 0; i < best.size(); ++i) {
+			taken[best[i]] = 1;
+		}
+		for (size_t k = 0; k < order.size() &&
+			static_cast<int>(best.size()) < max_keypoints; ++k) {
+			if (!taken[order[k]]) best.push_back(order[k]);
+		}
+	}
+	KeepKeypoints(keypoints, best);
+}
@@ -0,0 +1,102 @@
+/****************************************************************************//**
+ * @file keypoint_selector.h
+ * @brief Spatially uniform selection of the strongest keypoints.
+ *
+ * A detector run on a large textured image can return tens of thousands of
+ * keypoints, most of them packed into a few textured regions. The selectors
+ * keep at most \f$N\f$ keypoints that are spread over the whole image, either
+ * by bucketing them into a grid or with the adaptive non-maximal suppression
+ * (ANMS) of Suppression via Square Covering (SSC).
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-16
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _KEYPOINT_SELECTOR_H_
+#define _KEYPOINT_SELECTOR_H_
+#include <opencv2/opencv.hpp>
+
+//! Types of the keypoint selection.
+enum KeypointSelection {
+	SELECTION_RESPONSE = 0, //!< The strongest responses, no spatial constraint.
+	SELECTION_GRID = 1,     //!< Round robin over the cells of a grid.
+	SELECTION_ANMS = 2      //!< Adaptive non-maximal suppression.
+};
+
+/**
+ * Budget of the keypoints kept per image.
+ */
+struct KeypointBudget {
+	int max_keypoints;            //!< Maximum number of keypoints, 0 for no limit.
+	KeypointSelection selection;  //!< Selection of the kept keypoints.
+	cv::Size grid_size;           //!< Grid of SELECTION_GRID.
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  max_keypoints [in] Maximum number of keypoints, 0 for no limit.
+	 * @param  selection [in] Selection of the kept keypoints.
+	 * @param  grid_size [in] Grid of SELECTION_GRID.
+	 */
+	KeypointBudget(const int max_keypoints = 0,
+		const KeypointSelection selection = SELECTION_GRID,
+		const cv::Size& grid_size = cv::Size(20, 20))
+		:max_keypoints(max_keypoints), selection(selection), grid_size(grid_size) {}
+
+	//! Whether the budget limits the number of keypoints.
+	bool enabled() const { return max_keypoints > 0; }
+};
+
+/**
+ * @brief  Keeps at most max_keypoints keypoints of the image.
+ *
+ * The kept keypoints stay in the order of the detector. Nothing happens if
+ * the budget is disabled or not exceeded.
+ *
+ * @return void
+ * @param  keypoints [in,out] Keypoints of the image.
+ * @param  image_size [in] Size of the image.
+ * @param  budget [in] Budget of the keypoints.
+ */
+void SelectKeypoints(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const KeypointBudget& budget);
+
+/**
+ * @brief  Keeps the strongest keypoints of every grid cell.
+ *
+ * The keypoints of each cell are ranked by response. All first-ranked
+ * keypoints are taken before any second-ranked one, and so on, so sparse
+ * cells are never starved by dense ones. Ties within a rank go to the
+ * stronger response.
+ *
+ * @return void
+ * @param  keypoints [in,out] Keypoints of the image.
+ * @param  image_size [in] Size of the image.
+ * @param  max_keypoints [in] Maximum number of keypoints.
+ * @param  grid_size [in] Number of cells along the columns and the rows.
+ */
+void SelectKeypointsByGrid(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const int max_keypoints,
+	const cv::Size& grid_size);
+
+/**
+ * @brief  Keeps the keypoints with the largest suppression radii.
+ *
+ * The radius is found by a binary search, and every search step covers the
+ * image with squares of that radius in the order of the responses, which
+ * costs \f$O(n\log n)\f$ instead of the \f$O(n^2)\f$ of the classic ANMS.
+ *
+ * @return void
+ * @param  keypoints [in,out] Keypoints of the image.
+ * @param  image_size [in] Size of the image.
+ * @param  max_keypoints [in] Maximum number of keypoints.
+ * @param  tolerance [in] Accepted relative deviation from max_keypoints.
+ */
+void SelectKeypointsByANMS(std::vector<cv::KeyPoint>& keypoints,
+	const cv::Size& image_size, const int max_keypoints,
+	const double tolerance = 0.1);
+
+#endif
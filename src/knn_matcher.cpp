@@ -0,0 +1,266 @@
+#include "knn_matcher.h"
+
+// Number of extra candidates kept per query by the expanded distance. The
+// more there are, the rarer a query falls back to the exact scan.
+static const int kExtraCandidates = 4;
+
+/**
+ * @brief  Computes the squared L2 norm of every row.
+ *
+ * @return void
+ * @param  des [in] Descriptors, CV_32F.
+ * @param  norms [out] Squared norms, one per row.
+ */
+static void ComputeSquaredNorms(const cv::Mat& des, std::vector<float>& norms) {
+
+	norms.resize(des.rows);
+	for (int i = 0; i < des.rows; ++i) {
+		const float* p = des.ptr<float>(i);
+		float s = 0.f;
+		for (int j = 0; j < des.cols; ++j) {
+			s += p[j] * p[j];
+		}
+		norms[i] = s;
+	}
+}
+
+/**
+ * @brief  Computes the bound of the round-off error of the expanded distance.
+ *
+ * The expanded distance \f$\|a\|^2 + \|b\|^2 - 2a\cdot b\f$ and the
+ * squared distance cv::batchDistance() sums from \f$a - b\f$ both are within
+ * \f$(D + 2)u\,(\|a\|^2 + \|b\|^2)\f$ of the exact one, up to higher
+ * order terms, with the unit round-off \f$u\f$. The bound doubles that to
+ * cover the higher order terms and its own rounding.
+ *
+ * @return double Bound relative to \f$\|a\|^2 + \|b\|^2\f$.
+ * @param  dims [in] Length of the descriptors.
+ */
+static inline double ExpandedDistanceBound(const int dims) {
+
+	return (4.0 * dims + 16.0) * FLT_EPSILON;
+}
+
+/**
+ * @brief  Inserts a candidate into an ascending fixed-size list.
+ *
+ * Candidates with the same distance keep the order of insertion, which
+ * matches the tie breaking of cv::BFMatcher.
+ *
+ * @return void
+ * @param  dist [in,out] Distances of the list.
+ * @param  idx [in,out] Train indices of the list.
+ * @param  size [in] Capacity of the list.
+ * @param  d [in] Distance of the candidate.
+ * @param  j [in] Train index of the candidate.
+ */
+static inline void InsertCandidate(float* dist, int* idx, const int size,
+	const float d, const int j) {
+
+	if (!(d < dist[size - 1])) return;
+	int k = size - 1;
+	while (k > 0 && d < dist[k - 1]) {
+		dist[k] = dist[k - 1];
+		idx[k] = idx[k - 1];
+		--k;
+	}
+	dist[k] = d;
+	idx[k] = j;
+}
+
+/**
+ * Parallel body that searches the nearest neighbors of the query tiles.
+ *
+ * The expanded distances only select the candidates of a query. Their
+ * distances then come from cv::batchDistance(), like those of cv::BFMatcher,
+ * and a query whose discarded candidates may still be within the error bound
+ * of its k-th neighbor is scanned again with cv::batchDistance() over all
+ * train descriptors. The result is the one of cv::BFMatcher, bit for bit.
+ */
+class TiledKnnSearchBody : public cv::ParallelLoopBody {
+public:
+	TiledKnnSearchBody(const cv::Mat& query, const cv::Mat& train,
+		const std::vector<float>& query_norms, const std::vector<float>& train_norms,
+		const float max_train_norm, const int knn, const int query_tile,
+		const int train_tile, int* best_idx, float* best_dist)
+		:query_(query), train_(train), query_norms_(query_norms),
+		train_norms_(train_norms), max_train_norm_(max_train_norm), knn_(knn),
+		query_tile_(query_tile), train_tile_(train_tile), best_idx_(best_idx),
+		best_dist_(best_dist) {}
+
+	void operator()(const cv::Range& range) const {
+
+		const int num_candidates = std::min(knn_ + kExtraCandidates, train_.rows);
+		// With every train descriptor a candidate, no neighbor can be missed.
+		const bool check_bound = num_candidates < train_.rows;
+		const double bound = ExpandedDistanceBound(query_.cols);
+		std::vector<float> cand_dist(query_tile_ * num_candidates);
+		std::vector<int> cand_idx(query_tile_ * num_candidates);
+		std::vector<int> sorted_idx(num_candidates);
+		cv::Mat dots, candidates(num_candidates, query_.cols, CV_32F);
+		cv::Mat exact_dist, exact_idx;
+
+		for (int t = range.start; t < range.end; ++t) {
+			const int r0 = t * query_tile_;
+			const int r1 = std::min(r0 + query_tile_, query_.rows);
+			const cv::Mat query_rows = query_.rowRange(r0, r1);
+
+			std::fill(cand_dist.begin(), cand_dist.end(), FLT_MAX);
+			std::fill(cand_idx.begin(), cand_idx.end(), -1);
+
+			for (int c0 = 0; c0 < train_.rows; c0 += train_tile_) {
+				const int c1 = std::min(c0 + train_tile_, train_.rows);
+				// Blocked dot products of the query tile and the train tile.
+				cv::gemm(query_rows, train_.rowRange(c0, c1), 1.0, cv::noArray(),
+					0.0, dots, cv::GEMM_2_T);
+
+				for (int i = r0; i < r1; ++i) {
+					const float* pdot = dots.ptr<float>(i - r0);
+					float* pdist = &cand_dist[(i - r0) * num_candidates];
+					int* pidx = &cand_idx[(i - r0) * num_candidates];
+					const float qn = query_norms_[i];
+					for (int j = c0; j < c1; ++j) {
+						// ||a||^2 + ||b||^2 - 2a.b
+						float d = qn + train_norms_[j] - 2.f * pdot[j - c0];
+						InsertCandidate(pdist, pidx, num_candidates, d, j);
+					}
+				}
+			}
+
+			for (int i = r0; i < r1; ++i) {
+				const cv::Mat query_row = query_.row(i);
+				const float* pdist = &cand_dist[(i - r0) * num_candidates];
+				const int* pidx = &cand_idx[(i - r0) * num_candidates];
+				int* pbest_idx = best_idx_ + (size_t)i * knn_;
+				float* pbest_dist = best_dist_ + (size_t)i * knn_;
+
+				// The candidates go in by train index so that equal distances
+				// keep the order of the train descriptors.
+				std::copy(pidx, pidx + num_candidates, sorted_idx.begin());
+				std::sort(sorted_idx.begin(), sorted_idx.end());
+				int n = 0;
+				for (int k = 0; k < num_candidates; ++k) {
+					if (sorted_idx[k] < 0) continue;
+					sorted_idx[n] = sorted_idx[k];
+					train_.row(sorted_idx[n]).copyTo(candidates.row(n));
+					++n;
+				}
+				if (n == 0) continue;
+
+				const int num_exact = std::min(knn_, n);
+				cv::batchDistance(query_row, candidates.rowRange(0, n), exact_dist,
+					CV_32F, exact_idx, cv::NORM_L2, num_exact);
+				const float* pexact_dist = exact_dist.ptr<float>(0);
+				const int* pexact_idx = exact_idx.ptr<int>(0);
+
+				bool selected = true;
+				if (check_bound) {
+					// Every discarded candidate is at least this far away.
+					const double lower = pdist[num_candidates - 1] -
+						bound * (query_norms_[i] + max_train_norm_);
+					selected = num_exact == knn_ && pexact_idx[knn_ - 1] >= 0 &&
+						lower > 0 && std::sqrt(lower) * (1.0 - FLT_EPSILON) > pexact_dist[knn_ - 1];
+				}
+
+				if (selected) {
+					for (int k = 0; k < num_exact; ++k) {
+						if (pexact_idx[k] < 0) break;
+						pbest_idx[k] = sorted_idx[pexact_idx[k]];
+						pbest_dist[k] = pexact_dist[k];
+					}
+					continue;
+				}
+
+				// A discarded candidate may tie with the k-th neighbor.
+				cv::batchDistance(query_row, train_, exact_dist, CV_32F, exact_idx,
+					cv::NORM_L2, knn_);
+				pexact_dist = exact_dist.ptr<float>(0);
+				pexact_idx = exact_idx.ptr<int>(0);
+				for (int k = 0; k < knn_; ++k) {
+					if (pexact_idx[k] < 0) break;
+					pbest_idx[k] = pexact_idx[k];
+					pbest_dist[k] = pexact_dist[k];
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat& query_;
+	const cv::Mat& train_;
+	const std::vector<float>& query_norms_;
+	const std::vector<float>& train_norms_;
+	const float max_train_norm_;
+	const int knn_;
+	const int query_tile_;
+	const int train_tile_;
+	int* best_idx_;
+	float* best_dist_;
+};
+
+TiledKnnMatcher::TiledKnnMatcher(const int query_tile, const int train_tile)
+	:query_tile_(std::max(query_tile, 1)), train_tile_(std::max(train_tile, 1)) {}
+
+TiledKnnMatcher::~TiledKnnMatcher() {}
+
+void TiledKnnMatcher::Search(const cv::Mat& query, const cv::Mat& train,
+	const int knn, int* best_idx, float* best_dist) const {
+
+	std::fill(best_idx, best_idx + (size_t)query.rows * knn, -1);
+	std::fill(best_dist, best_dist + (size_t)query.rows * knn, FLT_MAX);
+	if (query.empty() || train.empty()) return;
+
+	CV_Assert(query.type() == CV_32F && train.type() == CV_32F &&
+		query.cols == train.cols);
+
+	std::vector<float> query_norms, train_norms;
+	ComputeSquaredNorms(query, query_norms);
+	ComputeSquaredNorms(train, train_norms);
+
+	const float max_train_norm = *std::max_element(train_norms.begin(), train_norms.end());
+
+	const int num_tiles = (query.rows + query_tile_ - 1) / query_tile_;
+	TiledKnnSearchBody body(query, train, query_norms, train_norms, max_train_norm,
+		knn, query_tile_, train_tile_, best_idx, best_dist);
+	cv::parallel_for_(cv::Range(0, num_tiles), body, num_tiles);
+}
+
+void TiledKnnMatcher::KnnMatch(const cv::Mat& query, const cv::Mat& train,
+	std::vector<std::vector<cv::DMatch> >& matches, const int knn) const {
+
+	MatchTable table;
+	KnnMatch(query, train, table, knn);
+	table.ToNested(matches);
+}
+
+void TiledKnnMatcher::KnnMatch(const cv::Mat& query, const cv::Mat& train,
+	MatchTable& matches, const int knn) const {
+
+	matches.Create(query.rows, std::max(knn, 0));
+	if (knn <= 0) return;
+
+	Search(query, train, knn, matches.TrainIdxData(), matches.DistancesData());
+}
+
+void TiledKnnMatcher::RatioMatch(const cv::Mat& query, const cv::Mat& train,
+	const double ratio, std::vector<cv::DMatch>& matches,
+	std::vector<double>& scores) const {
+
+	matches.clear();
+	scores.clear();
+
+	std::vector<int> best_idx((size_t)query.rows * 2);
+	std::vector<float> best_dist((size_t)query.rows * 2);
+	Search(query, train, 2, best_idx.data(), best_dist.data());
+
+	double score;
+	for (int i = 0; i < query.rows; ++i) {
+		// A query without a second neighbor can't be tested.
+		if (best_idx[2 * i + 1] < 0) continue;
+		score = best_dist[2 * i] / best_dist[2 * i + 1];
+		if (score < ratio) {
+			matches.push_back(cv::DMatch(i, best_idx[2 * i], best_dist[2 * i]));
+			scores.push_back(score);
+		}
+	}
+}
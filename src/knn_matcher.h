@@ -0,0 +1,108 @@
+/****************************************************************************//**
+ * @file knn_matcher.h
+ * @brief A multi-threaded tiled brute-force \f$k\f$ nearest neighbor matcher.
+ *
+ * The squared distances are computed tile by tile as
+ * \f$\|a\|^2 + \|b\|^2 - 2a\cdot b\f$, where the dot products of a tile come
+ * from one matrix product. Every query keeps its best candidates in a small
+ * fixed-size sorted array, and the candidates are re-ranked with the
+ * distances of cv::batchDistance(). A query whose discarded candidates are
+ * within the round-off bound of the expanded distance of its k-th neighbor
+ * is scanned again in full, so the output equals the one of the
+ * BruteForce-L2 matcher of OpenCV, ties going to the lower train index.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-09-24
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _KNN_MATCHER_H_
+#define _KNN_MATCHER_H_
+#include <opencv2/opencv.hpp>
+#include "match_table.h"
+
+/**
+ * Class for the tiled brute-force matcher.
+ */
+class TiledKnnMatcher {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  query_tile [in] Number of query descriptors per tile.
+	 * @param  train_tile [in] Number of train descriptors per tile.
+	 */
+	explicit TiledKnnMatcher(const int query_tile = 256, const int train_tile = 1024);
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~TiledKnnMatcher();
+
+	/**
+	 * @brief  Finds the k best matches for each query descriptor.
+	 *
+	 * The query tiles are processed in parallel with cv::parallel_for_.
+	 *
+	 * @return void
+	 * @param  query [in] Query descriptors, \f$N\times D\f$, CV_32F.
+	 * @param  train [in] Train descriptors, \f$M\times D\f$, CV_32F.
+	 * @param  matches [out] Matches, sorted by increasing distance per query.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	void KnnMatch(const cv::Mat& query, const cv::Mat& train,
+		std::vector<std::vector<cv::DMatch> >& matches, const int knn) const;
+
+	/**
+	 * @brief  Finds the k best matches for each query descriptor and writes 
+	 *         them into a match table without intermediate copies.
+	 *
+	 * @return void
+	 * @param  query [in] Query descriptors, \f$N\times D\f$, CV_32F.
+	 * @param  train [in] Train descriptors, \f$M\times D\f$, CV_32F.
+	 * @param  matches [out] Matches, \f$N\times k\f$.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	void KnnMatch(const cv::Mat& query, const cv::Mat& train,
+		MatchTable& matches, const int knn) const;
+
+	/**
+	 * @brief  Finds the best match for each query descriptor and applies 
+	 *         Lowe's ratio test in the same pass.
+	 *
+	 * Only the two best distances are kept per query, and the surviving 
+	 * matches are written into one flat vector in query order.
+	 *
+	 * @return void
+	 * @param  query [in] Query descriptors, \f$N\times D\f$, CV_32F.
+	 * @param  train [in] Train descriptors, \f$M\times D\f$, CV_32F.
+	 * @param  ratio [in] Threshold for ratio test.
+	 * @param  matches [out] Matches passing the ratio test.
+	 * @param  scores [out] Distance ratios of the matches.
+	 */
+	void RatioMatch(const cv::Mat& query, const cv::Mat& train,
+		const double ratio, std::vector<cv::DMatch>& matches,
+		std::vector<double>& scores) const;
+
+private:
+	/**
+	 * @brief  Searches the k nearest neighbors of every query descriptor.
+	 *
+	 * @return void
+	 * @param  query [in] Query descriptors, \f$N\times D\f$, CV_32F.
+	 * @param  train [in] Train descriptors, \f$M\times D\f$, CV_32F.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  best_idx [out] Train indices, \f$N\times k\f$, -1 if missing.
+	 * @param  best_dist [out] Distances, \f$N\times k\f$.
+	 */
+	void Search(const cv::Mat& query, const cv::Mat& train, const int knn,
+		int* best_idx, float* best_dist) const;
+
+private:
+	const int query_tile_; //!< Number of query descriptors per tile.
+	const int train_tile_; //!< Number of train descriptors per tile.
+};
+#endif
@@ -0,0 +1,388 @@
+#include "gms_fixed_grid.h"
+#include "../profiler.h"
+
+// 8 possible rotation and each one is 3 X 3, as in gms_matcher.cpp
+static constexpr int kRotationPatterns[8][9] = {
+	{ 1, 2, 3,
+	  4, 5, 6,
+	  7, 8, 9 },
+
+	{ 4, 1, 2,
+	  7, 5, 3,
+	  8, 9, 6 },
+
+	{ 7, 4, 1,
+	  8, 5, 2,
+	  9, 6, 3 },
+
+	{ 8, 7, 4,
+	  9, 5, 1,
+	  6, 3, 2 },
+
+	{ 9, 8, 7,
+	  6, 5, 4,
+	  3, 2, 1 },
+
+	{ 6, 9, 8,
+	  3, 5, 7,
+	  2, 1, 4 },
+
+	{ 3, 6, 9,
+	  2, 5, 8,
+	  1, 4, 7 },
+
+	{ 2, 3, 6,
+	  1, 5, 9,
+	  4, 7, 8 }
+};
+
+static const int kNumberScales = 5;
+static const int kNumberRotations = 8;
+
+/**
+ * @brief  Gets the integer square root.
+ *
+ * @return int Largest k with \f$k^2 \le n\f$.
+ * @param  n [in] Non-negative integer.
+ * @param  k [in] Current candidate.
+ */
+static constexpr int ISqrt(const int n, const int k = 0) {
+	return (k + 1) * (k + 1) > n ? k : ISqrt(n, k + 1);
+}
+
+/**
+ * @brief  Gets the size of a right grid, int(size * kScaleRatios[Scale]) of
+ *         GMS_Matcher for the ratios 1, 1/2, 1/sqrt(2), sqrt(2) and 2.
+ *
+ * @return int Size of the right grid.
+ * @param  size [in] Size of the left grid.
+ * @param  Scale [in] Index of the scale, 0 to 4.
+ */
+static constexpr int ScaledGridSize(const int size, const int Scale) {
+	return Scale == 0 ? size :
+		Scale == 1 ? size / 2 :
+		Scale == 2 ? ISqrt(size * size / 2) :
+		Scale == 3 ? ISqrt(2 * size * size) : 2 * size;
+}
+
+/**
+ * Unrolled sum over the 3x3 neighborhood of a cell-pair. Step J pairs the
+ * J-th neighbor of the left cell with the neighbor of the right cell given
+ * by the rotation pattern.
+ */
+template <int GridWidth, int GridHeight, int RightWidth, int RightHeight,
+	int RotationType, int J>
+struct NB9Accumulator {
+	static void Run(const int lx, const int ly, const int rx, const int ry,
+		const int* statistics, const int* points, int& score, int& thresh,
+		int& numpair) {
+
+		constexpr int P = kRotationPatterns[RotationType - 1][J] - 1;
+		const int llx = lx + J % 3 - 1, lly = ly + J / 3 - 1;
+		const int rrx = rx + P % 3 - 1, rry = ry + P / 3 - 1;
+		if (llx >= 0 && llx < GridWidth && lly >= 0 && lly < GridHeight &&
+			rrx >= 0 && rrx < RightWidth && rry >= 0 && rry < RightHeight) {
+			const int ll = llx + lly * GridWidth;
+			score += statistics[ll * (RightWidth * RightHeight) + rrx + rry * RightWidth];
+			thresh += points[ll];
+			numpair++;
+		}
+
+		NB9Accumulator<GridWidth, GridHeight, RightWidth, RightHeight, RotationType,
+			J + 1>::Run(lx, ly, rx, ry, statistics, points, score, thresh, numpair);
+	}
+};
+
+template <int GridWidth, int GridHeight, int RightWidth, int RightHeight,
+	int RotationType>
+struct NB9Accumulator<GridWidth, GridHeight, RightWidth, RightHeight,
+	RotationType, 9> {
+	static void Run(const int, const int, const int, const int, const int*,
+		const int*, int&, int&, int&) {}
+};
+
+/**
+ * Parallel body that evaluates the scale and rotation hypotheses, with the
+ * stripes of GMS_Matcher so that ties go to the same hypothesis.
+ */
+template <int GridWidth, int GridHeight>
+class GMS_FixedGridKernel<GridWidth, GridHeight>::ParallelHypothesisBody
+	: public cv::ParallelLoopBody {
+public:
+	ParallelHypothesisBody(const GMS_FixedGridKernel& kernel,
+		std::vector<HypothesisState>& states, const int num_hypotheses,
+		const int num_rotations)
+		:kernel_(kernel), states_(states), num_hypotheses_(num_hypotheses),
+		num_rotations_(num_rotations) {}
+
+	void operator()(const cv::Range& range) const {
+
+		const int num_stripes = static_cast<int>(states_.size());
+		for (int s = range.start; s < range.end; ++s) {
+			HypothesisState& state = states_[s];
+			const int h0 = s * num_hypotheses_ / num_stripes;
+			const int h1 = (s + 1) * num_hypotheses_ / num_stripes;
+			state.mBestInlier = 0;
+
+			for (int h = h0; h < h1; ++h) {
+				HypothesisFunction run = GetHypothesis(h / num_rotations_,
+					h % num_rotations_ + 1);
+				int num_inlier = (kernel_.*run)(state);
+				if (num_inlier > state.mBestInlier) {
+					state.mvbBestMask = state.mvbInlierMask;
+					state.mBestInlier = num_inlier;
+				}
+			}
+		}
+	}
+
+private:
+	const GMS_FixedGridKernel& kernel_;
+	std::vector<HypothesisState>& states_;
+	const int num_hypotheses_;
+	const int num_rotations_;
+};
+
+template <int GridWidth, int GridHeight>
+GMS_FixedGridKernel<GridWidth, GridHeight>::GMS_FixedGridKernel(const double alpha)
+	:mAlpha(alpha), mvP2(NULL), mvMatches(NULL) {}
+
+template <int GridWidth, int GridHeight>
+int GMS_FixedGridKernel<GridWidth, GridHeight>::GetInlierMask(
+	const std::vector<cv::Point2f>& vP1, const std::vector<cv::Point2f>& vP2,
+	const std::vector<std::pair<int, int> >& vMatches,
+	std::vector<bool>& vbInliers, bool WithScale, bool WithRotation,
+	bool Parallel) {
+
+	mvP2 = &vP2;
+	mvMatches = &vMatches;
+	mHalfCellX.resize(vMatches.size());
+	mHalfCellY.resize(vMatches.size());
+	for (size_t i = 0; i < vMatches.size(); i++) {
+		const cv::Point2f& lp = vP1[vMatches[i].first];
+		mHalfCellX[i] = (int)std::floor(lp.x * (2 * GridWidth));
+		mHalfCellY[i] = (int)std::floor(lp.y * (2 * GridHeight));
+	}
+
+	// The right cells of the previous matches are stale.
+	mState.mScale = -1;
+	for (size_t s = 0; s < mParallelStates.size(); s++) {
+		mParallelStates[s].mScale = -1;
+	}
+
+	int max_inlier = 0;
+	vbInliers.assign(vMatches.size(), false);
+
+	if (!WithScale && !WithRotation) {
+		max_inlier = Run<0, 1>(mState);
+		vbInliers.assign(mState.mvbInlierMask.begin(), mState.mvbInlierMask.end());
+		return max_inlier;
+	}
+
+	const int num_scales = WithScale ? kNumberScales : 1;
+	const int num_rotations = WithRotation ? kNumberRotations : 1;
+	const int num_hypotheses = num_scales * num_rotations;
+
+	if (Parallel) {
+		const int num_stripes = std::max(1,
+			std::min(cv::getNumThreads(), num_hypotheses));
+		if ((int)mParallelStates.size() != num_stripes) {
+			mParallelStates.resize(num_stripes);
+		}
+		ParallelHypothesisBody body(*this, mParallelStates, num_hypotheses,
+			num_rotations);
+		cv::parallel_for_(cv::Range(0, num_stripes), body, num_stripes);
+
+		int best_stripe = -1;
+		for (int s = 0; s < num_stripes; s++) {
+			if (mParallelStates[s].mBestInlier > max_inlier) {
+				max_inlier = mParallelStates[s].mBestInlier;
+				best_stripe = s;
+			}
+		}
+		if (best_stripe >= 0) {
+			const std::vector<uchar>& mask = mParallelStates[best_stripe].mvbBestMask;
+			vbInliers.assign(mask.begin(), mask.end());
+		}
+		return max_inlier;
+	}
+
+	for (int h = 0; h < num_hypotheses; h++) {
+		HypothesisFunction run = GetHypothesis(h / num_rotations,
+			h % num_rotations + 1);
+		int num_inlier = (this->*run)(mState);
+
+		if (num_inlier > max_inlier) {
+			vbInliers.assign(mState.mvbInlierMask.begin(), mState.mvbInlierMask.end());
+			max_inlier = num_inlier;
+		}
+	}
+
+	return max_inlier;
+}
+
+template <int GridWidth, int GridHeight>
+template <int Scale, int RotationType>
+int GMS_FixedGridKernel<GridWidth, GridHeight>::Run(HypothesisState& state) const {
+
+	constexpr int RightWidth = ScaledGridSize(GridWidth, Scale);
+	constexpr int RightHeight = ScaledGridSize(GridHeight, Scale);
+	const size_t num_matches = mvMatches->size();
+
+	if (state.mScale != Scale) {
+		// The counts are cleared after every use, so the table of the
+		// largest scale is zeroed only once.
+		const size_t buffer_size = (size_t)kGridNumberLeft *
+			ScaledGridSize(GridWidth, 4) * ScaledGridSize(GridHeight, 4);
+		if (state.mMotionStatistics.size() < buffer_size) {
+			IM_PROFILE_COUNTER("gms.bytes_allocated", (buffer_size -
+				state.mMotionStatistics.size()) * sizeof(int));
+			state.mMotionStatistics.assign(buffer_size, 0);
+		}
+
+		state.mRight.resize(num_matches);
+		for (size_t i = 0; i < num_matches; i++) {
+			const cv::Point2f& rp = (*mvP2)[(*mvMatches)[i].second];
+			const int x = (int)std::floor(rp.x * RightWidth);
+			const int y = (int)std::floor(rp.y * RightHeight);
+			// A point on the right border goes to the next row, as in
+			// GMS_Matcher::GetGridIndexRight().
+			const int rgidx = x + y * RightWidth;
+			state.mRight[i] = (x >= 0 && y >= 0 &&
+				rgidx < RightWidth * RightHeight) ? rgidx : -1;
+		}
+		state.mLeft.resize(num_matches);
+		state.mScale = Scale;
+	}
+
+	state.mvbInlierMask.assign(num_matches, 0);
+
+	AssignMatchPairs<Scale, 1>(state);
+	VerifyCellPairs<Scale, RotationType>(state);
+	AssignMatchPairs<Scale, 2>(state);
+	VerifyCellPairs<Scale, RotationType>(state);
+	AssignMatchPairs<Scale, 3>(state);
+	VerifyCellPairs<Scale, RotationType>(state);
+	AssignMatchPairs<Scale, 4>(state);
+	VerifyCellPairs<Scale, RotationType>(state);
+
+	int num_inlier = 0;
+	for (size_t i = 0; i < num_matches; i++) {
+		num_inlier += state.mvbInlierMask[i];
+	}
+	return num_inlier;
+}
+
+template <int GridWidth, int GridHeight>
+template <int Scale, int GridType>
+void GMS_FixedGridKernel<GridWidth, GridHeight>::AssignMatchPairs(
+	HypothesisState& state) const {
+
+	constexpr int GridNumberRight = ScaledGridSize(GridWidth, Scale) *
+		ScaledGridSize(GridHeight, Scale);
+	// floor(v + 0.5) of the shifted grids is (floor(2v) + 1) / 2.
+	constexpr int ShiftX = (GridType == 2 || GridType == 4) ? 1 : 0;
+	constexpr int ShiftY = (GridType == 3 || GridType == 4) ? 1 : 0;
+
+	std::fill(state.mNumberPointsInPerCellLeft,
+		state.mNumberPointsInPerCellLeft + kGridNumberLeft, 0);
+	std::fill(state.mCellPairs, state.mCellPairs + kGridNumberLeft, -1);
+	std::fill(state.mCellPairCount, state.mCellPairCount + kGridNumberLeft, 0);
+
+	int* statistics = state.mMotionStatistics.data();
+	const size_t num_matches = state.mLeft.size();
+	for (size_t i = 0; i < num_matches; i++) {
+		const int x = (mHalfCellX[i] + ShiftX) >> 1;
+		const int y = (mHalfCellY[i] + ShiftY) >> 1;
+		const int lgidx = state.mLeft[i] = ((unsigned)x < (unsigned)GridWidth &&
+			(unsigned)y < (unsigned)GridHeight) ? x + y * GridWidth : -1;
+		const int rgidx = state.mRight[i];
+		if (lgidx < 0 || rgidx < 0)	continue;
+
+		// Keep the first right cell with the most matches, as the scan of
+		// the dense table does.
+		const int count = ++statistics[lgidx * GridNumberRight + rgidx];
+		if (count > state.mCellPairCount[lgidx] ||
+			(count == state.mCellPairCount[lgidx] && rgidx < state.mCellPairs[lgidx])) {
+			state.mCellPairCount[lgidx] = count;
+			state.mCellPairs[lgidx] = rgidx;
+		}
+		state.mNumberPointsInPerCellLeft[lgidx]++;
+	}
+}
+
+template <int GridWidth, int GridHeight>
+template <int Scale, int RotationType>
+void GMS_FixedGridKernel<GridWidth, GridHeight>::VerifyCellPairs(
+	HypothesisState& state) const {
+
+	constexpr int RightWidth = ScaledGridSize(GridWidth, Scale);
+	constexpr int RightHeight = ScaledGridSize(GridHeight, Scale);
+	constexpr int GridNumberRight = RightWidth * RightHeight;
+
+	int* statistics = state.mMotionStatistics.data();
+	for (int i = 0; i < kGridNumberLeft; i++) {
+		if (state.mNumberPointsInPerCellLeft[i] == 0) continue;
+
+		const int idx_grid_rt = state.mCellPairs[i];
+		int score = 0;
+		int thresh = 0;
+		int numpair = 0;
+		NB9Accumulator<GridWidth, GridHeight, RightWidth, RightHeight, RotationType,
+			0>::Run(i % GridWidth, i / GridWidth, idx_grid_rt % RightWidth,
+			idx_grid_rt / RightWidth, statistics, state.mNumberPointsInPerCellLeft,
+			score, thresh, numpair);
+
+		if (score < mAlpha * sqrt((double)thresh / numpair))
+			state.mCellPairs[i] = -2;
+	}
+
+	// Mark inliers and clear the counts for the next grid shift.
+	const size_t num_matches = state.mLeft.size();
+	for (size_t i = 0; i < num_matches; i++) {
+		const int lgidx = state.mLeft[i];
+		const int rgidx = state.mRight[i];
+		if (lgidx < 0 || rgidx < 0) continue;
+		if (state.mCellPairs[lgidx] == rgidx) {
+			state.mvbInlierMask[i] = 1;
+		}
+		statistics[lgidx * GridNumberRight + rgidx] = 0;
+	}
+}
+
+template <int GridWidth, int GridHeight>
+typename GMS_FixedGridKernel<GridWidth, GridHeight>::HypothesisFunction
+GMS_FixedGridKernel<GridWidth, GridHeight>::GetHypothesis(int Scale,
+	int RotationType) {
+
+#define GMS_FIXED_GRID_ROTATIONS(s) { \
+	&GMS_FixedGridKernel::Run<s, 1>, &GMS_FixedGridKernel::Run<s, 2>, \
+	&GMS_FixedGridKernel::Run<s, 3>, &GMS_FixedGridKernel::Run<s, 4>, \
+	&GMS_FixedGridKernel::Run<s, 5>, &GMS_FixedGridKernel::Run<s, 6>, \
+	&GMS_FixedGridKernel::Run<s, 7>, &GMS_FixedGridKernel::Run<s, 8> }
+
+	static const HypothesisFunction kHypotheses[kNumberScales][kNumberRotations] = {
+		GMS_FIXED_GRID_ROTATIONS(0), GMS_FIXED_GRID_ROTATIONS(1),
+		GMS_FIXED_GRID_ROTATIONS(2), GMS_FIXED_GRID_ROTATIONS(3),
+		GMS_FIXED_GRID_ROTATIONS(4)
+	};
+
+#undef GMS_FIXED_GRID_ROTATIONS
+
+	return kHypotheses[Scale][RotationType - 1];
+}
+
+template class GMS_FixedGridKernel<15, 15>;
+template class GMS_FixedGridKernel<20, 20>;
+
+cv::Ptr<GMS_GridKernel> CreateFixedGridKernel(const cv::Size& grid_size,
+	const double alpha) {
+
+	if (grid_size == cv::Size(15, 15)) {
+		return cv::makePtr<GMS_FixedGridKernel<15, 15> >(alpha);
+	}
+	if (grid_size == cv::Size(20, 20)) {
+		return cv::makePtr<GMS_FixedGridKernel<20, 20> >(alpha);
+	}
+	return cv::Ptr<GMS_GridKernel>();
+}
@@ -0,0 +1,177 @@
+/****************************************************************************//**
+ * @file gms_fixed_grid.h
+ *
+ * @brief GMS kernels specialized at compile time for fixed grid sizes.
+ *
+ * GMS_Matcher computes the cell indices with a switch on the grid shift and
+ * floating point floors, and walks the neighborhoods through lookup tables.
+ * The kernels here take the size of the left grid as template parameters,
+ * and the scale, the grid shift and the rotation pattern of every
+ * hypothesis as template parameters of their inner functions:
+ * - The cell of a point is computed once on a grid of half cells, every grid
+ *   shift then only needs integer additions and shifts.
+ * - The sizes of the right grids are constants, and so is the size of every
+ *   row of the motion statistics.
+ * - The 3x3 neighborhoods are unrolled with the rotation pattern folded in.
+ * - The right cell with the most matches is tracked while counting, and the
+ *   counts are cleared per match, so no full row of the table is scanned.
+ *
+ * The masks are the same as those of GMS_Matcher with the dense statistics
+ * for keypoints inside the images. Of the right points, only those past
+ * the last cell of the right grid are dropped, which GMS_Matcher counts
+ * outside of the row of their left cell.
+ * GMS_Matcher uses these kernels for the grids of CreateFixedGridKernel().
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-22
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _GMS_FIXED_GRID_H_
+#define _GMS_FIXED_GRID_H_
+#include <opencv2/opencv.hpp>
+
+/**
+ * Interface of a GMS kernel, which evaluates the hypotheses on the
+ * normalized points of a GMS_Matcher.
+ */
+class GMS_GridKernel {
+public:
+	/**
+	 * @brief  Destructor.
+	 */
+	virtual ~GMS_GridKernel() {}
+
+	/**
+	 * @brief  Gets the mask of inliers/outliers.
+	 *
+	 * @return int Number of inliers.
+	 * @param  vP1 [in] Normalized points from the left image.
+	 * @param  vP2 [in] Normalized points from the right image.
+	 * @param  vMatches [in] Matches, indices of vP1 and vP2.
+	 * @param  vbInliers [out] Mask of inliers/outliers, all false without inliers.
+	 * @param  WithScale [in] Whether scale invariance is enabled.
+	 * @param  WithRotation [in] Whether rotational invariance is enabled.
+	 * @param  Parallel [in] Whether the hypotheses are evaluated in parallel.
+	 */
+	virtual int GetInlierMask(const std::vector<cv::Point2f>& vP1,
+		const std::vector<cv::Point2f>& vP2,
+		const std::vector<std::pair<int, int> >& vMatches,
+		std::vector<bool>& vbInliers, bool WithScale, bool WithRotation,
+		bool Parallel) = 0;
+};
+
+/**
+ * @brief  Creates the specialized kernel of a grid size.
+ *
+ * @return cv::Ptr<GMS_GridKernel> Kernel, empty if there is no
+ *                                 specialization of the grid size.
+ * @param  grid_size [in] Size of the left grid, 15x15 and 20x20 are
+ *                        specialized.
+ * @param  alpha [in] The factor \f$\alpha\f$ of the desired threshold.
+ */
+cv::Ptr<GMS_GridKernel> CreateFixedGridKernel(const cv::Size& grid_size,
+	const double alpha);
+
+/**
+ * Class for the GMS kernel of a fixed GridWidth x GridHeight left grid.
+ *
+ * The members are defined in gms_fixed_grid.cpp, which instantiates the
+ * grid sizes of CreateFixedGridKernel().
+ */
+template <int GridWidth, int GridHeight>
+class GMS_FixedGridKernel : public GMS_GridKernel {
+public:
+	static const int kGridNumberLeft = GridWidth * GridHeight; //!< Number of left cells.
+
+	/**
+	 * @brief  Constructor.
+	 *
+	 * @param  alpha [in] The factor \f$\alpha\f$ of the desired threshold.
+	 */
+	explicit GMS_FixedGridKernel(const double alpha);
+
+	int GetInlierMask(const std::vector<cv::Point2f>& vP1,
+		const std::vector<cv::Point2f>& vP2,
+		const std::vector<std::pair<int, int> >& vMatches,
+		std::vector<bool>& vbInliers, bool WithScale, bool WithRotation,
+		bool Parallel);
+
+private:
+	/**
+	 * Buffers of one scale and rotation hypothesis. Every worker thread owns
+	 * one of them in the parallel mode.
+	 */
+	struct HypothesisState {
+		int mScale;                       //!< Scale of mRight, -1 before the first one.
+		std::vector<int> mRight;          //!< Right cell of every match.
+		std::vector<int> mLeft;           //!< Left cell of every match for the current shift.
+		std::vector<int> mMotionStatistics;   //!< Dense counts, rows of the right grid size.
+		int mNumberPointsInPerCellLeft[kGridNumberLeft]; //!< Number of matches per left cell.
+		int mCellPairs[kGridNumberLeft];  //!< Right cell of every left cell, -1 empty, -2 rejected.
+		int mCellPairCount[kGridNumberLeft];  //!< Number of matches of mCellPairs.
+		std::vector<uchar> mvbInlierMask; //!< Mask of inliers/outliers.
+		std::vector<uchar> mvbBestMask;   //!< Best mask of the hypotheses of a worker.
+		int mBestInlier;                  //!< Number of inliers of the best mask.
+
+		HypothesisState() :mScale(-1), mBestInlier(0) {}
+	};
+
+	//! Evaluation of one hypothesis, instantiated for every scale and rotation.
+	typedef int (GMS_FixedGridKernel::*HypothesisFunction)(HypothesisState&) const;
+
+	class ParallelHypothesisBody;
+
+	/**
+	 * @brief  Evaluates one hypothesis.
+	 *
+	 * @return int Number of inliers.
+	 * @param  state [in,out] Buffers of the hypothesis.
+	 */
+	template <int Scale, int RotationType>
+	int Run(HypothesisState& state) const;
+
+	/**
+	 * @brief  Counts the matches of the cell-pairs of one grid shift and
+	 *         finds the right cell with the most matches for every left one.
+	 *
+	 * @return void
+	 * @param  state [in,out] Buffers of the hypothesis.
+	 */
+	template <int Scale, int GridType>
+	void AssignMatchPairs(HypothesisState& state) const;
+
+	/**
+	 * @brief  Verifies the cell-pairs, marks the inliers and clears the counts.
+	 *
+	 * @return void
+	 * @param  state [in,out] Buffers of the hypothesis.
+	 */
+	template <int Scale, int RotationType>
+	void VerifyCellPairs(HypothesisState& state) const;
+
+	/**
+	 * @brief  Gets the evaluation of a hypothesis.
+	 *
+	 * @return HypothesisFunction Evaluation.
+	 * @param  Scale [in] Index of the scale, 0 to 4.
+	 * @param  RotationType [in] Rotation type, 1 to 8.
+	 */
+	static HypothesisFunction GetHypothesis(int Scale, int RotationType);
+
+private:
+	const double mAlpha;  //!< The factor \f$\alpha\f$ of the desired threshold.
+
+	const std::vector<cv::Point2f>* mvP2;  //!< Normalized points from the right image.
+	const std::vector<std::pair<int, int> >* mvMatches; //!< Matches.
+
+	std::vector<int> mHalfCellX; //!< Column of the left point of every match on the grid of half cells.
+	std::vector<int> mHalfCellY; //!< Row of the left point of every match on the grid of half cells.
+
+	HypothesisState mState; //!< Buffers of the serial evaluation.
+	std::vector<HypothesisState> mParallelStates; //!< Buffers of the parallel workers.
+};
+
+#endif
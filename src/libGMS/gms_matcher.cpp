@@ -1,43 +1,47 @@
 #include "gms_matcher.h"
+#include "../profiler.h"
 //#define THRESH_FACTOR 3  //// initial 6 \alpha
 
 // 8 possible rotation and each one is 3 X 3 
-const int kRotationPatterns[8][9] = {
-	1, 2, 3,
-	4, 5, 6,
-	7, 8, 9,
-
-	4, 1, 2,
-	7, 5, 3,
-	8, 9, 6,
-
-	7, 4, 1,
-	8, 5, 2,
-	9, 6, 3,
-
-	8, 7, 4,
-	9, 5, 1,
-	6, 3, 2,
-
-	9, 8, 7,
-	6, 5, 4,
-	3, 2, 1,
-
-	6, 9, 8,
-	3, 5, 7,
-	2, 1, 4,
-
-	3, 6, 9,
-	2, 5, 8,
-	1, 4, 7,
-
-	2, 3, 6,
-	1, 5, 9,
-	4, 7, 8
+static constexpr int kRotationPatterns[8][9] = {
+	{ 1, 2, 3,
+	  4, 5, 6,
+	  7, 8, 9 },
+
+	{ 4, 1, 2,
+	  7, 5, 3,
+	  8, 9, 6 },
+
+	{ 7, 4, 1,
+	  8, 5, 2,
+	  9, 6, 3 },
+
+	{ 8, 7, 4,
+	  9, 5, 1,
+	  6, 3, 2 },
+
+	{ 9, 8, 7,
+	  6, 5, 4,
+	  3, 2, 1 },
+
+	{ 6, 9, 8,
+	  3, 5, 7,
+	  2, 1, 4 },
+
+	{ 3, 6, 9,
+	  2, 5, 8,
+	  1, 4, 7 },
+
+	{ 2, 3, 6,
+	  1, 5, 9,
+	  4, 7, 8 }
 };
 
 // 5 level scales
-const double kScaleRatios[5] = { 1.0, 1.0 / 2, 1.0 / sqrt(2.0), sqrt(2.0), 2.0 };
+static const int kNumberScales = 5;
+static const int kNumberRotations = 8;
+const double kScaleRatios[kNumberScales] = { 1.0, 1.0 / 2, 1.0 / sqrt(2.0), 
+	sqrt(2.0), 2.0 };
 
 GMS_Matcher::GMS_Matcher() {}
 
@@ -46,14 +50,18 @@ GMS_Matcher::~GMS_Matcher() {}
 GMS_Matcher::GMS_Matcher(const std::vector<cv::KeyPoint>& vkp1,
 	const cv::Size& size1, const std::vector<cv::KeyPoint>& vkp2,
 	const cv::Size& size2, const std::vector<cv::DMatch>& vDMatches, 
-	const cv::Size& grid_size, const double alpha) {
+	const cv::Size& grid_size, const double alpha,
+	const GMS_StatisticsType statistics)
+	:GMS_Matcher(grid_size, alpha, statistics) {
 	// Input initialize
-	NormalizePoints(vkp1, size1, mvP1);
-	NormalizePoints(vkp2, size2, mvP2);
-	mNumberMatches = vDMatches.size();
-	ConvertMatches(vDMatches, mvMatches);
+	SetMatches(vkp1, size1, vkp2, size2, vDMatches);
+}
+
+GMS_Matcher::GMS_Matcher(const cv::Size& grid_size, const double alpha,
+	const GMS_StatisticsType statistics) :mNumberMatches(0) {
 
 	mAlpha = alpha;
+	mStatisticsType = statistics;
 	// Grid initialize
 	mGridSizeLeft = grid_size;
 	//mGridSizeLeft = cv::Size(15, 15);  //// initial cv::Size(20, 20)
@@ -62,61 +70,157 @@ GMS_Matcher::GMS_Matcher(const std::vector<cv::KeyPoint>& vkp1,
 	// Initialize the neighbor of left grid 
 	mGridNeighborLeft = cv::Mat::zeros(mGridNumberLeft, 9, CV_32SC1);
 	InitializeNeighbors(mGridNeighborLeft, mGridSizeLeft);
-}
 
-int GMS_Matcher::GetInlierMask(std::vector<bool>& vbInliers, bool WithScale,
-	bool WithRotation) {
+	// Initialize the neighbor of right grid of every scale
+	mMaxGridNumberRight = 0;
+	for (int Scale = 0; Scale < kNumberScales; Scale++) {
+		int width = int(mGridSizeLeft.width  * kScaleRatios[Scale]);
+		int height = int(mGridSizeLeft.height * kScaleRatios[Scale]);
+		mGridNeighborRightScales[Scale] = cv::Mat::zeros(width * height, 9, CV_32SC1);
+		InitializeNeighbors(mGridNeighborRightScales[Scale], cv::Size(width, height));
+		mMaxGridNumberRight = std::max(mMaxGridNumberRight, width * height);
+	}
 
-	int max_inlier = 0;
+	UseFixedGridKernel(true);
+}
 
-	if (!WithScale && !WithRotation) {
-		SetScale(0);
-		max_inlier = Run(1);
-		vbInliers = mvbInlierMask;
-		return max_inlier;
+bool GMS_Matcher::UseFixedGridKernel(const bool enable) {
+
+	mFixedGridKernel.release();
+	if (enable && mStatisticsType == GMS_STATISTICS_DENSE) {
+		mFixedGridKernel = CreateFixedGridKernel(mGridSizeLeft, mAlpha);
 	}
+	return !mFixedGridKernel.empty();
+}
 
-	if (WithRotation && WithScale) {
-		for (int Scale = 0; Scale < 5; Scale++) {
-			SetScale(Scale);
-			for (int RotationType = 1; RotationType <= 8; RotationType++) {
-				int num_inlier = Run(RotationType);
+void GMS_Matcher::SetMatches(const std::vector<cv::KeyPoint>& vkp1,
+	const cv::Size& size1, const std::vector<cv::KeyPoint>& vkp2,
+	const cv::Size& size2, const std::vector<cv::DMatch>& vDMatches) {
 
-				if (num_inlier > max_inlier) {
-					vbInliers = mvbInlierMask;
-					max_inlier = num_inlier;
+	NormalizePoints(vkp1, size1, mvP1);
+	NormalizePoints(vkp2, size2, mvP2);
+	mNumberMatches = vDMatches.size();
+	ConvertMatches(vDMatches, mvMatches);
+}
+
+/**
+ * Parallel body that evaluates the scale and rotation hypotheses.
+ *
+ * The hypotheses are split into contiguous stripes, and stripe s keeps its
+ * best mask in the s-th buffers of the matcher. Reducing the stripes in 
+ * order afterwards gives ties to the hypothesis that comes first in the 
+ * serial order.
+ */
+class GMS_Matcher::ParallelHypothesisBody : public cv::ParallelLoopBody {
+public:
+	ParallelHypothesisBody(const GMS_Matcher& matcher,
+		std::vector<HypothesisState>& states, const int num_hypotheses,
+		const int num_rotations)
+		:matcher_(matcher), states_(states), num_hypotheses_(num_hypotheses),
+		num_rotations_(num_rotations) {}
+
+	void operator()(const cv::Range& range) const {
+
+		const int num_stripes = static_cast<int>(states_.size());
+		for (int s = range.start; s < range.end; ++s) {
+			HypothesisState& state = states_[s];
+			const int h0 = s * num_hypotheses_ / num_stripes;
+			const int h1 = (s + 1) * num_hypotheses_ / num_stripes;
+			int current_scale = -1;
+			state.mBestInlier = 0;
+
+			for (int h = h0; h < h1; ++h) {
+				int Scale = h / num_rotations_;
+				int RotationType = h % num_rotations_ + 1;
+				if (Scale != current_scale) {
+					matcher_.SetScale(Scale, state);
+					current_scale = Scale;
+				}
+
+				int num_inlier = matcher_.Run(RotationType, state);
+				if (num_inlier > state.mBestInlier) {
+					state.mvbBestMask = state.mvbInlierMask;
+					state.mBestInlier = num_inlier;
 				}
 			}
 		}
-		return max_inlier;
 	}
 
-	if (WithRotation && !WithScale) {
-		SetScale(0);
-		for (int RotationType = 1; RotationType <= 8; RotationType++) {
-			int num_inlier = Run(RotationType);
+private:
+	const GMS_Matcher& matcher_;
+	std::vector<HypothesisState>& states_;
+	const int num_hypotheses_;
+	const int num_rotations_;
+};
+
+int GMS_Matcher::GetInlierMask(std::vector<bool>& vbInliers, bool WithScale,
+	bool WithRotation, bool Parallel) {
+
+	IM_PROFILE_SCOPE("gms.inlier_mask");
+	IM_PROFILE_COUNTER("gms.matches", mNumberMatches);
+	IM_PROFILE_COUNTER("gms.hypotheses", (WithScale ? kNumberScales : 1) *
+		(WithRotation ? kNumberRotations : 1));
+	int max_inlier = 0;
 
-			if (num_inlier > max_inlier) {
-				vbInliers = mvbInlierMask;
-				max_inlier = num_inlier;
+	// A search without inliers leaves the mask all false, not the mask of
+	// the previous call.
+	vbInliers.assign(mNumberMatches, false);
+
+	if (!mFixedGridKernel.empty()) {
+		return mFixedGridKernel->GetInlierMask(mvP1, mvP2, mvMatches, vbInliers,
+			WithScale, WithRotation, Parallel);
+	}
+
+	if (!WithScale && !WithRotation) {
+		SetScale(0, mState);
+		max_inlier = Run(1, mState);
+		vbInliers = mState.mvbInlierMask;
+		return max_inlier;
+	}
+
+	// Hypothesis h is the scale h / num_rotations and the rotation type 
+	// h % num_rotations + 1, which is the serial order.
+	const int num_scales = WithScale ? kNumberScales : 1;
+	const int num_rotations = WithRotation ? kNumberRotations : 1;
+	const int num_hypotheses = num_scales * num_rotations;
+
+	if (Parallel) {
+		const int num_stripes = std::max(1, 
+			std::min(cv::getNumThreads(), num_hypotheses));
+		// The buffers of the workers are only allocated for the first call.
+		if ((int)mParallelStates.size() != num_stripes) {
+			mParallelStates.resize(num_stripes);
+		}
+		ParallelHypothesisBody body(*this, mParallelStates, num_hypotheses,
+			num_rotations);
+		cv::parallel_for_(cv::Range(0, num_stripes), body, num_stripes);
+
+		int best_stripe = -1;
+		for (int s = 0; s < num_stripes; s++) {
+			if (mParallelStates[s].mBestInlier > max_inlier) {
+				max_inlier = mParallelStates[s].mBestInlier;
+				best_stripe = s;
 			}
 		}
+		if (best_stripe >= 0) {
+			vbInliers = mParallelStates[best_stripe].mvbBestMask;
+		}
 		return max_inlier;
 	}
 
-	if (!WithRotation && WithScale) {
-		for (int Scale = 0; Scale < 5; Scale++) {
-			SetScale(Scale);
-
-			int num_inlier = Run(1);
+	int current_scale = -1;
+	for (int h = 0; h < num_hypotheses; h++) {
+		if (h / num_rotations != current_scale) {
+			current_scale = h / num_rotations;
+			SetScale(current_scale, mState);
+		}
 
-			if (num_inlier > max_inlier) {
-				vbInliers = mvbInlierMask;
-				max_inlier = num_inlier;
-			}
+		int num_inlier = Run(h % num_rotations + 1, mState);
 
+		if (num_inlier > max_inlier) {
+			vbInliers = mState.mvbInlierMask;
+			max_inlier = num_inlier;
 		}
-		return max_inlier;
 	}
 
 	return max_inlier;
@@ -144,7 +248,7 @@ void GMS_Matcher::ConvertMatches(const std::vector<cv::DMatch>& vDMatches,
 	}
 }
 
-int GMS_Matcher::GetGridIndexLeft(const cv::Point2f& pt, int type) {
+int GMS_Matcher::GetGridIndexLeft(const cv::Point2f& pt, int type) const {
 	int x = 0, y = 0;
 
 	if (type == 1) {
@@ -175,60 +279,135 @@ int GMS_Matcher::GetGridIndexLeft(const cv::Point2f& pt, int type) {
 	return x + y * mGridSizeLeft.width;
 }
 
-int GMS_Matcher::GetGridIndexRight(const cv::Point2f& pt) {
-	int x = (int)floor(pt.x * mGridSizeRight.width);
-	int y = (int)floor(pt.y * mGridSizeRight.height);
+int GMS_Matcher::GetGridIndexRight(const cv::Point2f& pt,
+	const cv::Size& GridSizeRight) const {
+	int x = (int)floor(pt.x * GridSizeRight.width);
+	int y = (int)floor(pt.y * GridSizeRight.height);
 
-	return x + y * mGridSizeRight.width;
+	return x + y * GridSizeRight.width;
 }
 
-void GMS_Matcher::AssignMatchPairs(int GridType) {
+void GMS_Matcher::AssignMatchPairs(int GridType, HypothesisState& state) const {
 
 	for (size_t i = 0; i < mNumberMatches; i++) {
-		cv::Point2f& lp = mvP1[mvMatches[i].first];
-		cv::Point2f& rp = mvP2[mvMatches[i].second];
+		const cv::Point2f& lp = mvP1[mvMatches[i].first];
+		const cv::Point2f& rp = mvP2[mvMatches[i].second];
 
-		int lgidx = mvMatchPairs[i].first = GetGridIndexLeft(lp, GridType);
+		int lgidx = state.mvMatchPairs[i].first = GetGridIndexLeft(lp, GridType);
 		int rgidx = -1;
 
 		if (GridType == 1) {
-			rgidx = mvMatchPairs[i].second = GetGridIndexRight(rp);
+			rgidx = state.mvMatchPairs[i].second = 
+				GetGridIndexRight(rp, state.mGridSizeRight);
 		}
 		else {
-			rgidx = mvMatchPairs[i].second;
+			rgidx = state.mvMatchPairs[i].second;
 		}
 
 		if (lgidx < 0 || rgidx < 0)	continue;
 
-		mMotionStatistics.at<int>(lgidx, rgidx)++;
-		mNumberPointsInPerCellLeft[lgidx]++;
+		if (mStatisticsType == GMS_STATISTICS_DENSE) {
+			state.mMotionStatistics.at<int>(lgidx, rgidx)++;
+		}
+		state.mNumberPointsInPerCellLeft[lgidx]++;
 	}
 
 }
 
-void GMS_Matcher::VerifyCellPairs(int RotationType) {
+void GMS_Matcher::BuildCompactStatistics(HypothesisState& state) const {
+
+	// Bucket the right cells of the matches by their left cells.
+	state.mCellOffsets.resize(mGridNumberLeft + 1);
+	state.mCellOffsets[0] = 0;
+	for (int i = 0; i < mGridNumberLeft; i++) {
+		state.mCellOffsets[i + 1] = state.mCellOffsets[i] + 
+			state.mNumberPointsInPerCellLeft[i];
+	}
+
+	state.mCellSize.assign(mGridNumberLeft, 0);
+	state.mCellRight.resize(state.mCellOffsets[mGridNumberLeft]);
+	state.mCellCount.resize(state.mCellOffsets[mGridNumberLeft]);
+	for (size_t i = 0; i < mNumberMatches; i++) {
+		int lgidx = state.mvMatchPairs[i].first;
+		int rgidx = state.mvMatchPairs[i].second;
+		if (lgidx < 0 || rgidx < 0)	continue;
+
+		state.mCellRight[state.mCellOffsets[lgidx] + state.mCellSize[lgidx]++] = rgidx;
+	}
+
+	// Sort every bucket and count the distinct right cells in place. The 
+	// first right cell with the most matches wins, as in the dense table.
+	for (int i = 0; i < mGridNumberLeft; i++) {
+		int* right = state.mCellRight.data() + state.mCellOffsets[i];
+		int* count = state.mCellCount.data() + state.mCellOffsets[i];
+		int num_points = state.mCellSize[i];
+		if (num_points == 0) continue;
+
+		std::sort(right, right + num_points);
+
+		int num_cells = 0;
+		int max_number = 0;
+		for (int j = 0; j < num_points; j++) {
+			if (num_cells > 0 && right[num_cells - 1] == right[j]) {
+				count[num_cells - 1]++;
+			}
+			else {
+				right[num_cells] = right[j];
+				count[num_cells] = 1;
+				num_cells++;
+			}
+			if (count[num_cells - 1] > max_number) {
+				max_number = count[num_cells - 1];
+				state.mCellPairs[i] = right[num_cells - 1];
+			}
+		}
+		state.mCellSize[i] = num_cells;
+	}
+}
+
+int GMS_Matcher::GetCellPairCount(int ll, int rr,
+	const HypothesisState& state) const {
+
+	if (mStatisticsType == GMS_STATISTICS_DENSE) {
+		return state.mMotionStatistics.at<int>(ll, rr);
+	}
+
+	const int* right = state.mCellRight.data() + state.mCellOffsets[ll];
+	const int num_cells = state.mCellSize[ll];
+	for (int j = 0; j < num_cells && right[j] <= rr; j++) {
+		if (right[j] == rr) {
+			return state.mCellCount[state.mCellOffsets[ll] + j];
+		}
+	}
+	return 0;
+}
+
+void GMS_Matcher::VerifyCellPairs(int RotationType, HypothesisState& state) const {
 
 	const int *CurrentRP = kRotationPatterns[RotationType - 1];
 
 	for (int i = 0; i < mGridNumberLeft; i++) {
-		if (cv::sum(mMotionStatistics.row(i))[0] == 0) {
-			mCellPairs[i] = -1;
+		if (state.mNumberPointsInPerCellLeft[i] == 0) {
+			state.mCellPairs[i] = -1;
 			continue;
 		}
 
-		int *value = mMotionStatistics.ptr<int>(i);
-		int max_number = 0;
-		for (int j = 0; j < mGridNumberRight; j++) {	
-			if (value[j] > max_number) {
-				mCellPairs[i] = j;
-				max_number = value[j];
+		// The compact statistics found the best right cell while counting.
+		if (mStatisticsType == GMS_STATISTICS_DENSE) {
+			int *value = state.mMotionStatistics.ptr<int>(i);
+			int max_number = 0;
+			for (int j = 0; j < state.mGridNumberRight; j++) {	
+				if (value[j] > max_number) {
+					state.mCellPairs[i] = j;
+					max_number = value[j];
+				}
 			}
 		}
 
-		int idx_grid_rt = mCellPairs[i];
+		int idx_grid_rt = state.mCellPairs[i];
 
 		const int *NB9_lt = mGridNeighborLeft.ptr<int>(i);
-		const int *NB9_rt = mGridNeighborRight.ptr<int>(idx_grid_rt);
+		const int *NB9_rt = state.mGridNeighborRight->ptr<int>(idx_grid_rt);
 
 		int score = 0;
 		double thresh = 0;
@@ -239,8 +418,8 @@ void GMS_Matcher::VerifyCellPairs(int RotationType) {
 			int rr = NB9_rt[CurrentRP[j] - 1];
 			if (ll == -1 || rr == -1)	continue;
 
-			score += mMotionStatistics.at<int>(ll, rr);
-			thresh += mNumberPointsInPerCellLeft[ll];
+			score += GetCellPairCount(ll, rr, state);
+			thresh += state.mNumberPointsInPerCellLeft[ll];
 			numpair++;
 		}
 
@@ -248,12 +427,13 @@ void GMS_Matcher::VerifyCellPairs(int RotationType) {
 		thresh = mAlpha * sqrt(thresh / numpair);
 
 		if (score < thresh)
-			mCellPairs[i] = -2;
+			state.mCellPairs[i] = -2;
 	}
 }
 
-std::vector<int> GMS_Matcher::GetNB9(const int idx, const cv::Size& GridSize) {
-	std::vector<int> NB9(9, -1);
+void GMS_Matcher::GetNB9(const int idx, const cv::Size& GridSize, 
+	int* NB9) const {
+	std::fill(NB9, NB9 + 9, -1);
 
 	int idx_x = idx % GridSize.width;
 	int idx_y = idx / GridSize.width;
@@ -270,57 +450,69 @@ std::vector<int> GMS_Matcher::GetNB9(const int idx, const cv::Size& GridSize) {
 			NB9[xi + 4 + yi * 3] = idx_xx + idx_yy * GridSize.width;
 		}
 	}
-	return NB9;
 }
 
 void GMS_Matcher::InitializeNeighbors(cv::Mat& neighbor,
-	const cv::Size& GridSize) {
+	const cv::Size& GridSize) const {
 	for (int i = 0; i < neighbor.rows; i++) {
-		std::vector<int> NB9 = GetNB9(i, GridSize);
-		int *data = neighbor.ptr<int>(i);
-		memcpy(data, &NB9[0], sizeof(int)* 9);
+		GetNB9(i, GridSize, neighbor.ptr<int>(i));
 	}
 }
 
-void GMS_Matcher::SetScale(int Scale) {
+void GMS_Matcher::SetScale(int Scale, HypothesisState& state) const {
 	// Set Scale
-	mGridSizeRight.width = int(mGridSizeLeft.width  * kScaleRatios[Scale]);
-	mGridSizeRight.height = int(mGridSizeLeft.height * kScaleRatios[Scale]);
-	mGridNumberRight = mGridSizeRight.width * mGridSizeRight.height;
-
-	// Initialize the neighbor of right grid 
-	mGridNeighborRight = cv::Mat::zeros(mGridNumberRight, 9, CV_32SC1);
-	InitializeNeighbors(mGridNeighborRight, mGridSizeRight);
+	state.mGridSizeRight.width = int(mGridSizeLeft.width  * kScaleRatios[Scale]);
+	state.mGridSizeRight.height = int(mGridSizeLeft.height * kScaleRatios[Scale]);
+	state.mGridNumberRight = state.mGridSizeRight.width * state.mGridSizeRight.height;
+
+	// The neighbor of right grid was initialized in the constructor
+	state.mGridNeighborRight = &mGridNeighborRightScales[Scale];
+
+	// Motion statistics of the right grid on the memory of the largest one
+	if (mStatisticsType == GMS_STATISTICS_DENSE) {
+		const size_t buffer_size = (size_t)mGridNumberLeft * mMaxGridNumberRight;
+		if (state.mMotionStatisticsBuffer.size() < buffer_size) {
+			IM_PROFILE_COUNTER("gms.bytes_allocated", (buffer_size - 
+				state.mMotionStatisticsBuffer.size()) * sizeof(int));
+			state.mMotionStatisticsBuffer.resize(buffer_size);
+		}
+		state.mMotionStatistics = cv::Mat(mGridNumberLeft, state.mGridNumberRight,
+			CV_32SC1, state.mMotionStatisticsBuffer.data());
+	}
 }
 
-int GMS_Matcher::Run(int RotationType) {
+int GMS_Matcher::Run(int RotationType, HypothesisState& state) const {
 
-	mvbInlierMask.assign(mNumberMatches, false);
+	state.mvbInlierMask.assign(mNumberMatches, false);
 
-	// Initialize Motion Statistics
-	mMotionStatistics = cv::Mat::zeros(mGridNumberLeft, mGridNumberRight, CV_32SC1);
-	mvMatchPairs.assign(mNumberMatches, std::pair<int, int>(0, 0));
+	state.mvMatchPairs.assign(mNumberMatches, std::pair<int, int>(0, 0));
 
 	for (int GridType = 1; GridType <= 4; GridType++) {
 		// initialize
-		mMotionStatistics.setTo(0);
-		mCellPairs.assign(mGridNumberLeft, -1);
-		mNumberPointsInPerCellLeft.assign(mGridNumberLeft, 0);
+		if (mStatisticsType == GMS_STATISTICS_DENSE) {
+			state.mMotionStatistics.setTo(0);
+		}
+		state.mCellPairs.assign(mGridNumberLeft, -1);
+		state.mNumberPointsInPerCellLeft.assign(mGridNumberLeft, 0);
 
-		AssignMatchPairs(GridType);
-		VerifyCellPairs(RotationType);
+		AssignMatchPairs(GridType, state);
+		if (mStatisticsType == GMS_STATISTICS_COMPACT) {
+			BuildCompactStatistics(state);
+		}
+		VerifyCellPairs(RotationType, state);
 
 		// Mark inliers
 		for (size_t i = 0; i < mNumberMatches; i++) {
-			if (mvMatchPairs[i].first == -1) continue;
-			if (mCellPairs[mvMatchPairs[i].first] == mvMatchPairs[i].second) {
-				mvbInlierMask[i] = true;
+			if (state.mvMatchPairs[i].first == -1) continue;
+			if (state.mCellPairs[state.mvMatchPairs[i].first] == 
+				state.mvMatchPairs[i].second) {
+				state.mvbInlierMask[i] = true;
 			}
 		}
 	}
-	//int num_inlier = cv::sum(mvbInlierMask)[0];
+	//int num_inlier = cv::sum(state.mvbInlierMask)[0];
 	int num_inlier = 0;
-	std::for_each(mvbInlierMask.begin(), mvbInlierMask.end(), 
+	std::for_each(state.mvbInlierMask.begin(), state.mvbInlierMask.end(), 
 		[&num_inlier](bool i){if (i) num_inlier++; });
 	return num_inlier;
 }
\ No newline at end of file
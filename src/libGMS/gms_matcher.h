@@ -24,6 +24,13 @@
 #ifndef _GMS_MATCHER_H_
 #define _GMS_MATCHER_H_
 #include <opencv2/opencv.hpp>
+#include "gms_fixed_grid.h"
+
+//! Data structures of the motion statistics.
+enum GMS_StatisticsType {
+	GMS_STATISTICS_DENSE = 0,   //!< Dense table of all left and right cell-pairs.
+	GMS_STATISTICS_COMPACT = 1  //!< Per left cell list of the right cells hit by matches.
+};
 
 /**
  * Class for GMS algorithm.
@@ -50,27 +57,133 @@ public:
 	 * @param  vDMatches [in] The nearest neighbor matches.
 	 * @param  grid_size [in] The size of the grid.
 	 * @param  alpha [in] The factor \f$\alpha\f$ of the desired threshold.
+	 * @param  statistics [in] The data structure of the motion statistics.
+	 *                         The compact one needs \f$O(N)\f$ memory instead
+	 *                         of \f$O(G_l G_r)\f$ and pays off for large grids.
+	 *                         Both give the same result.
 	 */
 	GMS_Matcher(const std::vector<cv::KeyPoint>& vkp1, const cv::Size& size1,
 		const std::vector<cv::KeyPoint>& vkp2, const cv::Size& size2,
 		const std::vector<cv::DMatch>& vDMatches, const cv::Size& grid_size,
-		const double alpha);
+		const double alpha, 
+		const GMS_StatisticsType statistics = GMS_STATISTICS_DENSE);
+
+	/**
+	 * @brief  Constructor of a persistent context without matches.
+	 *
+	 * The neighborhoods of the left grid and of the right grids of all 
+	 * scales are computed once here. Set the matches of every frame with 
+	 * SetMatches(). Once the buffers have grown to the size of a frame, the
+	 * later frames don't allocate any memory.
+	 *
+	 * @param  grid_size [in] The size of the grid.
+	 * @param  alpha [in] The factor \f$\alpha\f$ of the desired threshold.
+	 * @param  statistics [in] The data structure of the motion statistics.
+	 */
+	GMS_Matcher(const cv::Size& grid_size, const double alpha,
+		const GMS_StatisticsType statistics = GMS_STATISTICS_DENSE);
+
+	/**
+	 * @brief  Replaces the matches of the context. The buffers keep their 
+	 *         capacity.
+	 *
+	 * @return void
+	 * @param  vkp1 [in] The keypoints from the left image.
+	 * @param  size1 [in] The size of the left image.
+	 * @param  vkp2 [in] The keypoints from the right image.
+	 * @param  size2 [in] The size of the right image.
+	 * @param  vDMatches [in] The nearest neighbor matches.
+	 */
+	void SetMatches(const std::vector<cv::KeyPoint>& vkp1, const cv::Size& size1,
+		const std::vector<cv::KeyPoint>& vkp2, const cv::Size& size2,
+		const std::vector<cv::DMatch>& vDMatches);
 	
 	/**
 	 * @brief  Gets the mask of inliers/outliers.
 	 *
 	 * @return int Number of inliers.
 	 * @param  vbInliers [out] Output vector that contains the Boolean values 
-	 *                         indicating whether the matches are true.
+	 *                         indicating whether the matches are true, all
+	 *                         false if no hypothesis finds an inlier.
 	 * @param  WithScale [in] Parameter defining whether scale invariance 
 	 *                        should be enabled.
 	 * @param  WithRotation [in] Parameter defining whether rotational 
 	 *                           invariance should be enabled.
+	 * @param  Parallel [in] Parameter defining whether the scale and rotation
+	 *                       hypotheses should be evaluated in parallel. The 
+	 *                       result is the same as the serial evaluation.
 	 */
 	int GetInlierMask(std::vector<bool>& vbInliers, bool WithScale = false,
-		bool WithRotation = false);
+		bool WithRotation = false, bool Parallel = false);
+
+	/**
+	 * @brief  Enables or disables the kernel specialized for the grid size.
+	 *
+	 * The dense statistics of the 15x15 and 20x20 grids are evaluated by a
+	 * GMS_FixedGridKernel by default, which gives the same masks. The other
+	 * grids and the compact statistics always take the runtime path.
+	 *
+	 * @return bool Whether the specialized kernel is used.
+	 * @param  enable [in] Whether to use the specialized kernel.
+	 */
+	bool UseFixedGridKernel(const bool enable);
 
 private:
+	/**
+	 * Buffers of one scale and rotation hypothesis. Every worker thread owns
+	 * one of them in the parallel mode.
+	 */
+	struct HypothesisState {
+		cv::Size mGridSizeRight; //!< Grid size of the right image.
+		int mGridNumberRight;    //!< Number of grid-cells of the right image.
+
+		/**
+		 * x	  : left grid idx.\n
+		 * y      : right grid idx.\n
+		 * value  : how many matches from idx_left to idx_right.
+		 */
+		cv::Mat mMotionStatistics; //!< The number of matches between cells.
+		std::vector<int> mMotionStatisticsBuffer; //!< Memory of mMotionStatistics for all scales.
+
+		std::vector<int> mNumberPointsInPerCellLeft; /**< Number of the points from the 
+		                                             grid-cells of the left image. */
+		/**
+		 * Index  : grid_idx_left.\n
+		 * Value  : grid_idx_right.
+		 */	
+		std::vector<int> mCellPairs; //!< Indices of the cell-pairs.
+
+		/**
+		 * Every matches has a cell-pair.\n 
+		 * first  : grid_idx_left.\n
+		 * second : grid_idx_right.
+		 */
+		std::vector<std::pair<int, int> > mvMatchPairs; //!< Cell-pairs of the matches.
+
+		std::vector<bool> mvbInlierMask; //!< Mask of inliers/outliers.
+
+		const cv::Mat* mGridNeighborRight; //!< Neighborhoods of the grid-cells of the right image.
+
+		/**
+		 * Compact motion statistics. The right cells of left cell i are 
+		 * mCellRight[mCellOffsets[i]] to mCellRight[mCellOffsets[i] + 
+		 * mCellSize[i] - 1] in increasing order, mCellCount holds the number 
+		 * of matches of each of them.
+		 */
+		std::vector<int> mCellOffsets;  //!< Offsets of the left cells, \f$G_l+1\f$.
+		std::vector<int> mCellSize;     //!< Number of distinct right cells per left cell.
+		std::vector<int> mCellRight;    //!< Right cells of the cell-pairs.
+		std::vector<int> mCellCount;    //!< Number of matches of the cell-pairs.
+
+		std::vector<bool> mvbBestMask; //!< Best mask of the hypotheses of a worker.
+		int mBestInlier;               //!< Number of inliers of the best mask.
+
+		HypothesisState() :mGridNumberRight(0), mGridNeighborRight(NULL), 
+			mBestInlier(0) {}
+	};
+
+	class ParallelHypothesisBody;
+
 	
 	/**
 	 * @brief  Normalizes the keypoints to the range from 0 to 1.
@@ -100,40 +213,65 @@ private:
 	 * @param  pt [in] Point.
 	 * @param  type [in] Grid patterns shift flag. 
 	 */
-	int GetGridIndexLeft(const cv::Point2f& pt, int type);
+	int GetGridIndexLeft(const cv::Point2f& pt, int type) const;
 
 	/**
 	 * @brief  Gets the index of the cell for the point from the right image.
 	 *
 	 * @return int Index.
 	 * @param  pt [in] Point.
+	 * @param  GridSizeRight [in] Grid size of the right image.
 	 */
-	int GetGridIndexRight(const cv::Point2f& pt);
+	int GetGridIndexRight(const cv::Point2f& pt, const cv::Size& GridSizeRight) const;
 
 	/**
 	 * @brief  Assigns the matches to the cell-pairs.
 	 *
 	 * @return void 
 	 * @param  GridType [in] Grid patterns shift flag.
+	 * @param  state [in,out] Buffers of the hypothesis.
+	 */
+	void AssignMatchPairs(int GridType, HypothesisState& state) const;
+
+	/**
+	 * @brief  Builds the compact motion statistics from the cell-pairs of the
+	 *         matches with a counting sort, and finds the right cell with the
+	 *         most matches for every left cell on the way.
+	 *
+	 * @return void 
+	 * @param  state [in,out] Buffers of the hypothesis.
 	 */
-	void AssignMatchPairs(int GridType);
+	void BuildCompactStatistics(HypothesisState& state) const;
+
+	/**
+	 * @brief  Gets the number of matches between two cells.
+	 *
+	 * @return int Number of matches.
+	 * @param  ll [in] Index of the left cell.
+	 * @param  rr [in] Index of the right cell.
+	 * @param  state [in] Buffers of the hypothesis.
+	 */
+	int GetCellPairCount(int ll, int rr, const HypothesisState& state) const;
 
 	/**
 	 * @brief  Verifies the cell-pairs and divide them into true and false set.
 	 *
 	 * @return void 
 	 * @param  RotationType [in] Rotation type.
+	 * @param  state [in,out] Buffers of the hypothesis.
 	 */
-	void VerifyCellPairs(int RotationType);
+	void VerifyCellPairs(int RotationType, HypothesisState& state) const;
 
 	/**
 	 * @brief  Gets the indices of the grid-cell and its eight neighborhoods.
 	 *
-	 * @return std::vector<int> Indices of the cell and the 8-neighborhoods.
+	 * @return void
 	 * @param  idx [in] Index of the cell.
 	 * @param  GridSize [in] Grid size.
+	 * @param  NB9 [out] Indices of the cell and the 8-neighborhoods, 9 
+	 *                   elements, -1 outside of the grid.
 	 */
-	std::vector<int> GetNB9(const int idx, const cv::Size& GridSize);
+	void GetNB9(const int idx, const cv::Size& GridSize, int* NB9) const;
 
 	/**
 	 * @brief  Gets the neighborhoods of all grid-cells.
@@ -142,15 +280,17 @@ private:
 	 * @param  neighbor [out] Neighborhoods of all grid-cells, \f$N\times9\f$.
 	 * @param  GridSize [in] Grid size.
 	 */
-	void InitializeNeighbors(cv::Mat& neighbor, const cv::Size& GridSize);
+	void InitializeNeighbors(cv::Mat& neighbor, const cv::Size& GridSize) const;
 
 	/**
-	 * @brief  Sets the scale and compute the grid size of the right image.
+	 * @brief  Sets the scale, the grid size and the precomputed neighborhoods
+	 *         of the right image.
 	 *
 	 * @return void 
 	 * @param  Scale [in] Scale.
+	 * @param  state [in,out] Buffers of the hypothesis.
 	 */
-	void SetScale(int Scale);
+	void SetScale(int Scale, HypothesisState& state) const;
 
 	
 	/**
@@ -158,8 +298,9 @@ private:
 	 *
 	 * @return int Number of inliers.
 	 * @param  RotationType [in] Rotation type.
+	 * @param  state [in,out] Buffers of the hypothesis.
 	 */
-	int Run(int RotationType);
+	int Run(int RotationType, HypothesisState& state) const;
 private:
 	
 	std::vector<cv::Point2f> mvP1;  //!< Normalized points from the left image.
@@ -170,38 +311,21 @@ private:
 	size_t mNumberMatches; //!< Number of matches.
 
 	cv::Size mGridSizeLeft;  //!< Grid size of the left image.
-	cv::Size mGridSizeRight; //!< Grid size of the right image.
 	int mGridNumberLeft;  //!< Number of grid-cells of the left image.
-	int mGridNumberRight; //!< Number of grid-cells of the right image.
 
-	/**
-	 * x	  : left grid idx.\n
-	 * y      : right grid idx.\n
-	 * value  : how many matches from idx_left to idx_right.
-	 */
-	cv::Mat mMotionStatistics; //!< The number of matches between cells.
+	HypothesisState mState; //!< Buffers of the serial evaluation.
 
-	std::vector<int> mNumberPointsInPerCellLeft; /**< Number of the points from the 
-	                                             grid-cells of the left image. */
-	/**
-	 * Index  : grid_idx_left.\n
-	 * Value  : grid_idx_right.
-	 */	
-	std::vector<int> mCellPairs; //!< Indices of the cell-pairs.
-
-	/**
-	 * Every matches has a cell-pair.\n 
-	 * first  : grid_idx_left.\n
-	 * second : grid_idx_right.
-	 */
-	std::vector<std::pair<int, int> > mvMatchPairs; //!< Cell-pairs of the matches.
-
-	std::vector<bool> mvbInlierMask; //!< Mask of inliers/outliers.
+	std::vector<HypothesisState> mParallelStates; //!< Buffers of the parallel workers.
 
 	cv::Mat mGridNeighborLeft;  //!< Neighborhoods of the grid-cells of the left image.	
-	cv::Mat mGridNeighborRight; //!< Neighborhoods of the grid-cells of the right image.
+	cv::Mat mGridNeighborRightScales[5]; //!< Neighborhoods of the right grids of all scales.
+	int mMaxGridNumberRight; //!< Number of grid-cells of the largest right grid.
 	
 	double mAlpha;  /**< The factor \f$\alpha\f$ of the desired threshold 
 	                /to divide cell-pairs into true and false sets. */
+
+	GMS_StatisticsType mStatisticsType; //!< The data structure of the motion statistics.
+
+	cv::Ptr<GMS_GridKernel> mFixedGridKernel; //!< Specialized kernel, empty for the runtime path.
 };
 #endif
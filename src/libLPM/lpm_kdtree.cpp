@@ -0,0 +1,105 @@
+#include "lpm_kdtree.h"
+#include "lpm_parallel.h"
+
+// The largest K whose distances are kept on the stack during the search.
+static const int kMaxStackNeighbors = 32;
+
+/**
+ * @brief The K-NN result set of nanoflann that skips the points outside of a mask.
+ *
+ * Without a mask it gives the same neighbors in the same order as nanoflann::KNNResultSet.
+ */
+class MaskedKnnResultSet
+{
+public:
+	MaskedKnnResultSet(const int capacity, const std::vector<bool>& mask)
+		:indices_(NULL), dists_(NULL), capacity_(capacity), count_(0), mask_(mask) {}
+
+	inline void init(int* indices, double* dists) {
+		indices_ = indices;
+		dists_ = dists;
+		count_ = 0;
+		if (capacity_)
+			dists_[capacity_ - 1] = (std::numeric_limits<double>::max)();
+	}
+
+	inline int size() const { return count_; }
+
+	inline bool full() const { return count_ == capacity_; }
+
+	inline bool addPoint(double dist, size_t index) {
+		if (!mask_.empty() && !mask_[index])
+			return true;
+
+		int i;
+		for (i = count_; i > 0; --i) {
+			if (dists_[i - 1] > dist) {
+				if (i < capacity_) {
+					dists_[i] = dists_[i - 1];
+					indices_[i] = indices_[i - 1];
+				}
+			}
+			else
+				break;
+		}
+		if (i < capacity_) {
+			dists_[i] = dist;
+			indices_[i] = static_cast<int>(index);
+		}
+		if (count_ < capacity_)
+			count_++;
+
+		return true;
+	}
+
+	inline double worstDist() const { return dists_[capacity_ - 1]; }
+
+private:
+	int* indices_;
+	double* dists_;
+	const int capacity_;
+	int count_;
+	const std::vector<bool>& mask_;
+};
+
+LPM_KdTree::LPM_KdTree(const std::vector<cv::Point2d>& points, const int leaf_max_size)
+	:points_(points), adaptor_(points_.data(), points_.size()),
+	index_(2, adaptor_, nanoflann::KDTreeSingleIndexAdaptorParams(leaf_max_size)) {
+
+	index_.buildIndex();
+}
+
+LPM_KdTree::~LPM_KdTree() {}
+
+void LPM_KdTree::Rebuild(const std::vector<cv::Point2d>& points) {
+
+	points_.assign(points.begin(), points.end());
+	adaptor_ = PointAdaptor(points_.data(), points_.size());
+	index_.buildIndex();
+}
+
+void LPM_KdTree::FindKnnNeighbors(const std::vector<cv::Point2d>& queries, const int knn,
+	cv::Mat& indices, const std::vector<bool>& mask, const int num_threads) const {
+
+	CV_Assert(mask.empty() || mask.size() == points_.size());
+	indices.create((int)queries.size(), knn, CV_32S);
+	indices.setTo(-1);
+
+	// Every thread owns a result set and the buffer of the distances, on the stack for the usual K.
+	LPM_ParallelFor((int)queries.size(), num_threads, [&](const cv::Range& range) {
+		double stack_dists[kMaxStackNeighbors];
+		std::vector<double> heap_dists(knn > kMaxStackNeighbors ? knn : 0);
+		double* out_dists_sqr = knn > kMaxStackNeighbors ? &heap_dists[0] : stack_dists;
+		MaskedKnnResultSet resultSet(knn, mask);
+
+		double query[2];
+		for (int i = range.start; i < range.end; ++i) {
+			int* ptri = (int*)indices.ptr(i);
+			query[0] = queries[i].x;
+			query[1] = queries[i].y;
+
+			resultSet.init(ptri, out_dists_sqr);
+			index_.findNeighbors(resultSet, query, nanoflann::SearchParams(10));
+		}
+	});
+}
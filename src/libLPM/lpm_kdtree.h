@@ -0,0 +1,93 @@
+/****************************************************************************************************
+ * @file lpm_kdtree.h
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @brief A KD-tree of 2D points for the neighborhoods of LPM.
+ * @details The tree indexes a flat array of cv::Point2d without any per-point copy, and can be 
+ *          searched with a mask so that one tree serves the iterations of LPM on every inlier set.
+ * @date 2019-10-02
+ *
+ * @copyright Copyright (c) 2019
+ *
+*****************************************************************************************************/
+#ifndef _LPM_KDTREE_H_
+#define _LPM_KDTREE_H_
+#include <opencv2/opencv.hpp>
+#include "nanoflann/nanoflann.hpp"
+
+/**
+ * @brief The class of the KD-tree for 2D points.
+ */
+class LPM_KdTree
+{
+public:
+	/**
+	 * @brief  Constructor. Builds the tree.
+	 *
+	 * @param  points [in] The points to index.
+	 * @param  leaf_max_size [in] The maximum number of points in a leaf.
+	 */
+	explicit LPM_KdTree(const std::vector<cv::Point2d>& points, const int leaf_max_size = 10);
+
+	~LPM_KdTree();
+
+	/**
+	 * @brief  Rebuilds the tree on other points. The copy of the points and the index array keep their capacity.
+	 *
+	 * @return void 
+	 * @param  points [in] The points to index.
+	 */
+	void Rebuild(const std::vector<cv::Point2d>& points);
+
+	/**
+	 * @brief  Finds K nearest neighbors of the query points.
+	 *
+	 * @return void 
+	 * @param  queries [in] The query points.
+	 * @param  knn [in] The number of nearest neighbors to search for.
+	 * @param  indices [out] The indices of the K-nearest neighbors found, \f$ M\times K\f$, CV_32S, sorted by 
+	 *                       increasing distance. Missing neighbors are set to -1.
+	 * @param  mask [in] The vector of \f$ N\f$ elements, only the indexed points set to 1 are searched. An 
+	 *                   empty mask searches all points.
+	 * @param  num_threads [in] The number of threads the queries are split into.
+	 */
+	void FindKnnNeighbors(const std::vector<cv::Point2d>& queries, const int knn, cv::Mat& indices,
+		const std::vector<bool>& mask = std::vector<bool>(), const int num_threads = 1) const;
+
+	/**
+	 * @brief  Gets the number of the indexed points.
+	 *
+	 * @return int The number of the indexed points.
+	 */
+	int size() const { return static_cast<int>(points_.size()); }
+
+private:
+	LPM_KdTree(const LPM_KdTree&) = delete;            ///< The index refers to the adaptor member.
+	LPM_KdTree& operator=(const LPM_KdTree&) = delete; ///< The index refers to the adaptor member.
+
+	/**
+	 * @brief The dataset adaptor of nanoflann over a flat array of points.
+	 */
+	struct PointAdaptor {
+		const cv::Point2d* points; ///< The indexed points.
+		size_t count;              ///< The number of the indexed points.
+
+		PointAdaptor(const cv::Point2d* points_, const size_t count_) :points(points_), count(count_) {}
+
+		inline size_t kdtree_get_point_count() const { return count; }
+
+		inline double kdtree_get_pt(const size_t idx, const size_t dim) const {
+			return dim == 0 ? points[idx].x : points[idx].y;
+		}
+
+		template <class BBOX> bool kdtree_get_bbox(BBOX&) const { return false; }
+	};
+
+	typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Adaptor<double, PointAdaptor>,
+		PointAdaptor, 2> index_t;
+
+	std::vector<cv::Point2d> points_; ///< The indexed points.
+	PointAdaptor adaptor_;            ///< The adaptor over points_.
+	index_t index_;                   ///< The KD-tree over adaptor_.
+};
+
+#endif
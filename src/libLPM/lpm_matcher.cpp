@@ -1,147 +1,200 @@
 #include "lpm_matcher.h"
-#include "nanoflann/KDTreeVectorOfVectorsAdaptor.h"
+#include "lpm_parallel.h"
+#include "../profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IM_USE_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define IM_USE_NEON 1
+#endif
+
+// The number of scales of the multi-scale neighborhood representation.
+static const int kNumberScales = 3;
+// The largest K handled by the single pass cost on the stack.
+static const int kMaxSinglePassNeighbors = 16;
 
 /**
- * @brief  Finds K nearest neighbors for the feature points.
+ * @brief  Gets a matrix over a vector, which only reallocates when the vector has to grow.
  *
- * @return cv::Mat The indices of the K - nearest neighbors found, \f$ M\times K\f$, CV_32S.
- * @param  features[in] The feature points to index.
- * @param  queries[in] The query points.
- * @param  knn[in] The number of nearest neighbors to search for.
+ * @return cv::Mat The \f$ rows\times cols\f$ matrix, empty for no elements.
+ * @param  data [in,out] The memory of the matrix.
+ * @param  rows [in] The number of rows.
+ * @param  cols [in] The number of columns.
  */
-static cv::Mat FindKnnNeighbors(const std::vector<cv::Point2d>& features,
-	const std::vector<cv::Point2d>& queries, const int knn) {
-
-	typedef std::vector<std::vector<double> > vector_of_vectors_t;
-	//Convert point to vector
-	vector_of_vectors_t features_vecs(features.size());
-	for (size_t i = 0; i < features.size(); ++i) {
-		features_vecs[i] = { features[i].x, features[i].y };
-	}
-
-	typedef KDTreeVectorOfVectorsAdaptor<vector_of_vectors_t, double>  kd_tree_t;
-	kd_tree_t pt_index(2, features_vecs, 10);
-	pt_index.index->buildIndex();
-
-	// do a knn search
-	vector_of_vectors_t queries_vecs(queries.size());
-	for (size_t i = 0; i < queries.size(); ++i) {
-		queries_vecs[i] = { queries[i].x, queries[i].y };
-	}
-
-	cv::Mat indices((int)queries.size(), knn, CV_32S);
+template <typename T>
+static cv::Mat WrapBuffer(std::vector<T>& data, const int rows, const int cols) {
 
-	std::vector<size_t> ret_indexes(knn);
-	std::vector<double> out_dists_sqr(knn);
-
-	nanoflann::KNNResultSet<double> resultSet(knn);
-
-	for (size_t i = 0; i < queries.size(); ++i) {
-		resultSet.init(&ret_indexes[0], &out_dists_sqr[0]);
-		pt_index.index->findNeighbors(resultSet, &queries_vecs[i][0], 
-			nanoflann::SearchParams(10));
+	data.resize((size_t)rows * cols);
+	if (data.empty()) return cv::Mat();
+	return cv::Mat(rows, cols, cv::DataType<T>::type, data.data());
+}
 
-		int* ptri = (int*)indices.ptr((int)i);
-		for (int j = 0; j < knn; ++j) {
-			ptri[j] = (int)ret_indexes[j];
-		}
-	}
+LPM_Matcher::LPM_Matcher(const std::vector<cv::Point2d>& query_points, 
+	const std::vector<cv::Point2d>& refer_points,
+	const int knn, const double lambda, const double tau,
+	const std::vector<bool>& labels, const int num_threads)
+	:query_points_(query_points), refer_points_(refer_points), 
+	num_neighbors_(knn), lambda_(lambda), tau_(tau), 
+	num_threads_(num_threads > 0 ? num_threads : cv::getNumThreads()), 
+	owns_trees_(true), float_vectors_ready_(false) {
 
-	return indices;
+	Initialize(labels);
 }
 
 LPM_Matcher::LPM_Matcher(const std::vector<cv::Point2d>& query_points, 
 	const std::vector<cv::Point2d>& refer_points,
+	const cv::Ptr<LPM_KdTree>& query_tree, const cv::Ptr<LPM_KdTree>& refer_tree,
 	const int knn, const double lambda, const double tau,
-	const std::vector<bool>& labels)
+	const std::vector<bool>& labels, const int num_threads)
 	:query_points_(query_points), refer_points_(refer_points), 
-	num_neighbors_(knn), lambda_(lambda), tau_(tau) {
+	num_neighbors_(knn), lambda_(lambda), tau_(tau), 
+	num_threads_(num_threads > 0 ? num_threads : cv::getNumThreads()), 
+	query_tree_(query_tree), refer_tree_(refer_tree), owns_trees_(false), 
+	float_vectors_ready_(false) {
 
+	CV_Assert(query_tree_.empty() || query_tree_->size() == (int)query_points_.size());
+	CV_Assert(refer_tree_.empty() || refer_tree_->size() == (int)refer_points_.size());
 	Initialize(labels);
 }
 
+LPM_Matcher::LPM_Matcher(const int knn, const double lambda, const double tau, 
+	const int num_threads)
+	:num_neighbors_(knn), lambda_(lambda), tau_(tau), 
+	num_threads_(num_threads > 0 ? num_threads : cv::getNumThreads()), 
+	num_matches_(0), owns_trees_(true), float_vectors_ready_(false) {}
+
 LPM_Matcher::~LPM_Matcher() {}
 
-void LPM_Matcher::Match(cv::Mat& cost, std::vector<bool>& labels) {
+void LPM_Matcher::SetMatches(const std::vector<cv::Point2d>& query_points, 
+	const std::vector<cv::Point2d>& refer_points, const std::vector<bool>& labels) {
 
-	ComputeMultiScaleCost();
+	// assign() keeps the capacity.
+	query_points_.assign(query_points.begin(), query_points.end());
+	refer_points_.assign(refer_points.begin(), refer_points.end());
+	if (owns_trees_ && !query_tree_.empty() && !refer_tree_.empty()) {
+		IM_PROFILE_SCOPE("lpm.kdtree_build");
+		query_tree_->Rebuild(query_points_);
+		refer_tree_->Rebuild(refer_points_);
+	}
+	else {
+		query_tree_.release();
+		refer_tree_.release();
+	}
+	owns_trees_ = true;
+	float_vectors_ready_ = false;
+	Initialize(labels);
+}
+
+void LPM_Matcher::SetMatches(const std::vector<cv::Point2d>& query_points, 
+	const std::vector<cv::Point2d>& refer_points, 
+	const cv::Ptr<LPM_KdTree>& query_tree, const cv::Ptr<LPM_KdTree>& refer_tree,
+	const std::vector<bool>& labels) {
+
+	query_points_.assign(query_points.begin(), query_points.end());
+	refer_points_.assign(refer_points.begin(), refer_points.end());
+	query_tree_ = query_tree;
+	refer_tree_ = refer_tree;
+	owns_trees_ = false;
+	float_vectors_ready_ = false;
+	CV_Assert(query_tree_.empty() || query_tree_->size() == (int)query_points_.size());
+	CV_Assert(refer_tree_.empty() || refer_tree_->size() == (int)refer_points_.size());
+	Initialize(labels);
+}
+
+void LPM_Matcher::Match(cv::Mat& cost, std::vector<bool>& labels,
+	const LPM_PrecisionType precision) {
+
+	Match(precision);
 	lpm_cost_.copyTo(cost);
 	labels = labels_;
 }
 
+void LPM_Matcher::Match(const LPM_PrecisionType precision) {
+
+	IM_PROFILE_SCOPE("lpm.match");
+	if (precision == LPM_PRECISION_FLOAT && !float_vectors_ready_) {
+		// The struct of arrays for the single precision test.
+		vector_dx_.resize(num_matches_);
+		vector_dy_.resize(num_matches_);
+		vector_len_.resize(num_matches_);
+		vector_inv_len_.resize(num_matches_);
+		const double* pdis = (const double*)vector_lengths_.data;
+		for (int i = 0; i < num_matches_; ++i) {
+			const double* pveci = (const double*)match_vectors_.ptr(i);
+			vector_dx_[i] = static_cast<float>(pveci[0]);
+			vector_dy_[i] = static_cast<float>(pveci[1]);
+			vector_len_[i] = static_cast<float>(pdis[i]);
+			vector_inv_len_[i] = 1.f / vector_len_[i];
+		}
+		float_vectors_ready_ = true;
+	}
+
+	ComputeMultiScaleCost(precision);
+}
+
 void LPM_Matcher::Initialize(const std::vector<bool>& labels) {
 
 	CV_Assert(query_points_.size() == refer_points_.size());
 	num_matches_ = static_cast<int>(query_points_.size());
-	cv::Mat queries = cv::Mat(query_points_).reshape(1);
-	cv::Mat referes = cv::Mat(refer_points_).reshape(1);
 
 	// Convert the putative matches into displacement vectors.
-	match_vectors_ = referes - queries;
-	vector_lengths_ = match_vectors_.col(0).mul(match_vectors_.col(0)) +
-		match_vectors_.col(1).mul(match_vectors_.col(1));
-	cv::sqrt(vector_lengths_, vector_lengths_);
-
-	int knn = num_neighbors_ + 1;
-
-	// Find the k-nearest neighbor of the feature points.
-	cv::Mat query_knn(num_matches_, knn, CV_32S);
-	cv::Mat	refer_knn(num_matches_, knn, CV_32S);
-	if (labels.empty()) {
-		query_knn = FindKnnNeighbors(query_points_, query_points_, knn);
-		refer_knn = FindKnnNeighbors(refer_points_, refer_points_, knn);
+	match_vectors_ = WrapBuffer(match_vectors_data_, num_matches_, 2);
+	vector_lengths_ = WrapBuffer(vector_lengths_data_, num_matches_, 1);
+	for (int i = 0; i < num_matches_; ++i) {
+		double* pveci = &match_vectors_data_[2 * i];
+		pveci[0] = refer_points_[i].x - query_points_[i].x;
+		pveci[1] = refer_points_[i].y - query_points_[i].y;
+		vector_lengths_data_[i] = std::sqrt(pveci[0] * pveci[0] + pveci[1] * pveci[1]);
 	}
-	else { // Construct the neighborhoods based on the inlier set.
-		std::vector<cv::Point2d> query_inliers, refer_inliers;
-		std::vector<int> inlier_indices;
-		for (int i = 0; i < num_matches_; ++i) {
-			if (labels[i]) {
-				inlier_indices.push_back(i);
-				query_inliers.push_back(query_points_[i]);
-				refer_inliers.push_back(refer_points_[i]);
-			}
-		}
-
-		cv::Mat inliers_knn0, inliers_knn1;
-		inliers_knn0 = FindKnnNeighbors(query_inliers, query_points_, knn);
-		inliers_knn1 = FindKnnNeighbors(refer_inliers, refer_points_, knn);
 
-		for (int i = 0; i < inliers_knn0.rows; ++i) {
-			int* pknn0 = (int*)inliers_knn0.ptr(i);
-			int* pknn1 = (int*)inliers_knn1.ptr(i);
+	int knn = num_neighbors_ + 1;
 
-			int* pqk = (int*)query_knn.ptr(i);
-			int* prk = (int*)refer_knn.ptr(i);
-			for (int j = 0; j < inliers_knn0.cols; ++j) {
-				pqk[j] = inlier_indices[pknn0[j]];
-				prk[j] = inlier_indices[pknn1[j]];
-			}
-		}
+	// Find the k-nearest neighbor of the feature points. The trees are built
+	// once over all points, and the neighborhoods based on the inlier set 
+	// only search the points with the labels set to 1.
+	IM_PROFILE_COUNTER("lpm.matches", num_matches_);
+	if (query_tree_.empty() || refer_tree_.empty()) {
+		IM_PROFILE_SCOPE("lpm.kdtree_build");
+		if (query_tree_.empty()) query_tree_ = cv::makePtr<LPM_KdTree>(query_points_);
+		if (refer_tree_.empty()) refer_tree_ = cv::makePtr<LPM_KdTree>(refer_points_);
 	}
 
 	// Delete the first column, which is the nearest neighbor, i.e. 
-	// the feature point itself.
-	query_knn.colRange(1, query_knn.cols).copyTo(query_knn_);
-	refer_knn.colRange(1, refer_knn.cols).copyTo(refer_knn_);
+	// the feature point itself. The search buffer serves both images.
+	query_knn_ = WrapBuffer(query_knn_data_, num_matches_, num_neighbors_);
+	refer_knn_ = WrapBuffer(refer_knn_data_, num_matches_, num_neighbors_);
+	cv::Mat search_knn = WrapBuffer(search_knn_data_, num_matches_, knn);
+	if (num_matches_ > 0) {
+		IM_PROFILE_SCOPE("lpm.knn_search");
+		query_tree_->FindKnnNeighbors(query_points_, knn, search_knn, labels, num_threads_);
+		search_knn.colRange(1, knn).copyTo(query_knn_);
+		refer_tree_->FindKnnNeighbors(refer_points_, knn, search_knn, labels, num_threads_);
+		search_knn.colRange(1, knn).copyTo(refer_knn_);
+	}
+	IM_PROFILE_COUNTER("lpm.bytes_allocated", (search_knn_data_.size() + 
+		query_knn_data_.size() + refer_knn_data_.size()) * sizeof(int));
 }
 
 std::vector<std::vector<int> > LPM_Matcher::FindNeighborsIntersection(
 	const cv::Mat& query_knn, const cv::Mat& refer_knn) const {
 	
 	std::vector<std::vector<int> > consensus(num_matches_);
-	for (int i = 0; i < num_matches_; ++i) {	
-		std::vector<int> vec0(query_knn.row(i).reshape(1));
-		std::vector<int> vec1(refer_knn.row(i).reshape(1));
-
-		std::sort(vec0.begin(), vec0.end());
-		std::sort(vec1.begin(), vec1.end());
-
-		std::vector<int> vec_intersection;
-		std::set_intersection(vec0.begin(), vec0.end(), vec1.begin(), vec1.end(), 
-			std::back_inserter(vec_intersection));
-
-		consensus[i] = vec_intersection;
-	}
+	LPM_ParallelFor(num_matches_, num_threads_, [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; ++i) {
+			std::vector<int> vec0(query_knn.row(i).reshape(1));
+			std::vector<int> vec1(refer_knn.row(i).reshape(1));
+
+			std::sort(vec0.begin(), vec0.end());
+			std::sort(vec1.begin(), vec1.end());
+
+			// Skip the missing neighbors (-1) of small inlier sets.
+			std::set_intersection(std::lower_bound(vec0.begin(), vec0.end(), 0), vec0.end(), 
+				std::lower_bound(vec1.begin(), vec1.end(), 0), vec1.end(), 
+				std::back_inserter(consensus[i]));
+		}
+	});
 
 	return consensus;
 }
@@ -158,54 +211,189 @@ cv::Mat LPM_Matcher::ComputeFixedKCost(const cv::Mat& query_knn,
 	std::vector<std::vector<int> > knn_intersection;
 	knn_intersection = FindNeighborsIntersection(query_knn, refer_knn);
 
-	// The indices of common elements in the two neighborhoods for the ith match.
-	std::vector<int> indices_knni;
-	double* pdis = (double*)vector_lengths_.data;
-	for (int i = 0; i < num_matches_; ++i) {
-		indices_knni = knn_intersection[i];
-		// The number of common elements in the K-NN.
-		size_t num_inter = indices_knni.size();
-		
-		double c1 = static_cast<double>(knn - num_inter); // K-ni
-
-		double c2 = 0;
-		double* pveci = (double*)match_vectors_.ptr(i);
-		for (size_t j = 0; j < num_inter; ++j) {
-			double* pvecj = (double*)match_vectors_.ptr(indices_knni[j]);
-			//           (vi,vj)
-			// cos(θ) = ---------  Eq.(9)
-			//           |vi||vj|
-			double cos_theta = (pveci[0] * pvecj[0] + pveci[1] * pvecj[1]) /
-				(pdis[i] * pdis[indices_knni[j]]);
-
-			//          min{|vi|,|vj|}
-			// ratio = ----------------  Eq.(9)
-			//          max{|vi|,|vj|}
-			double ratio = std::min(pdis[i], pdis[indices_knni[j]]) /
-				std::max(pdis[i], pdis[indices_knni[j]]);
-
-			if (ratio*cos_theta < tau_) {
-				c2++;
+	const double* pdis = (const double*)vector_lengths_.data;
+	LPM_ParallelFor(num_matches_, num_threads_, [&](const cv::Range& range) {
+		for (int i = range.start; i < range.end; ++i) {
+			// The indices of common elements in the two neighborhoods for the ith match.
+			const std::vector<int>& indices_knni = knn_intersection[i];
+			// The number of common elements in the K-NN.
+			size_t num_inter = indices_knni.size();
+			
+			double c1 = static_cast<double>(knn - num_inter); // K-ni
+
+			double c2 = 0;
+			const double* pveci = (const double*)match_vectors_.ptr(i);
+			for (size_t j = 0; j < num_inter; ++j) {
+				const double* pvecj = (const double*)match_vectors_.ptr(indices_knni[j]);
+				//           (vi,vj)
+				// cos(θ) = ---------  Eq.(9)
+				//           |vi||vj|
+				double cos_theta = (pveci[0] * pvecj[0] + pveci[1] * pvecj[1]) /
+					(pdis[i] * pdis[indices_knni[j]]);
+
+				//          min{|vi|,|vj|}
+				// ratio = ----------------  Eq.(9)
+				//          max{|vi|,|vj|}
+				double ratio = std::min(pdis[i], pdis[indices_knni[j]]) /
+					std::max(pdis[i], pdis[indices_knni[j]]);
+
+				if (ratio*cos_theta < tau_) {
+					c2++;
+				}
 			}
+			pcost[i] = (c1 + c2) * inv_knn;
 		}
-		pcost[i] = (c1 + c2) * inv_knn;
-	}
+	});
 
 	return cost;
 }
 
-void LPM_Matcher::ComputeMultiScaleCost() {
+void LPM_Matcher::TestNeighborsFloat(const int i, const int* knn, 
+	const int num_neighbors, int* inconsistent) const {
+
+	// Gather the neighbors into rows padded to a multiple of 4.
+	float dx[kMaxSinglePassNeighbors], dy[kMaxSinglePassNeighbors];
+	float len[kMaxSinglePassNeighbors], inv_len[kMaxSinglePassNeighbors];
+	const int n = (num_neighbors + 3) & ~3;
+	for (int p = 0; p < n; ++p) {
+		const int j = p < num_neighbors ? knn[p] : -1;
+		dx[p] = j < 0 ? 0.f : vector_dx_[j];
+		dy[p] = j < 0 ? 0.f : vector_dy_[j];
+		len[p] = j < 0 ? 0.f : vector_len_[j];
+		inv_len[p] = j < 0 ? 0.f : vector_inv_len_[j];
+	}
 
-	// Computes the costs according to Eq.(14).
-	lpm_cost_ = cv::Mat::zeros(num_matches_, 1, CV_64F);
-	int num_scales = 3;
+	//          min{|vi|,|vj|}
+	// ratio = ---------------- = min{|vi|,|vj|} * min{1/|vi|,1/|vj|}
+	//          max{|vi|,|vj|}
+	// cos(θ) = (vi,vj) * (1/|vi|) * (1/|vj|)
+	// A zero vector gives 0 * inf = NaN, which fails the test as in double precision.
+	const float dxi = vector_dx_[i], dyi = vector_dy_[i];
+	const float leni = vector_len_[i], inv_leni = vector_inv_len_[i];
+	const float tau = static_cast<float>(tau_);
+#if defined(IM_USE_SSE2)
+	const __m128 vdxi = _mm_set1_ps(dxi), vdyi = _mm_set1_ps(dyi);
+	const __m128 vleni = _mm_set1_ps(leni), vinv_leni = _mm_set1_ps(inv_leni);
+	const __m128 vtau = _mm_set1_ps(tau);
+	for (int p = 0; p < n; p += 4) {
+		__m128 ratio = _mm_mul_ps(_mm_min_ps(vleni, _mm_loadu_ps(len + p)),
+			_mm_min_ps(vinv_leni, _mm_loadu_ps(inv_len + p)));
+		__m128 dot = _mm_add_ps(_mm_mul_ps(vdxi, _mm_loadu_ps(dx + p)),
+			_mm_mul_ps(vdyi, _mm_loadu_ps(dy + p)));
+		__m128 cos_theta = _mm_mul_ps(_mm_mul_ps(dot, vinv_leni), _mm_loadu_ps(inv_len + p));
+		__m128 mask = _mm_cmplt_ps(_mm_mul_ps(ratio, cos_theta), vtau);
+		_mm_storeu_si128((__m128i*)(inconsistent + p), _mm_castps_si128(mask));
+	}
+#elif defined(IM_USE_NEON)
+	const float32x4_t vdxi = vdupq_n_f32(dxi), vdyi = vdupq_n_f32(dyi);
+	const float32x4_t vleni = vdupq_n_f32(leni), vinv_leni = vdupq_n_f32(inv_leni);
+	const float32x4_t vtau = vdupq_n_f32(tau);
+	for (int p = 0; p < n; p += 4) {
+		float32x4_t ratio = vmulq_f32(vminq_f32(vleni, vld1q_f32(len + p)),
+			vminq_f32(vinv_leni, vld1q_f32(inv_len + p)));
+		float32x4_t dot = vaddq_f32(vmulq_f32(vdxi, vld1q_f32(dx + p)),
+			vmulq_f32(vdyi, vld1q_f32(dy + p)));
+		float32x4_t cos_theta = vmulq_f32(vmulq_f32(dot, vinv_leni), vld1q_f32(inv_len + p));
+		uint32x4_t mask = vcltq_f32(vmulq_f32(ratio, cos_theta), vtau);
+		vst1q_s32(inconsistent + p, vreinterpretq_s32_u32(mask));
+	}
+#else
+	for (int p = 0; p < n; ++p) {
+		float ratio = std::min(leni, len[p]) * std::min(inv_leni, inv_len[p]);
+		float cos_theta = (dxi * dx[p] + dyi * dy[p]) * inv_leni * inv_len[p];
+		inconsistent[p] = ratio*cos_theta < tau ? -1 : 0;
+	}
+#endif
+}
+
+void LPM_Matcher::ComputeSinglePassCost(const int num_scales, 
+	const LPM_PrecisionType precision) {
+
+	CV_Assert(num_neighbors_ <= kMaxSinglePassNeighbors && num_scales <= kNumberScales);
+	const int knn = num_neighbors_;
+	lpm_cost_ = WrapBuffer(lpm_cost_data_, num_matches_, 1);
+	double* pcost = (double*)lpm_cost_.data;
+	const double* pdis = (const double*)vector_lengths_.data;
+
+	LPM_ParallelFor(num_matches_, num_threads_, [&](const cv::Range& range) {
+		int num_inter[kNumberScales]; // The number of common elements per scale, ni.
+		int num_false[kNumberScales]; // The number of inconsistent common elements per scale.
+		int levels[kMaxSinglePassNeighbors];       // The deepest scales of the common elements, -1 for the others.
+		int inconsistent[kMaxSinglePassNeighbors]; // Nonzero for the inconsistent neighbors.
+
+		for (int i = range.start; i < range.end; ++i) {
+			const int* pqk = (const int*)query_knn_.ptr(i);
+			const int* prk = (const int*)refer_knn_.ptr(i);
+
+			for (int p = 0; p < knn; ++p) {
+				levels[p] = -1;
+				const int j = pqk[p];
+				if (j < 0) continue;
+				int q = 0;
+				while (q < knn && prk[q] != j) ++q;
+				if (q == knn) continue;
+
+				// The deepest scale whose column range [s, K-s) holds both neighbors.
+				levels[p] = std::min(std::min(p, knn - 1 - p), std::min(q, knn - 1 - q));
+			}
+
+			if (precision == LPM_PRECISION_FLOAT) {
+				TestNeighborsFloat(i, pqk, knn, inconsistent);
+			}
+			else {
+				const double* pveci = (const double*)match_vectors_.ptr(i);
+				for (int p = 0; p < knn; ++p) {
+					if (levels[p] < 0) continue;
+					const int j = pqk[p];
+					const double* pvecj = (const double*)match_vectors_.ptr(j);
+					// Eq.(9), computed in the same way as in ComputeFixedKCost().
+					double cos_theta = (pveci[0] * pvecj[0] + pveci[1] * pvecj[1]) /
+						(pdis[i] * pdis[j]);
+					double ratio = std::min(pdis[i], pdis[j]) / std::max(pdis[i], pdis[j]);
+					inconsistent[p] = ratio*cos_theta < tau_;
+				}
+			}
+
+			std::fill(num_inter, num_inter + num_scales, 0);
+			std::fill(num_false, num_false + num_scales, 0);
+			for (int p = 0; p < knn; ++p) {
+				for (int s = 0; s < num_scales && s <= levels[p]; ++s) {
+					num_inter[s]++;
+					if (inconsistent[p]) num_false[s]++;
+				}
+			}
+
+			// Sum over the scales in the order of the scales.
+			double cost = 0;
+			for (int s = 0; s < num_scales; ++s) {
+				const int scale_knn = knn - 2 * s;
+				double c1 = static_cast<double>(scale_knn - num_inter[s]); // K-ni
+				double c2 = static_cast<double>(num_false[s]);
+				cost += (c1 + c2) * (1.0 / scale_knn);
+			}
+			pcost[i] = cost;
+		}
+	});
+}
 
-	for (int i = 0; i < num_scales; ++i) {
-		cv::Mat temp_knn0(query_knn_.colRange(i, num_neighbors_ - i));
-		cv::Mat temp_knn1(refer_knn_.colRange(i, num_neighbors_ - i));
+void LPM_Matcher::ComputeMultiScaleCost(const LPM_PrecisionType precision) {
 
-		cv::Mat temp_cost = ComputeFixedKCost(temp_knn0, temp_knn1);
-		lpm_cost_ += temp_cost;
+	// Computes the costs according to Eq.(14).
+	IM_PROFILE_SCOPE("lpm.cost");
+	int num_scales = kNumberScales;
+
+	if (num_neighbors_ <= kMaxSinglePassNeighbors) {
+		ComputeSinglePassCost(num_scales, precision);
+	}
+	else {
+		lpm_cost_ = cv::Mat::zeros(num_matches_, 1, CV_64F);
+		for (int i = 0; i < num_scales; ++i) {
+			cv::Mat temp_knn0(query_knn_.colRange(i, num_neighbors_ - i));
+			cv::Mat temp_knn1(refer_knn_.colRange(i, num_neighbors_ - i));
+
+			cv::Mat temp_cost = ComputeFixedKCost(temp_knn0, temp_knn1);
+			lpm_cost_ += temp_cost;
+		}
 	}
 
 	lpm_cost_ /= num_scales;
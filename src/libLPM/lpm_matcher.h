@@ -11,9 +11,20 @@
 #ifndef _LPM_MATCHER_H_
 #define _LPM_MATCHER_H_
 #include <opencv2/opencv.hpp>
+#include "lpm_kdtree.h"
+
+/**
+ * @brief The floating point precision of the consistency test of the neighbors.
+ */
+enum LPM_PrecisionType {
+	LPM_PRECISION_DOUBLE = 0, ///< Double precision on the displacement vectors.
+	LPM_PRECISION_FLOAT = 1   ///< Single precision on a struct of arrays, vectorized over the K-NN.
+};
 
 /**
  * @brief The class for locality preserving matching. 
+ * @details The K-NN queries and the costs may run on several threads. Every match is handled as in the serial loop, 
+ *          so the labels are the same for any number of threads.
  */
 class LPM_Matcher
 {
@@ -27,24 +38,129 @@ public:
 	 * @param  lambda [in] \f$ \lambda\f$.
 	 * @param  tau [in] \f$ \tau\f$.
 	 * @param  labels [in] The vector of \f$ N\f$ elements, every element of which is set to 0 for outliers and to 1 for the other points.
+	 * @param  num_threads [in] The number of threads for the K-NN queries and the costs, 0 for cv::getNumThreads().
 	 */
 	LPM_Matcher(const std::vector<cv::Point2d>& query_points, 
 		const std::vector<cv::Point2d>& refer_points, 
 		const int knn = 8, const double lambda = 0.9, const double tau = 0.2,
-		const std::vector<bool>& labels = std::vector<bool>());
+		const std::vector<bool>& labels = std::vector<bool>(), const int num_threads = 1);
+
+	/**
+	 * @brief  Constructor with the KD-trees of a previous iteration.
+	 *
+	 * @param  query_points [in] The vector of \f$ N\f$ points from the query image.
+	 * @param  refer_points [in] The vector of \f$ N\f$ points from the reference image.
+	 * @param  query_tree [in] The KD-tree of query_points.
+	 * @param  refer_tree [in] The KD-tree of refer_points.
+	 * @param  knn [in] The number of nearest neighbors.
+	 * @param  lambda [in] \f$ \lambda\f$.
+	 * @param  tau [in] \f$ \tau\f$.
+	 * @param  labels [in] The vector of \f$ N\f$ elements, every element of which is set to 0 for outliers and to 1 for the other points.
+	 * @param  num_threads [in] The number of threads for the K-NN queries and the costs, 0 for cv::getNumThreads().
+	 */
+	LPM_Matcher(const std::vector<cv::Point2d>& query_points, 
+		const std::vector<cv::Point2d>& refer_points, 
+		const cv::Ptr<LPM_KdTree>& query_tree, const cv::Ptr<LPM_KdTree>& refer_tree,
+		const int knn = 8, const double lambda = 0.9, const double tau = 0.2,
+		const std::vector<bool>& labels = std::vector<bool>(), const int num_threads = 1);
 	
+	/**
+	 * @brief  Constructor of a persistent context without matches.
+	 * @details Set the matches of every pair with SetMatches(). The buffers, the copies of the points and the KD-trees 
+	 *          built by the context keep their capacity, so once they have grown to the size of a pair the later 
+	 *          pairs only allocate the nodes of the KD-trees.
+	 *
+	 * @param  knn [in] The number of nearest neighbors.
+	 * @param  lambda [in] \f$ \lambda\f$.
+	 * @param  tau [in] \f$ \tau\f$.
+	 * @param  num_threads [in] The number of threads for the K-NN queries and the costs, 0 for cv::getNumThreads().
+	 */
+	LPM_Matcher(const int knn, const double lambda, const double tau, const int num_threads);
+
 	~LPM_Matcher();
 
+	/**
+	 * @brief  Replaces the matches of the context and finds their K-NN.
+	 * @details The KD-trees built by the context for the previous matches are rebuilt in place, so the trees handed 
+	 *          out by GetQueryTree() and GetReferTree() change too.
+	 *
+	 * @return void 
+	 * @param  query_points [in] The vector of \f$ N\f$ points from the query image.
+	 * @param  refer_points [in] The vector of \f$ N\f$ points from the reference image.
+	 * @param  labels [in] The vector of \f$ N\f$ elements, every element of which is set to 0 for outliers and to 1 for the other points.
+	 */
+	void SetMatches(const std::vector<cv::Point2d>& query_points, 
+		const std::vector<cv::Point2d>& refer_points, 
+		const std::vector<bool>& labels = std::vector<bool>());
+
+	/**
+	 * @brief  Replaces the matches of the context and finds their K-NN in the KD-trees of a previous iteration.
+	 *
+	 * @return void 
+	 * @param  query_points [in] The vector of \f$ N\f$ points from the query image.
+	 * @param  refer_points [in] The vector of \f$ N\f$ points from the reference image.
+	 * @param  query_tree [in] The KD-tree of query_points.
+	 * @param  refer_tree [in] The KD-tree of refer_points.
+	 * @param  labels [in] The vector of \f$ N\f$ elements, every element of which is set to 0 for outliers and to 1 for the other points.
+	 */
+	void SetMatches(const std::vector<cv::Point2d>& query_points, 
+		const std::vector<cv::Point2d>& refer_points, 
+		const cv::Ptr<LPM_KdTree>& query_tree, const cv::Ptr<LPM_KdTree>& refer_tree,
+		const std::vector<bool>& labels = std::vector<bool>());
+
 	/**
 	 * @brief  Performs the locality preserving matching. 
 	 *
 	 * @return void 
 	 * @param  cost [out] The costs of the putative matches.
 	 * @param  labels [out] The binary vector that represents the match correctness of the correspondences.
+	 * @param  precision [in] The precision of the consistency test. The single precision needs \f$ K\le 16\f$ and falls 
+	 *                        back to the double precision otherwise. It may flip the test of the neighbors near 
+	 *                        \f$ \tau\f$.
+	 */
+	void Match(cv::Mat& cost, std::vector<bool>& labels, 
+		const LPM_PrecisionType precision = LPM_PRECISION_DOUBLE);
+
+	/**
+	 * @brief  Performs the locality preserving matching without copying the results, see GetCost() and GetLabels().
+	 *
+	 * @return void 
+	 * @param  precision [in] The precision of the consistency test.
 	 */
-	void Match(cv::Mat& cost, std::vector<bool>& labels);
+	void Match(const LPM_PrecisionType precision = LPM_PRECISION_DOUBLE);
+
+	/**
+	 * @brief  Gets the costs of the last Match() without copying, valid until the next Match().
+	 *
+	 * @return const cv::Mat& The costs of the putative matches, \f$ N\times 1\f$, CV_64F.
+	 */
+	const cv::Mat& GetCost() const { return lpm_cost_; }
+
+	/**
+	 * @brief  Gets the labels of the last Match() without copying.
+	 *
+	 * @return const std::vector<bool>& The binary vector that represents the match correctness of the correspondences.
+	 */
+	const std::vector<bool>& GetLabels() const { return labels_; }
+
+	/**
+	 * @brief  Gets the KD-tree of the points from the query image, which can be passed to the next iteration.
+	 *
+	 * @return const cv::Ptr<LPM_KdTree>& The KD-tree.
+	 */
+	const cv::Ptr<LPM_KdTree>& GetQueryTree() const { return query_tree_; }
+
+	/**
+	 * @brief  Gets the KD-tree of the points from the reference image, which can be passed to the next iteration.
+	 *
+	 * @return const cv::Ptr<LPM_KdTree>& The KD-tree.
+	 */
+	const cv::Ptr<LPM_KdTree>& GetReferTree() const { return refer_tree_; }
 
 private:
+	LPM_Matcher(const LPM_Matcher&) = delete;            ///< The matrices point into the member vectors.
+	LPM_Matcher& operator=(const LPM_Matcher&) = delete; ///< The matrices point into the member vectors.
+
 	/**
 	 * @brief  Converts the putative matches into displacement vectors and finds the k-nearest neighbor of the feature points.
 	 *
@@ -74,31 +190,75 @@ private:
 	cv::Mat ComputeFixedKCost(const cv::Mat& query_knn, 
 		const cv::Mat& refer_knn) const;
 
+	/**
+	 * @brief  Computes the sum of the costs of all scales in one pass over the K-NN.
+	 * @details A common neighbor at the column \f$ p\f$ of the query K-NN and the column \f$ q\f$ of the reference 
+	 *          K-NN belongs to the scales \f$ s\le\min(p, q, K-1-p, K-1-q)\f$, so every neighbor is matched and tested
+	 *          once and counted for all of its scales. The counts live on the stack, thus \f$ K\f$ must not exceed 
+	 *          kMaxSinglePassNeighbors. The sums are the same as those of ComputeFixedKCost() to the last bit.
+	 *
+	 * @return void 
+	 * @param  num_scales [in] The number of scales.
+	 * @param  precision [in] The precision of the consistency test.
+	 */
+	void ComputeSinglePassCost(const int num_scales, const LPM_PrecisionType precision);
+
+	/**
+	 * @brief  Tests the consistency of the ith match with the K-NN in single precision.
+	 *
+	 * @return void 
+	 * @param  i [in] The index of the match.
+	 * @param  knn [in] The K-NN of the ith match, \f$ K\f$ elements, -1 for missing neighbors.
+	 * @param  num_neighbors [in] \f$ K\f$.
+	 * @param  inconsistent [out] The nonzero elements mark the neighbors with \f$ ratio\cdot\cos\theta<\tau\f$.
+	 */
+	void TestNeighborsFloat(const int i, const int* knn, const int num_neighbors, 
+		int* inconsistent) const;
+
 	/**
 	 * @brief  Computes the costs using a multi-scale neighborhood representation and determines the optimal inlier set.
 	 *
 	 * @return void 
+	 * @param  precision [in] The precision of the consistency test.
 	 */
-	void ComputeMultiScaleCost();
+	void ComputeMultiScaleCost(const LPM_PrecisionType precision);
 
 private:
-	const std::vector<cv::Point2d> query_points_;  ///< Points from the query image.
-	const std::vector<cv::Point2d> refer_points_;  ///< Points from the reference image.
+	std::vector<cv::Point2d> query_points_;  ///< Points from the query image.
+	std::vector<cv::Point2d> refer_points_;  ///< Points from the reference image.
 
 	const int num_neighbors_;  ///< The number of nearest neighbors for multi-scale neighborhood construction.
 	const double lambda_;      ///< Parameter \f$ \lambda\f$ controls the threshold for judging the correctness of a putative correspondence.
 	const double tau_;         ///< Parameter \f$ \tau\f$ determines whether a neighboring putative match preserves the consensus of neighborhood topology.
+	const int num_threads_;    ///< The number of threads.
 
 	int num_matches_;   ///< The number of the putative matches.
+
+	cv::Ptr<LPM_KdTree> query_tree_; ///< The KD-tree of the points from the query image.
+	cv::Ptr<LPM_KdTree> refer_tree_; ///< The KD-tree of the points from the reference image.
+	bool owns_trees_;                ///< Whether the context built the KD-trees, which are rebuilt in place then.
 	
+	// The matrices below are headers over the vectors after them, which keep their capacity across SetMatches().
 	cv::Mat query_knn_; ///< The K-NN of the feature points from the query image.
 	cv::Mat refer_knn_; ///< The K-NN of the feature points from the reference image.
+	std::vector<int> query_knn_data_;  ///< The memory of query_knn_.
+	std::vector<int> refer_knn_data_;  ///< The memory of refer_knn_.
+	std::vector<int> search_knn_data_; ///< The memory of the K-NN search, with the point itself in the first column.
 
 	cv::Mat match_vectors_;  ///< The displacement vectors where the head and tail of each vector correspond to the spatial positions of two corresponding feature points in the two images.
 	cv::Mat vector_lengths_; ///< The lengths of the displacement vectors.
+	std::vector<double> match_vectors_data_;  ///< The memory of match_vectors_.
+	std::vector<double> vector_lengths_data_; ///< The memory of vector_lengths_.
+	bool float_vectors_ready_;                ///< Whether the single precision vectors hold the current matches.
+
+	std::vector<float> vector_dx_;      ///< The x components of the displacement vectors in single precision.
+	std::vector<float> vector_dy_;      ///< The y components of the displacement vectors in single precision.
+	std::vector<float> vector_len_;     ///< The lengths of the displacement vectors in single precision.
+	std::vector<float> vector_inv_len_; ///< The inverse lengths of the displacement vectors, inf for zero vectors.
 
-	std::vector<bool> labels_; ///< The binary vector that represents the match correctness of the correspondences.
-	cv::Mat lpm_cost_;         ///< The costs of the putative matches.
+	std::vector<bool> labels_;          ///< The binary vector that represents the match correctness of the correspondences.
+	cv::Mat lpm_cost_;                  ///< The costs of the putative matches.
+	std::vector<double> lpm_cost_data_; ///< The memory of lpm_cost_ in the single pass.
 };
 
 #endif
@@ -0,0 +1,51 @@
+/****************************************************************************************************
+ * @file lpm_parallel.h
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @brief Parallel loops over the putative matches of LPM.
+ * @details Every match is handled independently in the same way as in the serial loop, so the 
+ *          results don't depend on the number of threads.
+ * @date 2019-10-03
+ *
+ * @copyright Copyright (c) 2019
+ *
+*****************************************************************************************************/
+#ifndef _LPM_PARALLEL_H_
+#define _LPM_PARALLEL_H_
+#include <opencv2/opencv.hpp>
+
+/**
+ * @brief The parallel loop body that calls a function object on its range.
+ */
+template <typename Function>
+class LPM_ParallelBody : public cv::ParallelLoopBody
+{
+public:
+	explicit LPM_ParallelBody(const Function& function) :function_(function) {}
+
+	void operator()(const cv::Range& range) const { function_(range); }
+
+private:
+	const Function& function_;
+};
+
+/**
+ * @brief  Calls a function object on the range [0, n), split into one stripe per thread.
+ *
+ * @return void 
+ * @param  n [in] The number of iterations.
+ * @param  num_threads [in] The number of threads, 1 runs the loop in the calling thread.
+ * @param  function [in] The function object taking a cv::Range.
+ */
+template <typename Function>
+void LPM_ParallelFor(const int n, const int num_threads, const Function& function) {
+
+	if (num_threads <= 1 || n <= 1) {
+		function(cv::Range(0, n));
+		return;
+	}
+
+	LPM_ParallelBody<Function> body(function);
+	cv::parallel_for_(cv::Range(0, n), body, std::min(num_threads, n));
+}
+
+#endif
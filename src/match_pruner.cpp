@@ -1,143 +1,357 @@
 #include "match_pruner.h"
 #include "./libGMS/gms_matcher.h"
 #include "./libLPM/lpm_matcher.h"
+#include "profiler.h"
+#include "workspace.h"
+
+// Number of matches the check of PRUNER_LPM_CASCADE subsamples large sets to.
+static const int kCascadeSamples = 512;
 
 MatchPruner::MatchPruner(const cv::Mat& img0, const cv::Mat& img1,
 	const std::vector<cv::KeyPoint>& keypts0,
 	const std::vector<cv::KeyPoint>& keypts1,
 	const std::vector<std::vector<cv::DMatch> >& matches, PrunerType method)
-	:query_image_(img0), refer_image_(img1), query_kpts_(keypts0),
-	refer_kpts_(keypts1), putative_matches_(matches), pruner_method_(method) {
+	:pruner_method_(method), cascade_min_inliers_(kCascadeMinInliers),
+	rejected_(false), workspace_(NULL) {
+
+	// The results stay with the pruner without a workspace of the caller.
+	Workspace workspace;
+	PruneMatches(keypts0, img0.size(), keypts1, img1.size(), MatchTable(matches),
+		workspace);
+}
+
+MatchPruner::MatchPruner(const FeatureSet& query_features,
+	const FeatureSet& refer_features, const MatchTable& matches,
+	PrunerType method, const int cascade_min_inliers)
+	:pruner_method_(method), cascade_min_inliers_(cascade_min_inliers),
+	rejected_(false), workspace_(NULL) {
+
+	Workspace workspace;
+	PruneMatches(query_features.keypoints, query_features.image_size,
+		refer_features.keypoints, refer_features.image_size, matches, workspace);
+}
+
+MatchPruner::MatchPruner(const FeatureSet& query_features,
+	const FeatureSet& refer_features, const MatchTable& matches,
+	PrunerType method, Workspace& workspace, const int cascade_min_inliers)
+	:pruner_method_(method), cascade_min_inliers_(cascade_min_inliers),
+	rejected_(false), workspace_(&workspace) {
 
-	PruneMatches();
+	SwapResults(workspace);
+	PruneMatches(query_features.keypoints, query_features.image_size,
+		refer_features.keypoints, refer_features.image_size, matches, workspace);
 }
 
-MatchPruner::~MatchPruner() {}
+MatchPruner::~MatchPruner() {
+
+	if (workspace_) {
+		knn_distances_.release();
+		SwapResults(*workspace_);
+	}
+}
+
+void MatchPruner::SwapResults(Workspace& workspace) {
+
+	PrunerBuffers& buffers = workspace.GetPrunerBuffers();
+	pruned_matches_.swap(buffers.pruned_matches);
+	pruned_rows_.swap(buffers.pruned_rows);
+	query_mpts_.swap(buffers.query_mpts);
+	refer_mpts_.swap(buffers.refer_mpts);
+	knn_distances_data_.swap(buffers.knn_distances);
+	scores_.swap(buffers.scores);
+}
 
-void MatchPruner::PruneMatches() {
+void MatchPruner::PruneMatches(const std::vector<cv::KeyPoint>& keypts0,
+	const cv::Size& size0, const std::vector<cv::KeyPoint>& keypts1,
+	const cv::Size& size1, const MatchTable& matches, Workspace& workspace) {
 
+	IM_PROFILE_COUNTER("prune.putative_matches", matches.rows());
+	// The buffers of a workspace still hold the results of its last pair.
+	pruned_matches_.clear();
+	pruned_rows_.clear();
+	scores_.clear();
 	switch (pruner_method_) {
 	case PRUNER_RATIO:
-		PruneMatchesByRatioTest(0.8);
+		PruneMatchesByRatioTest(matches, 0.8);
 		break;
 	case PRUNER_GMS:
-		PruneMatchesByGMS(cv::Size(15, 15), 6);
+		PruneMatchesByGMS(keypts0, size0, keypts1, size1, matches, workspace,
+			cv::Size(15, 15), 6);
 		break;
 	case PRUNER_LPM:
-		PruneMatchesByLPM(8, 0.8, 0.2, 8, 0.5, 0.2);
+		PruneMatchesByLPM(keypts0, keypts1, matches, workspace, 8, 0.8, 0.2, 8,
+			0.5, 0.2);
+		break;
+	case PRUNER_GMS_CASCADE:
+		PruneMatchesByGMS(keypts0, size0, keypts1, size1, matches, workspace,
+			cv::Size(15, 15), 6, cascade_min_inliers_);
+		break;
+	case PRUNER_LPM_CASCADE:
+		PruneMatchesByLPM(keypts0, keypts1, matches, workspace, 8, 0.8, 0.2, 8,
+			0.5, 0.2, cascade_min_inliers_);
 		break;
 	}
-	
+	if (rejected_) {
+		IM_PROFILE_COUNTER("prune.cascade_rejected", 1);
+	}
+
 	int num_pruned_matches = static_cast<int>(pruned_matches_.size());
+	IM_PROFILE_COUNTER("prune.kept_matches", num_pruned_matches);
 	// Matched points from the query and the reference image.
 	query_mpts_.resize(num_pruned_matches);
 	refer_mpts_.resize(num_pruned_matches);
 
-	int knn = static_cast<int>(putative_matches_[0].size());
-	knn_distances_ = cv::Mat::zeros(num_pruned_matches, knn, CV_64F);	
+	// The distances are a header over knn_distances_data_, which keeps its
+	// capacity in a workspace.
+	int knn = matches.knn();
+	knn_distances_data_.assign((size_t)num_pruned_matches * knn, 0.0);
+	if (knn_distances_data_.empty()) {
+		knn_distances_ = cv::Mat::zeros(num_pruned_matches, knn, CV_64F);
+	}
+	else {
+		knn_distances_ = cv::Mat(num_pruned_matches, knn, CV_64F,
+			knn_distances_data_.data());
+	}
 	for (int i = 0; i < num_pruned_matches; ++i) {
-		query_mpts_[i] = query_kpts_[pruned_matches_[i].queryIdx].pt;
-		refer_mpts_[i] = refer_kpts_[pruned_matches_[i].trainIdx].pt;
+		query_mpts_[i] = keypts0[pruned_matches_[i].queryIdx].pt;
+		refer_mpts_[i] = keypts1[pruned_matches_[i].trainIdx].pt;
 
 		// Compute for EVSAC
+		// LSH may find less than k neighbors, the missing distances stay 0.
+		const int row = pruned_rows_[i];
+		const int num_valid = matches.ValidCount(row);
+		const float* pdist = matches.Distances(row);
 		double* pdata = (double*)knn_distances_.ptr(i);
-		for (int j = 0; j < knn; ++j) {
-			pdata[j] = putative_matches_[pruned_matches_[i].queryIdx][j].distance;
+		for (int j = 0; j < num_valid; ++j) {
+			pdata[j] = pdist[j];
 		}
 	}
 }
 
-void MatchPruner::PruneMatchesByRatioTest(const double ratio) {
+void MatchPruner::PruneMatchesByRatioTest(const MatchTable& matches,
+	const double ratio) {
+
+	IM_PROFILE_SCOPE("prune.ratio");
+	if (matches.knn() < 2) return;
 
 	double score;
-	for (size_t i = 0; i < putative_matches_.size(); ++i) {
-		std::vector<cv::DMatch> tmp_matches(putative_matches_[i]);
-		score = tmp_matches[0].distance / tmp_matches[1].distance;
+	for (int i = 0; i < matches.rows(); ++i) {
+		if (matches.ValidCount(i) < 2) continue;
+		const float* pdist = matches.Distances(i);
+		score = pdist[0] / pdist[1];
 		if (score < ratio) {
-			pruned_matches_.push_back(tmp_matches[0]);
+			pruned_matches_.push_back(matches.GetMatch(i, 0));
+			pruned_rows_.push_back(i);
 			scores_.push_back(score);
 		}
 	}
 }
 
-void MatchPruner::PruneMatchesByGMS(const cv::Size& grid_size, const double alpha) {
+/**
+ * @brief  Collects the nearest neighbor match of every row.
+ *
+ * @return void
+ * @param  matches [in] Putative matches.
+ * @param  initial_matches [out] Nearest neighbor matches.
+ * @param  initial_rows [out] Rows of the nearest neighbor matches.
+ */
+static void CollectNearestMatches(const MatchTable& matches,
+	std::vector<cv::DMatch>& initial_matches, std::vector<int>& initial_rows) {
 
-	std::vector<cv::DMatch> initial_matches(putative_matches_.size());
-	for (size_t i = 0; i < putative_matches_.size(); ++i) {
-		initial_matches[i] = putative_matches_[i][0];
+	initial_matches.clear();
+	initial_rows.clear();
+	initial_matches.reserve(matches.rows());
+	initial_rows.reserve(matches.rows());
+	for (int i = 0; i < matches.rows(); ++i) {
+		if (matches.ValidCount(i) == 0) continue;
+		initial_matches.push_back(matches.GetMatch(i, 0));
+		initial_rows.push_back(i);
 	}
+}
+
+void MatchPruner::PruneMatchesByGMS(const std::vector<cv::KeyPoint>& keypts0,
+	const cv::Size& size0, const std::vector<cv::KeyPoint>& keypts1,
+	const cv::Size& size1, const MatchTable& matches,
+	Workspace& workspace, const cv::Size& grid_size, const double alpha,
+	const int cascade_min_inliers) {
+
+	IM_PROFILE_SCOPE("prune.gms");
+	PrunerBuffers& buffers = workspace.GetPrunerBuffers();
+	std::vector<cv::DMatch>& initial_matches = buffers.initial_matches;
+	std::vector<int>& initial_rows = buffers.initial_rows;
+	CollectNearestMatches(matches, initial_matches, initial_rows);
 
-	// GMS matcher
-	GMS_Matcher gms_matcher(query_kpts_, query_image_.size(),
-		refer_kpts_, refer_image_.size(), initial_matches, grid_size, alpha);
+	if ((int)initial_matches.size() < cascade_min_inliers) {
+		rejected_ = true;
+		return;
+	}
+
+	// GMS matcher, whose grids are kept by the workspace
+	GMS_Matcher& gms_matcher = workspace.GetGmsMatcher(grid_size, alpha);
+	gms_matcher.SetMatches(keypts0, size0, keypts1, size1, initial_matches);
 
-	std::vector<bool> labels;
-	gms_matcher.GetInlierMask(labels, true, true);
+	// The same scale and rotation is one of the 40 hypotheses of the full
+	// search, at a fortieth of its cost. A pair seen under a strong scale or
+	// rotation change may fail it though.
+	std::vector<bool>& labels = buffers.labels;
+	if (cascade_min_inliers > 0 &&
+		gms_matcher.GetInlierMask(labels, false, false) < cascade_min_inliers) {
+		rejected_ = true;
+		return;
+	}
+
+	// The full search over the scales and rotations.
+	gms_matcher.GetInlierMask(labels, true, true, true);
 
 	for (size_t i = 0; i < labels.size(); ++i) {
 		if (labels[i]) {
 			pruned_matches_.push_back(initial_matches[i]);
+			pruned_rows_.push_back(initial_rows[i]);
 			scores_.push_back(1.0);
 		}
 	}
 }
 
-void MatchPruner::PruneMatchesByLPM(const int knn0, const double lambda0,
-	const double tau0, const int knn1, const double lambda1, const double tau1) {
+void MatchPruner::PruneMatchesByLPM(const std::vector<cv::KeyPoint>& keypts0,
+	const std::vector<cv::KeyPoint>& keypts1, const MatchTable& matches,
+	Workspace& workspace, const int knn0, const double lambda0,
+	const double tau0, const int knn1, const double lambda1, const double tau1,
+	const int cascade_min_inliers) {
+
+	IM_PROFILE_SCOPE("prune.lpm");
+	PrunerBuffers& buffers = workspace.GetPrunerBuffers();
+	std::vector<cv::DMatch>& initial_matches = buffers.initial_matches;
+	std::vector<int>& initial_rows = buffers.initial_rows;
+	CollectNearestMatches(matches, initial_matches, initial_rows);
 
-	std::vector<cv::DMatch> initial_matches(putative_matches_.size());
-	for (size_t i = 0; i < putative_matches_.size(); ++i) {
-		initial_matches[i] = putative_matches_[i][0];
+	if ((int)initial_matches.size() < cascade_min_inliers) {
+		rejected_ = true;
+		return;
 	}
 
-	std::vector<cv::Point2d> query_pts(initial_matches.size());
-	std::vector<cv::Point2d> refer_pts(initial_matches.size());
+	std::vector<cv::Point2d>& query_pts = buffers.query_pts;
+	std::vector<cv::Point2d>& refer_pts = buffers.refer_pts;
+	query_pts.resize(initial_matches.size());
+	refer_pts.resize(initial_matches.size());
 
 	cv::Point2d pt;
 	for (size_t i = 0; i < initial_matches.size(); ++i) {
-		pt.x = (double)query_kpts_[initial_matches[i].queryIdx].pt.x;
-		pt.y = (double)query_kpts_[initial_matches[i].queryIdx].pt.y;
+		pt.x = (double)keypts0[initial_matches[i].queryIdx].pt.x;
+		pt.y = (double)keypts0[initial_matches[i].queryIdx].pt.y;
 		query_pts[i] = pt;
-		pt.x = (double)refer_kpts_[initial_matches[i].trainIdx].pt.x;
-		pt.y = (double)refer_kpts_[initial_matches[i].trainIdx].pt.y;
+		pt.x = (double)keypts1[initial_matches[i].trainIdx].pt.x;
+		pt.y = (double)keypts1[initial_matches[i].trainIdx].pt.y;
 		refer_pts[i] = pt;
 	}
 
+	// A check on every stride-th match of a large set. A subsample of the true
+	// matches keeps their consistent neighborhoods at a lower density.
+	const int stride = static_cast<int>(initial_matches.size()) / kCascadeSamples;
+	if (cascade_min_inliers > 0 && stride > 1) {
+		std::vector<cv::Point2d>& sample_query_pts = buffers.sample_query_pts;
+		std::vector<cv::Point2d>& sample_refer_pts = buffers.sample_refer_pts;
+		sample_query_pts.clear();
+		sample_refer_pts.clear();
+		for (size_t i = 0; i < query_pts.size(); i += stride) {
+			sample_query_pts.push_back(query_pts[i]);
+			sample_refer_pts.push_back(refer_pts[i]);
+		}
+		LPM_Matcher& lpm = workspace.GetLpmMatcher(LPM_SLOT_CASCADE, knn0,
+			lambda0, tau0);
+		lpm.SetMatches(sample_query_pts, sample_refer_pts);
+		lpm.Match();
+		const std::vector<bool>& labels = lpm.GetLabels();
+		const int num_inliers = (int)std::count(labels.begin(), labels.end(), true);
+		if (num_inliers * stride < cascade_min_inliers) {
+			rejected_ = true;
+			return;
+		}
+	}
+
 	// Iteration 1
-	LPM_Matcher lpm0(query_pts, refer_pts, knn0, lambda0, tau0);
-	cv::Mat cost0;
-	std::vector<bool> labels0;
-	lpm0.Match(cost0, labels0);
+	LPM_Matcher& lpm0 = workspace.GetLpmMatcher(LPM_SLOT_ITERATION1, knn0,
+		lambda0, tau0);
+	lpm0.SetMatches(query_pts, refer_pts);
+	lpm0.Match();
+	const std::vector<bool>& labels0 = lpm0.GetLabels();
 
-	// Iteration 2
-	LPM_Matcher lpm1(query_pts, refer_pts, knn1, lambda1, tau1, labels0);
-	cv::Mat cost1;
-	std::vector<bool> labels1;
-	lpm1.Match(cost1, labels1);
+	// Small sets are checked on the first iteration itself.
+	if (cascade_min_inliers > 0 && stride <= 1 && (int)std::count(labels0.begin(),
+		labels0.end(), true) < cascade_min_inliers) {
+		rejected_ = true;
+		return;
+	}
+
+	// Iteration 2, which searches the KD-trees of iteration 1 on the inliers
+	LPM_Matcher& lpm1 = workspace.GetLpmMatcher(LPM_SLOT_ITERATION2, knn1,
+		lambda1, tau1);
+	lpm1.SetMatches(query_pts, refer_pts, lpm0.GetQueryTree(),
+		lpm0.GetReferTree(), labels0);
+	lpm1.Match();
+	const cv::Mat& cost1 = lpm1.GetCost();
+	const std::vector<bool>& labels1 = lpm1.GetLabels();
 
 	double* pcost = (double*)cost1.data;
 	for (size_t i = 0; i < labels1.size(); ++i) {
 		if (labels1[i]) {
 			pruned_matches_.push_back(initial_matches[i]);
+			pruned_rows_.push_back(initial_rows[i]);
 			scores_.push_back(pcost[i]);
 		}
 	}
 }
 
+bool MatchPruner::IsRejected() const {
+	return rejected_;
+}
+
 void MatchPruner::GetMatches(std::vector<cv::DMatch>& matches) const {
 	matches = pruned_matches_;
 }
 
+const std::vector<cv::DMatch>& MatchPruner::GetMatches() const {
+	return pruned_matches_;
+}
+
+void MatchPruner::TakeMatches(std::vector<cv::DMatch>& matches) {
+	matches.swap(pruned_matches_);
+	pruned_matches_.clear();
+}
+
 void MatchPruner::GetMatchedPoints(std::vector<cv::Point2f>& points0,
 	std::vector<cv::Point2f>& points1) const {
 	points0 = query_mpts_;
 	points1 = refer_mpts_;
 }
 
+const std::vector<cv::Point2f>& MatchPruner::GetQueryPoints() const {
+	return query_mpts_;
+}
+
+const std::vector<cv::Point2f>& MatchPruner::GetReferPoints() const {
+	return refer_mpts_;
+}
+
+void MatchPruner::TakeMatchedPoints(std::vector<cv::Point2f>& points0,
+	std::vector<cv::Point2f>& points1) {
+	points0.swap(query_mpts_);
+	points1.swap(refer_mpts_);
+	query_mpts_.clear();
+	refer_mpts_.clear();
+}
+
 void MatchPruner::GetKnnDistances(cv::Mat& knn_distances) const {
 	knn_distances_.copyTo(knn_distances);
 }
 
+const cv::Mat& MatchPruner::GetKnnDistances() const {
+	return knn_distances_;
+}
+
 void MatchPruner::GetMatchingScores(std::vector<double>& scores) const {
 	scores = scores_;
-}
\ No newline at end of file
+}
+
+const std::vector<double>& MatchPruner::GetMatchingScores() const {
+	return scores_;
+}
@@ -12,14 +12,26 @@
 #ifndef _MATCH_PRUNER_H
 #define _MATCH_PRUNER_H
 #include <opencv2/opencv.hpp>
+#include "feature_extractor.h"
+#include "match_table.h"
+
+class Workspace;
 
 //! Matches pruning algorithms.
 enum PrunerType{
-	PRUNER_RATIO = 0,     //!< Ratio test
-	PRUNER_GMS = 1,       //!< GMS
-	PRUNER_LPM = 2        //!< LPM
+	PRUNER_RATIO = 0,       //!< Ratio test
+	PRUNER_GMS = 1,         //!< GMS
+	PRUNER_LPM = 2,         //!< LPM
+	PRUNER_GMS_CASCADE = 3, //!< GMS after a single hypothesis GMS check
+	PRUNER_LPM_CASCADE = 4  //!< LPM after an LPM check on a subsample
 };
 
+/**
+ * Inliers the check of a cascaded pruner must find, otherwise the pair is
+ * rejected without the full pruning.
+ */
+static const int kCascadeMinInliers = 20;
+
 /**
  * Class for matches pruning.
  */
@@ -53,6 +65,56 @@ public:
 		const std::vector<cv::KeyPoint>& keypts0,
 		const std::vector<cv::KeyPoint>& keypts1, 
 		const std::vector<std::vector<cv::DMatch> >& matches, PrunerType method);
+
+	/**
+	 * @brief  Constructor with the features and the match table.
+	 *
+	 * The inputs are only read during the construction. Nothing is copied or
+	 * referenced afterwards, so they may be released right after.
+	 *
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  matches [in] Putative matches, \f$N\times k\f$.
+	 * @param  method [in] Matches pruning algorithm.
+	 * @param  cascade_min_inliers [in] Inliers the check of PRUNER_GMS_CASCADE
+	 *                                  and PRUNER_LPM_CASCADE must find.
+	 */
+	MatchPruner(const FeatureSet& query_features,
+		const FeatureSet& refer_features, const MatchTable& matches,
+		PrunerType method, const int cascade_min_inliers = kCascadeMinInliers);
+
+	/**
+	 * @brief  Constructor with the features, the match table and the
+	 *         workspace of the worker.
+	 *
+	 * The scratch buffers and the GMS and LPM contexts are taken from the
+	 * workspace, and the buffers of the results are handed back to it by the
+	 * destructor, so pruning pair after pair with the same workspace reuses
+	 * their capacity. LPM still allocates the pool of its KD-trees for every
+	 * pair, see workspace.h.
+	 *
+	 * @param  query_features [in] Features of the query image.
+	 * @param  refer_features [in] Features of the reference image.
+	 * @param  matches [in] Putative matches, \f$N\times k\f$.
+	 * @param  method [in] Matches pruning algorithm.
+	 * @param  workspace [in] Workspace of the worker, which must outlive the
+	 *                        pruner.
+	 * @param  cascade_min_inliers [in] Inliers the check of PRUNER_GMS_CASCADE
+	 *                                  and PRUNER_LPM_CASCADE must find.
+	 */
+	MatchPruner(const FeatureSet& query_features,
+		const FeatureSet& refer_features, const MatchTable& matches,
+		PrunerType method, Workspace& workspace,
+		const int cascade_min_inliers = kCascadeMinInliers);
+
+	/**
+	 * @brief  Checks whether the check of a cascaded pruner rejected the pair,
+	 *         in which case there are no matches.
+	 *
+	 * @return bool True if the pair was rejected before the full pruning.
+	 */
+	bool IsRejected() const;
+
 	/**
 	 * @brief  Gets the matches after pruning bad correspondences.
 	 *
@@ -61,6 +123,21 @@ public:
 	 */
 	void GetMatches(std::vector<cv::DMatch>& matches) const;
 
+	/**
+	 * @brief  Gets the matches after pruning without copying.
+	 *
+	 * @return const std::vector<cv::DMatch>& Matches.
+	 */
+	const std::vector<cv::DMatch>& GetMatches() const;
+
+	/**
+	 * @brief  Moves the matches after pruning out of the pruner.
+	 *
+	 * @return void
+	 * @param  matches [out] Matches.
+	 */
+	void TakeMatches(std::vector<cv::DMatch>& matches);
+
 	/**
 	 * @brief  Gets the matched points.
 	 *
@@ -71,6 +148,30 @@ public:
 	void GetMatchedPoints(std::vector<cv::Point2f>& points0,
 		std::vector<cv::Point2f>& points1) const;
 
+	/**
+	 * @brief  Gets the matched points from the query image without copying.
+	 *
+	 * @return const std::vector<cv::Point2f>& Matched points.
+	 */
+	const std::vector<cv::Point2f>& GetQueryPoints() const;
+
+	/**
+	 * @brief  Gets the matched points from the reference image without copying.
+	 *
+	 * @return const std::vector<cv::Point2f>& Matched points.
+	 */
+	const std::vector<cv::Point2f>& GetReferPoints() const;
+
+	/**
+	 * @brief  Moves the matched points out of the pruner.
+	 *
+	 * @return void
+	 * @param  points0 [out] Matched points from the query image.
+	 * @param  points1 [out] Matched points from the reference image.
+	 */
+	void TakeMatchedPoints(std::vector<cv::Point2f>& points0,
+		std::vector<cv::Point2f>& points1);
+
 	/**
 	 * @brief  Gets \f$k\f$ nearest neighbor distances.
 	 *
@@ -79,6 +180,13 @@ public:
 	 */
 	void GetKnnDistances(cv::Mat& knn_distances) const;
 
+	/**
+	 * @brief  Gets \f$k\f$ nearest neighbor distances without copying.
+	 *
+	 * @return const cv::Mat& \f$k\f$ nearest neighbor distances.
+	 */
+	const cv::Mat& GetKnnDistances() const;
+
 	/**
 	 * @brief  Gets the matching scores.
 	 *
@@ -87,64 +195,111 @@ public:
 	 */
 	void GetMatchingScores(std::vector<double>& scores) const;
 
+	/**
+	 * @brief  Gets the matching scores without copying.
+	 *
+	 * @return const std::vector<double>& Matching scores.
+	 */
+	const std::vector<double>& GetMatchingScores() const;
+
 private:
+	MatchPruner(const MatchPruner&) = delete;            //!< The buffers may belong to a workspace.
+	MatchPruner& operator=(const MatchPruner&) = delete; //!< The buffers may belong to a workspace.
+
+	/**
+	 * @brief  Swaps the buffers of the results with those of a workspace.
+	 *
+	 * @return void
+	 * @param  workspace [in] Workspace.
+	 */
+	void SwapResults(Workspace& workspace);
 
 	/**
 	 * @brief  PruneMatches
 	 *
 	 * @return void 
+	 * @param  keypts0 [in] Keypoints from the query image.
+	 * @param  size0 [in] Size of the query image.
+	 * @param  keypts1 [in] Keypoints from the reference image.
+	 * @param  size1 [in] Size of the reference image.
+	 * @param  matches [in] Putative matches.
+	 * @param  workspace [in] Workspace of the scratch buffers.
 	 */
-	void PruneMatches();
+	void PruneMatches(const std::vector<cv::KeyPoint>& keypts0,
+		const cv::Size& size0, const std::vector<cv::KeyPoint>& keypts1,
+		const cv::Size& size1, const MatchTable& matches, Workspace& workspace);
 
 	/**
 	 * @brief  Prunes the matches using Lowe's ratio test.
 	 *
 	 * @return void 
+	 * @param  matches [in] Putative matches.
 	 * @param  ratio [in] Threshold for ratio test.
 	 */
-	void PruneMatchesByRatioTest(const double ratio = 0.8);
+	void PruneMatchesByRatioTest(const MatchTable& matches,
+		const double ratio = 0.8);
 
 	/**
 	 * @brief  Prunes the matches using GMS algorithm.
 	 *
 	 * @return void 
+	 * @param  keypts0 [in] Keypoints from the query image.
+	 * @param  size0 [in] Size of the query image.
+	 * @param  keypts1 [in] Keypoints from the reference image.
+	 * @param  size1 [in] Size of the reference image.
+	 * @param  matches [in] Putative matches.
+	 * @param  workspace [in] Workspace of the scratch buffers and the context.
 	 * @param  grid_size [in] Size of the grid.
 	 * @param  alpha [in] Scale factor \f$ \alpha\f$.
+	 * @param  cascade_min_inliers [in] Inliers the single scale and rotation
+	 *                                  hypothesis must find before the full
+	 *                                  search, 0 to search right away.
 	 */
-	void PruneMatchesByGMS(const cv::Size& grid_size = cv::Size(20, 20), 
-		const double alpha = 6.0);
+	void PruneMatchesByGMS(const std::vector<cv::KeyPoint>& keypts0,
+		const cv::Size& size0, const std::vector<cv::KeyPoint>& keypts1,
+		const cv::Size& size1, const MatchTable& matches, Workspace& workspace,
+		const cv::Size& grid_size = cv::Size(20, 20), const double alpha = 6.0,
+		const int cascade_min_inliers = 0);
 
 	/**
 	 * @brief  Prunes the matches using LPM algorithm.
 	 *
 	 * @return void 
+	 * @param  keypts0 [in] Keypoints from the query image.
+	 * @param  keypts1 [in] Keypoints from the reference image.
+	 * @param  matches [in] Putative matches.
+	 * @param  workspace [in] Workspace of the scratch buffers and the contexts.
 	 * @param  knn0 [in] Number of nearest neighbors for the first time using LPM.
 	 * @param  lambda0 [in] \f$ \lambda\f$ for the first time using LPM.
 	 * @param  tau0 [in] \f$ \tau\f$ for the first time using LPM.
 	 * @param  knn1 [in] Number of nearest neighbors for the second time using LPM.
 	 * @param  lambda1 [in] \f$ \lambda\f$ for the second time using LPM.
 	 * @param  tau1 [in] \f$ \tau\f$ for the second time using LPM.
+	 * @param  cascade_min_inliers [in] Inliers the first iteration must find
+	 *                                  before the second one, 0 to run both
+	 *                                  right away. The first iteration runs on
+	 *                                  a subsample of large match sets and its
+	 *                                  inliers are scaled up.
 	 */
-	void PruneMatchesByLPM(const int knn0 = 8, const double lambda0 = 0.8,
+	void PruneMatchesByLPM(const std::vector<cv::KeyPoint>& keypts0,
+		const std::vector<cv::KeyPoint>& keypts1, const MatchTable& matches,
+		Workspace& workspace, const int knn0 = 8, const double lambda0 = 0.8,
 		const double tau0 = 0.2, const int knn1 = 8, const double lambda1 = 0.5,
-		const double tau1 = 0.2);
+		const double tau1 = 0.2, const int cascade_min_inliers = 0);
 private:
-	const cv::Mat query_image_;    //!< Query image.
-	const cv::Mat refer_image_;    //!< Reference image.
-
-	const std::vector<cv::KeyPoint> query_kpts_; //!< Key points from the query image.	
-	const std::vector<cv::KeyPoint> refer_kpts_; //!< Key points from the reference image.
-
-	const std::vector<std::vector<cv::DMatch> >& putative_matches_; //!< Matches before pruning.
-
 	PrunerType pruner_method_;    //!< Pruning methods.
+	int cascade_min_inliers_;     //!< Inliers the check of a cascaded pruner must find.
+	bool rejected_;               //!< Whether the check of a cascaded pruner rejected the pair.
+	Workspace* workspace_;        //!< Workspace the buffers of the results are handed back to, NULL for none.
 
 	std::vector<cv::DMatch> pruned_matches_; //!< Matches after pruning.
+	std::vector<int> pruned_rows_;           //!< Rows of the pruned matches in the match table.
 
 	std::vector<cv::Point2f> query_mpts_; //!< Matched points from the query image.	
 	std::vector<cv::Point2f> refer_mpts_; //!< Matched points from the reference image.
 
-	cv::Mat knn_distances_; //!< \f$k\f$ nearest neighbor distances.
+	cv::Mat knn_distances_;                  //!< \f$k\f$ nearest neighbor distances.
+	std::vector<double> knn_distances_data_; //!< Memory of knn_distances_.
 
 	std::vector<double> scores_;  //!< Matching scores. The lower score, the greater 
 	                              //!< the possibility of correct match. 
@@ -0,0 +1,68 @@
+#include "match_table.h"
+
+MatchTable::MatchTable() :rows_(0), knn_(0) {}
+
+MatchTable::~MatchTable() {}
+
+MatchTable::MatchTable(const int rows, const int knn) :rows_(0), knn_(0) {
+
+	Create(rows, knn);
+}
+
+MatchTable::MatchTable(const std::vector<std::vector<cv::DMatch> >& matches)
+	:rows_(0), knn_(0) {
+
+	Assign(matches);
+}
+
+void MatchTable::Assign(const std::vector<std::vector<cv::DMatch> >& matches) {
+
+	int knn = 0;
+	for (size_t i = 0; i < matches.size(); ++i) {
+		knn = std::max(knn, static_cast<int>(matches[i].size()));
+	}
+
+	Create(static_cast<int>(matches.size()), knn);
+	for (int i = 0; i < rows_; ++i) {
+		const std::vector<cv::DMatch>& row = matches[i];
+		query_idx_[i] = row.empty() ? i : row[0].queryIdx;
+		for (size_t j = 0; j < row.size(); ++j) {
+			train_idx_[(size_t)i * knn_ + j] = row[j].trainIdx;
+			distances_[(size_t)i * knn_ + j] = row[j].distance;
+		}
+	}
+}
+
+void MatchTable::Create(const int rows, const int knn) {
+
+	rows_ = rows;
+	knn_ = knn;
+
+	// assign() keeps the capacity, so a reused table doesn't reallocate.
+	query_idx_.resize(rows_);
+	for (int i = 0; i < rows_; ++i) {
+		query_idx_[i] = i;
+	}
+	train_idx_.assign((size_t)rows_ * knn_, -1);
+	distances_.assign((size_t)rows_ * knn_, FLT_MAX);
+}
+
+void MatchTable::ToNested(std::vector<std::vector<cv::DMatch> >& matches) const {
+
+	matches.resize(rows_);
+	for (int i = 0; i < rows_; ++i) {
+		int num_valid = ValidCount(i);
+		matches[i].resize(num_valid);
+		for (int j = 0; j < num_valid; ++j) {
+			matches[i][j] = GetMatch(i, j);
+		}
+	}
+}
+
+int MatchTable::ValidCount(const int i) const {
+
+	const int* ptrain = TrainIdx(i);
+	int j = 0;
+	while (j < knn_ && ptrain[j] >= 0) ++j;
+	return j;
+}
@@ -0,0 +1,131 @@
+/****************************************************************************//**
+ * @file match_table.h
+ * @brief Contiguous storage of \f$k\f$ nearest neighbor matches.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-09-26
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _MATCH_TABLE_H_
+#define _MATCH_TABLE_H_
+#include <opencv2/opencv.hpp>
+
+/**
+ * Class for \f$N\times k\f$ matches stored as a struct of arrays.
+ *
+ * Row \f$i\f$ holds the \f$k\f$ candidates of one query descriptor, sorted by
+ * increasing distance. Missing candidates have the train index -1, which
+ * happens when a matcher finds less than \f$k\f$ neighbors.
+ */
+class MatchTable {
+public:
+	/**
+	 * @brief  Default constructor.
+	 *
+	 */
+	MatchTable();
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~MatchTable();
+
+	MatchTable(const MatchTable&) = default;
+	MatchTable& operator=(const MatchTable&) = default;
+	MatchTable(MatchTable&&) = default;            //!< Moves without copying the buffers.
+	MatchTable& operator=(MatchTable&&) = default; //!< Moves without copying the buffers.
+
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  rows [in] Number of query descriptors.
+	 * @param  knn [in] Count of candidates per query descriptor.
+	 */
+	MatchTable(const int rows, const int knn);
+
+	/**
+	 * @brief  Constructor from the nested matches of cv::DescriptorMatcher.
+	 *
+	 * @param  matches [in] Matches, one vector per query descriptor.
+	 */
+	explicit MatchTable(const std::vector<std::vector<cv::DMatch> >& matches);
+
+	/**
+	 * @brief  Allocates the table and marks every candidate as missing. The
+	 *         buffers are reused if they are large enough.
+	 *
+	 * @return void
+	 * @param  rows [in] Number of query descriptors.
+	 * @param  knn [in] Count of candidates per query descriptor.
+	 */
+	void Create(const int rows, const int knn);
+
+	/**
+	 * @brief  Fills the table with the nested matches of
+	 *         cv::DescriptorMatcher. The buffers are reused if they are large
+	 *         enough.
+	 *
+	 * @return void
+	 * @param  matches [in] Matches, one vector per query descriptor.
+	 */
+	void Assign(const std::vector<std::vector<cv::DMatch> >& matches);
+
+	/**
+	 * @brief  Converts the table into the nested matches of
+	 *         cv::DescriptorMatcher. Missing candidates are left out.
+	 *
+	 * @return void
+	 * @param  matches [out] Matches, one vector per query descriptor.
+	 */
+	void ToNested(std::vector<std::vector<cv::DMatch> >& matches) const;
+
+	/**
+	 * @brief  Gets the number of valid candidates of a row.
+	 *
+	 * @return int Number of valid candidates.
+	 * @param  i [in] Row index.
+	 */
+	int ValidCount(const int i) const;
+
+	/**
+	 * @brief  Gets one candidate as cv::DMatch.
+	 *
+	 * @return cv::DMatch Match.
+	 * @param  i [in] Row index.
+	 * @param  j [in] Candidate index.
+	 */
+	cv::DMatch GetMatch(const int i, const int j) const {
+		return cv::DMatch(query_idx_[i], TrainIdx(i)[j], Distances(i)[j]);
+	}
+
+	int rows() const { return rows_; }   //!< Number of query descriptors.
+	int knn() const { return knn_; }     //!< Count of candidates per row.
+	bool empty() const { return rows_ == 0; }
+
+	//! Query index of a row.
+	int QueryIdx(const int i) const { return query_idx_[i]; }
+	//! Train indices of a row, \f$k\f$ elements.
+	const int* TrainIdx(const int i) const { return train_idx_.data() + (size_t)i * knn_; }
+	//! Distances of a row, \f$k\f$ elements.
+	const float* Distances(const int i) const { return distances_.data() + (size_t)i * knn_; }
+
+	//! Query indices of all rows, for matchers filling the table in place.
+	int* QueryIdxData() { return query_idx_.data(); }
+	//! Train indices of all rows, for matchers filling the table in place.
+	int* TrainIdxData() { return train_idx_.data(); }
+	//! Distances of all rows, for matchers filling the table in place.
+	float* DistancesData() { return distances_.data(); }
+
+private:
+	int rows_; //!< Number of query descriptors.
+	int knn_;  //!< Count of candidates per query descriptor.
+
+	std::vector<int> query_idx_;   //!< Query indices, \f$N\f$.
+	std::vector<int> train_idx_;   //!< Train indices, \f$N\times k\f$.
+	std::vector<float> distances_; //!< Distances, \f$N\times k\f$.
+};
+#endif
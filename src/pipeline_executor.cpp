@@ -0,0 +1,372 @@
+#include "pipeline_executor.h"
+#include "geometric_verifier.h"
+#include "profiler.h"
+#include "workspace.h"
+
+PipelineQueue::PipelineQueue(const size_t capacity)
+	:capacity_(capacity), closed_(false) {
+
+	CV_Assert(capacity_ > 0);
+}
+
+void PipelineQueue::Push(std::unique_ptr<PipelineJob> job) {
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	not_full_.wait(lock, [this]() { return jobs_.size() < capacity_ || closed_; });
+	CV_Assert(!closed_);
+	jobs_.push_back(std::move(job));
+	lock.unlock();
+	not_empty_.notify_one();
+}
+
+bool PipelineQueue::Pop(std::unique_ptr<PipelineJob>& job) {
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	not_empty_.wait(lock, [this]() { return !jobs_.empty() || closed_; });
+	if (jobs_.empty()) return false;
+	job = std::move(jobs_.front());
+	jobs_.pop_front();
+	lock.unlock();
+	not_full_.notify_one();
+	return true;
+}
+
+void PipelineQueue::Close() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+	}
+	not_empty_.notify_all();
+	not_full_.notify_all();
+}
+
+size_t PipelineQueue::Size() const {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	return jobs_.size();
+}
+
+/**
+ * @brief  Reads an image from a file or decodes it from memory.
+ *
+ * @return cv::Mat Image, empty if it can't be read.
+ * @param  path [in] Path of the image, empty to decode data.
+ * @param  data [in] Encoded image.
+ */
+static cv::Mat ReadImage(const std::string& path, const std::vector<uchar>& data) {
+
+	if (!path.empty()) return cv::imread(path);
+	if (!data.empty()) return cv::imdecode(data, cv::IMREAD_COLOR);
+	return cv::Mat();
+}
+
+/**
+ * @brief  Reads or decodes the images of a request.
+ *
+ * @return bool False if an image can't be read, which finishes the request.
+ * @param  job [in,out] Request.
+ */
+static bool DecodeImages(PipelineJob& job) {
+
+	IM_PROFILE_SCOPE("pipeline.decode");
+	if (job.query_image.empty()) {
+		job.query_image = ReadImage(job.query_path, job.query_data);
+	}
+	if (job.refer_image.empty()) {
+		job.refer_image = ReadImage(job.refer_path, job.refer_data);
+	}
+	std::vector<uchar>().swap(job.query_data);
+	std::vector<uchar>().swap(job.refer_data);
+	return !job.query_image.empty() && !job.refer_image.empty();
+}
+
+/**
+ * @brief  Extracts the features of a request.
+ *
+ * @return bool False if an image has no features, which finishes the request.
+ * @param  job [in,out] Request.
+ * @param  extractor [in] Extractor of the worker.
+ */
+static bool ExtractFeatures(PipelineJob& job, FeatureExtractor& extractor) {
+
+	IM_PROFILE_SCOPE("pipeline.extract");
+	extractor.Extract(job.query_image, job.result.query_features);
+	extractor.Extract(job.refer_image, job.result.refer_features);
+	job.query_image.release();
+	job.refer_image.release();
+	return !job.result.query_features.empty() && !job.result.refer_features.empty();
+}
+
+/**
+ * Resets a workspace when it goes out of scope, after the matcher or pruner
+ * constructed later has returned its buffers, also when one of them throws.
+ */
+struct WorkspaceResetGuard {
+	Workspace& workspace; //!< Workspace of the worker.
+
+	explicit WorkspaceResetGuard(Workspace& workspace) :workspace(workspace) {}
+	~WorkspaceResetGuard() { workspace.Reset(); }
+};
+
+/**
+ * @brief  Matches the descriptors of a request.
+ *
+ * @return bool True, the request always goes on to the pruning.
+ * @param  job [in,out] Request.
+ * @param  options [in] Options of the pipeline.
+ * @param  workspace [in] Workspace of the worker.
+ * @param  table [in,out] Spare table, whose buffers the matches of the
+ *                        request are written into.
+ */
+static bool MatchDescriptors(PipelineJob& job, const PipelineOptions& options,
+	Workspace& workspace, MatchTable& table) {
+
+	IM_PROFILE_SCOPE("pipeline.match");
+	// The matcher fills the table of the workspace, which leaves with the
+	// request.
+	std::swap(workspace.GetMatcherBuffers().matches, table);
+	// Drops the copies of the features before the worker waits for the next
+	// request.
+	WorkspaceResetGuard reset(workspace);
+	ImageMatcher image_matcher(job.result.query_features,
+		job.result.refer_features, workspace, options.matcher, options.knn);
+	image_matcher.TakeMatches(job.matches);
+	return true;
+}
+
+/**
+ * @brief  Prunes the matches of a request.
+ *
+ * @return bool False if the request is finished, i.e. the pair is rejected
+ *         or isn't verified.
+ * @param  job [in,out] Request.
+ * @param  options [in] Options of the pipeline.
+ * @param  workspace [in] Workspace of the worker.
+ * @param  verify [in] Whether the request goes on to the verification.
+ */
+static bool PruneMatches(PipelineJob& job, const PipelineOptions& options,
+	Workspace& workspace, const bool verify) {
+
+	IM_PROFILE_SCOPE("pipeline.prune");
+	PipelineResult& result = job.result;
+	WorkspaceResetGuard reset(workspace);
+	MatchPruner match_pruner(result.query_features, result.refer_features,
+		job.matches, options.pruner, workspace);
+	result.rejected = match_pruner.IsRejected();
+	if (verify && !result.rejected) {
+		GeometricVerifier::ComputeQuality(match_pruner, job.quality);
+	}
+	match_pruner.TakeMatches(result.matches);
+	match_pruner.TakeMatchedPoints(result.query_points, result.refer_points);
+	result.scores = match_pruner.GetMatchingScores();
+	return verify && !result.rejected;
+}
+
+/**
+ * @brief  Verifies the pruned matches of a request.
+ *
+ * @return bool False, the request is finished.
+ * @param  job [in,out] Request.
+ * @param  verifier [in] Verifier of the worker.
+ */
+static bool VerifyMatches(PipelineJob& job, GeometricVerifier& verifier) {
+
+	IM_PROFILE_SCOPE("pipeline.verify");
+	PipelineResult& result = job.result;
+	verifier.Verify(result.query_points, result.refer_points, job.quality);
+	result.homography = verifier.GetHomography();
+	result.inlier_mask = verifier.GetInlierMask();
+	result.num_inliers = verifier.GetInlierCount();
+	return false;
+}
+
+PipelineExecutor::PipelineExecutor(const PipelineOptions& options)
+	:options_(options) {
+
+	CV_Assert(options_.feature >= FEATURE_SIFT && options_.feature <= FEATURE_HALFSIFT);
+	CV_Assert(options_.matcher >= MATCHER_BF && options_.matcher <= MATCHER_BF_TILED);
+	CV_Assert(options_.pruner >= PRUNER_RATIO && options_.pruner <= PRUNER_LPM_CASCADE);
+	CV_Assert(options_.knn > 0 && options_.threshold > 0);
+	CV_Assert(options_.queue_capacity > 0);
+	// Throws for a feature type this build of OpenCV doesn't provide, which
+	// would otherwise only fail in the extraction workers.
+	FeatureExtractor(options_.feature, options_.budget);
+	for (int stage = 0; stage < kNumPipelineStages; ++stage) {
+		// Only the verification can be skipped.
+		CV_Assert(options_.num_threads[stage] > 0 ||
+			(stage == STAGE_VERIFY && options_.num_threads[stage] == 0));
+		queues_[stage].reset(new PipelineQueue(options_.queue_capacity));
+		num_running_[stage].store(options_.num_threads[stage]);
+	}
+
+	for (int stage = 0; stage < kNumPipelineStages; ++stage) {
+		for (int i = 0; i < options_.num_threads[stage]; ++i) {
+			workers_.push_back(std::thread(&PipelineExecutor::WorkerLoop, this, stage));
+		}
+	}
+}
+
+PipelineExecutor::~PipelineExecutor() {
+
+	// Every stage closes the queue of the next one once it is drained.
+	queues_[STAGE_DECODE]->Close();
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		workers_[i].join();
+	}
+}
+
+std::future<PipelineResult> PipelineExecutor::Submit(
+	const std::string& query_path, const std::string& refer_path) {
+
+	std::unique_ptr<PipelineJob> job(new PipelineJob());
+	job->query_path = query_path;
+	job->refer_path = refer_path;
+	return Enqueue(std::move(job));
+}
+
+std::future<PipelineResult> PipelineExecutor::Submit(
+	std::vector<uchar> query_data, std::vector<uchar> refer_data) {
+
+	std::unique_ptr<PipelineJob> job(new PipelineJob());
+	job->query_data = std::move(query_data);
+	job->refer_data = std::move(refer_data);
+	return Enqueue(std::move(job));
+}
+
+std::future<PipelineResult> PipelineExecutor::Submit(
+	const cv::Mat& query_image, const cv::Mat& refer_image) {
+
+	std::unique_ptr<PipelineJob> job(new PipelineJob());
+	job->query_image = query_image;
+	job->refer_image = refer_image;
+	return Enqueue(std::move(job));
+}
+
+size_t PipelineExecutor::GetQueueSize(const PipelineStage stage) const {
+
+	CV_Assert(stage >= 0 && stage < kNumPipelineStages);
+	return queues_[stage]->Size();
+}
+
+std::future<PipelineResult> PipelineExecutor::Enqueue(
+	std::unique_ptr<PipelineJob> job) {
+
+	std::future<PipelineResult> future = job->promise.get_future();
+	queues_[STAGE_DECODE]->Push(std::move(job));
+	return future;
+}
+
+int PipelineExecutor::NextStage(const int stage) const {
+
+	int next = stage + 1;
+	while (next < kNumPipelineStages && options_.num_threads[next] == 0) ++next;
+	return next;
+}
+
+template <typename Process>
+void PipelineExecutor::RunStage(const int stage, const Process& process) {
+
+	const int next = NextStage(stage);
+	std::unique_ptr<PipelineJob> job;
+	while (queues_[stage]->Pop(job)) {
+		bool pass_on = false;
+		try {
+			pass_on = process(*job) && next < kNumPipelineStages;
+		}
+		catch (...) {
+			job->promise.set_exception(std::current_exception());
+			continue;
+		}
+
+		if (pass_on) {
+			// Waits while the next stage is busy, which holds this one back.
+			queues_[next]->Push(std::move(job));
+		}
+		else {
+			job->promise.set_value(std::move(job->result));
+		}
+	}
+
+	// The last worker of a stage closes the queue of the next one.
+	if (--num_running_[stage] == 0 && next < kNumPipelineStages) {
+		queues_[next]->Close();
+	}
+}
+
+void PipelineExecutor::FailStage(const int stage, const std::exception_ptr& error) {
+
+	RunStage(stage, [&error](PipelineJob&) -> bool {
+		std::rethrow_exception(error);
+	});
+}
+
+void PipelineExecutor::WorkerLoop(const int stage) {
+
+	// The state of a worker lives as long as the worker.
+	const bool verify = NextStage(STAGE_PRUNE) == STAGE_VERIFY;
+	switch (stage) {
+	case STAGE_DECODE:
+		RunStage(stage, [](PipelineJob& job) { return DecodeImages(job); });
+		break;
+	case STAGE_EXTRACT: {
+		// One extractor per worker. The constructor checked the feature type,
+		// but creating the extractor may still fail, which must not throw out
+		// of the thread.
+		std::unique_ptr<FeatureExtractor> extractor;
+		try {
+			extractor.reset(new FeatureExtractor(options_.feature, options_.budget));
+		}
+		catch (...) {
+			FailStage(stage, std::current_exception());
+			break;
+		}
+		RunStage(stage, [&extractor](PipelineJob& job) {
+			return ExtractFeatures(job, *extractor);
+		});
+		break;
+	}
+	case STAGE_MATCH: {
+		Workspace workspace;
+		RunStage(stage, [this, &workspace](PipelineJob& job) {
+			MatchTable table = PopSpareTable();
+			return MatchDescriptors(job, options_, workspace, table);
+		});
+		break;
+	}
+	case STAGE_PRUNE: {
+		Workspace workspace;
+		RunStage(stage, [this, &workspace, verify](PipelineJob& job) {
+			const bool pass_on = PruneMatches(job, options_, workspace, verify);
+			PushSpareTable(job.matches);
+			return pass_on;
+		});
+		break;
+	}
+	case STAGE_VERIFY: {
+		GeometricVerifier verifier(SAMPLING_PROSAC, options_.threshold);
+		RunStage(stage, [&verifier](PipelineJob& job) {
+			return VerifyMatches(job, verifier);
+		});
+		break;
+	}
+	}
+}
+
+MatchTable PipelineExecutor::PopSpareTable() {
+
+	std::lock_guard<std::mutex> lock(spare_mutex_);
+	MatchTable table;
+	if (!spare_tables_.empty()) {
+		std::swap(table, spare_tables_.back());
+		spare_tables_.pop_back();
+	}
+	return table;
+}
+
+void PipelineExecutor::PushSpareTable(MatchTable& table) {
+
+	std::lock_guard<std::mutex> lock(spare_mutex_);
+	spare_tables_.push_back(MatchTable());
+	std::swap(spare_tables_.back(), table);
+}
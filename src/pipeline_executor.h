@@ -0,0 +1,311 @@
+/****************************************************************************//**
+ * @file pipeline_executor.h
+ * @brief A pipelined executor of image matching requests.
+ *
+ * A request runs through the stages decode, extract, match, prune and
+ * verify. Every stage has its own worker threads and a bounded queue in
+ * front of it, so the stages of consecutive requests overlap: one request is
+ * decoded while another is extracted and a third one pruned. A full queue
+ * blocks the stage before it, down to Submit(), which keeps the memory of
+ * the requests in flight bounded when the requests come faster than the
+ * slowest stage serves them.
+ *
+ * Every worker keeps its state from request to request: the extractors
+ * their FeatureExtractor, the matchers and pruners a Workspace, and the
+ * verifiers a GeometricVerifier. The match table of a request travels with
+ * it to the pruning, which hands it back to the matchers for a later
+ * request, so the tables keep their capacity too.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _PIPELINE_EXECUTOR_H_
+#define _PIPELINE_EXECUTOR_H_
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "feature_extractor.h"
+#include "image_matcher.h"
+#include "match_pruner.h"
+
+//! Stages of the pipeline, in the order a request runs through them.
+enum PipelineStage {
+	STAGE_DECODE = 0,  //!< Reads or decodes the images
+	STAGE_EXTRACT = 1, //!< Extracts the features of both images
+	STAGE_MATCH = 2,   //!< Matches the descriptors
+	STAGE_PRUNE = 3,   //!< Prunes the matches
+	STAGE_VERIFY = 4   //!< Verifies the pruned matches with a homography
+};
+
+//! Number of stages of the pipeline.
+static const int kNumPipelineStages = 5;
+
+/**
+ * Options of the pipeline.
+ */
+struct PipelineOptions {
+	FeatureType feature;    //!< Feature type.
+	KeypointBudget budget;  //!< Budget of the keypoints of every image.
+	MatcherType matcher;    //!< Descriptor matcher type.
+	int knn;                //!< Count of best matches found per each query descriptor.
+	PrunerType pruner;      //!< Matches pruning algorithm.
+	double threshold;       //!< Maximum reprojection error of an inlier of the verification.
+	int num_threads[kNumPipelineStages]; //!< Threads of every stage, 0 verify threads to skip the verification.
+	int queue_capacity;     //!< Requests the queue in front of every stage holds.
+
+	/**
+	 * @brief  Constructor with parameters. Every stage has one thread, but
+	 *         the extraction two, and every queue holds 4 requests.
+	 *
+	 * @param  feature [in] Feature type.
+	 * @param  matcher [in] Descriptor matcher type.
+	 * @param  pruner [in] Matches pruning algorithm.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 */
+	explicit PipelineOptions(FeatureType feature = FEATURE_ORB,
+		MatcherType matcher = MATCHER_BF_HAMMING, PrunerType pruner = PRUNER_GMS,
+		const int knn = 2)
+		:feature(feature), matcher(matcher), knn(knn), pruner(pruner),
+		threshold(3.0), queue_capacity(4) {
+		for (int i = 0; i < kNumPipelineStages; ++i) {
+			num_threads[i] = 1;
+		}
+		num_threads[STAGE_EXTRACT] = 2;
+	}
+};
+
+/**
+ * Result of a request.
+ */
+struct PipelineResult {
+	FeatureSet query_features;             //!< Features of the query image.
+	FeatureSet refer_features;             //!< Features of the reference image.
+	std::vector<cv::DMatch> matches;       //!< Matches after pruning.
+	std::vector<cv::Point2f> query_points; //!< Matched points from the query image.
+	std::vector<cv::Point2f> refer_points; //!< Matched points from the reference image.
+	std::vector<double> scores;            //!< Matching scores.
+	bool rejected;                         //!< Whether the check of a cascaded pruner rejected the pair.
+	cv::Matx33d homography;                //!< Homography from the query to the reference image, zero if none was found.
+	std::vector<bool> inlier_mask;         //!< Inliers of the homography among the matches.
+	int num_inliers;                       //!< Number of inliers of the homography.
+
+	PipelineResult() :rejected(false), homography(cv::Matx33d::zeros()), num_inliers(0) {}
+};
+
+/**
+ * A request in flight, which is handed from stage to stage.
+ */
+struct PipelineJob {
+	std::promise<PipelineResult> promise; //!< Promise of the result.
+	std::string query_path;               //!< Path of the query image, empty if not read from a file.
+	std::string refer_path;               //!< Path of the reference image, empty if not read from a file.
+	std::vector<uchar> query_data;        //!< Encoded query image, empty if not decoded from memory.
+	std::vector<uchar> refer_data;        //!< Encoded reference image, empty if not decoded from memory.
+	cv::Mat query_image;                  //!< Query image.
+	cv::Mat refer_image;                  //!< Reference image.
+	MatchTable matches;                   //!< Putative matches.
+	std::vector<double> quality;          //!< Quality of the pruned matches for the verification.
+	PipelineResult result;                //!< Result being built.
+};
+
+/**
+ * Bounded blocking queue of the requests in front of a stage.
+ */
+class PipelineQueue {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  capacity [in] Maximum number of requests in the queue.
+	 */
+	explicit PipelineQueue(const size_t capacity);
+
+	/**
+	 * @brief  Adds a request, waits while the queue is full.
+	 *
+	 * @return void
+	 * @param  job [in] Request.
+	 */
+	void Push(std::unique_ptr<PipelineJob> job);
+
+	/**
+	 * @brief  Takes the oldest request, waits while the queue is empty.
+	 *
+	 * @return bool False if the queue is closed and empty.
+	 * @param  job [out] Request.
+	 */
+	bool Pop(std::unique_ptr<PipelineJob>& job);
+
+	/**
+	 * @brief  Closes the queue. The requests in it are still popped.
+	 *
+	 * @return void
+	 */
+	void Close();
+
+	/**
+	 * @brief  Gets the number of requests in the queue.
+	 *
+	 * @return size_t Number of requests.
+	 */
+	size_t Size() const;
+
+private:
+	const size_t capacity_;                        //!< Maximum number of requests.
+	std::deque<std::unique_ptr<PipelineJob> > jobs_; //!< Requests, the oldest first.
+	bool closed_;                                  //!< Whether the queue is closed.
+	mutable std::mutex mutex_;                     //!< Guards the members above.
+	std::condition_variable not_empty_;            //!< Signals a new request or the closing.
+	std::condition_variable not_full_;             //!< Signals a popped request.
+};
+
+/**
+ * Class for the pipelined execution of matching requests.
+ */
+class PipelineExecutor {
+public:
+	/**
+	 * @brief  Constructor with parameters. Checks the options, which
+	 *         includes creating one extractor of the feature type, before it
+	 *         starts the workers, so invalid options throw here.
+	 *
+	 * @param  options [in] Options of the pipeline.
+	 */
+	explicit PipelineExecutor(const PipelineOptions& options = PipelineOptions());
+
+	/**
+	 * @brief  Destructor. Finishes the submitted requests and stops the
+	 *         workers.
+	 *
+	 */
+	~PipelineExecutor();
+
+	/**
+	 * @brief  Submits a pair read from files. Waits while the queue of the
+	 *         decoding is full.
+	 *
+	 * @return std::future<PipelineResult> Result of the pair. An image that
+	 *         can't be read gives an empty result, an error of a stage is
+	 *         thrown by std::future::get().
+	 * @param  query_path [in] Path of the query image.
+	 * @param  refer_path [in] Path of the reference image.
+	 */
+	std::future<PipelineResult> Submit(const std::string& query_path,
+		const std::string& refer_path);
+
+	/**
+	 * @brief  Submits a pair of encoded images, e.g. the bodies of requests
+	 *         to a service. Waits while the queue of the decoding is full.
+	 *
+	 * @return std::future<PipelineResult> Result of the pair.
+	 * @param  query_data [in] Encoded query image, see cv::imdecode().
+	 * @param  refer_data [in] Encoded reference image.
+	 */
+	std::future<PipelineResult> Submit(std::vector<uchar> query_data,
+		std::vector<uchar> refer_data);
+
+	/**
+	 * @brief  Submits a pair of decoded images, which skip the decoding.
+	 *         Waits while the queue of the decoding is full.
+	 *
+	 * @return std::future<PipelineResult> Result of the pair.
+	 * @param  query_image [in] Query image, shared with the caller.
+	 * @param  refer_image [in] Reference image, shared with the caller.
+	 */
+	std::future<PipelineResult> Submit(const cv::Mat& query_image,
+		const cv::Mat& refer_image);
+
+	/**
+	 * @brief  Gets the number of requests waiting for a stage.
+	 *
+	 * @return size_t Number of requests in the queue of the stage.
+	 * @param  stage [in] Stage.
+	 */
+	size_t GetQueueSize(const PipelineStage stage) const;
+
+private:
+	PipelineExecutor(const PipelineExecutor&) = delete;
+	PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+	/**
+	 * @brief  Queues a request into the decoding.
+	 *
+	 * @return std::future<PipelineResult> Result of the request.
+	 * @param  job [in] Request.
+	 */
+	std::future<PipelineResult> Enqueue(std::unique_ptr<PipelineJob> job);
+
+	/**
+	 * @brief  Loop of a worker, which creates the state of its stage.
+	 *
+	 * @return void
+	 * @param  stage [in] Stage of the worker.
+	 */
+	void WorkerLoop(const int stage);
+
+	/**
+	 * @brief  Processes the requests of a stage until its queue is closed,
+	 *         and passes them on to the next stage.
+	 *
+	 * @return void
+	 * @param  stage [in] Stage.
+	 * @param  process [in] Processes a request, returns false if the request
+	 *                      is finished.
+	 */
+	template <typename Process>
+	void RunStage(const int stage, const Process& process);
+
+	/**
+	 * @brief  Fails the requests of a stage whose worker couldn't create
+	 *         its state, until the queue of the stage is closed.
+	 *
+	 * @return void
+	 * @param  stage [in] Stage.
+	 * @param  error [in] Error of the creation, see std::future::get().
+	 */
+	void FailStage(const int stage, const std::exception_ptr& error);
+
+	/**
+	 * @brief  Gets the stage after another one.
+	 *
+	 * @return int Next stage with threads, kNumPipelineStages for none.
+	 * @param  stage [in] Stage.
+	 */
+	int NextStage(const int stage) const;
+
+	/**
+	 * @brief  Takes a table that the pruning handed back.
+	 *
+	 * @return MatchTable Table with the grown buffers, empty if there is none.
+	 */
+	MatchTable PopSpareTable();
+
+	/**
+	 * @brief  Hands a table back to the matchers.
+	 *
+	 * @return void
+	 * @param  table [in,out] Table of a pruned request, empty afterwards.
+	 */
+	void PushSpareTable(MatchTable& table);
+
+private:
+	const PipelineOptions options_; //!< Options of the pipeline.
+
+	std::unique_ptr<PipelineQueue> queues_[kNumPipelineStages]; //!< Queue in front of every stage.
+	std::atomic<int> num_running_[kNumPipelineStages];          //!< Running workers of every stage.
+	std::vector<std::thread> workers_;                          //!< Workers of all stages.
+
+	std::mutex spare_mutex_;               //!< Guards spare_tables_.
+	std::vector<MatchTable> spare_tables_; //!< Tables of pruned requests, at most one per request in flight.
+};
+#endif
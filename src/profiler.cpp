@@ -0,0 +1,321 @@
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+/**
+ * @brief  Gets a small sequential id of the calling thread.
+ *
+ * @return int Thread id, 0 for the first recording thread.
+ */
+static int CurrentThreadId() {
+
+	static std::atomic<int> next_id(0);
+	thread_local int id = next_id++;
+	return id;
+}
+
+/**
+ * @brief  Writes a string as a JSON string literal.
+ *
+ * @return void
+ * @param  os [in,out] Output stream.
+ * @param  s [in] String.
+ */
+static void WriteJsonString(std::ostream& os, const char* s) {
+
+	os << '"';
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\') os << '\\';
+		os << *s;
+	}
+	os << '"';
+}
+
+/**
+ * Statistics of the records of one thread.
+ */
+struct ProfileThreadStats {
+	std::mutex mutex; //!< Guards the maps, only contended by GetStats() and Reset().
+	std::map<const char*, ProfileStats::Stage> stages; //!< Timings by the address of the name.
+	std::map<const char*, int64> counters;             //!< Sums by the address of the name.
+};
+
+/**
+ * Thread local owner of the statistics of a thread, which hands them back to
+ * the profiler when the thread exits.
+ */
+struct ProfileThreadSlot {
+	std::shared_ptr<ProfileThreadStats> stats; //!< Statistics, empty before the first record.
+
+	~ProfileThreadSlot() {
+		if (stats) Profiler::Instance().RetireThreadStats(stats);
+	}
+};
+
+/**
+ * @brief  Adds the timings of a stage to another one.
+ *
+ * @return void
+ * @param  src [in] Timings to add.
+ * @param  dst [in,out] Timings, inserted if missing.
+ * @param  name [in] Name of the stage.
+ * @param  stages [in,out] Timings by name.
+ */
+static void MergeStage(const ProfileStats::Stage& src, const std::string& name,
+	std::map<std::string, ProfileStats::Stage>& stages) {
+
+	std::map<std::string, ProfileStats::Stage>::iterator it = stages.find(name);
+	if (it == stages.end()) {
+		stages.insert(std::make_pair(name, src));
+		return;
+	}
+	ProfileStats::Stage& stage = it->second;
+	stage.calls += src.calls;
+	stage.total_ms += src.total_ms;
+	stage.min_ms = std::min(stage.min_ms, src.min_ms);
+	stage.max_ms = std::max(stage.max_ms, src.max_ms);
+}
+
+/**
+ * @brief  Adds the statistics of a thread to the statistics by name. Equal
+ *         names at different addresses are merged.
+ *
+ * @return void
+ * @param  src [in] Statistics of a thread, locked by the caller.
+ * @param  dst [in,out] Statistics by name.
+ */
+static void MergeThreadStats(const ProfileThreadStats& src, ProfileStats& dst) {
+
+	for (std::map<const char*, ProfileStats::Stage>::const_iterator it =
+		src.stages.begin(); it != src.stages.end(); ++it) {
+		MergeStage(it->second, it->first, dst.stages);
+	}
+	for (std::map<const char*, int64>::const_iterator it =
+		src.counters.begin(); it != src.counters.end(); ++it) {
+		dst.counters[it->first] += it->second;
+	}
+}
+
+Profiler& Profiler::Instance() {
+
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+	:origin_ticks_(cv::getTickCount()), us_per_tick_(1e6 / cv::getTickFrequency()),
+	keep_records_(false), has_sink_(false), num_records_(0) {}
+
+void Profiler::RecordScope(const char* name, const int64 start_ticks,
+	const int64 end_ticks) {
+
+	ProfileRecord record;
+	record.type = PROFILE_SCOPE;
+	record.name = name;
+	record.thread_id = CurrentThreadId();
+	record.start_us = (start_ticks - origin_ticks_) * us_per_tick_;
+	record.duration_us = (end_ticks - start_ticks) * us_per_tick_;
+	record.value = 0;
+	Record(record);
+}
+
+void Profiler::AddCounter(const char* name, const int64 value) {
+
+	ProfileRecord record;
+	record.type = PROFILE_COUNTER;
+	record.name = name;
+	record.thread_id = CurrentThreadId();
+	record.start_us = (cv::getTickCount() - origin_ticks_) * us_per_tick_;
+	record.duration_us = 0;
+	record.value = value;
+	Record(record);
+}
+
+ProfileThreadStats& Profiler::GetThreadStats() {
+
+	static thread_local ProfileThreadSlot slot;
+	if (!slot.stats) {
+		slot.stats = std::make_shared<ProfileThreadStats>();
+		std::lock_guard<std::mutex> lock(mutex_);
+		threads_.push_back(slot.stats);
+	}
+	return *slot.stats;
+}
+
+void Profiler::RetireThreadStats(const std::shared_ptr<ProfileThreadStats>& stats) {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	{
+		std::lock_guard<std::mutex> thread_lock(stats->mutex);
+		MergeThreadStats(*stats, retired_);
+	}
+	threads_.erase(std::remove(threads_.begin(), threads_.end(), stats),
+		threads_.end());
+}
+
+void Profiler::Record(const ProfileRecord& record) {
+
+	ProfileThreadStats& thread_stats = GetThreadStats();
+	{
+		std::lock_guard<std::mutex> lock(thread_stats.mutex);
+		if (record.type == PROFILE_SCOPE) {
+			const double ms = record.duration_us * 1e-3;
+			std::map<const char*, ProfileStats::Stage>::iterator it =
+				thread_stats.stages.find(record.name);
+			if (it == thread_stats.stages.end()) {
+				ProfileStats::Stage stage = { 1, ms, ms, ms };
+				thread_stats.stages.insert(std::make_pair(record.name, stage));
+			}
+			else {
+				ProfileStats::Stage& stage = it->second;
+				++stage.calls;
+				stage.total_ms += ms;
+				stage.min_ms = std::min(stage.min_ms, ms);
+				stage.max_ms = std::max(stage.max_ms, ms);
+			}
+		}
+		else {
+			thread_stats.counters[record.name] += record.value;
+		}
+	}
+
+	if (keep_records_.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!records_.empty()) {
+			records_[num_records_ % records_.size()] = record;
+			++num_records_;
+		}
+	}
+
+	if (has_sink_.load(std::memory_order_relaxed)) {
+		Sink sink;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			sink = sink_;
+		}
+		// The sink runs outside the lock, so it may query the profiler.
+		if (sink) sink(record);
+	}
+}
+
+void Profiler::SetSink(const Sink& sink) {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	sink_ = sink;
+	has_sink_ = static_cast<bool>(sink_);
+}
+
+void Profiler::SetRecordCapacity(const size_t capacity) {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<ProfileRecord>(capacity).swap(records_);
+	num_records_ = 0;
+	keep_records_ = capacity > 0;
+}
+
+ProfileStats Profiler::GetStats() const {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	ProfileStats stats = retired_;
+	for (size_t i = 0; i < threads_.size(); ++i) {
+		std::lock_guard<std::mutex> thread_lock(threads_[i]->mutex);
+		MergeThreadStats(*threads_[i], stats);
+	}
+	return stats;
+}
+
+void Profiler::Reset() {
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	num_records_ = 0;
+	retired_ = ProfileStats();
+	for (size_t i = 0; i < threads_.size(); ++i) {
+		std::lock_guard<std::mutex> thread_lock(threads_[i]->mutex);
+		threads_[i]->stages.clear();
+		threads_[i]->counters.clear();
+	}
+}
+
+std::string Profiler::ToJson() const {
+
+	const ProfileStats stats = GetStats();
+
+	std::ostringstream os;
+	os << "{\"stages\":{";
+	for (std::map<std::string, ProfileStats::Stage>::const_iterator it =
+		stats.stages.begin(); it != stats.stages.end(); ++it) {
+		if (it != stats.stages.begin()) os << ',';
+		WriteJsonString(os, it->first.c_str());
+		os << ":{\"calls\":" << it->second.calls
+			<< ",\"total_ms\":" << it->second.total_ms
+			<< ",\"mean_ms\":" << it->second.total_ms / it->second.calls
+			<< ",\"min_ms\":" << it->second.min_ms
+			<< ",\"max_ms\":" << it->second.max_ms << '}';
+	}
+	os << "},\"counters\":{";
+	for (std::map<std::string, int64>::const_iterator it =
+		stats.counters.begin(); it != stats.counters.end(); ++it) {
+		if (it != stats.counters.begin()) os << ',';
+		WriteJsonString(os, it->first.c_str());
+		os << ':' << it->second;
+	}
+	os << "}}";
+	return os.str();
+}
+
+std::string Profiler::ToChromeTrace() const {
+
+	// The kept records, the oldest first.
+	std::vector<ProfileRecord> records;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		const size_t capacity = records_.size();
+		const size_t count = std::min(num_records_, capacity);
+		records.reserve(count);
+		for (size_t i = num_records_ - count; i < num_records_; ++i) {
+			records.push_back(records_[i % capacity]);
+		}
+	}
+
+	// Counter events show the running total of the kept records.
+	std::map<std::string, int64> totals;
+	std::ostringstream os;
+	os.setf(std::ios::fixed);
+	os.precision(3);
+	os << "{\"traceEvents\":[";
+	for (size_t i = 0; i < records.size(); ++i) {
+		const ProfileRecord& r = records[i];
+		if (i > 0) os << ',';
+		os << "{\"name\":";
+		WriteJsonString(os, r.name);
+		if (r.type == PROFILE_SCOPE) {
+			os << ",\"ph\":\"X\",\"ts\":" << r.start_us << ",\"dur\":" << r.duration_us
+				<< ",\"pid\":0,\"tid\":" << r.thread_id << '}';
+		}
+		else {
+			int64& total = totals[r.name];
+			total += r.value;
+			os << ",\"ph\":\"C\",\"ts\":" << r.start_us
+				<< ",\"pid\":0,\"tid\":" << r.thread_id
+				<< ",\"args\":{\"value\":" << total << "}}";
+		}
+	}
+	os << "],\"displayTimeUnit\":\"ms\"}";
+	return os.str();
+}
+
+bool Profiler::WriteJson(const std::string& path) const {
+
+	std::ofstream ofs(path.c_str());
+	ofs << ToJson();
+	return static_cast<bool>(ofs);
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path) const {
+
+	std::ofstream ofs(path.c_str());
+	ofs << ToChromeTrace();
+	return static_cast<bool>(ofs);
+}
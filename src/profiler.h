@@ -0,0 +1,270 @@
+/****************************************************************************//**
+ * @file profiler.h
+ * @brief Scoped stage timers and counters of the matching pipeline.
+ *
+ * The pipeline is instrumented with IM_PROFILE_SCOPE() and
+ * IM_PROFILE_COUNTER(). Both expand to nothing unless IM_ENABLE_PROFILING is
+ * defined, which the WITH_PROFILING option of CMake does. When enabled, the
+ * records are collected by the process-wide Profiler, which aggregates them
+ * into ProfileStats, forwards every record to an optional sink, and exports
+ * them as JSON or in the Chrome trace format (chrome://tracing, Perfetto).
+ *
+ * Every thread aggregates its own records, keyed by the address of the
+ * name, so recording takes no global lock and allocates only for the first
+ * record of a name on a thread. The individual records for the trace are
+ * only kept on request, in a ring buffer of a fixed capacity.
+ *
+ * Names must be string literals, only their address is stored.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-20
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Types of a profile record.
+enum ProfileRecordType {
+	PROFILE_SCOPE = 0,   //!< A timed scope.
+	PROFILE_COUNTER = 1  //!< A counter increment.
+};
+
+/**
+ * One timed scope or counter increment.
+ */
+struct ProfileRecord {
+	ProfileRecordType type; //!< Type of the record.
+	const char* name;       //!< Name of the stage or the counter.
+	int thread_id;          //!< Small sequential id of the recording thread.
+	double start_us;        //!< Start time in microseconds since the profiler was created.
+	double duration_us;     //!< Duration of a scope in microseconds, 0 for a counter.
+	int64 value;            //!< Increment of a counter, 0 for a scope.
+};
+
+/**
+ * Aggregated records of the profiler.
+ */
+struct ProfileStats {
+	/**
+	 * Timings of one stage.
+	 */
+	struct Stage {
+		int64 calls;     //!< Number of times the scope was entered.
+		double total_ms; //!< Total time in milliseconds.
+		double min_ms;   //!< Shortest call in milliseconds.
+		double max_ms;   //!< Longest call in milliseconds.
+	};
+
+	std::map<std::string, Stage> stages;   //!< Timings by stage name.
+	std::map<std::string, int64> counters; //!< Sums by counter name.
+};
+
+struct ProfileThreadStats;
+struct ProfileThreadSlot;
+
+/**
+ * Class for the process-wide collector of the profile records.
+ */
+class Profiler {
+public:
+	//! Callback receiving every record as it is made, on the recording thread.
+	typedef std::function<void(const ProfileRecord&)> Sink;
+
+	/**
+	 * @brief  Gets the profiler of the process.
+	 *
+	 * @return Profiler& Profiler.
+	 */
+	static Profiler& Instance();
+
+	/**
+	 * @brief  Records a timed scope.
+	 *
+	 * @return void
+	 * @param  name [in] Name of the stage, a string literal.
+	 * @param  start_ticks [in] cv::getTickCount() at the start of the scope.
+	 * @param  end_ticks [in] cv::getTickCount() at the end of the scope.
+	 */
+	void RecordScope(const char* name, const int64 start_ticks,
+		const int64 end_ticks);
+
+	/**
+	 * @brief  Adds a value to a counter.
+	 *
+	 * @return void
+	 * @param  name [in] Name of the counter, a string literal.
+	 * @param  value [in] Increment.
+	 */
+	void AddCounter(const char* name, const int64 value);
+
+	/**
+	 * @brief  Sets the sink receiving every record. The sink must be thread
+	 *         safe, since the stages record from worker threads.
+	 *
+	 * @return void
+	 * @param  sink [in] Callback, an empty function to remove it.
+	 */
+	void SetSink(const Sink& sink);
+
+	/**
+	 * @brief  Sets the number of the latest records kept for
+	 *         ToChromeTrace(), which drops the kept records. The statistics
+	 *         and the sink get the records in any case. 0 by default, which
+	 *         keeps none.
+	 *
+	 * @return void
+	 * @param  capacity [in] Capacity of the ring buffer of the records.
+	 */
+	void SetRecordCapacity(const size_t capacity);
+
+	/**
+	 * @brief  Gets the aggregated statistics.
+	 *
+	 * @return ProfileStats Statistics of the records so far.
+	 */
+	ProfileStats GetStats() const;
+
+	/**
+	 * @brief  Drops the records and the statistics.
+	 *
+	 * @return void
+	 */
+	void Reset();
+
+	/**
+	 * @brief  Exports the statistics as JSON.
+	 *
+	 * @return std::string JSON object with "stages" and "counters".
+	 */
+	std::string ToJson() const;
+
+	/**
+	 * @brief  Exports the kept records in the Chrome trace event format, see
+	 *         SetRecordCapacity(). Scopes are complete events, counters are
+	 *         counter events.
+	 *
+	 * @return std::string JSON object with "traceEvents".
+	 */
+	std::string ToChromeTrace() const;
+
+	/**
+	 * @brief  Writes ToJson() to a file.
+	 *
+	 * @return bool False if the file can't be written.
+	 * @param  path [in] Path of the file.
+	 */
+	bool WriteJson(const std::string& path) const;
+
+	/**
+	 * @brief  Writes ToChromeTrace() to a file.
+	 *
+	 * @return bool False if the file can't be written.
+	 * @param  path [in] Path of the file.
+	 */
+	bool WriteChromeTrace(const std::string& path) const;
+
+private:
+	friend struct ProfileThreadSlot;
+
+	Profiler();
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	/**
+	 * @brief  Aggregates, buffers and forwards a record.
+	 *
+	 * @return void
+	 * @param  record [in] Record.
+	 */
+	void Record(const ProfileRecord& record);
+
+	/**
+	 * @brief  Gets the statistics of the calling thread, which are 
+	 *         registered on the first call.
+	 *
+	 * @return ProfileThreadStats& Statistics of the thread.
+	 */
+	ProfileThreadStats& GetThreadStats();
+
+	/**
+	 * @brief  Merges the statistics of an exiting thread into the retired
+	 *         ones and unregisters them.
+	 *
+	 * @return void
+	 * @param  stats [in] Statistics of the thread.
+	 */
+	void RetireThreadStats(const std::shared_ptr<ProfileThreadStats>& stats);
+
+private:
+	const int64 origin_ticks_;   //!< cv::getTickCount() at the creation.
+	const double us_per_tick_;   //!< Microseconds per tick.
+
+	std::atomic<bool> keep_records_; //!< Whether the records are buffered.
+	std::atomic<bool> has_sink_;     //!< Whether a sink is set.
+
+	mutable std::mutex mutex_;   //!< Guards the members below.
+	std::vector<ProfileRecord> records_; //!< Ring buffer of the latest records.
+	size_t num_records_;         //!< Number of records written into the ring buffer.
+	std::vector<std::shared_ptr<ProfileThreadStats> > threads_; //!< Statistics of the running threads.
+	ProfileStats retired_;       //!< Statistics of the exited threads.
+	Sink sink_;                  //!< Optional callback.
+};
+
+/**
+ * Class for a timer recording the lifetime of a scope.
+ */
+class ProfileScope {
+public:
+	/**
+	 * @brief  Constructor, starts the timer.
+	 *
+	 * @param  name [in] Name of the stage, a string literal.
+	 */
+	explicit ProfileScope(const char* name)
+		:profiler_(Profiler::Instance()), name_(name),
+		start_ticks_(cv::getTickCount()) {}
+
+	/**
+	 * @brief  Destructor, records the scope.
+	 *
+	 */
+	~ProfileScope() {
+		profiler_.RecordScope(name_, start_ticks_, cv::getTickCount());
+	}
+
+private:
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	Profiler& profiler_;       //!< Created before the start, so the start is after its origin.
+	const char* name_;         //!< Name of the stage.
+	const int64 start_ticks_;  //!< cv::getTickCount() at the start.
+};
+
+#define IM_PROFILE_CONCAT_IMPL(a, b) a##b
+#define IM_PROFILE_CONCAT(a, b) IM_PROFILE_CONCAT_IMPL(a, b)
+
+#if defined(IM_ENABLE_PROFILING)
+//! Times the rest of the enclosing scope.
+#define IM_PROFILE_SCOPE(name) \
+	ProfileScope IM_PROFILE_CONCAT(im_profile_scope_, __LINE__)(name)
+//! Adds a value to a counter.
+#define IM_PROFILE_COUNTER(name, value) \
+	Profiler::Instance().AddCounter(name, static_cast<int64>(value))
+#else
+#define IM_PROFILE_SCOPE(name) do {} while (0)
+#define IM_PROFILE_COUNTER(name, value) do {} while (0)
+#endif
+
+#endif
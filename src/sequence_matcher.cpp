@@ -0,0 +1,137 @@
+#include "sequence_matcher.h"
+
+SequenceMatcher::SequenceMatcher(FeatureType feature, MatcherType matcher,
+	PrunerType pruner, const int knn, const cv::Size& grid_size,
+	const double alpha)
+	:matcher_method_(matcher), pruner_method_(pruner), knn_(knn),
+	grid_size_(grid_size), alpha_(alpha), extractor_(feature),
+	has_frame_(false), has_features_(false), stop_(false), num_ready_(0),
+	frame_index_(-1) {
+
+	worker_ = std::thread(&SequenceMatcher::ExtractionLoop, this);
+}
+
+SequenceMatcher::~SequenceMatcher() {
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	cond_.notify_all();
+	worker_.join();
+}
+
+void SequenceMatcher::ExtractionLoop() {
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		cond_.wait(lock, [this]() { return has_frame_ || stop_; });
+		if (stop_) return;
+
+		// The pending buffers are only touched by this thread until 
+		// has_features_ is set.
+		lock.unlock();
+		std::exception_ptr error;
+		try {
+			extractor_.Extract(pending_frame_, pending_features_);
+		}
+		catch (...) {
+			// Thrown on the caller's thread by CollectFeatures().
+			error = std::current_exception();
+		}
+		lock.lock();
+
+		error_ = error;
+
+		has_frame_ = false;
+		has_features_ = true;
+		cond_.notify_all();
+	}
+}
+
+bool SequenceMatcher::CollectFeatures() {
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [this]() { return !has_frame_; });
+	if (error_) {
+		std::exception_ptr error = error_;
+		error_ = nullptr;
+		has_features_ = false;
+		std::rethrow_exception(error);
+	}
+	if (!has_features_) return false;
+
+	// Swapping keeps the capacity of the buffers for the next frames.
+	std::swap(query_features_, refer_features_);
+	std::swap(refer_features_, pending_features_);
+	has_features_ = false;
+	num_ready_++;
+	return num_ready_ >= 2;
+}
+
+bool SequenceMatcher::AddFrame(const cv::Mat& frame) {
+
+	bool has_pair = CollectFeatures();
+
+	// The extraction thread is idle now.
+	frame.copyTo(pending_frame_);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		has_frame_ = true;
+	}
+	cond_.notify_all();
+
+	if (!has_pair) return false;
+	MatchPair();
+	return true;
+}
+
+bool SequenceMatcher::Finish() {
+
+	if (!CollectFeatures()) return false;
+	MatchPair();
+	return true;
+}
+
+void SequenceMatcher::MatchPair() {
+
+	frame_index_ = num_ready_ - 1;
+	matches_.clear();
+	query_points_.clear();
+	refer_points_.clear();
+	if (query_features_.empty() || refer_features_.empty()) return;
+
+	// The keypoints are copied into the buffers of the workspace, which
+	// keep their capacity, and the match table stays in the workspace too.
+	ImageMatcher image_matcher(query_features_, refer_features_, workspace_,
+		matcher_method_, knn_);
+	const MatchTable& table = image_matcher.GetMatchTable();
+
+	if (pruner_method_ != PRUNER_GMS) {
+		// Swapping the results keeps their capacity in the workspace.
+		MatchPruner match_pruner(query_features_, refer_features_, table,
+			pruner_method_, workspace_);
+		match_pruner.TakeMatches(matches_);
+		match_pruner.TakeMatchedPoints(query_points_, refer_points_);
+		return;
+	}
+
+	initial_matches_.clear();
+	for (int i = 0; i < table.rows(); ++i) {
+		if (table.ValidCount(i) == 0) continue;
+		initial_matches_.push_back(table.GetMatch(i, 0));
+	}
+
+	GMS_Matcher& gms = workspace_.GetGmsMatcher(grid_size_, alpha_);
+	gms.SetMatches(query_features_.keypoints, query_features_.image_size,
+		refer_features_.keypoints, refer_features_.image_size, initial_matches_);
+	// Consecutive frames need neither scale nor rotation invariance.
+	gms.GetInlierMask(inlier_mask_, false, false);
+
+	for (size_t i = 0; i < inlier_mask_.size(); ++i) {
+		if (!inlier_mask_[i]) continue;
+		matches_.push_back(initial_matches_[i]);
+		query_points_.push_back(query_features_.keypoints[initial_matches_[i].queryIdx].pt);
+		refer_points_.push_back(refer_features_.keypoints[initial_matches_[i].trainIdx].pt);
+	}
+}
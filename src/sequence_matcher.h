@@ -0,0 +1,156 @@
+/****************************************************************************//**
+ * @file sequence_matcher.h
+ * @brief A c++ implementation of frame-to-frame matching of a video.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-12
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _SEQUENCE_MATCHER_H_
+#define _SEQUENCE_MATCHER_H_
+#include <opencv2/opencv.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "feature_extractor.h"
+#include "image_matcher.h"
+#include "match_pruner.h"
+#include "workspace.h"
+#include "./libGMS/gms_matcher.h"
+
+/**
+ * Class for matching consecutive frames.
+ *
+ * Every frame is extracted once, and its features serve as the reference of
+ * one pair and then as the query of the next one. The extraction runs on a
+ * worker thread, so frame \f$t+1\f$ is extracted while the pair 
+ * \f$(t-1, t)\f$ is matched and pruned. The result of a pair is thus ready 
+ * one frame later. The matcher and the pruner of every pair work in one
+ * Workspace, which keeps the descriptor matcher, the match table, the GMS
+ * and LPM contexts and the buffers of the matches from frame to frame.
+ */
+class SequenceMatcher {
+public:
+	/**
+	 * @brief  Constructor with parameters.
+	 *
+	 * @param  feature [in] Feature type.
+	 * @param  matcher [in] Matching method.
+	 * @param  pruner [in] Matches pruning algorithm.
+	 * @param  knn [in] Count of best matches found per each query descriptor.
+	 * @param  grid_size [in] Size of the grid of GMS.
+	 * @param  alpha [in] Scale factor \f$ \alpha\f$ of GMS.
+	 */
+	explicit SequenceMatcher(FeatureType feature = FEATURE_ORB,
+		MatcherType matcher = MATCHER_BF_HAMMING, PrunerType pruner = PRUNER_GMS,
+		const int knn = 2, const cv::Size& grid_size = cv::Size(20, 20),
+		const double alpha = 6.0);
+
+	/**
+	 * @brief  Destructor. Waits for the pending extraction.
+	 *
+	 */
+	~SequenceMatcher();
+
+	/**
+	 * @brief  Adds the next frame. Its extraction starts in the background,
+	 *         and the pair of the two previous frames is matched meanwhile.
+	 *
+	 * An exception thrown by the extraction of the previous frame is
+	 * rethrown here. That frame is dropped, this one isn't added, and the
+	 * next call goes on with the frames extracted before.
+	 *
+	 * @return bool True if the result of a new pair is available.
+	 * @param  frame [in] Frame, copied into an internal buffer.
+	 */
+	bool AddFrame(const cv::Mat& frame);
+
+	/**
+	 * @brief  Matches the pair of the last two frames after the last call of
+	 *         AddFrame(). Rethrows an exception of the last extraction.
+	 *
+	 * @return bool True if the result of a new pair is available.
+	 */
+	bool Finish();
+
+	/**
+	 * @brief  Gets the index of the later frame of the current pair.
+	 *
+	 * @return int Index of the frame, counted from 0.
+	 */
+	int GetFrameIndex() const { return frame_index_; }
+
+	//! Features of the earlier frame of the current pair.
+	const FeatureSet& GetQueryFeatures() const { return query_features_; }
+	//! Features of the later frame of the current pair.
+	const FeatureSet& GetReferFeatures() const { return refer_features_; }
+	//! Matches of the current pair after pruning.
+	const std::vector<cv::DMatch>& GetMatches() const { return matches_; }
+	//! Matched points from the earlier frame.
+	const std::vector<cv::Point2f>& GetQueryPoints() const { return query_points_; }
+	//! Matched points from the later frame.
+	const std::vector<cv::Point2f>& GetReferPoints() const { return refer_points_; }
+
+private:
+	SequenceMatcher(const SequenceMatcher&) = delete;
+	SequenceMatcher& operator=(const SequenceMatcher&) = delete;
+
+	/**
+	 * @brief  Loop of the extraction thread.
+	 *
+	 * @return void
+	 */
+	void ExtractionLoop();
+
+	/**
+	 * @brief  Waits for the pending extraction, and moves its features to 
+	 *         the current pair. Rethrows an exception of the extraction.
+	 *
+	 * @return bool True if both frames of the current pair are extracted.
+	 */
+	bool CollectFeatures();
+
+	/**
+	 * @brief  Matches and prunes the current pair.
+	 *
+	 * @return void
+	 */
+	void MatchPair();
+
+private:
+	MatcherType matcher_method_; //!< Matching method.
+	PrunerType pruner_method_;   //!< Matches pruning algorithm.
+	const int knn_;              //!< Count of best matches per query descriptor.
+	const cv::Size grid_size_;   //!< Size of the grid of GMS.
+	const double alpha_;         //!< Scale factor of GMS.
+
+	FeatureExtractor extractor_;   //!< Extractor used by the extraction thread only.
+	std::thread worker_;           //!< Extraction thread.
+	std::mutex mutex_;             //!< Guards the members shared with the thread.
+	std::condition_variable cond_; //!< Signals a new frame or a finished extraction.
+	bool has_frame_;               //!< A frame waits for the extraction.
+	bool has_features_;            //!< The features of the pending frame are ready.
+	bool stop_;                    //!< Stops the extraction thread.
+	cv::Mat pending_frame_;        //!< Frame being extracted.
+	FeatureSet pending_features_;  //!< Features of the pending frame.
+	std::exception_ptr error_;     //!< Exception of the extraction of the pending frame.
+
+	int num_ready_;   //!< Number of frames extracted and moved to the pairs.
+	int frame_index_; //!< Index of the later frame of the current pair.
+
+	FeatureSet query_features_; //!< Features of the earlier frame.
+	FeatureSet refer_features_; //!< Features of the later frame.
+	Workspace workspace_;       //!< Buffers and pruning contexts of the pairs.
+
+	std::vector<cv::DMatch> initial_matches_; //!< Nearest neighbor matches of GMS.
+	std::vector<bool> inlier_mask_;           //!< Mask of GMS.
+
+	std::vector<cv::DMatch> matches_;        //!< Matches after pruning.
+	std::vector<cv::Point2f> query_points_;  //!< Matched points from the earlier frame.
+	std::vector<cv::Point2f> refer_points_;  //!< Matched points from the later frame.
+};
+#endif
@@ -0,0 +1,78 @@
+#include "workspace.h"
+
+void PrunerBuffers::Clear() {
+
+	initial_matches.clear();
+	initial_rows.clear();
+	query_pts.clear();
+	refer_pts.clear();
+	sample_query_pts.clear();
+	sample_refer_pts.clear();
+	labels.clear();
+	pruned_matches.clear();
+	pruned_rows.clear();
+	query_mpts.clear();
+	refer_mpts.clear();
+	knn_distances.clear();
+	scores.clear();
+}
+
+void MatcherBuffers::Clear() {
+
+	// The descriptors of the features may reference external memory, which
+	// must not be kept alive.
+	query_features.keypoints.clear();
+	query_features.descriptors.release();
+	query_features.holder.reset();
+	refer_features.keypoints.clear();
+	refer_features.descriptors.release();
+	refer_features.holder.reset();
+	matches.Create(0, 0);
+	knn_matches.clear();
+	train_descriptors.clear();
+}
+
+Workspace::Workspace() :gms_alpha_(0) {
+
+	for (int i = 0; i <= LPM_SLOT_ITERATION2; ++i) {
+		lpm_contexts_[i].knn = 0;
+		lpm_contexts_[i].lambda = 0;
+		lpm_contexts_[i].tau = 0;
+	}
+}
+
+Workspace::~Workspace() {}
+
+void Workspace::Reset() {
+
+	pruner_buffers_.Clear();
+	matcher_buffers_.Clear();
+}
+
+GMS_Matcher& Workspace::GetGmsMatcher(const cv::Size& grid_size,
+	const double alpha) {
+
+	if (gms_matcher_.empty() || gms_grid_size_ != grid_size ||
+		gms_alpha_ != alpha) {
+		gms_matcher_ = cv::makePtr<GMS_Matcher>(grid_size, alpha);
+		gms_grid_size_ = grid_size;
+		gms_alpha_ = alpha;
+	}
+	return *gms_matcher_;
+}
+
+LPM_Matcher& Workspace::GetLpmMatcher(const LpmSlot slot, const int knn,
+	const double lambda, const double tau) {
+
+	CV_Assert(slot >= LPM_SLOT_CASCADE && slot <= LPM_SLOT_ITERATION2);
+	LpmContext& context = lpm_contexts_[slot];
+	if (context.matcher.empty() || context.knn != knn ||
+		context.lambda != lambda || context.tau != tau) {
+		// The context runs on cv::getNumThreads() threads.
+		context.matcher = cv::makePtr<LPM_Matcher>(knn, lambda, tau, 0);
+		context.knn = knn;
+		context.lambda = lambda;
+		context.tau = tau;
+	}
+	return *context.matcher;
+}
@@ -0,0 +1,163 @@
+/****************************************************************************//**
+ * @file workspace.h
+ * @brief Scratch buffers and pruning contexts reused from pair to pair.
+ *
+ * A worker matching pair after pair passes the same Workspace to every
+ * ImageMatcher and MatchPruner. They take their buffers from it and hand them
+ * back with the grown capacity, and the GMS_Matcher and LPM_Matcher contexts
+ * are kept for the next pair, so the buffers of the matcher and the pruner
+ * stop growing once they have the size of a pair. A pair still allocates
+ * in the libraries: LPM rebuilds its nanoflann KD-trees, whose pool is
+ * freed and allocated again, OpenCV allocates the temporary matrices, and
+ * cv::DescriptorMatcher::knnMatch() allocates the nested rows of every
+ * matcher but MATCHER_BF_TILED.
+ *
+ * @author Gareth Wang <gareth.wang@hotmail.com>
+ * @version 0.1
+ * @date 2019-10-26
+ *
+ * @copyright Copyright (c) 2019
+ *
+********************************************************************************/
+#ifndef _WORKSPACE_H_
+#define _WORKSPACE_H_
+#include <opencv2/opencv.hpp>
+#include "image_matcher.h"
+#include "./libGMS/gms_matcher.h"
+#include "./libLPM/lpm_matcher.h"
+
+//! Slots of the LPM contexts of a workspace.
+enum LpmSlot {
+	LPM_SLOT_CASCADE = 0,    //!< Check of PRUNER_LPM_CASCADE on a subsample
+	LPM_SLOT_ITERATION1 = 1, //!< First iteration
+	LPM_SLOT_ITERATION2 = 2  //!< Second iteration on the KD-trees of the first
+};
+
+/**
+ * Buffers of MatchPruner.
+ */
+struct PrunerBuffers {
+	std::vector<cv::DMatch> initial_matches;    //!< Nearest neighbor matches.
+	std::vector<int> initial_rows;              //!< Rows of the nearest neighbor matches.
+	std::vector<cv::Point2d> query_pts;         //!< Matched points of LPM from the query image.
+	std::vector<cv::Point2d> refer_pts;         //!< Matched points of LPM from the reference image.
+	std::vector<cv::Point2d> sample_query_pts;  //!< Subsample of the cascade check of LPM.
+	std::vector<cv::Point2d> sample_refer_pts;  //!< Subsample of the cascade check of LPM.
+	std::vector<bool> labels;                   //!< Mask of inliers/outliers of GMS.
+
+	// Results, which the pruner holds while it lives.
+	std::vector<cv::DMatch> pruned_matches; //!< Matches after pruning.
+	std::vector<int> pruned_rows;           //!< Rows of the pruned matches.
+	std::vector<cv::Point2f> query_mpts;    //!< Matched points from the query image.
+	std::vector<cv::Point2f> refer_mpts;    //!< Matched points from the reference image.
+	std::vector<double> knn_distances;      //!< Memory of the \f$k\f$ nearest neighbor distances.
+	std::vector<double> scores;             //!< Matching scores.
+
+	/**
+	 * @brief  Clears the buffers and keeps their capacity.
+	 *
+	 * @return void
+	 */
+	void Clear();
+};
+
+/**
+ * Buffers of ImageMatcher.
+ */
+struct MatcherBuffers {
+	FeatureSet query_features; //!< Features of the query image.
+	FeatureSet refer_features; //!< Features of the reference image.
+	cv::Mat query_des;         //!< Query descriptors converted to CV_32F.
+	cv::Mat refer_des;         //!< Reference descriptors converted to CV_32F.
+	MatchTable matches;        //!< Putative matches.
+	std::vector<std::vector<cv::DMatch> > knn_matches; //!< Nested matches of cv::DescriptorMatcher.
+	std::vector<cv::Mat> train_descriptors;            //!< Train collection of the descriptor matcher.
+	cv::Ptr<cv::DescriptorMatcher> descriptor_matchers[MATCHER_BF_TILED + 1]; //!< Matchers by MatcherType.
+
+	/**
+	 * @brief  Clears the buffers and keeps their capacity and the matchers.
+	 *
+	 * @return void
+	 */
+	void Clear();
+};
+
+/**
+ * Class for the buffers and pruning contexts of one worker.
+ *
+ * A workspace is not thread-safe, every worker owns one. It must outlive the
+ * matchers and pruners constructed with it, and is in use by at most one
+ * ImageMatcher and one MatchPruner at a time.
+ */
+class Workspace {
+public:
+	/**
+	 * @brief  Default constructor. Nothing is allocated before the first pair.
+	 *
+	 */
+	Workspace();
+
+	/**
+	 * @brief  Destructor.
+	 *
+	 */
+	~Workspace();
+
+	/**
+	 * @brief  Clears the buffers between two pairs. The capacity of the
+	 *         buffers and the pruning contexts are kept.
+	 *
+	 * @return void
+	 */
+	void Reset();
+
+	/**
+	 * @brief  Gets the GMS context, which is created on the first call and
+	 *         again when the parameters change.
+	 *
+	 * @return GMS_Matcher& Context, see GMS_Matcher::SetMatches().
+	 * @param  grid_size [in] Size of the grid.
+	 * @param  alpha [in] Scale factor \f$ \alpha\f$.
+	 */
+	GMS_Matcher& GetGmsMatcher(const cv::Size& grid_size, const double alpha);
+
+	/**
+	 * @brief  Gets an LPM context, which is created on the first call and
+	 *         again when the parameters change.
+	 *
+	 * @return LPM_Matcher& Context, see LPM_Matcher::SetMatches().
+	 * @param  slot [in] Slot of the context.
+	 * @param  knn [in] Number of nearest neighbors.
+	 * @param  lambda [in] \f$ \lambda\f$.
+	 * @param  tau [in] \f$ \tau\f$.
+	 */
+	LPM_Matcher& GetLpmMatcher(const LpmSlot slot, const int knn,
+		const double lambda, const double tau);
+
+	PrunerBuffers& GetPrunerBuffers() { return pruner_buffers_; }    //!< Buffers of MatchPruner.
+	MatcherBuffers& GetMatcherBuffers() { return matcher_buffers_; } //!< Buffers of ImageMatcher.
+
+private:
+	Workspace(const Workspace&) = delete;
+	Workspace& operator=(const Workspace&) = delete;
+
+	/**
+	 * Parameters of an LPM context.
+	 */
+	struct LpmContext {
+		cv::Ptr<LPM_Matcher> matcher; //!< Context, empty before the first use.
+		int knn;                      //!< Number of nearest neighbors.
+		double lambda;                //!< \f$ \lambda\f$.
+		double tau;                   //!< \f$ \tau\f$.
+	};
+
+	PrunerBuffers pruner_buffers_;   //!< Buffers of MatchPruner.
+	MatcherBuffers matcher_buffers_; //!< Buffers of ImageMatcher.
+
+	cv::Ptr<GMS_Matcher> gms_matcher_; //!< GMS context, empty before the first use.
+	cv::Size gms_grid_size_;           //!< Size of the grid of gms_matcher_.
+	double gms_alpha_;                 //!< Scale factor of gms_matcher_.
+
+	LpmContext lpm_contexts_[LPM_SLOT_ITERATION2 + 1]; //!< LPM contexts by slot.
+};
+#endif